@@ -33,7 +33,6 @@
  *  Module Globals
  */
 extern struct usb_driver		blast_comms_usb_drv;
-extern const struct usb_device_id	*blast_comms_id_table;
 
 /**
  * Module Information
@@ -42,13 +41,13 @@ MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("Stephen Lewis (stfl1g09@soton.ac.uk)");
 MODULE_DESCRIPTION("Device Driver for the BLAST Uplink/Downlink Comms Device");
 MODULE_VERSION(BLAST_COMMS_VERSION);
-MODULE_DEVICE_TABLE(usb, blast_comms_id_table);
 
 /**
  * blast_comms_init - initialise the module
  */
 static int __init blast_comms_init(void) {
 	blast_comms_link_ctrlinit();			/* link level work */
+	blast_comms_stats_module_init();		/* debugfs root */
 	return usb_register(&blast_comms_usb_drv);	/* register with usb */
 }
 
@@ -58,6 +57,7 @@ static int __init blast_comms_init(void) {
 static void __exit blast_comms_exit(void) {
 	blast_comms_link_exit();		/* link level work */
 	usb_deregister(&blast_comms_usb_drv);	/* deregister with usb */
+	blast_comms_stats_module_exit();	/* debugfs root */
 }
 
 /**
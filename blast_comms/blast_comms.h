@@ -30,12 +30,23 @@
 #include <linux/kfifo.h>
 #include <linux/timer.h>
 #include <linux/semaphore.h>
+#include <linux/usb.h>
+#include <linux/ioctl.h>
 
 /*
  * Local inclusions
  */
+#include "blast_comms_pic.h"
+#include "blast_comms_frame.h"
 #include "blast_comms_link.h"
 #include "blast_comms_usb.h"
+#include "blast_comms_stats.h"
+#include "blast_comms_crc.h"
+#include "blast_comms_lz4.h"
+#include "blast_comms_fec.h"
+#include "blast_comms_ilv.h"
+#include "blast_comms_lt.h"
+#include "blast_comms_rto.h"
 #include "blast_comms_dev.h"
 
 /*
@@ -64,25 +75,88 @@
 
 #define	BLAST_COMMS_IOCRESET	_IO(BLAST_COMMS_IOC_MAGIC, 0)
 
-#define	BLAST_COMMS_IOCSFREQ	_IO(BLAST_COMMS_IOC_MAGIC, 1, double)
-#define	BLAST_COMMS_IOCGFREQ	_IO(BLAST_COMMS_IOC_MAGIC, 2, double)
+#define	BLAST_COMMS_IOCSTXFREQ	_IOW(BLAST_COMMS_IOC_MAGIC, 1, double)
+#define	BLAST_COMMS_IOCGTXFREQ	_IOR(BLAST_COMMS_IOC_MAGIC, 2, double)
 
-#define	BLAST_COMMS_IOCTPOWER	_IO(BLAST_COMMS_IOC_MAGIC, 3, int)
-#define	BLAST_COMMS_IOCQPOWER	_IO(BLAST_COMMS_IOC_MAGIC, 4, int)
+#define	BLAST_COMMS_IOCTPOWER	_IO(BLAST_COMMS_IOC_MAGIC, 3)
+#define	BLAST_COMMS_IOCQPOWER	_IO(BLAST_COMMS_IOC_MAGIC, 4)
 
-#define	BLAST_COMMS_IOCTDR	_IO(BLAST_COMMS_IOC_MAGIC, 5, unsigned long)
-#define	BLAST_COMMS_IOCQDR	_IO(BLAST_COMMS_IOC_MAGIC, 6, unsigned long)
+#define	BLAST_COMMS_IOCTDR	_IO(BLAST_COMMS_IOC_MAGIC, 5)
+#define	BLAST_COMMS_IOCQDR	_IO(BLAST_COMMS_IOC_MAGIC, 6)
 
-#define	BLAST_COMMS_IOCTPRELEN	_IO(BLAST_COMMS_IOC_MAGIC, 7, __u8)
-#define	BLAST_COMMS_IOCQPRELEN	_IO(BLAST_COMMS_IOC_MAGIC, 8, __u8)
+#define	BLAST_COMMS_IOCTPRELEN	_IO(BLAST_COMMS_IOC_MAGIC, 7)
+#define	BLAST_COMMS_IOCQPRELEN	_IO(BLAST_COMMS_IOC_MAGIC, 8)
 
-#define	BLAST_COMMS_IOCTSW	_IO(BLAST_COMMS_IOC_MAGIC, 9, __u32)
-#define	BLAST_COMMS_IOCQSW	_IO(BLAST_COMMS_IOC_MAGIC, 10, __u32)
+#define	BLAST_COMMS_IOCTSW	_IO(BLAST_COMMS_IOC_MAGIC, 9)
+#define	BLAST_COMMS_IOCQSW	_IO(BLAST_COMMS_IOC_MAGIC, 10)
 
-#define	BLAST_COMMS_IOCPAIR	_IO(BLAST_COMMS_IOC_MAGIC, 11, \
-						struct blast_comms_pair *)
+#define	BLAST_COMMS_IOCPAIR	_IO(BLAST_COMMS_IOC_MAGIC, 11)
 
-#define	BLAST_COMMS_IOC_MAXNR	13
+#define	BLAST_COMMS_IOCMKNODEXT	_IOWR(BLAST_COMMS_IOC_MAGIC, 12, \
+						struct blast_comms_node_ext)
+
+#define	BLAST_COMMS_IOCSRXFREQ	_IOW(BLAST_COMMS_IOC_MAGIC, 13, double)
+#define	BLAST_COMMS_IOCGRXFREQ	_IOR(BLAST_COMMS_IOC_MAGIC, 14, double)
+
+/* Control device (bcll0) */
+#define	BLAST_COMMS_IOCSILENCE	_IO(BLAST_COMMS_IOC_MAGIC, 15)
+#define	BLAST_COMMS_IOCMKNOD	_IOWR(BLAST_COMMS_IOC_MAGIC, 16, \
+						struct blast_comms_node)
+#define	BLAST_COMMS_IOCRMNOD	_IOW(BLAST_COMMS_IOC_MAGIC, 17, \
+						struct blast_comms_node)
+
+/* Compression (per link) */
+#define	BLAST_COMMS_IOCTCOMPRESS	_IO(BLAST_COMMS_IOC_MAGIC, 18)
+#define	BLAST_COMMS_IOCQCOMPRESS	_IO(BLAST_COMMS_IOC_MAGIC, 19)
+
+/* Forward error correction (per link, chosen by MKNODEXT) */
+#define	BLAST_COMMS_IOCQFEC	_IO(BLAST_COMMS_IOC_MAGIC, 20)
+
+/* Interleaving (per link) */
+#define	BLAST_COMMS_IOCTILV	_IO(BLAST_COMMS_IOC_MAGIC, 21)
+#define	BLAST_COMMS_IOCQILV	_IO(BLAST_COMMS_IOC_MAGIC, 22)
+
+/* Tag search (per link) */
+#define	BLAST_COMMS_IOCTSYNCDIST	_IO(BLAST_COMMS_IOC_MAGIC, 23)
+#define	BLAST_COMMS_IOCQSYNCDIST	_IO(BLAST_COMMS_IOC_MAGIC, 24)
+
+/* Coalescing small writes (per link) */
+#define	BLAST_COMMS_IOCTCOALESCE	_IO(BLAST_COMMS_IOC_MAGIC, 25)
+#define	BLAST_COMMS_IOCQCOALESCE	_IO(BLAST_COMMS_IOC_MAGIC, 26)
+#define	BLAST_COMMS_IOCFLUSH	_IO(BLAST_COMMS_IOC_MAGIC, 27)
+
+/* Message mode (per link) */
+#define	BLAST_COMMS_IOCTMSG	_IO(BLAST_COMMS_IOC_MAGIC, 28)
+#define	BLAST_COMMS_IOCQMSG	_IO(BLAST_COMMS_IOC_MAGIC, 29)
+
+/* Fountain coded downlink (per link) */
+#define	BLAST_COMMS_IOCTFOUNTAIN	_IO(BLAST_COMMS_IOC_MAGIC, 30)
+#define	BLAST_COMMS_IOCQFOUNTAIN	_IO(BLAST_COMMS_IOC_MAGIC, 31)
+#define	BLAST_COMMS_IOCFOUNTAINSTOP	_IO(BLAST_COMMS_IOC_MAGIC, 32)
+
+/* ACK piggybacking (per link) */
+#define	BLAST_COMMS_IOCTACKDELAY	_IO(BLAST_COMMS_IOC_MAGIC, 33)
+#define	BLAST_COMMS_IOCQACKDELAY	_IO(BLAST_COMMS_IOC_MAGIC, 34)
+
+/* Retransmission timeout (per link) */
+#define	BLAST_COMMS_IOCTRTO	_IO(BLAST_COMMS_IOC_MAGIC, 35)
+#define	BLAST_COMMS_IOCQRTO	_IO(BLAST_COMMS_IOC_MAGIC, 36)
+
+#define	BLAST_COMMS_IOC_MAXNR	37
+
+#define	BLAST_COMMS_READ_TIMEOUT		(5 * HZ)
+#define	BLAST_COMMS_TRANSMIT_THREAD_TIMEOUT	(HZ / 10)
+
+#define	BLAST_COMMS_COALESCE_MAX	5000	/* ms */
+
+/*
+ * Message mode (BLAST_COMMS_IOCTMSG)
+ * Each write() is sent as one message, its first frame flagged
+ * BLAST_COMMS_FRAME_CTL_FIRST and its last BLAST_COMMS_FRAME_CTL_LAST, and
+ * each read() returns one whole message, the rest of it dropped if the
+ * buffer is too short.  Both ends of the link must agree.
+ */
+#define	BLAST_COMMS_MSG_MAX		2048
 
 /*
  * The Device Structure
@@ -95,6 +169,46 @@ struct blast_comms_dev {
 	struct usb_interface 	*usb_if;
 	int 			usb_ep_out;
 	int 			usb_ep_in;
+	struct semaphore	usb_lock;
+
+	/* Receive Path (per radio, as each has its own byte stream) */
+	struct kfifo		rx_raw_stack;
+	wait_queue_head_t	framefinder_q;
+	wait_queue_head_t	receive_q;
+	struct task_struct	*rawrecv_thread;
+	struct task_struct	*framefnd_thread;
+
+	/* Tagged Command Table */
+	struct blast_comms_pic_req req[BLAST_COMMS_PIC_TAGS];
+	spinlock_t		req_lock;
+	wait_queue_head_t	req_q;
+	struct usb_anchor	resp_anchor;
+	struct urb		*resp_ring[BLAST_COMMS_USB_RESP_RING];
+
+	/* Asynchronous Transmit Pipeline */
+	struct usb_anchor	tx_anchor;
+	struct blast_comms_tx_slot tx_ring[BLAST_COMMS_USB_TX_RING];
+	unsigned int		tx_head;	/* next slot to submit */
+	atomic_t		tx_inflight;
+	atomic_t		tx_nacks;
+	wait_queue_head_t	tx_idle_q;
+	int			tx_sg;		/* gather from tx stack */
+
+	/* Command Buffer Pool */
+	struct blast_comms_usb_buf buf_pool[BLAST_COMMS_USB_POOL_SIZE];
+	struct list_head	buf_free;
+	spinlock_t		buf_lock;
+	wait_queue_head_t	buf_q;
+
+	/* Streaming Receive Ring (optional third endpoint) */
+	int			usb_ep_stream;
+	struct usb_anchor	rx_anchor;
+	struct urb		*rx_ring[BLAST_COMMS_USB_RX_RING];
+	int			rx_streaming;
+	atomic_t		rx_overruns;
+
+	/* Round-trip Statistics (debugfs) */
+	struct blast_comms_stats stats;
 
 	/* Device Configuration */
 	double	freq;
@@ -102,7 +216,8 @@ struct blast_comms_dev {
 	int	bitrate;
 	u8	preamble_len;
 
-	struct blast_comms_link_dev *dev_list;
+	struct list_head		dev_list;
+	struct blast_comms_link_dev	*link_dev;
 };
 
 /*
@@ -110,25 +225,73 @@ struct blast_comms_dev {
  */
 
 /* Utilities */
-static void bitflip(u8 *buf, size_t len);
+static void bitrev8_words(void *buf, size_t len);
+
+/* Selective Repeat */
+static int blast_comms_arq_mark(struct blast_comms_link_dev *dev, u8 seq);
+static void blast_comms_arq_clear(struct blast_comms_link_dev *dev, u8 seq);
+static void blast_comms_arq_ack(struct blast_comms_link_dev *dev, u8 cum,
+								u64 sack);
+static void blast_comms_ack_send(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static void blast_comms_ack_work(struct work_struct *work);
+static void blast_comms_ack_attach(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
 
 /* Threads */
-static void blast_comms_softirq(struct blast_comms_dev *dev);
-static void blast_comms_transmit(struct blast_comms_dev *dev);
-static void blast_comms_watchdog(struct blast_comms_dev *dev);
-static void blast_comms_receive(struct blast_comms_dev *dev);
-static void blast_comms_frame_finder(struct blast_comms_dev *dev);
+static int blast_comms_transmit_thread(void *data);
+static int blast_comms_watchdog(void *data);
+static int blast_comms_receive_thread(void *data);
+static int blast_comms_frame_finder(void *data);
+static void blast_comms_frame_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static void blast_comms_ilv_deliver(struct blast_comms_link_dev *dev,
+					struct blast_comms_ilv_rx *ilv,
+					struct blast_comms_frame *frame);
+static int blast_comms_raw_receive(void *data);
+static void blast_comms_msg_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static int blast_comms_lt_transmit(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static void blast_comms_lt_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static void blast_comms_lt_deliver(struct blast_comms_link_dev *dev,
+					struct blast_comms_lt *lt);
 
 /* File Operations */
 static int blast_comms_open(struct inode *inode, struct file *filp);
 static int blast_comms_release(struct inode *inode, struct file *filp);
 static ssize_t blast_comms_read(struct file *filp, char __user *buf,
 						size_t count, loff_t *f_pos);
-static ssize_t blast_comms_write(struct file *filp, char __user *buf,
+static ssize_t blast_comms_read_msg(struct blast_comms_link_dev *dev,
+					char __user *buf, size_t count);
+static ssize_t blast_comms_write(struct file *filp, const char __user *buf,
 						size_t count, loff_t *f_pos);
-static int blast_comms_ioctl(struct inode *inode, struct file *filp,
-					unsigned int cmd, unsigned long arg);
-static int blast_comms_flush(struct file *filp);
+static int blast_comms_slot_free(struct blast_comms_link_dev *dev, u8 seq);
+static struct blast_comms_frame *blast_comms_claim_frame(
+				struct blast_comms_link_dev *dev, u8 *tx_ptr);
+static void blast_comms_release_frame(struct blast_comms_link_dev *dev,
+				struct blast_comms_frame *frame, u8 tx_ptr);
+static void blast_comms_queue_frame(struct blast_comms_link_dev *dev,
+				struct blast_comms_frame *frame, u8 tx_ptr,
+				size_t len);
+static ssize_t blast_comms_write_lz4(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count);
+static void blast_comms_hold_push(struct blast_comms_link_dev *dev);
+static void blast_comms_hold_work(struct work_struct *work);
+static int blast_comms_push(struct blast_comms_link_dev *dev);
+static ssize_t blast_comms_write_coalesce(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count);
+static ssize_t blast_comms_write_msg(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count);
+static ssize_t blast_comms_write_lt(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count);
+static void blast_comms_lt_stop(struct blast_comms_link_dev *dev);
+static long blast_comms_ioctl(struct file *filp, unsigned int cmd,
+							unsigned long arg);
+static int blast_comms_flush(struct file *filp, fl_owner_t id);
+static int blast_comms_fsync(struct file *filp, loff_t start, loff_t end,
+								int datasync);
 
 #endif /* _BLAST_COMMS_H_ */
 
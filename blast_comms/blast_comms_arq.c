@@ -0,0 +1,225 @@
+/**
+ * blast_comms_arq.c
+ *
+ * Selective Repeat
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * The ACK state at both ends of a link (see BLAST_COMMS_ARQ_WINDOW): the
+ * receiver marks off the frames it takes in, and the transmitter frees or
+ * sends again its frames by what the ACKs say.  The ACK state goes in an
+ * ACK frame, or on an RTX link with the next data frame back.
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/kfifo.h>
+#include <linux/workqueue.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * blast_comms_arq_mark - a data frame has been received
+ * @dev: the link (rx_data_stack lock held)
+ * @seq: its sequence number
+ * Returns 1 if the frame is to be kept, having moved the ACK state on
+ * past it; 0 for a repeat of a frame already ACKed, or one whose slot
+ * hasn't been read yet, which is left to be sent again.
+ */
+static int blast_comms_arq_mark(struct blast_comms_link_dev *dev, u8 seq)
+{
+	u8 off = blast_comms_seq_diff(seq, dev->rx_cum);
+
+	if (off >= dev->arq_window || (dev->rx_sack & (1ULL << off)) ||
+			dev->rx_data_stack->map[seq] ==
+					BLAST_COMMS_STACK_MAP_UNREAD)
+		return 0;
+
+	dev->rx_sack |= 1ULL << off;
+	while (dev->rx_sack & 1) {
+		dev->rx_sack >>= 1;
+		dev->rx_cum = (dev->rx_cum + 1) % BLAST_COMMS_FRAME_SEQNUM_MOD;
+	}
+
+	return 1;
+}
+
+/**
+ * blast_comms_arq_clear - a transmit stack frame has been ACKed
+ * @dev: the link (tx_data_stack lock held)
+ * @seq: its sequence number
+ */
+static void blast_comms_arq_clear(struct blast_comms_link_dev *dev, u8 seq)
+{
+	u8 map = dev->tx_data_stack->map[seq];
+
+	if (map == BLAST_COMMS_STACK_MAP_CLEAR)
+		return;
+
+	blast_comms_rto_cancel(dev, seq);
+
+	/* It may have been waiting to go again */
+	if (map & BLAST_COMMS_STACK_MAP_SENT)
+		atomic_dec(&dev->unack);
+	else
+		atomic_dec(&dev->unsent);
+
+	dev->tx_data_stack->map[seq] = BLAST_COMMS_STACK_MAP_CLEAR;
+}
+
+/**
+ * blast_comms_arq_ack - act on an ACK frame
+ * @dev: the link
+ * @cum: first frame the other end hasn't received
+ * @sack: frames it has received after that
+ * Frees what was received and sends again what is missing below the last
+ * frame received, unless it went again too recently for the ACK to know;
+ * the watchdog still resends what no ACK mentions.
+ */
+static void blast_comms_arq_ack(struct blast_comms_link_dev *dev, u8 cum,
+								u64 sack)
+{
+	u8	seq, map;
+	int	resend = 0;
+	int	last, i;
+
+	spin_lock(&dev->tx_data_stack->lock);
+
+	/* Overtaken by a later ACK */
+	if (blast_comms_seq_diff(cum, dev->tx_base) > dev->arq_window) {
+		spin_unlock(&dev->tx_data_stack->lock);
+		return;
+	}
+
+	for (seq = dev->tx_base; seq != cum;
+			seq = (seq + 1) % BLAST_COMMS_FRAME_SEQNUM_MOD)
+		blast_comms_arq_clear(dev, seq);
+	dev->tx_base = cum;
+
+	last = fls64(sack);
+	for (i = 0; i < last; i++) {
+		seq = (cum + 1 + i) % BLAST_COMMS_FRAME_SEQNUM_MOD;
+		if (sack & (1ULL << i))
+			blast_comms_arq_clear(dev, seq);
+	}
+
+	/* The holes: cum itself and any unset bits before the last set */
+	for (i = -1; last && i < last - 1; i++) {
+		if (i >= 0 && (sack & (1ULL << i)))
+			continue;
+
+		seq = (cum + 1 + i) % BLAST_COMMS_FRAME_SEQNUM_MOD;
+		map = dev->tx_data_stack->map[seq];
+		if ((map & BLAST_COMMS_STACK_MAP_SENT) &&
+				blast_comms_rto_older(dev, seq,
+						BLAST_COMMS_ARQ_HOLDOFF)) {
+			blast_comms_rto_cancel(dev, seq);
+			dev->tx_data_stack->map[seq] = \
+					BLAST_COMMS_STACK_MAP_READY;
+			atomic_dec(&dev->unack);
+			atomic_inc(&dev->unsent);
+			resend++;
+		}
+	}
+
+	spin_unlock(&dev->tx_data_stack->lock);
+
+	if (resend)
+		wake_up(&dev->transmit_q);
+
+	/* The window may have moved on */
+	wake_up_interruptible(&dev->writers_q);
+}
+
+/**
+ * blast_comms_ack_send - send the ACK state in an ACK frame
+ * @dev: the link
+ * @frame: frame buffer
+ */
+static void blast_comms_ack_send(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	u8	cum;
+	u64	sack;
+
+	spin_lock(&dev->rx_data_stack->lock);
+	dev->ack_pending = 0;
+	cum = dev->rx_cum;
+	sack = dev->rx_sack >> 1;
+	spin_unlock(&dev->rx_data_stack->lock);
+
+	blast_comms_build_ack_frame(dev, frame, cum, sack);
+
+	kfifo_in_spinlocked(dev->tx_meta_stack, frame, sizeof(*frame),
+							&dev->tx_meta_lock);
+
+	wake_up(&dev->transmit_q);
+}
+
+/**
+ * blast_comms_ack_work - no data frame has taken the ACK state in time
+ * @work: the link's ack_work
+ */
+static void blast_comms_ack_work(struct work_struct *work)
+{
+	struct blast_comms_link_dev *dev = container_of(to_delayed_work(work),
+				struct blast_comms_link_dev, ack_work);
+	struct blast_comms_frame frame;
+
+	if (dev->ack_pending)
+		blast_comms_ack_send(dev, &frame);
+}
+
+/**
+ * blast_comms_ack_attach - piggyback the ACK state on a data frame
+ * @dev: the link (BLAST_COMMS_RTX)
+ * @frame: transmit stack frame about to be sent
+ * The frame is finalised again with the ACK state after its data; the
+ * frame itself is left as it was, so a resend carries the state of then.
+ */
+static void blast_comms_ack_attach(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	u8	cum;
+	u64	sack;
+
+	spin_lock(&dev->rx_data_stack->lock);
+	if (!dev->ack_pending) {
+		spin_unlock(&dev->rx_data_stack->lock);
+		return;
+	}
+	dev->ack_pending = 0;
+	cum = dev->rx_cum;
+	sack = dev->rx_sack >> 1;
+	spin_unlock(&dev->rx_data_stack->lock);
+
+	cancel_delayed_work(&dev->ack_work);
+
+	frame->data[frame->data_len] = cum;
+	put_unaligned_le64(sack, &frame->data[frame->data_len + 1]);
+
+	frame->ctl |= BLAST_COMMS_FRAME_CTL_ACK;
+	frame->data_len += BLAST_COMMS_ARQ_ACK_LEN;
+	blast_comms_finalise_frame(dev, frame, frame->seq_num);
+	frame->data_len -= BLAST_COMMS_ARQ_ACK_LEN;
+	frame->ctl &= ~BLAST_COMMS_FRAME_CTL_ACK;
+}
+
+/* EOF */
@@ -0,0 +1,78 @@
+/**
+ * blast_comms_crc.c
+ *
+ * Frame Check Sequence
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * CRC-CCITT, as crc_ccitt(), but four bytes at a time using the slice-by-4
+ * tables gen_crctable writes at build time.  Feed it a frame in as many
+ * pieces as is convenient:
+ *
+ *	crc = blast_comms_crc_init();
+ *	crc = blast_comms_crc_update(crc, a, alen);
+ *	crc = blast_comms_crc_update(crc, b, blen);
+ *	fcs = blast_comms_crc_final(crc);
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <asm/unaligned.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+#include "blast_comms_crctable.h"
+
+/**
+ * blast_comms_crc_update - add bytes to a running frame check sequence
+ * @crc: running CRC, from blast_comms_crc_init() or a previous update
+ * @buf: the bytes
+ * @len: how many
+ */
+static u16 blast_comms_crc_update(u16 crc, const void *buf, size_t len)
+{
+	const u8 *p = buf;
+	u32 v;
+
+	/* Four bytes at a time; the reflected CRC sits in the low half */
+	while (len >= BLAST_COMMS_CRC_SLICES) {
+		v = crc ^ get_unaligned_le32(p);
+		crc = blast_comms_crc_table[3][v & 0xFF] ^
+			blast_comms_crc_table[2][(v >> 8) & 0xFF] ^
+			blast_comms_crc_table[1][(v >> 16) & 0xFF] ^
+			blast_comms_crc_table[0][v >> 24];
+		p += BLAST_COMMS_CRC_SLICES;
+		len -= BLAST_COMMS_CRC_SLICES;
+	}
+
+	/* Then the tail a byte at a time */
+	while (len--)
+		crc = (crc >> 8) ^ blast_comms_crc_table[0][(crc ^ *p++) & 0xFF];
+
+	return crc;
+}
+
+/**
+ * blast_comms_crc - frame check sequence of a single buffer
+ * @buf: the bytes
+ * @len: how many
+ */
+static u16 blast_comms_crc(const void *buf, size_t len)
+{
+	return blast_comms_crc_final(blast_comms_crc_update(
+					blast_comms_crc_init(), buf, len));
+}
+
+/* EOF */
@@ -0,0 +1,57 @@
+/**
+ * blast_comms_crc.h
+ *
+ * Frame Check Sequence
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_CRC_H_
+#define _BLAST_COMMS_CRC_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+
+/*
+ * Constants
+ */
+#define	BLAST_COMMS_CRC_INIT		0xFFFF
+
+/**
+ * blast_comms_crc_init - start a frame check sequence
+ */
+static inline u16 blast_comms_crc_init(void)
+{
+	return BLAST_COMMS_CRC_INIT;
+}
+
+/**
+ * blast_comms_crc_final - finish a frame check sequence
+ * @crc: running CRC
+ * The FCS goes on air least significant bit first, like every other
+ * field (see blast_comms_frame_to_air()), which is the order the reflected
+ * CRC is already in.
+ */
+static inline u16 blast_comms_crc_final(u16 crc)
+{
+	return crc;
+}
+
+/*
+ * Function Prototypes
+ */
+static u16 blast_comms_crc_update(u16 crc, const void *buf, size_t len);
+static u16 blast_comms_crc(const void *buf, size_t len);
+
+#endif /* _BLAST_COMMS_CRC_H_ */
+
+/* EOF */
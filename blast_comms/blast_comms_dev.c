@@ -31,27 +31,25 @@
 #include "blast_comms_rfm.h"
 
 /**
- * blast_comms_pic_write - writes raw data to the PIC
+ * blast_comms_pic_write - writes a built command to the PIC
  * @dev: device to write to
- * @buf: buffer to write
- * @len: length of buffer
+ * @buf: pool buffer holding the command (see blast_comms_pic_buildcmd)
+ * The buffer is returned to the pool whatever the outcome.
  */
-static int blast_comms_pic_write(struct blast_comms_dev *dev, char *buf,
-								size_t len)
+static int blast_comms_pic_write(struct blast_comms_dev *dev,
+						struct blast_comms_usb_buf *buf)
 {
-	/* Check for valid len */
-	if (len <= 0 || len > BLAST_COMMS_USB_MAXLEN) {
-		kprint(KERN_WARNING "%s: blast_comms_pic_write: length too long",
-			DRIVER_NAME);
-		return -EINVAL;
-	}
+	int result = 0;
+	size_t actual = 0;
 
 	/* Send buffer to device */
-	result = usb_bulk_msg(dev->usb_dev,
+	result = blast_comms_usb_xfer(dev, buf,
 				usb_sndbulkpipe(dev->usb_dev, dev->usb_ep_out),
-				buf, len, &actual, BLAST_COMMS_USB_TIMEOUT);
-	if (!result) {
-		kprint(KERN_WARNING "%s: blast_comms_pic_write: send failed",
+				buf->len, &actual);
+	blast_comms_usb_buf_put(dev, buf);
+
+	if (result) {
+		printk(KERN_WARNING "%s: blast_comms_pic_write: send failed",
 			DRIVER_NAME);
 		return -EFAULT;
 	}
@@ -60,96 +58,93 @@ static int blast_comms_pic_write(struct blast_comms_dev *dev, char *buf,
 }
 
 /**
- * blast_comms_pic_read - read raw data from the PIC
- * @dev: device to read from
- * @buf: buffer to read to
- * @len: length of buffer
- * NOTE: RETURNS ACK/NACK/EXACK/EXNACK! (or -ve error code)
+ * blast_comms_pic_buildcmd - build a PIC command in a pool buffer
+ * @dev: device the command is for
+ * @cmd: command byte
+ * @tag: command tag (see blast_comms_usb_req_arm)
+ * @data: command data, or NULL for a header-only request
+ * @len: length of data (or, for a header-only request, the length field)
  */
-static int blast_comms_pic_read(struct blast_comms_dev *dev, char *buf,
-						size_t len, size_t *actual)
+static struct blast_comms_usb_buf *blast_comms_pic_buildcmd(
+					struct blast_comms_dev *dev,
+					unsigned int cmd, u8 tag,
+					char *data, size_t len)
 {
-	int ret = 0;
-	size_t act;
-	char *resp = kmalloc(BLAST_COMMS_USB_MAXLEN, GFP_KERNEL);
-
-	/* check if actual is being ignored */
-	if (actual == NULL)
-		actual = &act;
-
-	/* check if len is being ignored */
-	if (len == 0)
-		len = BLAST_COMMS_USB_MAXLEN);
-
-	/* check allocation */
-	if (!resp) {
-		printk(KERN_WARNING "%s: blast_comms_pic_read: out of memory",
-			DRIVER_NAME);
-		return -ENOMEM;
-	}
+	struct blast_comms_usb_buf *buf;
 
-	/* USB receive */
-	ret = usb_bulk_msg(dev->usb_dev,
-				usb_rcvbulkpipe(dev->usb_dev, dev->usb_ep_in),
-				resp, len, actual, BLAST_COMMS_USB_TIMEOUT);
-	if (!ret) {
-		kprint(KERN_WARNING "%s: blast_comms_pic_read: receive failed",
+	/* check command data length */
+	if (len > BLAST_COMMS_PIC_CMDMAXLEN) {
+		printk(KERN_WARNING "%s: blast_comms_pic_buildcmd: data too long",
 			DRIVER_NAME);
-		return -EFAULT;
+		return NULL;
 	}
 
-	/* check actual length and truncate if necessary */
-	if ((actual - 3) > len) {
-		printk(KERN_WARNING "%s: blast_comms_pic_read: caution, truncating",
-			DRIVER_NAME);
-
-		*actual = len;
-	}
+	/* get a buffer from the pool */
+	buf = blast_comms_usb_buf_get(dev);
+	if (!buf)
+		return NULL;
 
-	/* fill buf if EX(N)ACK and buf isn't being ignored */
-	ret = (int)resp[0];
-	if (((ret == BLAST_COMMS_PIC_EXACK) || (ret == BLAST_COMMS_PIC_EXNACK))
-							&& buf != NULL) {
-		memset(buf, 0, len);
-		memcpy(buf, &resp[3], actual);
-	} else {
-		*actual = 0;
+	/* build command */
+	buf->data[0] = (unsigned char)cmd;
+	buf->data[1] = tag;
+	*((__le16 *)&buf->data[2]) = cpu_to_le16(len);
+	buf->len = BLAST_COMMS_PIC_HDRLEN;
+
+	if (data) {
+		memcpy(&buf->data[BLAST_COMMS_PIC_HDRLEN], data, len);
+		buf->len += len;
 	}
 
-	kfree(resp);
-	return ret;
+	return buf;
 }
 
-static inline int blast_comms_pic_readack(struct blast_comms_dev *dev)
+/**
+ * blast_comms_pic_exec - send a tagged command and wait for its response
+ * @dev: device to use
+ * @cmd: command byte
+ * @data: command data, or NULL for a header-only request
+ * @len: length of data (or the length field of a header-only request)
+ * @resp: buffer for EX(N)ACK data, or NULL
+ * @resp_len: length of resp
+ * @actual: bytes placed in resp, or NULL
+ * Other commands, including the transmit ring's PUTRAMs, carry on while this
+ * one waits.
+ * NOTE: RETURNS ACK/NACK/EXACK/EXNACK! (or -ve error code)
+ */
+static int blast_comms_pic_exec(struct blast_comms_dev *dev, unsigned int cmd,
+				char *data, size_t len,
+				char *resp, size_t resp_len, size_t *actual)
 {
-	return blast_comms_pic_read(dev, NULL, 0, NULL);
-}
+	struct blast_comms_pic_req *req;
+	struct blast_comms_usb_buf *buf;
+	int ret = 0;
 
-static char *blast_comms_pic_buildcmd(unsigned int cmd, char *data, size_t len)
-{
-	char *buf;
+	req = blast_comms_usb_req_get(dev);
+	if (!req)
+		return -ERESTARTSYS;
 
-	/* check command data length */
-	if (len > BLAST_COMMS_PIC_CMDMAXLEN) {
-		kprint(KERN_WARNING "%s: blast_comms_pic_buildcmd: data too long",
-			DRIVER_NAME);
-		return NULL;
-	}
+	req->buf = resp;
+	req->len = resp ? resp_len : 0;
 
-	/* allocate buffer and check */
-	buf = kmalloc(len + 3, GFP_KERNEL);
+	buf = blast_comms_pic_buildcmd(dev, cmd,
+				blast_comms_usb_req_arm(dev, req, cmd), data, len);
 	if (!buf) {
-		kprint(KERN_WARNING "%s: blast_comms_pic_buildcmd: out of memory",
-			DRIVER_NAME);
-		return NULL;
+		blast_comms_usb_req_put(dev, req);
+		return -EFAULT;
 	}
 
-	/* build command */
-	buf[0] = (unsigned char)cmd;
-	*((uint16_t)&buf[1]) = (uint16_t)len;
-	memcpy(&buf[3], data, len);
+	if (blast_comms_pic_write(dev, buf)) {
+		blast_comms_usb_req_put(dev, req);
+		return -EFAULT;
+	}
 
-	return buf;
+	ret = blast_comms_usb_req_wait(dev, req);
+
+	if (actual)
+		*actual = req->actual;
+
+	blast_comms_usb_req_put(dev, req);
+	return ret;
 }
 
 /**
@@ -159,116 +154,208 @@ static char *blast_comms_pic_buildcmd(unsigned int cmd, char *data, size_t len)
  * Uses the PIC's PUT RAM command, form:
  * 	Offset	Description
  *	0x00	Command Byte (PUT RAM)
- *	0x01	Length (bytes)
- *	0x03	Data
+ *	0x01	Tag
+ *	0x02	Length (bytes)
+ *	0x04	Data
+ * Sends the finalised frame's wire bytes.  The command is queued on the
+ * asynchronous transmit ring and this returns as soon as it is submitted;
+ * the ACK is collected by the ring.
  */
 static int blast_comms_pic_tx_write(struct blast_comms_dev *dev,
 						struct blast_comms_frame *frame)
 {
-	char *buf;
-	int ret = 0;
+	return blast_comms_usb_tx_submit(dev, BLAST_COMMS_PIC_PUTRAM,
+					(char *)frame->wire, frame->wire_len);
+}
 
-	/* build command */
-	buf = blast_comms_pic_buildcmd(BLAST_COMMS_PIC_PUTRAM, frame,
-					sizeof(struct blast_comms_frame));
-	if (!buf)
-		return -EFAULT;
+/**
+ * blast_comms_pic_tx_write_sg - writes frames without copying them again
+ * @dev: device to write to
+ * @frames: frames to send, in order, in the transmit stack
+ * @count: number of frames (at most BLAST_COMMS_PIC_BATCH_MAX)
+ * As blast_comms_pic_tx_write_batch, but the USB controller reads each
+ * frame's wire bytes from the stack itself.  The frames must stay put until
+ * the PIC's ACK; the stack map keeps them SENT until then.
+ */
+static int blast_comms_pic_tx_write_sg(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count)
+{
+	struct blast_comms_tx_slot *slot;
+	unsigned int cmd = BLAST_COMMS_PIC_PUTRAM;
+	char *lens;
+	size_t hdr_len = 0;
+	int result = 0;
+	int i;
 
-	/* lock USB to prevent erroneous responses */
-	down(dev->usb_lock);
+	/* a full batch must fit, one entry per frame */
+	BUILD_BUG_ON(BLAST_COMMS_PIC_BATCH_MAX + 1 > BLAST_COMMS_USB_TX_SGS);
 
-	/* write command to PIC */
-	if (blast_comms_pic_write(dev, buf, sizeof(struct blast_comms_frame) + 3)) {
-		/* MUST unlock USB and free buf for cleanliness */
-		up(dev->usb_lock);
-		kfree(buf);
-		return -EFAULT;
-	}
+	slot = blast_comms_usb_tx_begin(dev);
+	if (!slot)
+		return -ERESTARTSYS;
 
-	/* get PIC response */
-	ret = blast_comms_pic_readack(dev);
+	lens = &slot->sg_hdr[BLAST_COMMS_PIC_HDRLEN +
+					BLAST_COMMS_PIC_BATCH_HDRLEN];
+
+	/* should the sg list fill anyway, the rest go in a batch of their
+	 * own rather than being dropped
+	 */
+	for (i = 0; i < count; i++) {
+		if (blast_comms_usb_tx_sg_add(slot, frames[i]->wire,
+						frames[i]->wire_len))
+			break;
+		lens[i] = (char)frames[i]->wire_len;
+	}
 
-	/* unlock USB and free buf for cleanliness */
-	up(dev->usb_lock);
-	kfree(buf);
+	if (i > 1) {
+		cmd = BLAST_COMMS_PIC_PUTRAMN;
+		hdr_len = BLAST_COMMS_PIC_BATCH_HDRLEN + i;
+		slot->sg_hdr[BLAST_COMMS_PIC_HDRLEN] = (char)i;
+	}
 
-	if (likely(ret == BLAST_COMMS_PIC_ACK))
-		return 0;
+	result = blast_comms_usb_tx_commit_sg(dev, slot, cmd, hdr_len);
+	if (result || i == count)
+		return result;
 
-	return -EFAULT;
+	return blast_comms_pic_tx_write_sg(dev, &frames[i], count - i);
 }
 
 /**
- * blast_comms_pic_rx_read - reads a frame off of the PIC's receive stack
- * @dev: device to read from
- * @frame: buffer to read to
+ * blast_comms_pic_tx_write_batch - writes several frames in one transfer
+ * @dev: device to write to
+ * @frames: frames to send, in order
+ * @count: number of frames (at most BLAST_COMMS_PIC_BATCH_MAX)
+ * Uses the PIC's batched PUT RAM command, form:
+ * 	Offset	Description
+ *	0x00	Command Byte (PUT RAM BATCH)
+ *	0x01	Tag
+ *	0x02	Length (bytes)
+ *	0x04	Frame Count
+ *	0x05	Frame Lengths (one byte each)
+ *	0x05+n	Frames
+ * The PIC stores the whole batch or none of it and returns a single ACK.
  */
-static int blast_comms_pic_rx_read(struct blast_comms_dev *dev,
-						struct blast_comms_frame *frame)
+static int blast_comms_pic_tx_write_batch(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count)
 {
-	char cmd[3] = { BLAST_COMMS_PIC_GETRAM, 0, 0 };
-	size_t actual = 0;
+	struct blast_comms_tx_slot *slot;
+	char *lens;
+	char *ptr;
+	int i;
 
-	*((uint16_t *)&cmd[1]) = (uint16_t)sizeof(struct blast_comms_frame);
+	if (count < 1 || count > BLAST_COMMS_PIC_BATCH_MAX)
+		return -EINVAL;
 
-	down(dev->usb_lock);
+	/* send the wire bytes from the stack if the controller allows */
+	if (dev->tx_sg)
+		return blast_comms_pic_tx_write_sg(dev, frames, count);
 
-	/* write command to PIC */
-	if (blast_comms_pic_write(dev, cmd, 3)) {
-		/* MUST unlock USB for cleanliness */
-		up(dev->usb_lock);
-		return -EFAULT;
-	}
+	/* a lone frame doesn't need the batch header */
+	if (count == 1)
+		return blast_comms_pic_tx_write(dev, frames[0]);
 
-	blast_comms_pic_read(dev, (char *)frame, sizeof(struct blast_comms_frame),
-								&actual);
+	slot = blast_comms_usb_tx_begin(dev);
+	if (!slot)
+		return -ERESTARTSYS;
 
-	up(dev->usb_lock);
+	/* pack the wire bytes into the transfer buffer */
+	ptr = &slot->cmd_buf[BLAST_COMMS_PIC_HDRLEN];
+	*ptr++ = (char)count;
+	lens = ptr;
+	ptr += count;
 
-	if (actual != sizeof(struct blast_comms_frame)) {
-		memset((char *)frame, 0, sizeof(struct blast_comms_frame));
-		return -EFAULT;
+	for (i = 0; i < count; i++) {
+		lens[i] = (char)frames[i]->wire_len;
+		memcpy(ptr, frames[i]->wire, frames[i]->wire_len);
+		ptr += frames[i]->wire_len;
 	}
 
-	return 0;
+	return blast_comms_usb_tx_commit(dev, slot, BLAST_COMMS_PIC_PUTRAMN,
+				ptr - &slot->cmd_buf[BLAST_COMMS_PIC_HDRLEN]);
 }
 
+/**
+ * blast_comms_pic_tx_write_ilv - writes frames as an interleaved group
+ * @dev: device to write to
+ * @frames: frames to send, in order
+ * @count: number of frames (at most BLAST_COMMS_ILV_MAX)
+ * @group: group number
+ * As blast_comms_pic_tx_write_batch, but the batch holds the group's
+ * packets (see blast_comms_ilv.h) rather than the frames themselves.
+ * Interleaving copies every byte anyway, so this always packs the
+ * transfer buffer.
+ */
+static int blast_comms_pic_tx_write_ilv(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count, u8 group)
+{
+	struct blast_comms_tx_slot *slot;
+	size_t packets;
+	u8 *lens;
+	char *ptr;
+
+	/* a full group must fit in one batch */
+	BUILD_BUG_ON(BLAST_COMMS_ILV_PACKETS(BLAST_COMMS_ILV_MAX,
+			BLAST_COMMS_ILV_ROW_MAX) > BLAST_COMMS_PIC_BATCH_MAX);
+
+	if (count < 1 || count > BLAST_COMMS_ILV_MAX)
+		return -EINVAL;
 
+	slot = blast_comms_usb_tx_begin(dev);
+	if (!slot)
+		return -ERESTARTSYS;
+
+	packets = BLAST_COMMS_ILV_PACKETS(count,
+				blast_comms_ilv_row_len(frames, count));
+
+	ptr = &slot->cmd_buf[BLAST_COMMS_PIC_HDRLEN];
+	*ptr++ = (char)packets;
+	lens = (u8 *)ptr;
+	ptr += packets;
+	ptr += blast_comms_ilv_encode(frames, count, group, (u8 *)ptr, lens);
+
+	return blast_comms_usb_tx_commit(dev, slot, BLAST_COMMS_PIC_PUTRAMN,
+				ptr - &slot->cmd_buf[BLAST_COMMS_PIC_HDRLEN]);
+}
 
 /**
- * blast_comms_pic_rfm_write - writes a command to the RFM23 via the PIC
- * @dev: device to write to
- * @buf: buffer to write from
- * @len: length to write
+ * blast_comms_pic_rx_read - reads bytes off of the PIC's receive stack
+ * @dev: device to read from
+ * @buf: buffer to read to
+ * @len: most bytes to read
+ * Returns the number of bytes read (the PIC returns what it has, up to len).
  */
-static int blast_comms_pic_rfm_write(struct blast_comms_dev *dev,  char *buf,
-							uint16_t len)
+static int blast_comms_pic_rx_read(struct blast_comms_dev *dev, char *buf,
+								size_t len)
 {
-	char *buffer = blast_comms_pic_buildcmd(BLAST_COMMS_PIC_PUTXCVR, buf, len);
+	size_t actual = 0;
 	int ret = 0;
 
-	if (!buffer)
-		return -EFAULT;
-
-	down(dev->usb_lock);
+	ret = blast_comms_pic_exec(dev, BLAST_COMMS_PIC_GETRAM, NULL, len,
+						buf, len, &actual);
 
-	if(!blast_comms_pic_write(dev, buffer, len + 3)) {
-		up(dev->usb_lock);
-		kfree(buffer);
+	if (ret != BLAST_COMMS_PIC_EXACK)
 		return -EFAULT;
-	}
-
-	ret = blast_comms_pic_readack(dev);
 
-	up(dev->usb_lock);
+	return actual;
+}
 
-	if (ret == BLAST_COMMS_PIC_ACK)
-		ret = 0;
-	else
-		ret = -EFAULT;
+/**
+ * blast_comms_pic_rfm_write - writes a command to the RFM23 via the PIC
+ * @dev: device to write to
+ * @buf: buffer to write from
+ * @len: length to write
+ */
+static int blast_comms_pic_rfm_write(struct blast_comms_dev *dev,  char *buf,
+							uint16_t len)
+{
+	if (blast_comms_pic_exec(dev, BLAST_COMMS_PIC_PUTXCVR, buf, len,
+					NULL, 0, NULL) == BLAST_COMMS_PIC_ACK)
+		return 0;
 
-	kfree(buffer);
-	return ret;
+	return -EFAULT;
 }
 
 /**
@@ -280,27 +367,25 @@ static int blast_comms_pic_rfm_write(struct blast_comms_dev *dev,  char *buf,
 static int blast_comms_pic_rfm_read(struct blast_comms_dev *dev,  char *buf,
 							size_t len)
 {
-	char cmd[3] = { BLAST_COMMS_PIC_READRFM, 0, 0 };
-	int ret = 0;
-	*((uint16_t *)&cmd[1]) = (uint16_t)len;
-
-	down(dev->usb_lock);
-
-	if(!blast_comms_pic_write(dev, cmd, 3)) {
-		up(dev->usb_lock);
-		return -EFAULT;
-	}
-
-	ret = blast_comms_pic_read(dev, len, buf, NULL);
+	if (blast_comms_pic_exec(dev, BLAST_COMMS_PIC_GETXCVR, NULL, len,
+					buf, len, NULL) == BLAST_COMMS_PIC_EXACK)
+		return 0;
 
-	up(dev->usb_lock);
+	return -EFAULT;
+}
 
-	if (ret == BLAST_COMMS_PIC_EXACK)
-		ret = 0;
-	else
-		ret = -EFAULT;
+/**
+ * blast_comms_pic_mode - sets the PIC's operating mode
+ * @dev: device to configure
+ * @mode: one of BLAST_COMMS_PIC_MODE_*
+ */
+static int blast_comms_pic_mode(struct blast_comms_dev *dev, u8 mode)
+{
+	if (blast_comms_pic_exec(dev, BLAST_COMMS_PIC_SETMODE, (char *)&mode,
+				sizeof(u8), NULL, 0, NULL) == BLAST_COMMS_PIC_ACK)
+		return 0;
 
-	return ret;
+	return -EFAULT;
 }
 
 /**
@@ -334,23 +419,25 @@ static int blast_comms_dev_start(struct blast_comms_dev *dev, int mode,
 
 	/* Set RFM and PIC to appropriate mode */
 	if (mode == BLAST_COMMS_TX) {
-		cmd[0] = RFM_WRITE | RFM_REG;
+		cmd[0] = RFM_WRITE | RFM_REG_OPERATING_MODE;
 		cmd[1] = RFM_MODE_TX;
 		ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 		if (!ret_val)
 			return ret_val;
 
-		ret_val = blast_comms_pic_mode(dev, BLAST_COMMS_TX);
+		ret_val = blast_comms_pic_mode(dev,
+					BLAST_COMMS_PIC_MODE_TRANSMIT);
 		if (!ret_val)
 			return ret_val;
 	} else {
-		cmd[0] = RFM_WRITE | RFM_REG;
+		cmd[0] = RFM_WRITE | RFM_REG_OPERATING_MODE;
 		cmd[1] = RFM_MODE_RX;
 		ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 		if (!ret_val)
 			return ret_val;
 
-		ret_val = blast_comms_pic_mode(dev, BLAST_COMMS_RX);
+		ret_val = blast_comms_pic_mode(dev,
+					BLAST_COMMS_PIC_MODE_RECEIVE);
 		if (!ret_val)
 			return ret_val;
 	}
@@ -367,13 +454,13 @@ static int blast_comms_dev_init(struct blast_comms_dev *dev)
 	u8 cmd[2];
 	int ret_val = 0;
 
-	cmd[0] = RFM_WRITE | RFM_REG;
+	cmd[0] = RFM_WRITE | RFM_REG_OPERATING_MODE;
 	cmd[1] = RFM_MODE_STANDBY;
 	ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 	if (!ret_val)
 		return ret_val;
 
-	ret_val = blast_comms_pic_mode(dev, PIC_MODE_STANDBY);
+	ret_val = blast_comms_pic_mode(dev, BLAST_COMMS_PIC_MODE_STANDBY);
 	if (!ret_val)
 		return ret_val;
 
@@ -397,9 +484,10 @@ static int blast_comms_dev_stop(struct blast_comms_dev *dev)
 static inline int blast_comms_dev_starttx(struct blast_comms_dev *dev)
 {
 	return blast_comms_dev_start(dev, BLAST_COMMS_TX,
-					BLAST_COMMS_DEFAULT_TXFREQ,
-					BLAST_COMMS_DEFAULT_TXPOWER,
-					BLAST_COMMS_DEFAULT_TXBR);
+					BLAST_COMMS_DEFAULT_FREQUENCY,
+					BLAST_COMMS_DEFAULT_POWER,
+					BLAST_COMMS_DEFAULT_BITRATE,
+					BLAST_COMMS_DEFAULT_PREAMBLE);
 }
 
 /**
@@ -409,9 +497,10 @@ static inline int blast_comms_dev_starttx(struct blast_comms_dev *dev)
 static inline int blast_comms_dev_startrx(struct blast_comms_dev *dev)
 {
 	return blast_comms_dev_start(dev, BLAST_COMMS_RX,
-					BLAST_COMMS_DEFAULT_RXFREQ,
-					BLAST_COMMS_DEFAULT_RXPOWER,
-					BLAST_COMMS_DEFAULT_RXBR);
+					BLAST_COMMS_DEFAULT_FREQUENCY,
+					BLAST_COMMS_DEFAULT_POWER,
+					BLAST_COMMS_DEFAULT_BITRATE,
+					BLAST_COMMS_DEFAULT_PREAMBLE);
 }
 
 /**
@@ -504,10 +593,10 @@ static int blast_comms_rfm_bitrate(struct blast_comms_dev *dev,
 
 	if (val < 30) {
 		dr = (val * RFM_TX_DR_2_21) / 1000;
-		set_bit(RFM_TX_DR_SCALE_BIT, (unsigned long *)&cmd[1]);
+		cmd[1] |= 1 << RFM_TX_DR_SCALE_BIT;
 	} else {
 		dr = (val * RFM_TX_DR_2_16) / 1000;
-		clear_bit(RFM_TX_DR_SCALE_BIT, (unsigned long *)&cmd[1]);
+		cmd[1] &= ~(1 << RFM_TX_DR_SCALE_BIT);
 	}
 
 	cmd[0] = RFM_WRITE | RFM_REG_MOD_MODE_1;
@@ -607,28 +696,28 @@ static int blast_comms_rfm_sync_word(struct blast_comms_dev *dev, u32 val)
 	int ret_val = 0;
 
 	cmd[0] = RFM_WRITE | RFM_REG_SYNC_WORD_3;
-	cmd[1] = ((u8 *)val)[3];
+	cmd[1] = val >> 24;
 
 	ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 	if (!ret_val)
 		return ret_val;
 
 	cmd[0] = RFM_WRITE | RFM_REG_SYNC_WORD_2;
-	cmd[1] = ((u8 *)val)[2];
+	cmd[1] = val >> 16;
 
 	ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 	if (!ret_val)
 		return ret_val;
 
 	cmd[0] = RFM_WRITE | RFM_REG_SYNC_WORD_1;
-	cmd[1] = ((u8 *)val)[1];
+	cmd[1] = val >> 8;
 
 	ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 	if (!ret_val)
 		return ret_val;
 
 	cmd[0] = RFM_WRITE | RFM_REG_SYNC_WORD_0;
-	cmd[1] = ((u8 *)val)[0];
+	cmd[1] = val;
 
 	ret_val = blast_comms_pic_rfm_write(dev, (char *)cmd, 2);
 	if (!ret_val)
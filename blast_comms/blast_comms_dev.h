@@ -27,18 +27,33 @@
 /*
  * Function Prototypes
  */
-static inline int blast_comms_pic_write(struct blast_comms_dev *dev, char *buf,
-								size_t len);
-static inline int blast_comms_pic_read(struct blast_comms_dev *dev, char *cmd,
-				size_t cmdlen, char *buf, size_t buflen);
+static int blast_comms_pic_write(struct blast_comms_dev *dev,
+					struct blast_comms_usb_buf *buf);
+static struct blast_comms_usb_buf *blast_comms_pic_buildcmd(
+					struct blast_comms_dev *dev,
+					unsigned int cmd, u8 tag,
+					char *data, size_t len);
+static int blast_comms_pic_exec(struct blast_comms_dev *dev, unsigned int cmd,
+				char *data, size_t len,
+				char *resp, size_t resp_len, size_t *actual);
 static int blast_comms_pic_tx_write(struct blast_comms_dev *dev,
 						struct blast_comms_frame *frame);
-static int blast_comms_pic_rx_read(struct blast_comms_dev *dev,
-						struct blast_comms_frame *frame);
+static int blast_comms_pic_tx_write_sg(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count);
+static int blast_comms_pic_tx_write_batch(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count);
+static int blast_comms_pic_tx_write_ilv(struct blast_comms_dev *dev,
+					struct blast_comms_frame **frames,
+					int count, u8 group);
+static int blast_comms_pic_rx_read(struct blast_comms_dev *dev, char *buf,
+								size_t len);
 static int blast_comms_pic_rfm_write(struct blast_comms_dev *dev,  char *buf,
-							unsigned char len);
+							uint16_t len);
 static int blast_comms_pic_rfm_read(struct blast_comms_dev *dev,  char *buf,
-							unsigned char len);
+							size_t len);
+static int blast_comms_pic_mode(struct blast_comms_dev *dev, u8 mode);
 static int blast_comms_dev_start(struct blast_comms_dev *dev, int mode,
 						double freq, int power,
 						unsigned long br, u8 preamble);
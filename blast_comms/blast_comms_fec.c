@@ -0,0 +1,446 @@
+/**
+ * blast_comms_fec.c
+ *
+ * Forward Error Correction Schemes
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Each link codes its frames with one of these, chosen when the link is
+ * made, so the code rate can follow the link margin from pass to pass:
+ *	none		CRC only, for strong links
+ *	reed-solomon	32 check symbols, corrects 16 bad bytes
+ *	convolutional	rate 1/2, for weak links with scattered bit errors
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/bitops.h>
+#include <linux/bitrev.h>
+#include <linux/rslib.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * The schemes, indexed by BLAST_COMMS_FEC_*
+ */
+static const struct blast_comms_fec_ops
+			blast_comms_fec_schemes[BLAST_COMMS_FEC_SCHEMES] = {
+	[BLAST_COMMS_FEC_RS] = {
+		.id = BLAST_COMMS_FEC_RS,
+		.name = "reed-solomon",
+		.data_max = BLAST_COMMS_FRAME_DATA_LEN,
+		.head_len = BLAST_COMMS_WIRE_HEAD_LEN,
+		.init = blast_comms_fec_rs_init,
+		.release = blast_comms_fec_rs_release,
+		.encode = blast_comms_fec_rs_encode,
+		.decode = blast_comms_fec_rs_decode,
+		.air_len = blast_comms_fec_rs_air_len
+	},
+	[BLAST_COMMS_FEC_NONE] = {
+		.id = BLAST_COMMS_FEC_NONE,
+		.name = "none",
+		.data_max = BLAST_COMMS_FRAME_DATA_LEN,
+		.head_len = BLAST_COMMS_WIRE_HEAD_LEN,
+		.init = blast_comms_fec_none_init,
+		.release = blast_comms_fec_none_release,
+		.encode = blast_comms_fec_none_encode,
+		.decode = blast_comms_fec_none_decode,
+		.air_len = blast_comms_fec_none_air_len
+	},
+	[BLAST_COMMS_FEC_CONV] = {
+		.id = BLAST_COMMS_FEC_CONV,
+		.name = "convolutional",
+		.data_max = BLAST_COMMS_CONV_DATA_MAX,
+		.head_len = BLAST_COMMS_CONV_LEN(BLAST_COMMS_WIRE_LEN(0)),
+		.init = blast_comms_fec_conv_init,
+		.release = blast_comms_fec_conv_release,
+		.encode = blast_comms_fec_conv_encode,
+		.decode = blast_comms_fec_conv_decode,
+		.air_len = blast_comms_fec_conv_air_len
+	}
+};
+
+/**
+ * Hamming distance between two pairs of code bits
+ */
+static const u8 blast_comms_conv_dist[4] = { 0, 1, 1, 2 };
+
+/**
+ * blast_comms_fec_get - look up a scheme
+ * @scheme: BLAST_COMMS_FEC_*
+ * Returns NULL if there is no such scheme.
+ */
+static const struct blast_comms_fec_ops *blast_comms_fec_get(int scheme)
+{
+	if (scheme < 0 || scheme >= BLAST_COMMS_FEC_SCHEMES)
+		return NULL;
+
+	return &blast_comms_fec_schemes[scheme];
+}
+
+/*
+ * No FEC: the frame goes on air as it is, the CRC catches any errors
+ */
+static int blast_comms_fec_none_init(struct blast_comms_link_dev *dev)
+{
+	dev->fec_priv = NULL;
+	return 0;
+}
+
+static void blast_comms_fec_none_release(struct blast_comms_link_dev *dev)
+{
+}
+
+static void blast_comms_fec_none_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+}
+
+static int blast_comms_fec_none_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	return 0;
+}
+
+static size_t blast_comms_fec_none_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air)
+{
+	u8 data_len = blast_comms_frame_air_data_len(air);
+
+	if (data_len > BLAST_COMMS_FRAME_DATA_LEN)
+		return 0;
+
+	return BLAST_COMMS_WIRE_LEN(data_len);
+}
+
+/**
+ * blast_comms_fec_rs_init - set up the Reed-Solomon codec for a link
+ * @dev: the link
+ */
+static int blast_comms_fec_rs_init(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_fec_rs *rs;
+
+	rs = kzalloc(sizeof(struct blast_comms_fec_rs), GFP_KERNEL);
+	if (!rs)
+		return -ENOMEM;
+
+	rs->rs = init_rs(BLAST_COMMS_RS_SYMSIZE, BLAST_COMMS_RS_GFPOLY,
+				BLAST_COMMS_RS_FCR, BLAST_COMMS_RS_PRIM,
+				BLAST_COMMS_RS_NROOTS);
+	if (!rs->rs) {
+		kfree(rs);
+		return -ENOMEM;
+	}
+
+	mutex_init(&rs->lock);
+	dev->fec_priv = rs;
+
+	return 0;
+}
+
+/**
+ * blast_comms_fec_rs_release - free a link's Reed-Solomon codec
+ * @dev: the link
+ */
+static void blast_comms_fec_rs_release(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_fec_rs *rs = dev->fec_priv;
+
+	free_rs(rs->rs);
+	kfree(rs);
+	dev->fec_priv = NULL;
+}
+
+/**
+ * blast_comms_fec_rs_encode - append check symbols to a frame
+ * @dev: the link
+ * @frame: frame buffer, encoded
+ * The check symbols cover the head sync word to the tail sync word.
+ */
+static void blast_comms_fec_rs_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_fec_rs *rs = dev->fec_priv;
+	u16 par[BLAST_COMMS_RS_NROOTS];
+	u8 *check;
+	int i;
+
+	memset(par, 0, sizeof(par));
+	mutex_lock(&rs->lock);
+	encode_rs8(rs->rs, &frame->wire[BLAST_COMMS_WIRE_SYNC],
+				BLAST_COMMS_RS_LEN(frame->wire_len), par, 0);
+	mutex_unlock(&rs->lock);
+
+	check = &frame->wire[frame->wire_len];
+	for (i = 0; i < BLAST_COMMS_RS_NROOTS; i++)
+		check[i] = par[i];
+
+	frame->wire_len += BLAST_COMMS_RS_NROOTS;
+}
+
+/**
+ * blast_comms_fec_rs_decode - correct a frame and strip its check symbols
+ * @dev: the link
+ * @frame: frame buffer, as received
+ * Up to BLAST_COMMS_RS_NROOTS / 2 bad bytes are corrected in place.
+ */
+static int blast_comms_fec_rs_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_fec_rs *rs = dev->fec_priv;
+	u16 par[BLAST_COMMS_RS_NROOTS];
+	u8 *check;
+	int result;
+	int i;
+
+	if (frame->wire_len < BLAST_COMMS_WIRE_SYNC + BLAST_COMMS_RS_NROOTS)
+		return -EINVAL;
+
+	frame->wire_len -= BLAST_COMMS_RS_NROOTS;
+
+	check = &frame->wire[frame->wire_len];
+	for (i = 0; i < BLAST_COMMS_RS_NROOTS; i++)
+		par[i] = check[i];
+
+	mutex_lock(&rs->lock);
+	result = decode_rs8(rs->rs, &frame->wire[BLAST_COMMS_WIRE_SYNC], par,
+			BLAST_COMMS_RS_LEN(frame->wire_len),
+			NULL, 0, NULL, 0, NULL);
+	mutex_unlock(&rs->lock);
+
+	return result < 0 ? -EBADMSG : 0;
+}
+
+static size_t blast_comms_fec_rs_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air)
+{
+	u8 data_len = blast_comms_frame_air_data_len(air);
+
+	if (data_len > BLAST_COMMS_FRAME_DATA_LEN)
+		return 0;
+
+	return BLAST_COMMS_WIRE_LEN(data_len) + BLAST_COMMS_RS_NROOTS;
+}
+
+/**
+ * blast_comms_fec_conv_init - set up the Viterbi decoder for a link
+ * @dev: the link
+ * Tabulates the code bits for every value of the encoder's shift register
+ * (newest bit least significant), which both directions look up.
+ */
+static int blast_comms_fec_conv_init(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_conv *conv;
+	int sr;
+
+	conv = kzalloc(sizeof(struct blast_comms_conv), GFP_KERNEL);
+	if (!conv)
+		return -ENOMEM;
+
+	mutex_init(&conv->lock);
+
+	for (sr = 0; sr < 2 * BLAST_COMMS_CONV_STATES; sr++)
+		conv->sym[sr] = (hweight8(sr & BLAST_COMMS_CONV_G1) & 1) |
+			((hweight8(sr & BLAST_COMMS_CONV_G2) & 1) << 1);
+
+	dev->fec_priv = conv;
+
+	return 0;
+}
+
+/**
+ * blast_comms_fec_conv_release - free a link's Viterbi decoder
+ * @dev: the link
+ */
+static void blast_comms_fec_conv_release(struct blast_comms_link_dev *dev)
+{
+	kfree(dev->fec_priv);
+	dev->fec_priv = NULL;
+}
+
+/**
+ * blast_comms_fec_conv_encode - convolutionally code a frame
+ * @dev: the link
+ * @frame: frame buffer, encoded
+ */
+static void blast_comms_fec_conv_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_conv *conv = dev->fec_priv;
+	u8 in[BLAST_COMMS_WIRE_MAX];
+	u8 *out = &frame->wire[BLAST_COMMS_WIRE_SYNC];
+	size_t len = frame->wire_len - BLAST_COMMS_WIRE_SYNC;
+	size_t i;
+	u8 sr = 0;
+	u8 sym;
+
+	/* Plus a byte of zeros to flush the encoder */
+	memcpy(in, out, len);
+	in[len++] = 0;
+
+	memset(out, 0, 2 * len);
+
+	for (i = 0; i < 8 * len; i++) {
+		sr = ((sr << 1) | ((in[i >> 3] >> (i & 7)) & 1)) &
+					(2 * BLAST_COMMS_CONV_STATES - 1);
+		sym = conv->sym[sr];
+
+		/* Two code bits, both in the same output byte */
+		out[i >> 2] |= sym << (2 * (i & 3));
+	}
+
+	frame->wire_len = BLAST_COMMS_CONV_LEN(frame->wire_len);
+}
+
+/**
+ * blast_comms_fec_conv_decode - Viterbi decode a frame
+ * @dev: the link
+ * @frame: frame buffer, as received
+ * Always produces a frame; the CRC decides whether it was right.
+ */
+static int blast_comms_fec_conv_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_conv *conv = dev->fec_priv;
+	u8 out[BLAST_COMMS_WIRE_MAX];
+	size_t len;
+
+	if (frame->wire_len < BLAST_COMMS_CONV_LEN(BLAST_COMMS_WIRE_LEN(0)) ||
+			(frame->wire_len - BLAST_COMMS_WIRE_SYNC) & 1)
+		return -EINVAL;
+
+	len = (frame->wire_len - BLAST_COMMS_WIRE_SYNC) / 2;
+
+	mutex_lock(&conv->lock);
+	blast_comms_viterbi(conv, &frame->wire[BLAST_COMMS_WIRE_SYNC], out,
+								len, 1);
+	mutex_unlock(&conv->lock);
+
+	/* Drop the flush byte */
+	len--;
+	memcpy(&frame->wire[BLAST_COMMS_WIRE_SYNC], out, len);
+	frame->wire_len = BLAST_COMMS_WIRE_SYNC + len;
+
+	return 0;
+}
+
+/**
+ * blast_comms_fec_conv_air_len - on-air length of a convolutional frame
+ * @dev: the link
+ * @air: the frame's first head_len bytes, as on air
+ * Decodes as much as the shortest frame has, which takes in the data
+ * length, without assuming the encoder has been flushed by then.
+ */
+static size_t blast_comms_fec_conv_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air)
+{
+	struct blast_comms_conv *conv = dev->fec_priv;
+	u8 in[2 * (BLAST_COMMS_WIRE_LEN(0) - BLAST_COMMS_WIRE_SYNC + 1)];
+	u8 out[sizeof(in) / 2];
+	u8 data_len;
+
+	memcpy(in, &air[BLAST_COMMS_WIRE_SYNC], sizeof(in));
+	bitrev8_words(in, sizeof(in));
+
+	mutex_lock(&conv->lock);
+	blast_comms_viterbi(conv, in, out, sizeof(out), 0);
+	mutex_unlock(&conv->lock);
+
+	data_len = out[BLAST_COMMS_WIRE_DLEN - BLAST_COMMS_WIRE_SYNC];
+	if (data_len > BLAST_COMMS_CONV_DATA_MAX)
+		return 0;
+
+	return BLAST_COMMS_CONV_LEN(BLAST_COMMS_WIRE_LEN(data_len));
+}
+
+/**
+ * blast_comms_viterbi - hard decision Viterbi decoder
+ * @conv: decoder state (lock held)
+ * @in: 2 * len bytes of code bits
+ * @out: len bytes decoded
+ * @len: bytes to decode
+ * @flushed: the encoder ended in state 0
+ * The add-compare-select step looks up the expected code bits of both
+ * ways into each state, and records which won as one bit of a word per
+ * step; the traceback then follows those bits back from the end.
+ */
+static void blast_comms_viterbi(struct blast_comms_conv *conv, const u8 *in,
+					u8 *out, size_t len, int flushed)
+{
+	u16 *metric = conv->metric[0];
+	u16 *next = conv->metric[1];
+	u16 *tmp;
+	u16 m0, m1;
+	u64 decision;
+	size_t i;
+	u8 rx;
+	int s, best;
+
+	if (len * 8 > BLAST_COMMS_CONV_BITS_MAX)
+		len = BLAST_COMMS_CONV_BITS_MAX / 8;
+
+	/* The encoder starts in state 0 */
+	for (s = 0; s < BLAST_COMMS_CONV_STATES; s++)
+		metric[s] = s ? 0x3FFF : 0;
+
+	for (i = 0; i < len * 8; i++) {
+		rx = (in[i >> 2] >> (2 * (i & 3))) & 3;
+		decision = 0;
+
+		for (s = 0; s < BLAST_COMMS_CONV_STATES; s++) {
+			m0 = metric[s >> 1] +
+				blast_comms_conv_dist[conv->sym[s] ^ rx];
+			m1 = metric[(s >> 1) | (BLAST_COMMS_CONV_STATES / 2)] +
+				blast_comms_conv_dist[conv->sym[s |
+					BLAST_COMMS_CONV_STATES] ^ rx];
+
+			if (m1 < m0) {
+				next[s] = m1;
+				decision |= 1ULL << s;
+			} else {
+				next[s] = m0;
+			}
+		}
+
+		conv->decision[i] = decision;
+
+		tmp = metric;
+		metric = next;
+		next = tmp;
+	}
+
+	best = 0;
+	if (!flushed)
+		for (s = 1; s < BLAST_COMMS_CONV_STATES; s++)
+			if (metric[s] < metric[best])
+				best = s;
+
+	/* Each state's newest bit is the input that led to it */
+	memset(out, 0, len);
+	s = best;
+	for (i = len * 8; i-- > 0; ) {
+		out[i >> 3] |= (s & 1) << (i & 7);
+		s = (s >> 1) | (((conv->decision[i] >> s) & 1) <<
+					(BLAST_COMMS_CONV_K - 2));
+	}
+}
+
+/* EOF */
@@ -0,0 +1,154 @@
+/**
+ * blast_comms_fec.h
+ *
+ * Forward Error Correction Schemes
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_FEC_H_
+#define _BLAST_COMMS_FEC_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/mutex.h>
+
+/*
+ * Schemes, chosen per link when it is made (blast_comms_node_ext.fec)
+ */
+#define	BLAST_COMMS_FEC_RS		0	/* Reed-Solomon, the default */
+#define	BLAST_COMMS_FEC_NONE		1	/* CRC only */
+#define	BLAST_COMMS_FEC_CONV		2	/* rate 1/2 convolutional */
+#define	BLAST_COMMS_FEC_SCHEMES		3
+
+/*
+ * Reed-Solomon code
+ * CCSDS RS(255,223): 8 bit symbols, 32 check symbols, shortened to the
+ * length of the frame from the head sync word to the tail sync word and
+ * appended to it
+ */
+#define	BLAST_COMMS_RS_SYMSIZE		8
+#define	BLAST_COMMS_RS_GFPOLY		0x187
+#define	BLAST_COMMS_RS_FCR		112
+#define	BLAST_COMMS_RS_PRIM		11
+#define	BLAST_COMMS_RS_NROOTS		32
+#define	BLAST_COMMS_RS_LEN(wire_len)	((wire_len) - BLAST_COMMS_WIRE_SYNC)
+
+/*
+ * Convolutional code
+ * CCSDS rate 1/2, constraint length 7, generators 171 and 133 (octal).
+ * Everything from the head sync word on is coded, least significant bit
+ * of each byte first, then a byte of zeros returns the encoder to state 0;
+ * the two output bits of each input bit are packed the same way, G1 first.
+ * Frames come out just over twice as long, so carry less data.
+ */
+#define	BLAST_COMMS_CONV_K		7
+#define	BLAST_COMMS_CONV_STATES		(1 << (BLAST_COMMS_CONV_K - 1))
+#define	BLAST_COMMS_CONV_G1		0x79
+#define	BLAST_COMMS_CONV_G2		0x5B
+#define	BLAST_COMMS_CONV_LEN(wire_len)	\
+		(BLAST_COMMS_WIRE_SYNC + 2 * ((wire_len) - BLAST_COMMS_WIRE_SYNC + 1))
+#define	BLAST_COMMS_CONV_DATA_MAX	\
+		((BLAST_COMMS_WIRE_MAX - BLAST_COMMS_WIRE_SYNC) / 2 - 1 -	\
+		(BLAST_COMMS_WIRE_LEN(0) - BLAST_COMMS_WIRE_SYNC))
+#define	BLAST_COMMS_CONV_BITS_MAX	\
+		(8 * ((BLAST_COMMS_WIRE_MAX - BLAST_COMMS_WIRE_SYNC) / 2))
+
+/*
+ * FEC operations
+ * Frames are laid out in frame->wire as described in blast_comms_frame.h;
+ * encode turns that into what goes on air, in place, and decode turns it
+ * back, correcting what it can.  Both work in on-air byte order but before
+ * blast_comms_frame_to_air() / after blast_comms_frame_from_air(), and
+ * leave the correlation tag alone.
+ */
+struct blast_comms_link_dev;
+struct blast_comms_frame;
+
+struct blast_comms_fec_ops {
+	int		id;		/** BLAST_COMMS_FEC_* */
+	const char	*name;
+	size_t		data_max;	/** most data a frame can carry */
+	size_t		head_len;	/** on-air bytes air_len() looks at */
+
+	/* Set up and free per link state, at open() and release() */
+	int	(*init)(struct blast_comms_link_dev *dev);
+	void	(*release)(struct blast_comms_link_dev *dev);
+
+	/* Sets frame->wire_len to the on-air length */
+	void	(*encode)(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+	/* Sets frame->wire_len back; -ve if uncorrectable */
+	int	(*decode)(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+
+	/* On-air length of a frame from its first head_len bytes, as
+	 * received (before blast_comms_frame_from_air()); 0 if damaged
+	 */
+	size_t	(*air_len)(struct blast_comms_link_dev *dev, const u8 *air);
+};
+
+/*
+ * Reed-Solomon codec, one per link
+ * Bonded radios each have a frame finder, and decode_rs8() works in the
+ * codec's own buffers, so coding is serialised.
+ */
+struct blast_comms_fec_rs {
+	struct mutex		lock;
+	struct rs_control	*rs;
+};
+
+/*
+ * Viterbi decoder state, one per link
+ * Bonded radios each have a frame finder, so decoding is serialised.
+ */
+struct blast_comms_conv {
+	struct mutex	lock;
+	u8		sym[2 * BLAST_COMMS_CONV_STATES];	/** by register */
+	u16		metric[2][BLAST_COMMS_CONV_STATES];
+	u64		decision[BLAST_COMMS_CONV_BITS_MAX];	/** by state */
+};
+
+/*
+ * Function Prototypes
+ */
+static const struct blast_comms_fec_ops *blast_comms_fec_get(int scheme);
+static int blast_comms_fec_none_init(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_none_release(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_none_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static int blast_comms_fec_none_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static size_t blast_comms_fec_none_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air);
+static int blast_comms_fec_rs_init(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_rs_release(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_rs_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static int blast_comms_fec_rs_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static size_t blast_comms_fec_rs_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air);
+static int blast_comms_fec_conv_init(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_conv_release(struct blast_comms_link_dev *dev);
+static void blast_comms_fec_conv_encode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static int blast_comms_fec_conv_decode(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame);
+static size_t blast_comms_fec_conv_air_len(struct blast_comms_link_dev *dev,
+					const u8 *air);
+static void blast_comms_viterbi(struct blast_comms_conv *conv, const u8 *in,
+					u8 *out, size_t len, int flushed);
+
+#endif /* _BLAST_COMMS_FEC_H_ */
+
+/* EOF */
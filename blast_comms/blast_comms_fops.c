@@ -23,6 +23,9 @@
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/rslib.h>
 
 /*
  * Local inclusions
@@ -37,7 +40,9 @@
 static int blast_comms_open(struct inode *inode, struct file *filp)
 {
 	struct blast_comms_link_dev *dev;  /* the link device */
+	struct blast_comms_dev *radio;	/* a receiving radio */
 	int result = 0;	/* return code */
+	int i;
 
 	/* Get the device structure */
 	dev = container_of(inode->i_cdev, struct blast_comms_link_dev, cdev);
@@ -61,44 +66,114 @@ static int blast_comms_open(struct inode *inode, struct file *filp)
 	if (!result)
 		return result;
 
-	result = kfifo_alloc(dev->rx_raw_stack, BLAST_COMMS_STACK_SIZE,
-								GFP_KERNEL);
-	if (!result)
-		goto openfail_freetxkfifo;
+	/* Each receiving radio gets its own raw stack */
+	for (i = 0; i < dev->radios && dev->rxs[i]; i++) {
+		result = kfifo_alloc(&dev->rxs[i]->rx_raw_stack,
+					BLAST_COMMS_STACK_SIZE, GFP_KERNEL);
+		if (result)
+			goto openfail_freerxkfifo;
+	}
 
 	result = kfifo_alloc(dev->read_stack, BLAST_COMMS_STACK_SIZE,
 								GFP_KERNEL);
 	if (!result)
 		goto openfail_freerxkfifo;
 
-	result = dev->tx_data_stack = blast_comms_frame_stack_alloc();
-	if (!result)
+	result = -ENOMEM;
+	dev->tx_data_stack = blast_comms_frame_stack_alloc();
+	if (!dev->tx_data_stack)
 		goto openfail_freereadkfifo;
 
-	result = dev->rx_data_stack = blast_comms_frame_stack_alloc();
-	if (!result)
+	dev->rx_data_stack = blast_comms_frame_stack_alloc();
+	if (!dev->rx_data_stack)
 		goto openfail_releasetx;
 
+	/* FEC codec state, shared by both directions */
+	result = dev->fec->init(dev);
+	if (result)
+		goto openfail_releaserx;
+
+	/* LZ4 buffers, used if compression is switched on */
+	dev->lz4 = blast_comms_lz4_alloc();
+	if (!dev->lz4) {
+		result = -ENOMEM;
+		goto openfail_releasefec;
+	}
+
+	/* Message reassembly, used if message mode is switched on */
+	dev->msg_buf = kmalloc(BLAST_COMMS_MSG_MAX, GFP_KERNEL);
+	if (!dev->msg_buf) {
+		result = -ENOMEM;
+		goto openfail_releaselz4;
+	}
+	dev->msg_len = 0;
+	dev->msg_open = 0;
+
+	/* Fountain coder, used if switched on here or at the other end */
+	dev->lt = blast_comms_lt_alloc();
+	if (!dev->lt) {
+		result = -ENOMEM;
+		goto openfail_freemsg;
+	}
+
+	/* Retransmission deadlines */
+	dev->rto = blast_comms_rto_alloc(dev);
+	if (!dev->rto) {
+		result = -ENOMEM;
+		goto openfail_releaselt;
+	}
+
 	/* Initialise locking mechanisms */
-	init_MUTEX(&dev->read_stack_sem);
-	init_MUTEX(&dev->master_sem);
+	sema_init(&dev->read_stack_sem, 1);
+	sema_init(&dev->master_sem, 1);
+	sema_init(&dev->hold_sem, 1);
 	spin_lock_init(&dev->tx_ptr_lock);
-	spin_lock_init(&dev->usb_lock);
+	spin_lock_init(&dev->tx_meta_lock);
+
+	/* Nothing held back yet */
+	dev->hold_frame = NULL;
+	dev->hold_len = 0;
+	INIT_DELAYED_WORK(&dev->hold_work, blast_comms_hold_work);
 
 	/* Reset counters */
 	atomic_set(&dev->unack, 0);
 	atomic_set(&dev->unsent, 0);
 
+	/* Both ends start their windows at 0 */
+	dev->tx_ptr = 0;
+	dev->tx_base = 0;
+	dev->rx_cum = 0;
+	dev->rx_sack = 0;
+	dev->ack_pending = 0;
+	INIT_DELAYED_WORK(&dev->ack_work, blast_comms_ack_work);
+
 	/* Fire up threads and timer list */
 	if (dev->mode & BLAST_COMMS_TX)
 		dev->transmit_thread = kthread_run(blast_comms_transmit_thread,
 					dev, "bcxmit%d", MINOR(dev->devno));
 
 	if (dev->mode & BLAST_COMMS_RX) {
-		dev->rawrecv_thread = kthread_run(blast_comms_raw_receive, dev,
-						"bcrawrx%d", MINOR(dev->devno));
-		dev->framefnd_thread = kthread_run(blast_comms_frame_finder,
-					dev, "bcfrfr%d", MINOR(dev->devno));
+		/* One frame finder per radio; they all feed rx_data_stack,
+		 * which puts the frames back in sequence order
+		 */
+		for (i = 0; i < dev->radios; i++) {
+			radio = dev->rxs[i];
+			init_waitqueue_head(&radio->framefinder_q);
+			init_waitqueue_head(&radio->receive_q);
+
+			/* Prefer the streaming receive ring; poll with GETRAM
+			 * if the firmware has no streaming endpoint
+			 */
+			if (radio->usb_ep_stream)
+				blast_comms_usb_rx_start(radio);
+			else
+				radio->rawrecv_thread = kthread_run(
+					blast_comms_raw_receive, radio,
+					"bcrawrx%d.%d", MINOR(dev->devno), i);
+			radio->framefnd_thread = kthread_run(
+					blast_comms_frame_finder, radio,
+					"bcfrfr%d.%d", MINOR(dev->devno), i);
+		}
 		dev->receive_thread = kthread_run(blast_comms_receive_thread,
 					dev, "bcrecv%d", MINOR(dev->devno));
 	}
@@ -106,25 +181,32 @@ static int blast_comms_open(struct inode *inode, struct file *filp)
 	if (dev->mode & BLAST_COMMS_RTX) {
 		dev->watchdog_thread = kthread_run(blast_comms_watchdog, dev,
 						"bcwdog%d", MINOR(dev->devno));
-		init_timer(&dev->softirq);
-		dev->softirq.expires = BLAST_COMMS_WATCHDOG_PERIOD;
-		dev->softirq.function = blast_comms_softirq;
-		dev->softirq.data = dev;
-
-		add_timer(&dev->softirq);
 	}
 
 	filp->private_data = dev;  /* for other methods */
 
 	return 0;
 
+openfail_releaselt:
+	blast_comms_lt_release(dev->lt);
+	dev->lt = NULL;
+openfail_freemsg:
+	kfree(dev->msg_buf);
+	dev->msg_buf = NULL;
+openfail_releaselz4:
+	blast_comms_lz4_release(dev->lz4);
+	dev->lz4 = NULL;
+openfail_releasefec:
+	dev->fec->release(dev);
+openfail_releaserx:
+	blast_comms_frame_stack_release(dev->rx_data_stack);
 openfail_releasetx:
 	blast_comms_frame_stack_release(dev->tx_data_stack);
 openfail_freereadkfifo:
 	kfifo_free(dev->read_stack);
 openfail_freerxkfifo:
-	kfifo_free(dev->rx_raw_stack);
-openfail_freetxkfifo:
+	for (i = 0; i < dev->radios && dev->rxs[i]; i++)
+		kfifo_free(&dev->rxs[i]->rx_raw_stack);
 	kfifo_free(dev->tx_meta_stack);
 	return result;
 }
@@ -137,10 +219,11 @@ openfail_freetxkfifo:
 static int blast_comms_release(struct inode *inode, struct file *filp)
 {
 	struct blast_comms_link_dev *dev = filp->private_data;
-	int retval = 0;
+	struct blast_comms_dev *radio;
+	int i;
 
-	if (down_interruptible(dev->master_sem)) {
-		return RESTARTSYS;
+	if (down_interruptible(&dev->master_sem)) {
+		return -ERESTARTSYS;
 	}
 
 	/* Reset Counters */
@@ -148,26 +231,97 @@ static int blast_comms_release(struct inode *inode, struct file *filp)
 	atomic_set(&dev->unsent, 0);
 
 	/* Stop threads */
-	del_timer(&dev->softirgq);
+	hrtimer_cancel(&dev->rto->timer);
 	kthread_stop(dev->receive_thread);
-	kthread_stop(dev->framefnd_thread);
-	kthread_stop(dev->rawrecv_thread);
+	for (i = 0; i < dev->radios && dev->rxs[i]; i++) {
+		radio = dev->rxs[i];
+		kthread_stop(radio->framefnd_thread);
+		if (radio->rawrecv_thread)
+			kthread_stop(radio->rawrecv_thread);
+		else
+			blast_comms_usb_rx_stop(radio);
+		radio->framefnd_thread = NULL;
+		radio->rawrecv_thread = NULL;
+	}
 	kthread_stop(dev->watchdog_thread);
 	kthread_stop(dev->transmit_thread);
 
+	/* Anything still held was pushed by flush() on close */
+	cancel_delayed_work_sync(&dev->hold_work);
+	cancel_delayed_work_sync(&dev->ack_work);
+	dev->hold_frame = NULL;
+	dev->hold_len = 0;
+
+	/* PUTRAMs may still be reading frames out of the stack */
+	for (i = 0; i < dev->radios && dev->txs[i]; i++)
+		blast_comms_usb_tx_quiesce(dev->txs[i]);
+
 	/* free stacks */
 	kfifo_free(dev->tx_meta_stack);
-	kfifo_free(dev->rx_raw_stack);
+	for (i = 0; i < dev->radios && dev->rxs[i]; i++)
+		kfifo_free(&dev->rxs[i]->rx_raw_stack);
 	kfifo_free(dev->read_stack);
 	blast_comms_frame_stack_release(dev->tx_data_stack);
 	blast_comms_frame_stack_release(dev->rx_data_stack);
 
-	/* TODO: Check correct */
-	kfree(dev->rs);
+	dev->fec->release(dev);
+	blast_comms_lz4_release(dev->lz4);
+	dev->lz4 = NULL;
+	kfree(dev->msg_buf);
+	dev->msg_buf = NULL;
+	blast_comms_lt_release(dev->lt);
+	dev->lt = NULL;
+	blast_comms_rto_release(dev->rto);
+	dev->rto = NULL;
 
 	return 0;
 }
 
+/**
+ * blast_comms_read_msg - read() in message mode
+ * @dev: the link
+ * @buf: user buffer
+ * @count: its length
+ * Blocks for the next whole message.  read_stack holds each one as a u16
+ * length and then the message, put in together by blast_comms_msg_receive.
+ * Returns the number of bytes copied; the rest of a longer message is lost.
+ */
+static ssize_t blast_comms_read_msg(struct blast_comms_link_dev *dev,
+					char __user *buf, size_t count)
+{
+	char	*kbuf;
+	u16	len;
+
+	kbuf = kmalloc(BLAST_COMMS_MSG_MAX, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	if (down_interruptible(&dev->read_stack_sem)) {
+		kfree(kbuf);
+		return -ERESTARTSYS;
+	}
+
+	if (wait_event_interruptible(dev->readers_q,
+				kfifo_len(dev->read_stack) >= sizeof(len))) {
+		up(&dev->read_stack_sem);
+		kfree(kbuf);
+		return -ERESTARTSYS;
+	}
+
+	kfifo_out(dev->read_stack, &len, sizeof(len));
+	kfifo_out(dev->read_stack, kbuf, len);
+	wake_up(&dev->decoder_q);
+
+	up(&dev->read_stack_sem);
+
+	count = min_t(size_t, count, len);
+	if (copy_to_user(buf, kbuf, count))
+		count = -EFAULT;
+	kfree(kbuf);
+
+	return count;
+}
+
 /**
  * blast_comms_read - handles the read() system call
  */
@@ -177,6 +331,9 @@ static ssize_t blast_comms_read(struct file *filp, char __user *buf,
 	struct blast_comms_link_dev *dev = filp->private_data;
 	char *kbuf;
 
+	if (dev->msg)
+		return blast_comms_read_msg(dev, buf, count);
+
 	kbuf = kmalloc(count, GFP_KERNEL);
 	if (unlikely(kbuf))
 		return -ENOMEM;
@@ -204,6 +361,7 @@ static ssize_t blast_comms_read(struct file *filp, char __user *buf,
 
 	/* Read... */
 	kfifo_out(dev->read_stack, kbuf, count);
+	wake_up(&dev->decoder_q);
 
 	up(&dev->read_stack_sem);
 
@@ -214,67 +372,443 @@ static ssize_t blast_comms_read(struct file *filp, char __user *buf,
 }
 
 /**
- * blast_comms_write - handles the write() system call
+ * blast_comms_slot_free - can the next frame go in this transmit stack slot
+ * @dev: the link
+ * @seq: the slot's sequence number
+ * Not while it is still in use, or past the ARQ window.
  */
-static ssize_t blast_comms_write(struct file *filp, char __user *buf,
-						size_t count, loff_t *f_pos)
+static int blast_comms_slot_free(struct blast_comms_link_dev *dev, u8 seq)
 {
-	struct blast_comms_link_dev *dev = filp->private_data;
-	struct blast_comms_frame frame;
+	return (dev->tx_data_stack->map[seq] == BLAST_COMMS_STACK_MAP_CLEAR) &&
+		(blast_comms_seq_diff(seq, dev->tx_base) < dev->arq_window);
+}
+
+/**
+ * blast_comms_claim_frame - claim the next transmit stack slot
+ * @dev: the link
+ * @tx_ptr: set to the slot's sequence number
+ * Sleeps while the slot is still in use.  The frame comes back built and is
+ * ours until blast_comms_queue_frame marks it ready, or
+ * blast_comms_release_frame gives it back.  The sequence number is only
+ * taken once the slot is free, so being interrupted leaves no hole.
+ */
+static struct blast_comms_frame *blast_comms_claim_frame(
+				struct blast_comms_link_dev *dev, u8 *tx_ptr)
+{
+	struct blast_comms_frame *frame;
+
+	for (;;) {
+		/* Sleep - stack full, or past the ARQ window! */
+		if (wait_event_interruptible(dev->writers_q,
+				blast_comms_slot_free(dev, dev->tx_ptr)))
+			return NULL;
+
+		/* Claim the next sequence number, if no one beat us to it */
+		spin_lock(&dev->tx_ptr_lock);
+		if (blast_comms_slot_free(dev, dev->tx_ptr)) {
+			*tx_ptr = dev->tx_ptr;
+			dev->tx_ptr = (*tx_ptr + 1) % \
+					(BLAST_COMMS_FRAME_SEQNUM_LIM + 1);
+			spin_unlock(&dev->tx_ptr_lock);
+			break;
+		}
+		spin_unlock(&dev->tx_ptr_lock);
+	}
+
+	frame = &dev->tx_data_stack->frame[*tx_ptr];
+	blast_comms_build_frame(dev, frame);
+
+	return frame;
+}
+
+/**
+ * blast_comms_release_frame - give back a claimed frame that won't be sent
+ * @dev: the link
+ * @frame: frame from blast_comms_claim_frame
+ * @tx_ptr: its sequence number
+ * The sequence number is taken back if no one has claimed one since;
+ * otherwise the frame goes with no data, so the receiver isn't left
+ * waiting for it.
+ */
+static void blast_comms_release_frame(struct blast_comms_link_dev *dev,
+				struct blast_comms_frame *frame, u8 tx_ptr)
+{
+	spin_lock(&dev->tx_ptr_lock);
+	if (dev->tx_ptr == (tx_ptr + 1) % (BLAST_COMMS_FRAME_SEQNUM_LIM + 1)) {
+		dev->tx_ptr = tx_ptr;
+		spin_unlock(&dev->tx_ptr_lock);
+		wake_up_interruptible(&dev->writers_q);
+		return;
+	}
+	spin_unlock(&dev->tx_ptr_lock);
+
+	blast_comms_queue_frame(dev, frame, tx_ptr, 0);
+}
+
+/**
+ * blast_comms_queue_frame - hand a filled frame to the transmit thread
+ * @dev: the link
+ * @frame: frame from blast_comms_claim_frame, data filled in
+ * @tx_ptr: its sequence number
+ * @len: its data length
+ */
+static void blast_comms_queue_frame(struct blast_comms_link_dev *dev,
+				struct blast_comms_frame *frame, u8 tx_ptr,
+				size_t len)
+{
+	frame->data_len = len;
+	blast_comms_finalise_frame(dev, frame, tx_ptr);
+
+	spin_lock(&dev->tx_data_stack->lock);
+		dev->tx_data_stack->map[tx_ptr] = \
+				BLAST_COMMS_STACK_MAP_READY;
+	spin_unlock(&dev->tx_data_stack->lock);
+
+	atomic_inc(&dev->unsent);
+	wake_up(&dev->transmit_q);
+}
+
+/**
+ * blast_comms_write_lz4 - write() with compression on
+ * @dev: the link
+ * @buf: user data
+ * @count: its length
+ * The data is compressed a block at a time, as part of the link's one
+ * stream, and each block chopped into frames of its own (see
+ * blast_comms_lz4.h).  Returns the number of user bytes taken, in whole
+ * blocks if interrupted.
+ */
+static ssize_t blast_comms_write_lz4(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count)
+{
+	struct blast_comms_lz4 *lz = dev->lz4;
+	struct blast_comms_frame *frame;
+	size_t raw, block, off, len;
 	ssize_t c = 0;
 	u8	tx_ptr;
-	char *data;
-	char *data_head;
 
-	data =  = kmalloc(count, GFP_KERNEL);
-	if (unlikely(!data))
-		return -ENOMEM;
+	if (down_interruptible(&lz->tx_sem))
+		return -ERESTARTSYS;
+
+	while (count > 0) {
+		raw = min_t(size_t, count, BLAST_COMMS_LZ4_BLOCK);
+
+		if (copy_from_user(blast_comms_lz4_raw(lz), buf + c, raw)) {
+			up(&lz->tx_sem);
+			return c ? c : -EFAULT;
+		}
+
+		block = blast_comms_lz4_compress(lz, raw);
+
+		for (off = 0; off < block; off += len) {
+			len = min_t(size_t, block - off,
+						blast_comms_data_max(dev));
+
+			/* Interrupted part way through a block: the receiver
+			 * drops the part it gets when the next block starts,
+			 * so that one mustn't refer back to it
+			 */
+			frame = blast_comms_claim_frame(dev, &tx_ptr);
+			if (!frame) {
+				blast_comms_lz4_restart(lz);
+				goto out;
+			}
+
+			memcpy(frame->data, &lz->tx_block[off], len);
+			frame->ctl |= BLAST_COMMS_FRAME_CTL_LZ4;
+			if (off == 0)
+				frame->ctl |= BLAST_COMMS_FRAME_CTL_LZ4_START;
+			blast_comms_queue_frame(dev, frame, tx_ptr, len);
+		}
+
+		c += raw;
+		count -= raw;
 	}
 
-	data_head = data;
+out:
+	up(&lz->tx_sem);
 
-	copy_from_user(data, buf, count);
+	if (c == 0 && count > 0)
+		return -ERESTARTSYS;
+
+	return c;
+}
+
+/**
+ * blast_comms_hold_push - send the frame held back for more data
+ * @dev: the link (hold_sem held)
+ */
+static void blast_comms_hold_push(struct blast_comms_link_dev *dev)
+{
+	if (!dev->hold_frame)
+		return;
+
+	blast_comms_queue_frame(dev, dev->hold_frame, dev->hold_ptr,
+							dev->hold_len);
+	dev->hold_frame = NULL;
+	dev->hold_len = 0;
+
+	cancel_delayed_work(&dev->hold_work);
+}
+
+/**
+ * blast_comms_hold_work - the held frame has waited long enough
+ * @work: the link's hold_work
+ */
+static void blast_comms_hold_work(struct work_struct *work)
+{
+	struct blast_comms_link_dev *dev = container_of(to_delayed_work(work),
+				struct blast_comms_link_dev, hold_work);
+
+	down(&dev->hold_sem);
+	blast_comms_hold_push(dev);
+	up(&dev->hold_sem);
+}
+
+/**
+ * blast_comms_push - send anything held back now
+ * @dev: the link
+ * For the flush ioctl, fsync() and close().
+ */
+static int blast_comms_push(struct blast_comms_link_dev *dev)
+{
+	if (down_interruptible(&dev->hold_sem))
+		return -ERESTARTSYS;
+
+	blast_comms_hold_push(dev);
+
+	up(&dev->hold_sem);
+
+	return 0;
+}
+
+/**
+ * blast_comms_write_coalesce - write() with small write coalescing on
+ * @dev: the link
+ * @buf: user data
+ * @count: its length
+ * Data is added to a held frame, which is sent when it is full or
+ * coalesce_ms after it was started, whichever is first (see
+ * BLAST_COMMS_IOCTCOALESCE).  The frame already has its slot in the
+ * transmit stack, so later writes can't overtake it.
+ */
+static ssize_t blast_comms_write_coalesce(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count)
+{
+	size_t len;
+	ssize_t c = 0;
+	u8	tx_ptr;
+
+	if (down_interruptible(&dev->hold_sem))
+		return -ERESTARTSYS;
 
 	while (count > 0) {
-		blast_comms_build_frame(dev, &frame);
-
-		if (count < BLAST_COMMS_FRAME_DATA_LEN) {
-			memcpy(frame.data, data, count);
-			frame.data_len = count;
-			c += count;
-			count = 0;
-		} else {
-			memcpy(frame.data, data, BLAST_COMMS_FRAME_DATA_LEN);
-			data += BLAST_COMMS_FRAME_DATA_LEN;
-			frame.data_len = BLAST_COMMS_FRAME_DATA_LEN;
-			c += BLAST_COMMS_FRAME_DATA_LEN;
-			count -= BLAST_COMMS_FRAME_DATA_LEN;
+		if (!dev->hold_frame) {
+			dev->hold_frame = blast_comms_claim_frame(dev, &tx_ptr);
+			if (!dev->hold_frame) {
+				if (!c)
+					c = -ERESTARTSYS;
+				break;
+			}
+
+			dev->hold_ptr = tx_ptr;
+			dev->hold_len = 0;
+			schedule_delayed_work(&dev->hold_work,
+					msecs_to_jiffies(dev->coalesce_ms));
 		}
 
-		spin_lock(&dev->tx_ptr_lock);
-			tx_ptr = dev->tx_ptr;
-		spin_unlock(&dev->tx_ptr_lock);
+		len = min_t(size_t, count,
+				blast_comms_data_max(dev) - dev->hold_len);
+
+		if (copy_from_user(&dev->hold_frame->data[dev->hold_len],
+							buf + c, len)) {
+			/* Nothing in the frame yet, so don't send it */
+			if (!dev->hold_len) {
+				cancel_delayed_work(&dev->hold_work);
+				blast_comms_release_frame(dev, dev->hold_frame,
+								dev->hold_ptr);
+				dev->hold_frame = NULL;
+			}
+			if (!c)
+				c = -EFAULT;
+			break;
+		}
+
+		dev->hold_len += len;
+		c += len;
+		count -= len;
+
+		if (dev->hold_len == blast_comms_data_max(dev))
+			blast_comms_hold_push(dev);
+	}
+
+	up(&dev->hold_sem);
+
+	return c;
+}
+
+/**
+ * blast_comms_write_msg - write() in message mode
+ * @dev: the link
+ * @buf: user data, one message
+ * @count: its length, at most BLAST_COMMS_MSG_MAX
+ * All or nothing: if interrupted part way the frames already queued still
+ * go, and the receiver drops them when the next message starts.
+ */
+static ssize_t blast_comms_write_msg(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count)
+{
+	struct blast_comms_frame *frame;
+	size_t c = 0;
+	size_t len;
+	u8	tx_ptr;
 
-		blast_comms_finalise_frame(dev, &frame, tx_ptr);
+	if (count > BLAST_COMMS_MSG_MAX)
+		return -EMSGSIZE;
 
-		/* Sleep - stack full! */
-		if (dev->tx_data_stack.map[tx_ptr] != \
-						BLAST_COMMS_STACK_MAP_CLEAR)
-			wait_event_interruptible(dev->writers_q,
-					dev->tx_data_stack.map[tx_ptr] == \
-						BLAST_COMMS_STACK_MAP_CLEAR);
+	/* Keep other writers' frames out of the middle of the message */
+	if (down_interruptible(&dev->master_sem))
+		return -ERESTARTSYS;
+
+	for (;;) {
+		len = min_t(size_t, count - c, blast_comms_data_max(dev));
 
-		spin_lock(&dev->tx_data_stack.lock);
-			memcpy(&dev->tx_data_stack.frame[tx_ptr], &frame,
-					sizeof(struct blast_comms_frame));
-			dev->tx_data_stack.map[tx_ptr] = \
-					BLAST_COMMS_STACK_MAP_READY;
-		spin_unlock(&dev->tx_data_stack.lock);
+		frame = blast_comms_claim_frame(dev, &tx_ptr);
+		if (!frame) {
+			up(&dev->master_sem);
+			return -ERESTARTSYS;
+		}
 
-		wake_up(transmit_q);
+		if (copy_from_user(frame->data, buf + c, len)) {
+			/* Left unfinished, so the receiver drops it */
+			blast_comms_release_frame(dev, frame, tx_ptr);
+			up(&dev->master_sem);
+			return -EFAULT;
+		}
+
+		if (c == 0)
+			frame->ctl |= BLAST_COMMS_FRAME_CTL_FIRST;
+		c += len;
+		if (c == count)
+			frame->ctl |= BLAST_COMMS_FRAME_CTL_LAST;
+
+		blast_comms_queue_frame(dev, frame, tx_ptr, len);
+
+		if (c == count)
+			break;
 	}
 
-	kfree(data_head);
+	up(&dev->master_sem);
+
+	return c;
+}
+
+/**
+ * blast_comms_write_lt - write() with fountain coding on
+ * @dev: the link
+ * @buf: user data, one source block
+ * @count: its length, at most BLAST_COMMS_LT_K_MAX symbols
+ * Waits until the block before has had its share of the air (see
+ * BLAST_COMMS_IOCTFOUNTAIN), then hands this one to the transmit thread,
+ * which sends it until the next write or BLAST_COMMS_IOCFOUNTAINSTOP.
+ */
+static ssize_t blast_comms_write_lt(struct blast_comms_link_dev *dev,
+					const char __user *buf, size_t count)
+{
+	struct blast_comms_lt *lt = dev->lt;
+	size_t sym = dev->fec->data_max - BLAST_COMMS_LT_HDRLEN;
+
+	if (count == 0)
+		return 0;
+
+	if (count > BLAST_COMMS_LT_K_MAX * sym)
+		return -EMSGSIZE;
+
+	for (;;) {
+		if (wait_event_interruptible(dev->writers_q,
+					!lt->tx_active ||
+					lt->tx_sent >= lt->tx_min))
+			return -ERESTARTSYS;
+
+		mutex_lock(&lt->tx_lock);
+		if (!lt->tx_active || lt->tx_sent >= lt->tx_min)
+			break;
+		mutex_unlock(&lt->tx_lock);
+	}
+
+	if (copy_from_user(lt->tx_block, buf, count)) {
+		lt->tx_active = 0;
+		mutex_unlock(&lt->tx_lock);
+		return -EFAULT;
+	}
+
+	blast_comms_lt_load(lt, sym, count, dev->lt_overhead);
+
+	mutex_unlock(&lt->tx_lock);
+
+	wake_up(&dev->transmit_q);
+
+	return count;
+}
+
+/**
+ * blast_comms_lt_stop - stop sending the current fountain block
+ * @dev: the link
+ */
+static void blast_comms_lt_stop(struct blast_comms_link_dev *dev)
+{
+	mutex_lock(&dev->lt->tx_lock);
+	dev->lt->tx_active = 0;
+	mutex_unlock(&dev->lt->tx_lock);
+
+	wake_up_interruptible(&dev->writers_q);
+}
+
+/**
+ * blast_comms_write - handles the write() system call
+ * Each frame is built in its own transmit stack slot and the user data is
+ * copied straight into it.  finalise() then serializes it into the frame's
+ * wire bytes, beside it in the slot, which the USB controller reads from
+ * the stack itself where it can (see blast_comms_pic_tx_write_sg).
+ */
+static ssize_t blast_comms_write(struct file *filp, const char __user *buf,
+						size_t count, loff_t *f_pos)
+{
+	struct blast_comms_link_dev *dev = filp->private_data;
+	struct blast_comms_frame *frame;
+	ssize_t c = 0;
+	size_t len;
+	u8	tx_ptr;
+
+	if (dev->lt_overhead)
+		return blast_comms_write_lt(dev, buf, count);
+
+	if (dev->msg)
+		return blast_comms_write_msg(dev, buf, count);
+
+	if (dev->compress)
+		return blast_comms_write_lz4(dev, buf, count);
+
+	if (dev->coalesce_ms)
+		return blast_comms_write_coalesce(dev, buf, count);
+
+	while (count > 0) {
+		len = min_t(size_t, count, blast_comms_data_max(dev));
+
+		frame = blast_comms_claim_frame(dev, &tx_ptr);
+		if (!frame)
+			return c ? c : -ERESTARTSYS;
+
+		if (copy_from_user(frame->data, buf + c, len)) {
+			blast_comms_release_frame(dev, frame, tx_ptr);
+			return c ? c : -EFAULT;
+		}
+
+		blast_comms_queue_frame(dev, frame, tx_ptr, len);
+
+		c += len;
+		count -= len;
+	}
 
 	return c;
 }
@@ -282,11 +816,15 @@ static ssize_t blast_comms_write(struct file *filp, char __user *buf,
 /**
  * blast_comms_ioctl - handles ioctl() system call.
  */
-static int blast_comms_ioctl(struct inode *inode, struct file *filp,
-					unsigned int cmd, unsigned long arg)
+static long blast_comms_ioctl(struct file *filp, unsigned int cmd,
+							unsigned long arg)
 {
-	struct blast_comms_dev *dev = filp->private_data;
+	struct blast_comms_link_dev *link = filp->private_data;
+	/* the radio settings of the first radio, transmitting if any */
+	struct blast_comms_dev *dev = link->tx ? link->tx : link->rx;
 	double freq = 0.0;
+	int result = 0;
+	int i;
 
 	/* Execute command */
 	switch (cmd) {
@@ -301,12 +839,17 @@ static int blast_comms_ioctl(struct inode *inode, struct file *filp,
 			return -EPERM;
 
 		__get_user(freq, (double __user *)arg);
-		return blast_comms_rfm_frequency(dev->tx, freq);
+
+		/* bonded radios follow, one channel apart */
+		for (i = 0; i < link->radios && !result; i++)
+			result = blast_comms_rfm_frequency(link->txs[i],
+						freq + i * link->spacing);
+		return result;
 		break;
 
 	case BLAST_COMMS_IOCGTXFREQ:
 		/* Get transmit frequency */
-		return __put_user(dev->tx->freq, (double __user *)arg);
+		return __put_user(link->tx->freq, (double __user *)arg);
 		break;
 
 	case BLAST_COMMS_IOCSRXFREQ:
@@ -315,12 +858,16 @@ static int blast_comms_ioctl(struct inode *inode, struct file *filp,
 			return -EPERM;
 
 		__get_user(freq, (double __user *)arg);
-		return blast_comms_rfm_frequency(dev->rx, freq);
+
+		for (i = 0; i < link->radios && !result; i++)
+			result = blast_comms_rfm_frequency(link->rxs[i],
+						freq + i * link->spacing);
+		return result;
 		break;
 
 	case BLAST_COMMS_IOCGRXFREQ:
 		/* Get receive frequency */
-		return __put_user(dev->rx->freq, (double __user *)arg);
+		return __put_user(link->rx->freq, (double __user *)arg);
 		break;
 
 
@@ -342,7 +889,7 @@ static int blast_comms_ioctl(struct inode *inode, struct file *filp,
 		if (!capable(CAP_SYS_ADMIN)) {
 			return -EPERM;
 		}
-		blast_comms_rfm_datarate(dev, (int)arg);
+		blast_comms_rfm_bitrate(dev, (int)arg);
 		break;
 	case BLAST_COMMS_IOCQDR:
 		return dev->bitrate;
@@ -356,9 +903,171 @@ static int blast_comms_ioctl(struct inode *inode, struct file *filp,
 	case BLAST_COMMS_IOCQPRELEN:
 		return dev->preamble_len;
 		break;
+	case BLAST_COMMS_IOCTCOMPRESS:
+		/* Compress what is written from now on; each write() would
+		 * be a block, in frames of its own, so not with coalescing
+		 */
+		if (arg && link->coalesce_ms)
+			return -EINVAL;
+		link->compress = !!arg;
+		break;
+	case BLAST_COMMS_IOCQCOMPRESS:
+		return link->compress;
+		break;
+	case BLAST_COMMS_IOCTILV:
+		/* Interleave groups of this many frames, 0 or 1 for none */
+		if (arg > BLAST_COMMS_ILV_MAX)
+			return -EINVAL;
+		link->ilv_depth = arg;
+		break;
+	case BLAST_COMMS_IOCQILV:
+		return link->ilv_depth;
+		break;
+	case BLAST_COMMS_IOCTSYNCDIST:
+		/* Bit errors to allow in a correlation tag */
+		if (arg > BLAST_COMMS_SYNC_DIST_MAX)
+			return -EINVAL;
+		link->sync_dist = arg;
+		break;
+	case BLAST_COMMS_IOCQSYNCDIST:
+		return link->sync_dist;
+		break;
+	case BLAST_COMMS_IOCQFEC:
+		/* Fixed when the link was made */
+		return link->fec->id;
+		break;
+	case BLAST_COMMS_IOCTCOALESCE:
+		/* Hold small writes up to this long, 0 for not at all */
+		if (arg > BLAST_COMMS_COALESCE_MAX)
+			return -EINVAL;
+		if (arg && link->compress)
+			return -EINVAL;
+		link->coalesce_ms = arg;
+		if (!arg)
+			return blast_comms_push(link);
+		break;
+	case BLAST_COMMS_IOCQCOALESCE:
+		return link->coalesce_ms;
+		break;
+	case BLAST_COMMS_IOCTMSG:
+		/* Anything waiting to be read was in the old format */
+		if (down_interruptible(&link->read_stack_sem))
+			return -ERESTARTSYS;
+		link->msg = !!arg;
+		kfifo_reset(link->read_stack);
+		up(&link->read_stack_sem);
+		break;
+	case BLAST_COMMS_IOCQMSG:
+		return link->msg;
+		break;
+	case BLAST_COMMS_IOCTFOUNTAIN:
+		/* Fountain code what is written from now on, sending this
+		 * many percent more symbols than each block has before the
+		 * next may replace it; 0 for off
+		 */
+		if (arg > BLAST_COMMS_LT_OVERHEAD_MAX)
+			return -EINVAL;
+		/* One way only: its frames aren't ACKed, and would upset
+		 * selective repeat on a link that has it
+		 */
+		if (arg && link->mode == BLAST_COMMS_RTX)
+			return -EINVAL;
+		link->lt_overhead = arg;
+		if (!arg)
+			blast_comms_lt_stop(link);
+		break;
+	case BLAST_COMMS_IOCQFOUNTAIN:
+		return link->lt_overhead;
+		break;
+	case BLAST_COMMS_IOCFOUNTAINSTOP:
+		blast_comms_lt_stop(link);
+		break;
+	case BLAST_COMMS_IOCTACKDELAY:
+		/* Wait this long for a data frame to carry an ACK */
+		if (arg > BLAST_COMMS_ACK_DELAY_MAX)
+			return -EINVAL;
+		link->ack_delay_ms = arg;
+		break;
+	case BLAST_COMMS_IOCQACKDELAY:
+		return link->ack_delay_ms;
+		break;
+	case BLAST_COMMS_IOCTRTO:
+		/* Send frames again this long after, if not ACKed */
+		if (arg < BLAST_COMMS_RTO_MIN || arg > BLAST_COMMS_RTO_MAX)
+			return -EINVAL;
+		spin_lock(&link->tx_data_stack->lock);
+		link->rto_ms = arg;
+		blast_comms_rto_restart(link);
+		spin_unlock(&link->tx_data_stack->lock);
+		break;
+	case BLAST_COMMS_IOCQRTO:
+		return link->rto_ms;
+		break;
+	case BLAST_COMMS_IOCFLUSH:
+		/* Send anything held back now */
+		return blast_comms_push(link);
+		break;
 	default:
 		return -EINVAL;
 	}
+
+	return 0;
 }
 
+/**
+ * blast_comms_fsync - handles the fsync() system call
+ * Sends anything held back for coalescing; it doesn't wait for it to be
+ * acknowledged.
+ */
+static int blast_comms_fsync(struct file *filp, loff_t start, loff_t end,
+								int datasync)
+{
+	return blast_comms_push(filp->private_data);
+}
+
+/**
+ * blast_comms_flush - called on every close() of a node
+ */
+static int blast_comms_flush(struct file *filp, fl_owner_t id)
+{
+	struct blast_comms_link_dev *dev = filp->private_data;
+
+	if (!(filp->f_mode & FMODE_WRITE))
+		return 0;
+
+	return blast_comms_push(dev);
+}
+
+/**
+ * THE file operations VFTs for the nodes, by mode
+ */
+struct file_operations blast_comms_rx_fops = {
+	.owner = THIS_MODULE,
+	.open = blast_comms_open,
+	.release = blast_comms_release,
+	.read = blast_comms_read,
+	.unlocked_ioctl = blast_comms_ioctl
+};
+
+struct file_operations blast_comms_tx_fops = {
+	.owner = THIS_MODULE,
+	.open = blast_comms_open,
+	.release = blast_comms_release,
+	.write = blast_comms_write,
+	.unlocked_ioctl = blast_comms_ioctl,
+	.fsync = blast_comms_fsync,
+	.flush = blast_comms_flush
+};
+
+struct file_operations blast_comms_rtx_fops = {
+	.owner = THIS_MODULE,
+	.open = blast_comms_open,
+	.release = blast_comms_release,
+	.read = blast_comms_read,
+	.write = blast_comms_write,
+	.unlocked_ioctl = blast_comms_ioctl,
+	.fsync = blast_comms_fsync,
+	.flush = blast_comms_flush
+};
+
 /* EOF */
@@ -23,9 +23,12 @@
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/errno.h>
-#include <linux/crc-ccitt.h>
-#include <linux/rslib.h>
 #include <linux/spinlock.h>
+#include <linux/bitrev.h>
+#include <linux/bitops.h>
+#include <linux/swab.h>
+#include <linux/kfifo.h>
+#include <asm/unaligned.h>
 
 /*
  * Local inclusions
@@ -37,7 +40,7 @@
  * @dev: device to use configuration
  * @buf: frame buffer
  */
-static void blast_comms_build_frame(struct blast_comms_dev *dev,
+static void blast_comms_build_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf)
 {
 	/* Clear out buf */
@@ -49,28 +52,46 @@ static void blast_comms_build_frame(struct blast_comms_dev *dev,
 	buf->head_sync_word = BLAST_COMMS_FRAME_SYNCWORD;
 	/*memcpy(buf->dest, dev->dest_addr, BLAST_COMMS_ADDR_LEN);*/
 	/*memcpy(buf->src, dev->src_addr, BLAST_COMMS_ADDR_LEN);*/
-	/*buf->ctl = BLAST_COMMS_DATA_FRAME;	/* default to data frame */
-	/*buf->pid = BLAST_COMMS_FRAME_PID;*/
+	buf->ctl = BLAST_COMMS_DATA_FRAME;	/* default to data frame */
+	buf->pid = BLAST_COMMS_FRAME_PID;
 	buf->data_len = BLAST_COMMS_FRAME_DATA_LEN;
 	buf->tail_sync_word = BLAST_COMMS_FRAME_SYNCWORD;
 }
 
+/**
+ * blast_comms_data_max - most data a data frame can carry
+ * @dev: the link
+ * Less room on a BLAST_COMMS_RTX link, to piggyback ACKs.
+ */
+static size_t blast_comms_data_max(struct blast_comms_link_dev *dev)
+{
+	if (dev->mode == BLAST_COMMS_RTX)
+		return dev->fec->data_max - BLAST_COMMS_ARQ_ACK_LEN;
+
+	return dev->fec->data_max;
+}
+
 /**
  * blast_comms_build_ack_frame - build an ACK meta frame
  * @dev: device to use configuration
  * @buf: frame buffer
- * @seqnum: sequence number
+ * @seqnum: first sequence number not yet received
+ * @sack: frames received after it (see BLAST_COMMS_ARQ_WINDOW)
+ * Meta frames are finalised here, ready to send.
  */
-static void blast_comms_build_ack_frame(struct blast_comms_dev *dev,
+static void blast_comms_build_ack_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf,
-						u8 seqnum)
+						u8 seqnum, u64 sack)
 {
 	/* Build empty frame */
 	blast_comms_build_frame(dev, buf);
 
-	/* Make ACK frame */
-	/*buf->ctl = BLAST_COMMS_ACK_FRAME;*/
-	/*buf->seq_num = seqnum;*/
+	/* Make ACK frame, which carries the SACK bitmap */
+	buf->ctl = BLAST_COMMS_ACK_FRAME;
+	buf->data_len = BLAST_COMMS_ARQ_SACK_LEN;
+	put_unaligned_le64(sack, buf->data);
+
+	blast_comms_finalise_frame(dev, buf, seqnum);
 }
 
 /**
@@ -78,17 +99,42 @@ static void blast_comms_build_ack_frame(struct blast_comms_dev *dev,
  * @dev: device to use configuration
  * @buf: frame buffer
  * @seqnum: sequence number
+ * Meta frames are finalised here, ready to send.
  */
-static void blast_comms_build_nack_frame(struct blast_comms_dev *dev,
+static void blast_comms_build_nack_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf,
 						u8 seqnum)
 {
 	/* Build empty frame */
 	blast_comms_build_frame(dev, buf);
 
-	/* Make NACK frame */
-	/*buf->ctl = BLAST_COMMS_NACK_FRAME;*/
-	/*buf->seq_num = seqnum;*/
+	/* Make NACK frame, which carries no data */
+	buf->ctl = BLAST_COMMS_NACK_FRAME;
+	buf->data_len = 0;
+
+	blast_comms_finalise_frame(dev, buf, seqnum);
+}
+
+/**
+ * blast_comms_frame_fcs - frame check sequence of a frame's fields
+ * @frame: frame buffer
+ * Covers ctl to the end of the data, as they are laid out on the wire.
+ */
+static u16 blast_comms_frame_fcs(const struct blast_comms_frame *frame)
+{
+	u8 data_len = frame->data_len;
+	u16 crc;
+
+	crc = blast_comms_crc_init();
+	/*crc = blast_comms_crc_update(crc, frame->dest, BLAST_COMMS_ADDR_LEN);
+	crc = blast_comms_crc_update(crc, frame->src, BLAST_COMMS_ADDR_LEN);*/
+	crc = blast_comms_crc_update(crc, &frame->ctl, sizeof(u8));
+	crc = blast_comms_crc_update(crc, &frame->pid, sizeof(u8));
+	crc = blast_comms_crc_update(crc, &frame->seq_num, sizeof(u8));
+	crc = blast_comms_crc_update(crc, &data_len, sizeof(u8));
+	crc = blast_comms_crc_update(crc, frame->data, frame->data_len);
+
+	return blast_comms_crc_final(crc);
 }
 
 /**
@@ -96,62 +142,247 @@ static void blast_comms_build_nack_frame(struct blast_comms_dev *dev,
  * @dev: device to use configuration
  * @frame: frame buffer
  * @seqnum: sequence number
+ * Leaves the frame ready to send in frame->wire, coded with the link's
+ * FEC scheme.
  */
-static void blast_comms_finalise_frame(struct blast_comms_dev *dev,
+static void blast_comms_finalise_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *frame,
 						u8 seqnum)
 {
-	u16 crc = 0;
-
-	/*frame->seq_num = seqnum;*/
+	frame->seq_num = seqnum;
 
 	/* do CRC work */
-	/*crc = crc_ccitt(~0, (char *)frame->dest, BLAST_COMMS_ADDR_LEN);
-	crc = crc_ccitt(crc, (char *)frame->src, BLAST_COMMS_ADDR_LEN);
-	crc = crc_ccitt(crc, &frame->ctl, sizeof(u8));
-	crc = crc_ccitt(crc, &frame->pid, sizeof(u8));
-	crc = crc_ccitt(crc, &frame->seq_num, sizeof(u8));*/
-	/*crc = crc_ccitt(crc, &frame->data_len, sizeof(u16));*/
-	crc = crc_ccitt(~0, &frame->data_len, sizeof(u16));
-	crc = crc_ccitt(crc, frame->data, BLAST_COMMS_FRAME_DATA_LEN);
+	frame->fcs = blast_comms_frame_fcs(frame);
 
-	bitflip((u8 *)&crc, sizeof(u16));
+	blast_comms_frame_encode(frame);
 
-	frame->fcs = crc;
+	/* do FEC work */
+	dev->fec->encode(dev, frame);
 
-	/* do RS work */
+	blast_comms_frame_to_air(frame);
 }
 
 /**
  * blast_comms_validate_frame - validate and correct a received frame
  * @dev: device to use configuration
- * @frame: frame buffer
+ * @frame: frame buffer, received into frame->wire
+ * The link's FEC scheme corrects what it can in place before the frame is
+ * decoded and its CRC checked.
  */
-static int blast_comms_validate_frame(struct blast_comms_dev *dev,
+static int blast_comms_validate_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *frame)
 {
-	u16 crc = 0;
-	/* do rs validation */
-	/* TODO */
+	if (frame->wire_len < BLAST_COMMS_WIRE_LEN(0) ||
+				frame->wire_len > BLAST_COMMS_WIRE_MAX)
+		return BLAST_COMMS_E_BADFRAME_NOSEQ;
+
+	blast_comms_frame_from_air(frame);
+
+	/* do FEC work */
+	if (dev->fec->decode(dev, frame))
+		return BLAST_COMMS_E_BADFRAME_NOSEQ;
+
+	if (blast_comms_frame_decode(frame))
+		return BLAST_COMMS_E_BADFRAME_NOSEQ;
 
 	/* do crc validation */
-	bitflip((u8 *)frame->fcs, sizeof(__u16));
-
-	/*crc = crc_ccitt(~0, (char *)frame->dest, BLAST_COMMS_ADDR_LEN);
-	crc = crc_ccitt(crc, (char *)frame->src, BLAST_COMMS_ADDR_LEN);
-	crc = crc_ccitt(crc, &frame->ctl, sizeof(u8));
-	crc = crc_ccitt(crc, &frame->pid, sizeof(u8));
-	crc = crc_ccitt(crc, &frame->seq_num, sizeof(u8));*/
-	/*crc = crc_ccitt(crc, &frame->data_len, sizeof(u16));*/
-	crc = crc_ccitt(~0, &frame->data_len, sizeof(u16));
-	crc = crc_ccitt(crc, frame->data, BLAST_COMMS_FRAME_DATA_LEN);
-
-	if (crc != frame->fcs))
+	if (blast_comms_frame_fcs(frame) != frame->fcs)
 		return BLAST_COMMS_E_BADFRAME_NOSEQ;
 
 	return frame->ctl & BLAST_COMMS_ACK_FRAME;
 }
 
+/**
+ * blast_comms_frame_encode - serialize a frame's fields into frame->wire
+ * @frame: frame buffer
+ * Lays the frame out as described in blast_comms_frame.h, before any FEC.
+ * Returns the length on the wire.
+ */
+static size_t blast_comms_frame_encode(struct blast_comms_frame *frame)
+{
+	u8 *wire = frame->wire;
+	u8 len = min_t(u16, frame->data_len, BLAST_COMMS_FRAME_DATA_LEN);
+
+	put_unaligned_le32(frame->correlation_tag[0], &wire[0]);
+	put_unaligned_le32(frame->correlation_tag[1], &wire[4]);
+	wire[BLAST_COMMS_WIRE_SYNC] = frame->head_sync_word;
+	wire[BLAST_COMMS_WIRE_CTL] = frame->ctl;
+	wire[BLAST_COMMS_WIRE_PID] = frame->pid;
+	wire[BLAST_COMMS_WIRE_SEQ] = frame->seq_num;
+	wire[BLAST_COMMS_WIRE_DLEN] = len;
+	memcpy(&wire[BLAST_COMMS_WIRE_DATA], frame->data, len);
+
+	wire += BLAST_COMMS_WIRE_DATA + len;
+	put_unaligned_le16(frame->fcs, &wire[0]);
+	wire[2] = frame->tail_sync_word;
+
+	frame->wire_len = BLAST_COMMS_WIRE_LEN(len);
+
+	return frame->wire_len;
+}
+
+/**
+ * blast_comms_frame_decode - fill in a frame's fields from frame->wire
+ * @frame: frame buffer, wire_len bytes of wire received and FEC decoded
+ * Returns 0, or -EINVAL if the lengths don't agree.
+ */
+static int blast_comms_frame_decode(struct blast_comms_frame *frame)
+{
+	u8 *wire = frame->wire;
+	u8 len = wire[BLAST_COMMS_WIRE_DLEN];
+
+	if (len > BLAST_COMMS_FRAME_DATA_LEN ||
+				frame->wire_len != BLAST_COMMS_WIRE_LEN(len))
+		return -EINVAL;
+
+	frame->correlation_tag[0] = get_unaligned_le32(&wire[0]);
+	frame->correlation_tag[1] = get_unaligned_le32(&wire[4]);
+	frame->head_sync_word = wire[BLAST_COMMS_WIRE_SYNC];
+	frame->ctl = wire[BLAST_COMMS_WIRE_CTL];
+	frame->pid = wire[BLAST_COMMS_WIRE_PID];
+	frame->seq_num = wire[BLAST_COMMS_WIRE_SEQ];
+	frame->data_len = len;
+	memcpy(frame->data, &wire[BLAST_COMMS_WIRE_DATA], len);
+
+	wire += BLAST_COMMS_WIRE_DATA + len;
+	frame->fcs = get_unaligned_le16(&wire[0]);
+	frame->tail_sync_word = wire[2];
+
+	return 0;
+}
+
+/**
+ * blast_comms_frame_to_air - put a frame's wire bytes in on-air bit order
+ * @frame: frame buffer, encoded
+ * Every field goes on air least significant bit first (ISO-3309).  The
+ * RFM23 shifts each byte out most significant bit first, so every byte
+ * after the correlation tag has its bits reversed, in one pass.  The tag
+ * is a bit pattern rather than a number and goes out as it is.
+ */
+static void blast_comms_frame_to_air(struct blast_comms_frame *frame)
+{
+	bitrev8_words(&frame->wire[BLAST_COMMS_WIRE_SYNC],
+				frame->wire_len - BLAST_COMMS_WIRE_SYNC);
+}
+
+/**
+ * blast_comms_frame_from_air - undo blast_comms_frame_to_air()
+ * @frame: frame buffer, as received
+ */
+static void blast_comms_frame_from_air(struct blast_comms_frame *frame)
+{
+	bitrev8_words(&frame->wire[BLAST_COMMS_WIRE_SYNC],
+				frame->wire_len - BLAST_COMMS_WIRE_SYNC);
+}
+
+/**
+ * blast_comms_frame_air_data_len - data length of a frame in on-air order
+ * @wire: the frame's first BLAST_COMMS_WIRE_HEAD_LEN bytes, as on air
+ * Lets the frame finder size a frame before it has all of it.
+ */
+static u8 blast_comms_frame_air_data_len(const u8 *wire)
+{
+	return bitrev8(wire[BLAST_COMMS_WIRE_DLEN]);
+}
+
+/**
+ * blast_comms_seq_diff - how far sequence number a is after b
+ */
+static u8 blast_comms_seq_diff(u8 a, u8 b)
+{
+	return (a + BLAST_COMMS_FRAME_SEQNUM_MOD - b) %
+					BLAST_COMMS_FRAME_SEQNUM_MOD;
+}
+
+/**
+ * blast_comms_frame_sync - look for a correlation tag, at any bit offset
+ * @radio: the receiving radio
+ * @sync: the search state, kept between calls
+ * @dist: most bit errors to accept in a tag
+ * The radio may slip a bit or more, so tags needn't start on a byte.  The
+ * raw bytes are taken as a bit stream, earliest bit most significant, a
+ * word at a time; each word is shifted against the last to give all 64
+ * windows ending in it, which are compared to the tags with a popcount of
+ * the difference.  At 256kbps that is 4000 words a second.
+ * Takes bytes off the raw stack up to and including the end of a tag, and
+ * leaves sync->shift at where it ended in the last of them, for
+ * blast_comms_frame_read().  Returns BLAST_COMMS_SYNC_FRAME or
+ * BLAST_COMMS_SYNC_ILV, or 0 once there is less than a word left.
+ */
+static int blast_comms_frame_sync(struct blast_comms_dev *radio,
+					struct blast_comms_sync *sync, int dist)
+{
+	const u64 frame_tag = swab64(BLAST_COMMS_FRAME_CORREL_TAG);
+	const u64 ilv_tag = swab64(BLAST_COMMS_ILV_CORREL_TAG);
+	u8	buf[sizeof(u64)];
+	u64	next, win;
+	int	tag = 0;
+	int	k, len;
+
+	while (kfifo_out_peek(&radio->rx_raw_stack, buf, sizeof(buf)) ==
+								sizeof(buf)) {
+		next = get_unaligned_be64(buf);
+
+		for (k = 1; k <= 64 && !tag; k++) {
+			win = k < 64 ? (sync->cur << k) | (next >> (64 - k)) :
+									next;
+
+			if (hweight64(win ^ frame_tag) <= dist)
+				tag = BLAST_COMMS_SYNC_FRAME;
+			else if (hweight64(win ^ ilv_tag) <= dist)
+				tag = BLAST_COMMS_SYNC_ILV;
+		}
+
+		if (!tag) {
+			kfifo_out(&radio->rx_raw_stack, buf, sizeof(buf));
+			sync->cur = next;
+			continue;
+		}
+
+		/* The tag ended k bits into this word: take the bytes it
+		 * ended in, and realign what follows by the remainder
+		 */
+		k--;
+		len = DIV_ROUND_UP(k, 8);
+		sync->shift = k % 8;
+
+		kfifo_out(&radio->rx_raw_stack, buf, len);
+		sync->cur = len < sizeof(u64) ?
+				(sync->cur << (8 * len)) |
+					(next >> (64 - 8 * len)) : next;
+
+		return tag;
+	}
+
+	return 0;
+}
+
+/**
+ * blast_comms_frame_read - take bytes that follow a tag
+ * @radio: the receiving radio
+ * @sync: the search state, locked on by blast_comms_frame_sync()
+ * @buf: buffer to read to
+ * @len: bytes to read, and have on the raw stack
+ * Shifts each byte into place across the raw byte boundaries.
+ */
+static void blast_comms_frame_read(struct blast_comms_dev *radio,
+				struct blast_comms_sync *sync, u8 *buf,
+				size_t len)
+{
+	size_t	i;
+	u8	n;
+
+	kfifo_out(&radio->rx_raw_stack, buf, len);
+
+	for (i = 0; i < len; i++) {
+		n = buf[i];
+		if (sync->shift)
+			buf[i] = ((u8)sync->cur << sync->shift) |
+						(n >> (8 - sync->shift));
+		sync->cur = (sync->cur << 8) | n;
+	}
+}
+
 /**
  * blast_comms_frame_stack_init - initialise a blast_comms_frame_stack structure
  * @stack: stack pointer
@@ -165,12 +396,12 @@ static int blast_comms_frame_stack_init(struct blast_comms_frame_stack *stack)
 	stack->frame = kcalloc(sizeof(struct blast_comms_frame),
 							BLAST_COMMS_STACK_SIZE,
 							GFP_KERNEL);
-	if (stack->frame)
+	if (!stack->frame)
 		return -ENOMEM;
 
 	/* Allocate map, fail gracefully */
 	stack->map = (char *)kzalloc(BLAST_COMMS_STACK_SIZE, GFP_KERNEL);
-	if (stack->map) {
+	if (!stack->map) {
 		kfree(stack->frame);
 		return -ENOMEM;
 	}
@@ -193,8 +424,10 @@ static struct blast_comms_frame_stack *blast_comms_frame_stack_alloc(void)
 	if (!stack)
 		return NULL;
 
-	if (!blast_comms_frame_stack_init(stack))
+	if (blast_comms_frame_stack_init(stack)) {
+		kfree(stack);
 		return NULL;
+	}
 
 	return stack;
 }
@@ -36,8 +36,25 @@
  */
 #define		BLAST_COMMS_FRAME_CORREL_TAG_1		0x26FF60A6
 #define		BLAST_COMMS_FRAME_CORREL_TAG_2		0x00CC8FDE
+#define		BLAST_COMMS_FRAME_CORREL_TAG		\
+		((u64)BLAST_COMMS_FRAME_CORREL_TAG_2 << 32 |	\
+					BLAST_COMMS_FRAME_CORREL_TAG_1)
 #define		BLAST_COMMS_FRAME_SYNCWORD		0x7E
 
+/*
+ * Tag search
+ * The frame finder slides a 64 bit window over the received bits and
+ * syncs where it is within the link's sync distance (bit errors) of a
+ * correlation tag.  By chance, a window of random bytes comes within 4 bits
+ * of a tag about once in 3 x 10^13 positions, and within 12 about once in
+ * 4 x 10^6.  The tags themselves differ in 32 bits.
+ */
+#define		BLAST_COMMS_SYNC_DIST_DEFAULT		4
+#define		BLAST_COMMS_SYNC_DIST_MAX		12
+
+#define		BLAST_COMMS_SYNC_FRAME			1
+#define		BLAST_COMMS_SYNC_ILV			2
+
 #define		BLAST_COMMS_ADDR_LEN			32
 
 #define		BLAST_COMMS_FRAME_PID			0xF0
@@ -45,23 +62,96 @@
 #define		BLAST_COMMS_DATA_FRAME			0x00
 #define		BLAST_COMMS_NACK_FRAME			0x01
 #define		BLAST_COMMS_ACK_FRAME			0x03
+#define		BLAST_COMMS_FRAME_CTL_LT		0x04	/* fountain coded */
+#define		BLAST_COMMS_FRAME_CTL_ACK		0x08	/* ACK on board */
+#define		BLAST_COMMS_FRAME_CTL_LZ4		0x10	/* compressed */
+#define		BLAST_COMMS_FRAME_CTL_LZ4_START		0x20	/* new block */
+#define		BLAST_COMMS_FRAME_CTL_FIRST		0x40	/* starts a message */
+#define		BLAST_COMMS_FRAME_CTL_LAST		0x80	/* ends a message */
 
 #define		BLAST_COMMS_FRAME_SEQNUM_LIM		0x7D
+#define		BLAST_COMMS_FRAME_SEQNUM_MOD		\
+				(BLAST_COMMS_FRAME_SEQNUM_LIM + 1)
+
+/*
+ * Selective repeat
+ * An ACK frame's seq_num is cumulative, the first frame not yet received,
+ * and its data a SACK bitmap, LE64: bit n set if frame seq_num + 1 + n has
+ * been.  Frames missing below the last one received are sent again.  Half
+ * the sequence numbers at most may be outstanding, so the receiver can
+ * tell a new frame from a repeat of one it has already ACKed; less on a
+ * bonded link, where a repeat can be overtaken by the other radios'
+ * batches.
+ */
+#define		BLAST_COMMS_ARQ_WINDOW(radios)		\
+		(BLAST_COMMS_FRAME_SEQNUM_MOD / 2 -	\
+			((radios) - 1) * BLAST_COMMS_PIC_BATCH_MAX)
+#define		BLAST_COMMS_ARQ_SACK_LEN		sizeof(u64)
+
+/*
+ * Piggybacked ACKs
+ * On a BLAST_COMMS_RTX link, the ACK state goes out on the next data frame
+ * instead, at the end of its data: the cumulative sequence number and then
+ * the SACK bitmap.  The frame is marked BLAST_COMMS_FRAME_CTL_ACK and has
+ * room left for it.  An ACK frame goes only if no data frame has taken the
+ * ACK state within the link's ACK delay.
+ */
+#define		BLAST_COMMS_ARQ_ACK_LEN			\
+				(1 + BLAST_COMMS_ARQ_SACK_LEN)
+#define		BLAST_COMMS_ACK_DELAY_DEFAULT		40	/* ms */
+#define		BLAST_COMMS_ACK_DELAY_MAX		1000	/* ms */
+#define		BLAST_COMMS_ARQ_HOLDOFF			100	/* ms */
+
+/*
+ * blast_comms_validate_frame() results other than the frame type
+ */
+#define		BLAST_COMMS_E_BADFRAME_NOSEQ		(-1)	/* drop it */
+#define		BLAST_COMMS_E_BADFRAME_SEQ		(-2)	/* NACK it */
 
 #define		BLAST_COMMS_FRAME_DATA_LEN		128
-#define		BLAST_COMMS_FRAME_CHKSYM_LEN		32
+
+/*
+ * Wire format
+ * Frames are serialized field by field, with no padding, least significant
+ * byte first; everything after the correlation tag then goes on air least
+ * significant bit first (see blast_comms_frame_to_air()).
+ *	Offset	Length	Field
+ *	0	8	correlation tag
+ *	8	1	head sync word
+ *	9	1	ctl
+ *	10	1	pid
+ *	11	1	seq_num
+ *	12	1	data_len (n)
+ *	13	n	data
+ *	13+n	2	fcs, over ctl to the end of data
+ *	15+n	1	tail sync word
+ * The link's FEC scheme then codes it for the air (see blast_comms_fec.h),
+ * so the frame that goes on air may be longer than this, up to
+ * BLAST_COMMS_WIRE_MAX; the scheme also limits how much data fits.
+ */
+#define		BLAST_COMMS_WIRE_SYNC			8
+#define		BLAST_COMMS_WIRE_CTL			9
+#define		BLAST_COMMS_WIRE_PID			10
+#define		BLAST_COMMS_WIRE_SEQ			11
+#define		BLAST_COMMS_WIRE_DLEN			12
+#define		BLAST_COMMS_WIRE_DATA			13
+
+#define		BLAST_COMMS_WIRE_HEAD_LEN		BLAST_COMMS_WIRE_DATA
+#define		BLAST_COMMS_WIRE_TAIL_LEN		(sizeof(u16) + 1)
+#define		BLAST_COMMS_WIRE_LEN(n)			\
+		(BLAST_COMMS_WIRE_HEAD_LEN + (n) + BLAST_COMMS_WIRE_TAIL_LEN)
+#define		BLAST_COMMS_WIRE_MAX			BLAST_COMMS_PIC_FRAME_MAX
 
 /*
  * Stack map entries
  * Format:
- * | READY | SENT  |                COUNTER                |
- * |   1   |   1   |   0   |   0   |   0   |   0   |   1   |
+ * | READY | SENT  |   0   |   0   | UNREAD |   0   |   0   |   0   |
+ * Sent frames' retransmission deadlines are kept apart, in blast_comms_rto.
  */
 #define		BLAST_COMMS_STACK_MAP_CLEAR		0x00
 #define		BLAST_COMMS_STACK_MAP_READY		0x80
 #define		BLAST_COMMS_STACK_MAP_SENT		0x40
 #define		BLAST_COMMS_STACK_MAP_UNREAD		0x08
-#define		BLAST_COMMS_STACK_MAP_EXPIRED		0xFF
 
 /**
  * The Frame Structure
@@ -75,16 +165,26 @@ struct blast_comms_frame {
 /*	char dest[BLAST_COMMS_ADDR_LEN];	/** destination address */
 /*	char src[BLAST_COMMS_ADDR_LEN];		/** source address */
 
-/*	u8 ctl;					/** control flags */
-/*	u8 pid;					/** level 3 protocol id */
-/*	u8 seq_num;				/** sequence number */
+	u8 ctl;					/** control flags */
+	u8 pid;					/** level 3 protocol id */
+	u8 seq_num;				/** sequence number */
 
 	u16 data_len;				/** length of data */
 	u8 data[BLAST_COMMS_FRAME_DATA_LEN];	/** data */
 
 	u16 fcs;				/** checksum */
 	u8 tail_sync_word;			/** sync word */
-/*	u8 check_sym[BLAST_COMMS_FRAME_CHKSYM_LEN];	/** check symbols */
+
+	u8 wire[BLAST_COMMS_WIRE_MAX];		/** as sent */
+	u16 wire_len;				/** bytes of wire in use */
+};
+
+/**
+ * Frame finder search state
+ */
+struct blast_comms_sync {
+	u64 cur;				/** last 64 bits taken */
+	int shift;				/** bit offset of the frame */
 };
 
 /**
@@ -102,21 +202,38 @@ struct blast_comms_frame_stack {
 /*
  * Function Prototypes
  */
-static void blast_comms_build_frame(struct blast_comms_dev *dev,
+struct blast_comms_dev;
+struct blast_comms_link_dev;
+
+static void blast_comms_build_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf);
-static void blast_comms_build_ack_frame(struct blast_comms_dev *dev,
+static size_t blast_comms_data_max(struct blast_comms_link_dev *dev);
+static void blast_comms_build_ack_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf,
-						u8 seqnum);
-static void blast_comms_build_nack_frame(struct blast_comms_dev *dev,
+						u8 seqnum, u64 sack);
+static void blast_comms_build_nack_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf,
 						u8 seqnum);
-static void blast_comms_finalise_frame(struct blast_comms_dev *dev,
+static void blast_comms_finalise_frame(struct blast_comms_link_dev *dev,
 						struct blast_comms_frame *buf,
 						u8 seqnum);
-static int blast_comms_validate_frame(struct blast_comms_dev *dev,
+static int blast_comms_validate_frame(struct blast_comms_link_dev *dev,
 					struct blast_comms_frame *frame);
+static u16 blast_comms_frame_fcs(const struct blast_comms_frame *frame);
+static size_t blast_comms_frame_encode(struct blast_comms_frame *frame);
+static int blast_comms_frame_decode(struct blast_comms_frame *frame);
+static void blast_comms_frame_to_air(struct blast_comms_frame *frame);
+static void blast_comms_frame_from_air(struct blast_comms_frame *frame);
+static u8 blast_comms_frame_air_data_len(const u8 *wire);
+static u8 blast_comms_seq_diff(u8 a, u8 b);
+static int blast_comms_frame_sync(struct blast_comms_dev *radio,
+					struct blast_comms_sync *sync, int dist);
+static void blast_comms_frame_read(struct blast_comms_dev *radio,
+				struct blast_comms_sync *sync, u8 *buf,
+				size_t len);
 
 static int blast_comms_frame_stack_init(struct blast_comms_frame_stack *stack);
+static struct blast_comms_frame_stack *blast_comms_frame_stack_alloc(void);
 static void blast_comms_frame_stack_release(struct blast_comms_frame_stack *stack);
 
 #endif /* _BLAST_COMMS_FRAME_H_ */
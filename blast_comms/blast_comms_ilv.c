@@ -0,0 +1,199 @@
+/**
+ * blast_comms_ilv.c
+ *
+ * Cross-frame Block Interleaver
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Fades during a pass cause error bursts longer than one frame's FEC can
+ * correct.  With interleaving on (BLAST_COMMS_IOCTILV) the transmit thread
+ * sends each batch as interleaved groups, and the frame finder puts them
+ * back together; links with it off send and receive plain frames.
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/bitrev.h>
+#include <asm/unaligned.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * blast_comms_ilv_row_len - row length of a group
+ * @frames: finalised frames
+ * @depth: how many
+ */
+static size_t blast_comms_ilv_row_len(struct blast_comms_frame **frames,
+								int depth)
+{
+	size_t row_len = 0;
+	int i;
+
+	for (i = 0; i < depth; i++)
+		row_len = max_t(size_t, row_len,
+				frames[i]->wire_len - BLAST_COMMS_WIRE_SYNC);
+
+	return row_len;
+}
+
+/**
+ * blast_comms_ilv_encode - interleave a group of frames into packets
+ * @frames: finalised frames, in order
+ * @depth: how many, at most BLAST_COMMS_ILV_MAX
+ * @group: group number
+ * @buf: packets, one after another
+ * @lens: each packet's length
+ * There are BLAST_COMMS_ILV_PACKETS(depth, row length) of them.  Returns
+ * the number of bytes written to buf.
+ */
+static size_t blast_comms_ilv_encode(struct blast_comms_frame **frames,
+					int depth, u8 group, u8 *buf, u8 *lens)
+{
+	size_t row_len = blast_comms_ilv_row_len(frames, depth);
+	size_t total = depth * row_len;
+	size_t s, col, len;
+	u8 *ptr = buf;
+	u8 hdr[BLAST_COMMS_ILV_FIELDS];
+	int packet, row, i;
+
+	for (s = 0, packet = 0; s < total; packet++) {
+		len = min_t(size_t, total - s, BLAST_COMMS_ILV_PKT_DATA);
+		lens[packet] = BLAST_COMMS_ILV_HEAD_LEN + len;
+
+		put_unaligned_le32(BLAST_COMMS_FRAME_CORREL_TAG_1, &ptr[0]);
+		put_unaligned_le32(BLAST_COMMS_ILV_CORREL_TAG_2, &ptr[4]);
+		ptr += BLAST_COMMS_WIRE_SYNC;
+
+		/* The header goes on air least significant bit first too */
+		hdr[0] = bitrev8((depth << 4) | packet);
+		hdr[1] = bitrev8(group);
+		hdr[2] = bitrev8(row_len);
+		for (i = 0; i < BLAST_COMMS_ILV_COPIES; i++) {
+			memcpy(ptr, hdr, sizeof(hdr));
+			ptr += sizeof(hdr);
+		}
+
+		/* Column by column, the short rows padded with zeros */
+		for (len += s; s < len; s++) {
+			row = s % depth;
+			col = s / depth;
+			*ptr++ = col < frames[row]->wire_len -
+					BLAST_COMMS_WIRE_SYNC ?
+				frames[row]->wire[BLAST_COMMS_WIRE_SYNC + col] : 0;
+		}
+	}
+
+	return ptr - buf;
+}
+
+/**
+ * blast_comms_ilv_head - read a packet's header
+ * @air: the packet's first BLAST_COMMS_ILV_HEAD_LEN bytes, as on air
+ * @head: the header
+ * Each bit is taken from at least two of the three copies.  Returns 0, or
+ * -EINVAL if the header makes no sense.
+ */
+static int blast_comms_ilv_head(const u8 *air,
+					struct blast_comms_ilv_head *head)
+{
+	const u8 *a = &air[BLAST_COMMS_WIRE_SYNC];
+	const u8 *b = a + BLAST_COMMS_ILV_FIELDS;
+	const u8 *c = b + BLAST_COMMS_ILV_FIELDS;
+	u8 hdr[BLAST_COMMS_ILV_FIELDS];
+	int i;
+
+	for (i = 0; i < BLAST_COMMS_ILV_FIELDS; i++)
+		hdr[i] = bitrev8((a[i] & b[i]) | (a[i] & c[i]) | (b[i] & c[i]));
+
+	head->depth = hdr[0] >> 4;
+	head->index = hdr[0] & 0x0F;
+	head->group = hdr[1];
+	head->row_len = hdr[2];
+
+	if (head->depth < 1 || head->depth > BLAST_COMMS_ILV_MAX ||
+			head->row_len < BLAST_COMMS_WIRE_LEN(0) -
+					BLAST_COMMS_WIRE_SYNC ||
+			head->row_len > BLAST_COMMS_ILV_ROW_MAX ||
+			head->index >= BLAST_COMMS_ILV_PACKETS(head->depth,
+							head->row_len))
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * blast_comms_ilv_packet_len - on-air length of a packet
+ * @head: its header
+ */
+static size_t blast_comms_ilv_packet_len(
+				const struct blast_comms_ilv_head *head)
+{
+	size_t total = head->depth * head->row_len;
+
+	return BLAST_COMMS_ILV_HEAD_LEN + min_t(size_t, total -
+			head->index * BLAST_COMMS_ILV_PKT_DATA,
+			BLAST_COMMS_ILV_PKT_DATA);
+}
+
+/**
+ * blast_comms_ilv_rx_same - does a packet belong to the group being read
+ * @rx: the de-interleaver
+ * @head: the packet's header
+ */
+static int blast_comms_ilv_rx_same(const struct blast_comms_ilv_rx *rx,
+				const struct blast_comms_ilv_head *head)
+{
+	return rx->head.group == head->group &&
+				rx->head.depth == head->depth &&
+				rx->head.row_len == head->row_len &&
+				!(rx->have & (1 << head->index));
+}
+
+/**
+ * blast_comms_ilv_rx_reset - get ready for the next group
+ * @rx: the de-interleaver
+ * Packets that never arrive leave zeros, for the FEC to fill in.
+ */
+static void blast_comms_ilv_rx_reset(struct blast_comms_ilv_rx *rx)
+{
+	memset(rx, 0, sizeof(struct blast_comms_ilv_rx));
+}
+
+/**
+ * blast_comms_ilv_rx_row - take a frame out of a group
+ * @rx: the de-interleaver, with what was received of the group
+ * @row: which frame
+ * @frame: frame buffer
+ * Fills in frame->wire as the frame finder would have found it, padding
+ * and all; the caller trims wire_len with the FEC scheme's air_len().
+ */
+static void blast_comms_ilv_rx_row(const struct blast_comms_ilv_rx *rx,
+				int row, struct blast_comms_frame *frame)
+{
+	size_t col;
+
+	put_unaligned_le32(BLAST_COMMS_FRAME_CORREL_TAG_1, &frame->wire[0]);
+	put_unaligned_le32(BLAST_COMMS_FRAME_CORREL_TAG_2, &frame->wire[4]);
+
+	for (col = 0; col < rx->head.row_len; col++)
+		frame->wire[BLAST_COMMS_WIRE_SYNC + col] =
+				rx->stream[col * rx->head.depth + row];
+
+	frame->wire_len = BLAST_COMMS_WIRE_SYNC + rx->head.row_len;
+}
+
+/* EOF */
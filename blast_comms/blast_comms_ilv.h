@@ -0,0 +1,98 @@
+/**
+ * blast_comms_ilv.h
+ *
+ * Cross-frame Block Interleaver
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_ILV_H_
+#define _BLAST_COMMS_ILV_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+
+/*
+ * Interleaved groups
+ * Up to BLAST_COMMS_ILV_MAX finalised frames are written as the rows of a
+ * block, each padded with zeros to the longest, and the block is read out
+ * a column at a time; a burst on air then takes at most a few bytes from
+ * each frame, which its FEC can put right.  The correlation tags stay with
+ * the frames, so only the bytes after them are interleaved.  The column
+ * stream is cut into packets, each:
+ *	Offset	Length	Field
+ *	0	8	correlation tag, BLAST_COMMS_ILV_CORREL_TAG_2 second
+ *	8	3	DEPTH << 4 | INDEX, GROUP, ROW LENGTH
+ *	11	6	two more copies of the above, for a majority vote
+ *	17	n	up to BLAST_COMMS_ILV_PKT_DATA bytes of the stream
+ * The group number tells the receiver which packets belong together.
+ */
+#define	BLAST_COMMS_ILV_CORREL_TAG_2	0xFF337021	/* frame tag, inverted */
+#define	BLAST_COMMS_ILV_CORREL_TAG	\
+		((u64)BLAST_COMMS_ILV_CORREL_TAG_2 << 32 |	\
+					BLAST_COMMS_FRAME_CORREL_TAG_1)
+#define	BLAST_COMMS_ILV_MAX		8	/* frames per group */
+#define	BLAST_COMMS_ILV_FIELDS		3
+#define	BLAST_COMMS_ILV_COPIES		3
+#define	BLAST_COMMS_ILV_HDRLEN		\
+		(BLAST_COMMS_ILV_FIELDS * BLAST_COMMS_ILV_COPIES)
+#define	BLAST_COMMS_ILV_HEAD_LEN	\
+		(BLAST_COMMS_WIRE_SYNC + BLAST_COMMS_ILV_HDRLEN)
+#define	BLAST_COMMS_ILV_PKT_DATA	\
+		(BLAST_COMMS_WIRE_MAX - BLAST_COMMS_ILV_HEAD_LEN)
+#define	BLAST_COMMS_ILV_ROW_MAX		\
+		(BLAST_COMMS_WIRE_MAX - BLAST_COMMS_WIRE_SYNC)
+#define	BLAST_COMMS_ILV_PACKETS(depth, row_len)	\
+		DIV_ROUND_UP((depth) * (row_len), BLAST_COMMS_ILV_PKT_DATA)
+
+/*
+ * Packet header
+ */
+struct blast_comms_ilv_head {
+	u8	depth;				/** frames in the group */
+	u8	index;				/** packet number */
+	u8	group;
+	u8	row_len;			/** bytes per frame */
+};
+
+/*
+ * De-interleaver, one per receiving radio
+ */
+struct blast_comms_ilv_rx {
+	struct blast_comms_ilv_head	head;	/** of the group being read */
+	u16				have;	/** packets of it, by index */
+	u8	stream[BLAST_COMMS_ILV_MAX * BLAST_COMMS_ILV_ROW_MAX];
+};
+
+/*
+ * Function Prototypes
+ */
+struct blast_comms_frame;
+
+static size_t blast_comms_ilv_row_len(struct blast_comms_frame **frames,
+								int depth);
+static size_t blast_comms_ilv_encode(struct blast_comms_frame **frames,
+					int depth, u8 group, u8 *buf, u8 *lens);
+static int blast_comms_ilv_head(const u8 *air,
+					struct blast_comms_ilv_head *head);
+static size_t blast_comms_ilv_packet_len(
+				const struct blast_comms_ilv_head *head);
+static int blast_comms_ilv_rx_same(const struct blast_comms_ilv_rx *rx,
+				const struct blast_comms_ilv_head *head);
+static void blast_comms_ilv_rx_reset(struct blast_comms_ilv_rx *rx);
+static void blast_comms_ilv_rx_row(const struct blast_comms_ilv_rx *rx,
+				int row, struct blast_comms_frame *frame);
+
+#endif /* _BLAST_COMMS_ILV_H_ */
+
+/* EOF */
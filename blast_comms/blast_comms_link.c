@@ -70,7 +70,7 @@ static int blast_comms_link_ctrlinit(void)
 	INIT_LIST_HEAD(&bcll->link_dev_list);
 
 	/* initialise spinlocks */
-	spin_lock_init(&bcll->link_lock);
+	spin_lock_init(&bcll->list_lock);
 
 	/* allocate chrdev region, fail gracefully */
 	result = alloc_chrdev_region(&devno, 0, BLAST_COMMS_LINKDEV_COUNT,
@@ -90,8 +90,7 @@ static int blast_comms_link_ctrlinit(void)
 	cdev_init(&bcll->ctrl_cdev, &blast_comms_ctrl_fops);
 	cdev_add(&bcll->ctrl_cdev, MKDEV(bcll->major, 0), 1);
 
-	/* create master device symbolic link */
-	symlink("/dev/bcll0", "/dev/bcll_master");
+	/* /dev/bcll_master, pointing at bcll0, is left to udev rules */
 
 	printk(KERN_NOTICE "%s: control device set up.\n", DRIVER_NAME);
 
@@ -108,15 +107,12 @@ static void blast_comms_link_exit(void)
 	struct blast_comms_link_dev *dev_entry;
 
 	/* Stop EVERYTHING! */
-	list_for_each_safe(ptr, next, &link_dev_list) {
+	list_for_each_safe(ptr, next, &bcll->link_dev_list) {
 		dev_entry = list_entry(ptr, struct blast_comms_link_dev,
 								dev_list);
 		blast_comms_link_release(dev_entry);
 	}
 
-	/* remove master device symbolic link */
-	unlink("/dev/bcll_master");
-
 	/* Release the control device */
 	cdev_del(&bcll->ctrl_cdev);
 
@@ -125,7 +121,7 @@ static void blast_comms_link_exit(void)
 					atomic_read(&bcll->minor_count));
 	atomic_set(&bcll->minor_count, 0);
 	atomic_set(&bcll->next_minor, 0);
-	&bcll->major = 0;
+	bcll->major = 0;
 
 	printk(KERN_NOTICE "%s: exiting.\n", DRIVER_NAME);
 }
@@ -142,8 +138,8 @@ static int blast_comms_cdev_add_minor(void)
 	devno = MKDEV(bcll->major, atomic_read(&bcll->next_minor));
 
 	/* add additional minor devices to chrdev region */
-	result = register_chrdev_region(devno, 1, BLAST_COMMS_DEVNAME);
-	if (!result) {
+	ret = register_chrdev_region(devno, 1, BLAST_COMMS_DEVNAME);
+	if (!ret) {
 		printk(KERN_CRIT "%s: blast_comms_cdev_add_minor: unable to add"
 				 " additional chrdev region", DRIVER_NAME);
 		return ret;
@@ -159,12 +155,22 @@ static int blast_comms_cdev_add_minor(void)
  * blast_comms_link_init - initialise a link layer device
  * @dev: pointer to a preallocated link device structure
  * @mode: type of device - RTX, just TX or just RX
+ * @radios: radios to bond in each direction (0 or 1 for a plain link)
+ * @spacing: channel spacing between bonded radios
+ * @fec: forward error correction scheme, BLAST_COMMS_FEC_*
+ *
+ * A bonded link stripes its frames across several radios, each on its own
+ * channel; frames are put back in order by sequence number on receipt.
  */
-static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode)
+static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode,
+					int radios, double spacing, int fec)
 {
-	struct list_head *rx;	/** receiver */
-	struct list_head *tx;	/** transmitter */
-	dev_t	devno;		/** device number */
+	struct list_head *entry;	/** a device on avail_list */
+	dev_t	devno;			/** device number */
+	int	needed;			/** devices to claim */
+	int	avail = 0;		/** devices available */
+	int	result = 0;
+	int	i;
 
 	/* Sanity: valid mode? */
 	if (unlikely(!(mode | BLAST_COMMS_RTX))) {
@@ -173,9 +179,36 @@ static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode)
 		return -EINVAL;
 	}
 
+	if (radios < 1)
+		radios = 1;
+
+	if (radios > BLAST_COMMS_BOND_MAX) {
+		printk(KERN_WARNING "%s: link_init - too many radios.\n",
+								DRIVER_NAME);
+		return -EINVAL;
+	}
+
+	/* Both ends of a link must be made with the same scheme */
+	dev->fec = blast_comms_fec_get(fec);
+	if (!dev->fec) {
+		printk(KERN_WARNING "%s: link_init - invalid FEC scheme.\n",
+								DRIVER_NAME);
+		return -EINVAL;
+	}
+
+	dev->mode = mode;
+	dev->radios = radios;
+	dev->spacing = spacing;
+	dev->sync_dist = BLAST_COMMS_SYNC_DIST_DEFAULT;
+	dev->arq_window = BLAST_COMMS_ARQ_WINDOW(radios);
+	dev->ack_delay_ms = BLAST_COMMS_ACK_DELAY_DEFAULT;
+	dev->rto_ms = BLAST_COMMS_RTO_DEFAULT;
+
+	needed = radios * (!!(mode & BLAST_COMMS_RX) + !!(mode & BLAST_COMMS_TX));
+
 	/* Check just in case we are out of minors */
 	if (unlikely(atomic_read(&bcll->next_minor) > 	\
-					(atomic_read(&bcll->minor_count) - 1)) {
+					(atomic_read(&bcll->minor_count) - 1))) {
 		result = blast_comms_cdev_add_minor();	/* allocate more! */
 		if (!result)
 			return result;
@@ -185,10 +218,11 @@ static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode)
 	/* Enter a locked, softirq-less environment to manipulate lists */
 	spin_lock_bh(&bcll->list_lock);
 
-	/* Test for valid entries */
-	if (list_empty(&bcll->avail_list) ||		 \
-			(list_singular(&bcll->avail_list) && \
-					mode == BLAST_COMMS_RTX)) {
+	/* Test for enough entries */
+	list_for_each(entry, &bcll->avail_list)
+		avail++;
+
+	if (avail < needed) {
 		spin_unlock_bh(&bcll->list_lock);
 		printk(KERN_WARNING "%s: no available devices.\n", DRIVER_NAME);
 		return -ENODEV;
@@ -199,34 +233,45 @@ static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode)
 	dev->devno = devno;
 
 	/* Get device(s) */
-	if (mode & BLAST_COMMS_RX) {
-		rx = bcll->avail_list->next;
-		list_move_tail(rx, &bcll->used_list);
-	}
+	for (i = 0; i < radios; i++) {
+		if (mode & BLAST_COMMS_RX) {
+			entry = bcll->avail_list.next;
+			list_move_tail(entry, &bcll->used_list);
+			dev->rxs[i] = list_entry(entry, struct blast_comms_dev,
+								dev_list);
+		}
 
-	if (mode & BLAST_COMMS_TX) {
-		tx = bcll->avail_list->next;
-		list_move_tail(tx, &bcll->used_list);
+		if (mode & BLAST_COMMS_TX) {
+			entry = bcll->avail_list.next;
+			list_move_tail(entry, &bcll->used_list);
+			dev->txs[i] = list_entry(entry, struct blast_comms_dev,
+								dev_list);
+		}
 	}
 	spin_unlock_bh(&bcll->list_lock);
 
-	/* Link device(s) */
-	if (mode & BLAST_COMMS_RX) {
-		dev->rx = list_entry(rx, struct blast_comms_dev, dev_list);
-		dev->rx->link_dev = dev;
-	}
+	dev->rx = dev->rxs[0];
+	dev->tx = dev->txs[0];
+
+	/* Link and initialise device(s), each bonded radio one channel up */
+	for (i = 0; i < radios; i++) {
+		if (mode & BLAST_COMMS_RX) {
+			dev->rxs[i]->link_dev = dev;
+			blast_comms_dev_startrx(dev->rxs[i]);
+			if (i)
+				blast_comms_rfm_frequency(dev->rxs[i],
+					dev->rxs[0]->freq + i * spacing);
+		}
 
-	if (mode & BLAST_COMMS_TX) {
-		dev->tx = list_entry(tx, struct blast_comms_dev, dev_list);
-		dev->tx->link_dev = dev;
+		if (mode & BLAST_COMMS_TX) {
+			dev->txs[i]->link_dev = dev;
+			blast_comms_dev_starttx(dev->txs[i]);
+			if (i)
+				blast_comms_rfm_frequency(dev->txs[i],
+					dev->txs[0]->freq + i * spacing);
+		}
 	}
 
-	/* Initialise device(s) */
-	if (mode & BLAST_COMMS_RX)
-		blast_comms_dev_startrx(dev->rx);
-	if (mode & BLAST_COMMS_TX)
-		blast_comms_dev_starttx(dev->tx);
-
 	/* Initialise chrdev */
 	switch (mode) {
 	case BLAST_COMMS_RX:
@@ -244,16 +289,22 @@ static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode)
 	list_add_tail(&dev->dev_list, &bcll->link_dev_list);
 	cdev_add(&dev->cdev, devno, 1);
 
-	printk(KERN_NOTICE "%s: created device %d:%d, mode %d.\n", DRIVER_NAME,
-					MAJOR(devno), MINOR(devno), mode);
+	printk(KERN_NOTICE "%s: created device %d:%d, mode %d, %d radio(s), "
+			"%s FEC.\n", DRIVER_NAME, MAJOR(devno), MINOR(devno),
+			mode, radios, dev->fec->name);
 
 	return 0;
 }
 
 /**
  * blast_comms_link_alloc - allocate and initialise a link layer device
+ * @mode: type of device - RTX, just TX or just RX
+ * @radios: radios to bond in each direction
+ * @spacing: channel spacing between bonded radios
+ * @fec: forward error correction scheme, BLAST_COMMS_FEC_*
  */
-static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode)
+static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode,
+					int radios, double spacing, int fec)
 {
 	/* Allocate the link device structure */
 	struct blast_comms_link_dev *dev;
@@ -266,7 +317,7 @@ static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode)
 	}
 
 	/* Initialise */
-	if (likely(blast_comms_link_init(dev, mode)))
+	if (!blast_comms_link_init(dev, mode, radios, spacing, fec))
 		return dev;
 
 	/* Clean up on failure */
@@ -281,34 +332,41 @@ static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode)
 static void blast_comms_link_release(struct blast_comms_link_dev *dev)
 {
 	dev_t devno;
+	int i;
 	/* TODO: check for open files - kref? */
 	if (dev) {
 		devno = dev->devno;
 
 		/* Remove the link device from the kernel and the list */
-		cdev_del(dev->cdev);
-		list_del(&dev->dev_list, &bcll->link_dev_list);
+		cdev_del(&dev->cdev);
+		list_del(&dev->dev_list);
 
 		/* Put the device(s) into standby */
-		if (dev->tx != NULL) {
-			blast_comms_dev_stop(dev->tx);
-			dev->tx->link_dev = NULL;
-		}
-
-		if (dev->rx != NULL) {
-			blast_comms_dev_stop(dev->rx);
-			dev->rx->link_dev = NULL;
+		for (i = 0; i < dev->radios; i++) {
+			if (dev->txs[i] != NULL) {
+				blast_comms_dev_stop(dev->txs[i]);
+				dev->txs[i]->link_dev = NULL;
+			}
+
+			if (dev->rxs[i] != NULL) {
+				blast_comms_dev_stop(dev->rxs[i]);
+				dev->rxs[i]->link_dev = NULL;
+			}
 		}
 
 		/* Make the devices available for reuse */
 		/* Enter locked, softirq-less environment to manipulate lists */
 		spin_lock_bh(&bcll->list_lock);
 
-		if (dev->tx != NULL)
-			list_move_tail(dev->tx->dev_list, &bcll->avail_list);
+		for (i = 0; i < dev->radios; i++) {
+			if (dev->txs[i] != NULL)
+				list_move_tail(&dev->txs[i]->dev_list,
+							&bcll->avail_list);
 
-		if (dev->rx != NULL)
-			list_move_tail(dev->rx->dev_list, &bcll->avail_list);
+			if (dev->rxs[i] != NULL)
+				list_move_tail(&dev->rxs[i]->dev_list,
+							&bcll->avail_list);
+		}
 
 		spin_unlock_bh(&bcll->list_lock);
 
@@ -334,7 +392,7 @@ static int blast_comms_link_register(struct blast_comms_dev *dev)
 	blast_comms_dev_stop(dev);
 
 	/* Make device available */
-	list_add_tail(dev->dev_list, &bcll->avail_list);
+	list_add_tail(&dev->dev_list, &bcll->avail_list);
 
 	printk(KERN_NOTICE "%s: device has been registered.\n", DRIVER_NAME);
 
@@ -372,7 +430,7 @@ static int blast_comms_link_unregister(struct blast_comms_dev *dev)
 	list_for_each_safe(ptr, next, &bcll->avail_list) {
 		dev_entry = list_entry(ptr, struct blast_comms_dev, dev_list);
 		if (dev_entry == dev)
-			link_del(ptr);
+			list_del(ptr);
 	}
 
 	/* Back to reality */
@@ -385,16 +443,17 @@ static int blast_comms_link_unregister(struct blast_comms_dev *dev)
 
 /**
  * blast_comms_linkctrl_ioctl - ioctl routine for the control device
- * @inode: the inode associated with the ioctl call (can only be control dev)
  * @filp: the file associated with the ioctl call (can only be control dev)
  * @cmd: the command
  * @arg: argument of the command
  */
-static int blast_comms_linkctrl_ioctl(struct inode *inode, struct file *filp,
-					unsigned int cmd, unsigned long arg)
+static long blast_comms_linkctrl_ioctl(struct file *filp, unsigned int cmd,
+							unsigned long arg)
 {
 	struct blast_comms_node node;
+	struct blast_comms_node_ext node_ext;
 	struct blast_comms_link_dev *dev;
+	__u32 size;
 	struct list_head *ptr;
 	struct list_head *next;
 
@@ -427,20 +486,54 @@ static int blast_comms_linkctrl_ioctl(struct inode *inode, struct file *filp,
 
 		break;
 	case BLAST_COMMS_IOCMKNOD:
-		/* Make a communication node */
-		copy_from_user(&node, arg, sizeof(struct blast_comms_node));
+		/* Make a communication node, one radio each way */
+		if (copy_from_user(&node, (void __user *)arg,
+					sizeof(struct blast_comms_node)))
+			return -EFAULT;
+
+		dev = blast_comms_link_alloc(node.mode, 1,
+				BLAST_COMMS_DEFAULT_SPACING, BLAST_COMMS_FEC_RS);
+		if (unlikely(!dev))
+			return -ENODEV;
+
+		node.devno = dev->devno;
+		if (copy_to_user((void __user *)arg, &node,
+					sizeof(struct blast_comms_node)))
+			return -EFAULT;
+
+		break;
+	case BLAST_COMMS_IOCMKNODEXT:
+		/* Make a communication node, bonded or with another FEC */
+		if (get_user(size, (__u32 __user *)arg))
+			return -EFAULT;
+
+		if (size < BLAST_COMMS_NODE_EXT_V1)
+			return -EINVAL;
+
+		/* Take what the caller and we both know of */
+		memset(&node_ext, 0, sizeof(struct blast_comms_node_ext));
+		if (copy_from_user(&node_ext, (void __user *)arg,
+				min_t(size_t, size, sizeof(node_ext))))
+			return -EFAULT;
 
-		dev = blast_comms_link_alloc(node.mode);
+		dev = blast_comms_link_alloc(node_ext.mode, node_ext.radios,
+				node_ext.spacing ? node_ext.spacing :
+				BLAST_COMMS_DEFAULT_SPACING, node_ext.fec);
 		if (unlikely(!dev))
 			return -ENODEV;
 
-		copy_to_user(arg, &node, sizeof(struct blast_comms_node));
+		node_ext.devno = dev->devno;
+		if (copy_to_user((void __user *)arg, &node_ext,
+				min_t(size_t, size, sizeof(node_ext))))
+			return -EFAULT;
 
 		break;
 	case BLAST_COMMS_IOCRMNOD:
 		/* Remove a communication node */
 		/* TODO: open file clean-up, maybe using kref? */
-		copy_from_user(&node, arg, sizeof(struct blast_comms_node));
+		if (copy_from_user(&node, (void __user *)arg,
+					sizeof(struct blast_comms_node)))
+			return -EFAULT;
 
 		list_for_each_safe(ptr, next, &bcll->link_dev_list) {
 			dev = list_entry(ptr, struct blast_comms_link_dev,
@@ -487,7 +580,7 @@ struct file_operations blast_comms_ctrl_fops = {
 	.owner = THIS_MODULE,
 	.open = blast_comms_linkctrl_open,
 	.release = blast_comms_linkctrl_release,
-	.ioctl = blast_comms_linkctrl_ioctl
+	.unlocked_ioctl = blast_comms_linkctrl_ioctl
 };
 
 /* EOF */
@@ -29,12 +29,23 @@
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
 #include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/workqueue.h>
 
 /*
  * Local inclusions
  */
 #include "blast_comms.h"
 
+/*
+ * Constants
+ */
+#define	BLAST_COMMS_BOND_MAX		4	/* radios per direction */
+#define	BLAST_COMMS_DEFAULT_SPACING	100	/* between bonded radios */
+
+#define	BLAST_COMMS_DEVNAME		"bcll"
+#define	BLAST_COMMS_LINKDEV_COUNT	8	/* minors to start with */
+
 /*
  * THE link layer structure layout
  */
@@ -61,6 +72,25 @@ struct blast_comms_node {
 	int 		mode;
 };
 
+/*
+ * Extended node structure, for BLAST_COMMS_IOCMKNODEXT
+ * Leaves struct blast_comms_node, and so BLAST_COMMS_IOCMKNOD, as they
+ * were for programs built before bonding and FEC schemes.  size is
+ * sizeof(struct blast_comms_node_ext) as the caller knew it; fields
+ * appended later are taken as 0 if it is too small to hold them.
+ */
+struct blast_comms_node_ext {
+	__u32		size;
+	dev_t 		devno;
+	int 		mode;
+	int		radios;		/* per direction; 0 or 1 unbonded */
+	double		spacing;	/* channel spacing of bonded radios */
+	int		fec;		/* BLAST_COMMS_FEC_*; 0 Reed-Solomon */
+};
+
+#define	BLAST_COMMS_NODE_EXT_V1		\
+		(offsetof(struct blast_comms_node_ext, spacing) + sizeof(double))
+
 /*
  * The Link Device Structure
  */
@@ -70,18 +100,57 @@ struct blast_comms_link_dev {
 	struct blast_comms_dev 		*rx;
 	struct blast_comms_dev 		*tx;
 
+	/* Bonded radios, rx and tx above are rxs[0] and txs[0] */
+	struct blast_comms_dev		*rxs[BLAST_COMMS_BOND_MAX];
+	struct blast_comms_dev		*txs[BLAST_COMMS_BOND_MAX];
+	int				radios;
+	double				spacing;
+
 	int				mode;
+	int				status;		/* BLAST_COMMS_OPEN... */
 	atomic_t 			refcount;
 	dev_t				devno;
-	struct rc_control		*rs;
+
+	/* Forward error correction */
+	const struct blast_comms_fec_ops *fec;
+	void				*fec_priv;	/* scheme's state */
+
+	/* Small write coalescing, on transmit */
+	int				coalesce_ms;	/* 0 off */
+	struct semaphore		hold_sem;
+	struct blast_comms_frame	*hold_frame;	/* partly filled */
+	u8				hold_ptr;	/* its slot */
+	size_t				hold_len;	/* data in it */
+	struct delayed_work		hold_work;	/* sends it */
+
+	/* Bit errors allowed in a correlation tag, on receive */
+	int				sync_dist;
+
+	/* Interleaving, on transmit */
+	int				ilv_depth;	/* 0 or 1 off */
+	u8				ilv_group;
+
+	/* Fountain coding */
+	struct blast_comms_lt		*lt;
+	int				lt_overhead;	/* on transmit, 0 off */
+
+	/* Message mode, both ways */
+	int				msg;
+	u8				*msg_buf;	/* reassembly */
+	size_t				msg_len;	/* in msg_buf */
+	int				msg_open;	/* first frame seen */
+
+	/* Payload compression */
+	struct blast_comms_lz4		*lz4;
+	int				compress;	/* on transmit */
 
 	char				dest_addr[BLAST_COMMS_ADDR_LEN];
 	char				src_addr[BLAST_COMMS_ADDR_LEN];
 
 	struct blast_comms_frame_stack	*tx_data_stack;
 	struct kfifo			*tx_meta_stack;
+	spinlock_t			tx_meta_lock;	/* its producers */
 	struct blast_comms_frame_stack	*rx_data_stack;
-	struct kfifo			*rx_raw_stack;
 
 	struct kfifo			*read_stack;
 	struct semaphore		read_stack_sem;
@@ -91,29 +160,35 @@ struct blast_comms_link_dev {
 	u8				tx_ptr;
 	spinlock_t			tx_ptr_lock;
 
+	/* Selective repeat (under the data stacks' locks) */
+	int				arq_window;
+	u8				tx_base;	/* oldest unACKed */
+	u8				rx_cum;		/* first not received */
+	u64				rx_sack;	/* by distance from it */
+	int				ack_pending;	/* not yet sent */
+	int				ack_delay_ms;
+	struct delayed_work		ack_work;	/* sends it alone */
+
 	/* Stack Data */
 	atomic_t			unack;
 	atomic_t			unsent;
 
-	/* Soft IRQ Timer */
-	struct timer_list		softirq;
+	/* Retransmission deadlines */
+	struct blast_comms_rto		*rto;
+	int				rto_ms;
 
 	/* Thread Wait Queues */
 	wait_queue_head_t		transmit_q;
 	wait_queue_head_t		watchdog_q;
-	wait_queue_head_t		receive_q;
-	wait_queue_head_t		framefinder_q;
-	wait_quene_head_t		decoder_q;
+	wait_queue_head_t		decoder_q;
 	wait_queue_head_t		readers_q;
 	wait_queue_head_t		writers_q;
 
 	struct task_struct		*transmit_thread;
 	struct task_struct 		*watchdog_thread;
-	struct task_struct 		*rawrecv_thread;
-	struct task_struct 		*framefnd_thread;
 	struct task_struct 		*receive_thread;
 
-	struct list_head 		*dev_list;
+	struct list_head 		dev_list;
 };
 
 /*
@@ -122,13 +197,15 @@ struct blast_comms_link_dev {
 static int blast_comms_link_ctrlinit(void);
 static void blast_comms_link_exit(void);
 static int blast_comms_cdev_add_minor(void);
-static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode);
-static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode);
+static int blast_comms_link_init(struct blast_comms_link_dev *dev, int mode,
+					int radios, double spacing, int fec);
+static inline struct blast_comms_link_dev *blast_comms_link_alloc(int mode,
+					int radios, double spacing, int fec);
 static void blast_comms_link_release(struct blast_comms_link_dev *dev);
 static int blast_comms_link_register(struct blast_comms_dev *dev);
 static int blast_comms_link_unregister(struct blast_comms_dev *dev);
-static int blast_comms_linkctrl_ioctl(struct inode *inode, struct file *filp,
-					unsigned int cmd, unsigned long arg);
+static long blast_comms_linkctrl_ioctl(struct file *filp, unsigned int cmd,
+							unsigned long arg);
 static int blast_comms_linkctrl_open(struct inode *inode, struct file *filp);
 static int blast_comms_linkctrl_release(struct inode *inode, struct file *filp);
 
@@ -0,0 +1,240 @@
+/**
+ * blast_comms_lt.c
+ *
+ * Fountain Coded Downlink
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * A rateless erasure code for links with no way back, switched on at the
+ * transmitting end with BLAST_COMMS_IOCTFOUNTAIN.  The transmit thread
+ * sends encoded symbols of the last block written until it is told to stop
+ * or the next block replaces it; the receiving end needs no setting, and
+ * sends no ACKs for them.
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <asm/unaligned.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * blast_comms_lt_alloc - allocate a link's fountain state
+ * Returns NULL on failure.
+ */
+static struct blast_comms_lt *blast_comms_lt_alloc(void)
+{
+	struct blast_comms_lt *lt;
+
+	lt = kzalloc(sizeof(struct blast_comms_lt), GFP_KERNEL);
+	if (!lt)
+		return NULL;
+
+	mutex_init(&lt->tx_lock);
+	mutex_init(&lt->rx_lock);
+
+	return lt;
+}
+
+/**
+ * blast_comms_lt_release - free a link's fountain state
+ * @lt: the state, or NULL
+ */
+static void blast_comms_lt_release(struct blast_comms_lt *lt)
+{
+	kfree(lt);
+}
+
+/**
+ * blast_comms_lt_mask - source symbols an encoded symbol is made of
+ * @id: block number
+ * @esi: encoded symbol number
+ * @k: source symbols in the block
+ * Bit n set for source symbol n.  Both ends must agree on this, so it is a
+ * fixed hash (the MurmurHash3 finaliser) rather than the kernel's PRNG.
+ */
+static u32 blast_comms_lt_mask(u8 id, u16 esi, int k)
+{
+	u32 x = (u32)id << 16 | esi;
+
+	if (esi < k)
+		return 1U << esi;
+
+	x ^= x >> 16;
+	x *= 0x85EBCA6B;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35;
+	x ^= x >> 16;
+
+	if (k < BLAST_COMMS_LT_K_MAX)
+		x &= (1U << k) - 1;
+
+	/* An empty symbol would be wasted air */
+	return x ? x : 1U << (esi % k);
+}
+
+/**
+ * blast_comms_lt_xor - dst ^= src
+ */
+static void blast_comms_lt_xor(u8 *dst, const u8 *src, size_t len)
+{
+	while (len--)
+		*dst++ ^= *src++;
+}
+
+/**
+ * blast_comms_lt_load - start sending a new block
+ * @lt: the state (tx_lock held), with the block in tx_block
+ * @sym: symbol length, at most BLAST_COMMS_LT_SYM_MAX
+ * @len: block length, at most BLAST_COMMS_LT_K_MAX symbols
+ * @overhead: percent more symbols than K to send before the next block
+ */
+static void blast_comms_lt_load(struct blast_comms_lt *lt, size_t sym,
+						size_t len, u32 overhead)
+{
+	lt->tx_k = max_t(int, DIV_ROUND_UP(len, sym), 1);
+	memset(&lt->tx_block[len], 0, lt->tx_k * sym - len);
+
+	lt->tx_id++;
+	lt->tx_sym = sym;
+	lt->tx_len = len;
+	lt->tx_esi = 0;
+	lt->tx_sent = 0;
+	lt->tx_min = DIV_ROUND_UP(lt->tx_k * (100 + overhead), 100);
+	lt->tx_active = 1;
+}
+
+/**
+ * blast_comms_lt_encode - make the next encoded symbol
+ * @lt: the state (tx_lock held, tx_active)
+ * @out: frame data, BLAST_COMMS_LT_HDRLEN + tx_sym bytes
+ * Returns the number of bytes written to out.
+ */
+static size_t blast_comms_lt_encode(struct blast_comms_lt *lt, u8 *out)
+{
+	u8 *sym = &out[BLAST_COMMS_LT_HDRLEN];
+	u32 mask;
+	int i;
+
+	out[0] = lt->tx_id;
+	out[1] = lt->tx_k;
+	put_unaligned_le16(lt->tx_esi, &out[2]);
+	put_unaligned_le16(lt->tx_len, &out[4]);
+
+	mask = blast_comms_lt_mask(lt->tx_id, lt->tx_esi, lt->tx_k);
+
+	memset(sym, 0, lt->tx_sym);
+	for (i = 0; i < lt->tx_k; i++)
+		if (mask & (1U << i))
+			blast_comms_lt_xor(sym, &lt->tx_block[i * lt->tx_sym],
+								lt->tx_sym);
+
+	lt->tx_esi++;
+	lt->tx_sent++;
+
+	return BLAST_COMMS_LT_HDRLEN + lt->tx_sym;
+}
+
+/**
+ * blast_comms_lt_decode - take in an encoded symbol
+ * @lt: the state (rx_lock held)
+ * @in: frame data
+ * @len: its length
+ * The rows are kept fully reduced: each holds a different source symbol
+ * (its pivot) XORed with only non-pivot ones, so a new symbol needs one
+ * pass to reduce and one to clear its pivot from the rest, and once every
+ * source symbol is a pivot the rows are the block.  A symbol of another
+ * block starts that one afresh.  Returns 1 when the block is decoded, 0 if
+ * not yet, or -EINVAL if the symbol makes no sense.
+ */
+static int blast_comms_lt_decode(struct blast_comms_lt *lt, const u8 *in,
+								size_t len)
+{
+	u8	id = in[0];
+	int	k = in[1];
+	u16	esi, blen;
+	size_t	sym;
+	u32	full, mask, b;
+	int	p;
+
+	if (len <= BLAST_COMMS_LT_HDRLEN)
+		return -EINVAL;
+
+	esi = get_unaligned_le16(&in[2]);
+	blen = get_unaligned_le16(&in[4]);
+	sym = len - BLAST_COMMS_LT_HDRLEN;
+
+	if (k < 1 || k > BLAST_COMMS_LT_K_MAX ||
+			sym > BLAST_COMMS_LT_SYM_MAX ||
+			blen > k * sym || blen <= (k - 1) * sym)
+		return -EINVAL;
+
+	if (lt->rx_state == BLAST_COMMS_LT_IDLE || id != lt->rx_id ||
+			k != lt->rx_k || sym != lt->rx_sym ||
+			blen != lt->rx_len) {
+		lt->rx_state = BLAST_COMMS_LT_DECODING;
+		lt->rx_id = id;
+		lt->rx_k = k;
+		lt->rx_sym = sym;
+		lt->rx_len = blen;
+		lt->rx_have = 0;
+	}
+
+	if (lt->rx_state != BLAST_COMMS_LT_DECODING)
+		return lt->rx_state == BLAST_COMMS_LT_DECODED;
+
+	full = k < BLAST_COMMS_LT_K_MAX ? (1U << k) - 1 : ~0U;
+	mask = blast_comms_lt_mask(id, esi, k);
+	memcpy(lt->rx_tmp, &in[BLAST_COMMS_LT_HDRLEN], sym);
+
+	/* Reduce by the rows we have */
+	while ((b = mask & lt->rx_have)) {
+		p = __ffs(b);
+		mask ^= lt->rx_mask[p];
+		blast_comms_lt_xor(lt->rx_tmp, lt->rx_row[p], sym);
+	}
+
+	/* Nothing new */
+	if (!mask)
+		return 0;
+
+	/* Clear the new pivot from the other rows */
+	p = __ffs(mask);
+	for (b = lt->rx_have; b; b &= b - 1) {
+		int q = __ffs(b);
+
+		if (lt->rx_mask[q] & (1U << p)) {
+			lt->rx_mask[q] ^= mask;
+			blast_comms_lt_xor(lt->rx_row[q], lt->rx_tmp, sym);
+		}
+	}
+
+	lt->rx_mask[p] = mask;
+	memcpy(lt->rx_row[p], lt->rx_tmp, sym);
+	lt->rx_have |= 1U << p;
+
+	if (lt->rx_have != full)
+		return 0;
+
+	lt->rx_state = BLAST_COMMS_LT_DECODED;
+
+	return 1;
+}
+
+/* EOF */
@@ -0,0 +1,98 @@
+/**
+ * blast_comms_lt.h
+ *
+ * Fountain Coded Downlink
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_LT_H_
+#define _BLAST_COMMS_LT_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/mutex.h>
+
+/*
+ * Source blocks and symbols
+ * Each write() is one source block, cut into K source symbols of the same
+ * size (the last padded with zeros).  Encoded symbols go one to a frame
+ * marked BLAST_COMMS_FRAME_CTL_LT, whose data is:
+ *	| BLOCK | K | ESI (LE16) | BLOCK LENGTH (LE16) | SYMBOL ... |
+ * Symbols 0 to K-1 are the source symbols themselves; each one after that
+ * is the XOR of a pseudo-random half of them, chosen by a hash of BLOCK
+ * and ESI that both ends compute.  Any K or so that arrive, whichever they
+ * are, give the block back.
+ */
+#define	BLAST_COMMS_LT_K_MAX		32	/* fits a u32 of neighbours */
+#define	BLAST_COMMS_LT_HDRLEN		6
+#define	BLAST_COMMS_LT_SYM_MAX		\
+		(BLAST_COMMS_FRAME_DATA_LEN - BLAST_COMMS_LT_HDRLEN)
+#define	BLAST_COMMS_LT_BLOCK_MAX	\
+		(BLAST_COMMS_LT_K_MAX * BLAST_COMMS_LT_SYM_MAX)	/* fits read_stack */
+#define	BLAST_COMMS_LT_OVERHEAD_MAX	1000	/* percent */
+
+/*
+ * Receive states
+ */
+#define	BLAST_COMMS_LT_IDLE		0
+#define	BLAST_COMMS_LT_DECODING		1
+#define	BLAST_COMMS_LT_DECODED		2	/* waiting for read_stack */
+#define	BLAST_COMMS_LT_DELIVERED	3
+
+/*
+ * Per link fountain state
+ */
+struct blast_comms_lt {
+	/* Transmit (writers and the transmit thread take tx_lock) */
+	struct mutex	tx_lock;
+	int		tx_active;		/** still sending the block */
+	u8		tx_id;
+	int		tx_k;
+	size_t		tx_sym;			/** symbol length */
+	u16		tx_len;			/** block length */
+	u16		tx_esi;			/** next to send */
+	u32		tx_sent;
+	u32		tx_min;			/** before the next block */
+	u8		tx_block[BLAST_COMMS_LT_BLOCK_MAX];
+
+	/* Receive (bonded radios' frame finders take rx_lock) */
+	struct mutex	rx_lock;
+	int		rx_state;
+	u8		rx_id;
+	int		rx_k;
+	size_t		rx_sym;
+	u16		rx_len;
+	u32		rx_have;		/** pivots, by source symbol */
+	u32		rx_mask[BLAST_COMMS_LT_K_MAX];	/** row neighbours */
+	u8		rx_row[BLAST_COMMS_LT_K_MAX][BLAST_COMMS_LT_SYM_MAX];
+	u8		rx_tmp[BLAST_COMMS_LT_SYM_MAX];
+};
+
+/*
+ * Function Prototypes
+ */
+struct blast_comms_frame;
+
+static struct blast_comms_lt *blast_comms_lt_alloc(void);
+static void blast_comms_lt_release(struct blast_comms_lt *lt);
+static u32 blast_comms_lt_mask(u8 id, u16 esi, int k);
+static void blast_comms_lt_xor(u8 *dst, const u8 *src, size_t len);
+static void blast_comms_lt_load(struct blast_comms_lt *lt, size_t sym,
+						size_t len, u32 overhead);
+static size_t blast_comms_lt_encode(struct blast_comms_lt *lt, u8 *out);
+static int blast_comms_lt_decode(struct blast_comms_lt *lt, const u8 *in,
+								size_t len);
+
+#endif /* _BLAST_COMMS_LT_H_ */
+
+/* EOF */
@@ -0,0 +1,216 @@
+/**
+ * blast_comms_lz4.c
+ *
+ * Payload Compression
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Optional LZ4 compression of the byte stream a link carries, switched on
+ * at the transmitting end with BLAST_COMMS_IOCTCOMPRESS.  The receiving end
+ * needs no setting; it decompresses whatever arrives marked compressed.
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * blast_comms_lz4_alloc - allocate a link's compression state
+ * Returns NULL on failure.
+ */
+static struct blast_comms_lz4 *blast_comms_lz4_alloc(void)
+{
+	struct blast_comms_lz4 *lz;
+
+	/* Two histories, too big for kmalloc */
+	lz = vzalloc(sizeof(struct blast_comms_lz4));
+	if (!lz)
+		return NULL;
+
+	sema_init(&lz->tx_sem, 1);
+
+	/* Nothing to refer back to until a block 0 */
+	lz->rx_num = -1;
+
+	return lz;
+}
+
+/**
+ * blast_comms_lz4_release - free a link's compression state
+ * @lz: the state, or NULL
+ */
+static void blast_comms_lz4_release(struct blast_comms_lz4 *lz)
+{
+	vfree(lz);
+}
+
+/**
+ * blast_comms_lz4_raw - where to put the raw data of the next block
+ * @lz: the state (tx_sem held)
+ * Returns room for BLAST_COMMS_LZ4_BLOCK bytes, in the history.
+ */
+static u8 *blast_comms_lz4_raw(struct blast_comms_lz4 *lz)
+{
+	/* Block 0 starts the history anew */
+	if (lz->tx_num == 0) {
+		LZ4_resetStream(&lz->tx_stream);
+		lz->tx_hist_len = 0;
+	}
+
+	return &lz->tx_hist[lz->tx_hist_len];
+}
+
+/**
+ * blast_comms_lz4_compress - make a block of the raw data
+ * @lz: the state (tx_sem held)
+ * @raw_len: bytes put where blast_comms_lz4_raw said, at most
+ *	BLAST_COMMS_LZ4_BLOCK
+ * Returns the length of the block left in tx_block.
+ */
+static size_t blast_comms_lz4_compress(struct blast_comms_lz4 *lz,
+							size_t raw_len)
+{
+	u8 *raw = &lz->tx_hist[lz->tx_hist_len];
+	u8 *data = &lz->tx_block[BLAST_COMMS_LZ4_HDRLEN];
+	int len;
+
+	len = LZ4_compress_fast_continue(&lz->tx_stream, (char *)raw,
+			(char *)data, raw_len,
+			BLAST_COMMS_LZ4_BUFLEN - BLAST_COMMS_LZ4_HDRLEN,
+			LZ4_ACCELERATION_DEFAULT);
+
+	/* Didn't shrink, store it; it is in the history all the same */
+	if (len <= 0 || len >= raw_len) {
+		memcpy(data, raw, raw_len);
+		len = raw_len;
+	}
+
+	put_unaligned_le16(len, &lz->tx_block[0]);
+	put_unaligned_le16(raw_len, &lz->tx_block[2]);
+	lz->tx_block[4] = lz->tx_num;
+
+	lz->tx_hist_len += raw_len;
+	lz->tx_num = (lz->tx_num + 1) % BLAST_COMMS_LZ4_RESYNC;
+
+	return BLAST_COMMS_LZ4_HDRLEN + len;
+}
+
+/**
+ * blast_comms_lz4_restart - start the history anew with the next block
+ * @lz: the state (tx_sem held)
+ * For when the last block wasn't all sent, so the receiver will drop it.
+ */
+static void blast_comms_lz4_restart(struct blast_comms_lz4 *lz)
+{
+	lz->tx_num = 0;
+}
+
+/**
+ * blast_comms_lz4_feed - add a received frame's data to the current block
+ * @lz: the state
+ * @data: the frame's data
+ * @len: the frame's data length
+ * @start: the frame starts a block
+ * Returns the number of bytes decompressed, left at rx_raw, when the frame
+ * completes a block, 0 if the block needs more, or -EBADMSG if the block
+ * was damaged or refers back to one that was (it is dropped, and the next
+ * frame starts a new one).
+ */
+static int blast_comms_lz4_feed(struct blast_comms_lz4 *lz, const u8 *data,
+						size_t len, int start)
+{
+	size_t comp_len, raw_len;
+	u8 *raw;
+	int num;
+	int result;
+
+	/* The last block was never finished */
+	if (start && lz->rx_len) {
+		lz->rx_len = 0;
+		lz->rx_errors++;
+		lz->rx_num = -1;
+	}
+
+	/* The start of this one was lost */
+	if (!start && !lz->rx_len)
+		goto bad_block;
+
+	if (lz->rx_len + len > BLAST_COMMS_LZ4_BUFLEN)
+		goto bad_block;
+
+	memcpy(&lz->rx_block[lz->rx_len], data, len);
+	lz->rx_len += len;
+
+	if (lz->rx_len < BLAST_COMMS_LZ4_HDRLEN)
+		return 0;
+
+	comp_len = get_unaligned_le16(&lz->rx_block[0]);
+	raw_len = get_unaligned_le16(&lz->rx_block[2]);
+	num = lz->rx_block[4];
+
+	if (raw_len > BLAST_COMMS_LZ4_BLOCK || comp_len > raw_len ||
+			num >= BLAST_COMMS_LZ4_RESYNC ||
+			BLAST_COMMS_LZ4_HDRLEN + comp_len < lz->rx_len)
+		goto bad_block;
+
+	if (lz->rx_len < BLAST_COMMS_LZ4_HDRLEN + comp_len)
+		return 0;
+
+	lz->rx_len = 0;
+
+	/* A block since the last block 0 was lost, and this one may refer
+	 * back to it
+	 */
+	if (num == 0)
+		lz->rx_hist_len = 0;
+	else if (num != lz->rx_num)
+		goto bad_block;
+
+	raw = &lz->rx_hist[lz->rx_hist_len];
+
+	if (comp_len == raw_len) {
+		/* Stored */
+		memcpy(raw, &lz->rx_block[BLAST_COMMS_LZ4_HDRLEN], raw_len);
+	} else {
+		/* The whole history is the dictionary, stored blocks too */
+		LZ4_setStreamDecode(&lz->rx_stream, (char *)lz->rx_hist,
+							lz->rx_hist_len);
+		result = LZ4_decompress_safe_continue(&lz->rx_stream,
+				(char *)&lz->rx_block[BLAST_COMMS_LZ4_HDRLEN],
+				(char *)raw, comp_len, raw_len);
+		if (result != raw_len)
+			goto bad_block;
+	}
+
+	lz->rx_hist_len += raw_len;
+	lz->rx_num = num + 1;
+	lz->rx_raw = raw;
+
+	return raw_len;
+
+bad_block:
+	lz->rx_len = 0;
+	lz->rx_errors++;
+	lz->rx_num = -1;
+	return -EBADMSG;
+}
+
+/* EOF */
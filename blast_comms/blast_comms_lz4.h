@@ -0,0 +1,90 @@
+/**
+ * blast_comms_lz4.h
+ *
+ * Payload Compression
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_LZ4_H_
+#define _BLAST_COMMS_LZ4_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/semaphore.h>
+#include <linux/lz4.h>
+
+/*
+ * Constants
+ * A compressed stream is a run of blocks, each the compressed form of up to
+ * BLAST_COMMS_LZ4_BLOCK bytes of one write():
+ *	| COMPRESSED LENGTH (LE16) | RAW LENGTH (LE16) | NUMBER | DATA ... |
+ * A block that wouldn't shrink is stored as it is, with both lengths equal.
+ * Blocks are compressed as one LZ4 stream, so a block may refer back to
+ * the ones before it and small writes still compress.  The history goes
+ * back to the last block numbered 0, which starts it anew; the transmitter
+ * numbers blocks up to BLAST_COMMS_LZ4_RESYNC, so a receiver that loses a
+ * block picks the stream up again at the next block 0.
+ * Blocks are chopped into frames marked BLAST_COMMS_FRAME_CTL_LZ4 and never
+ * share a frame, so each received frame completes at most one block.  The
+ * first frame of a block is also marked BLAST_COMMS_FRAME_CTL_LZ4_START, so
+ * the receiver can drop what it has of a block that was never finished.
+ */
+#define	BLAST_COMMS_LZ4_BLOCK		2048
+#define	BLAST_COMMS_LZ4_RESYNC		16	/* blocks per history */
+#define	BLAST_COMMS_LZ4_HIST		(BLAST_COMMS_LZ4_RESYNC * \
+					BLAST_COMMS_LZ4_BLOCK)
+#define	BLAST_COMMS_LZ4_HDRLEN		5
+#define	BLAST_COMMS_LZ4_BUFLEN		(BLAST_COMMS_LZ4_HDRLEN + \
+					LZ4_COMPRESSBOUND(BLAST_COMMS_LZ4_BLOCK))
+
+/*
+ * Per link compression state
+ * Each end keeps the raw data of the blocks since the last block 0 in its
+ * history, where LZ4 looks for it; the block being made or decompressed
+ * is added at hist_len.
+ */
+struct blast_comms_lz4 {
+	/* Transmit (writers take tx_sem) */
+	struct semaphore	tx_sem;
+	LZ4_stream_t		tx_stream;
+	u8			tx_hist[BLAST_COMMS_LZ4_HIST];
+	size_t			tx_hist_len;
+	u8			tx_num;		/** of the next block */
+	u8			tx_block[BLAST_COMMS_LZ4_BUFLEN];
+
+	/* Receive (receive thread only) */
+	LZ4_streamDecode_t	rx_stream;
+	u8			rx_block[BLAST_COMMS_LZ4_BUFLEN];
+	size_t			rx_len;		/** of rx_block */
+	u8			rx_hist[BLAST_COMMS_LZ4_HIST];
+	size_t			rx_hist_len;
+	int			rx_num;		/** expected, -1 lost */
+	u8			*rx_raw;	/** last block, in rx_hist */
+	unsigned long		rx_errors;	/** blocks dropped */
+};
+
+/*
+ * Function Prototypes
+ */
+static struct blast_comms_lz4 *blast_comms_lz4_alloc(void);
+static void blast_comms_lz4_release(struct blast_comms_lz4 *lz);
+static u8 *blast_comms_lz4_raw(struct blast_comms_lz4 *lz);
+static size_t blast_comms_lz4_compress(struct blast_comms_lz4 *lz,
+							size_t raw_len);
+static void blast_comms_lz4_restart(struct blast_comms_lz4 *lz);
+static int blast_comms_lz4_feed(struct blast_comms_lz4 *lz, const u8 *data,
+						size_t len, int start);
+
+#endif /* _BLAST_COMMS_LZ4_H_ */
+
+/* EOF */
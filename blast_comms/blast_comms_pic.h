@@ -25,6 +25,7 @@
 #define BLAST_COMMS_PIC_CLEARRAM	0x10
 #define	BLAST_COMMS_PIC_PUTRAM		0x11
 #define	BLAST_COMMS_PIC_GETRAM		0x12
+#define	BLAST_COMMS_PIC_PUTRAMN		0x13	/* batched PUT RAM */
 #define	BLAST_COMMS_PIC_PUTXCVR		0x21
 #define	BLAST_COMMS_PIC_GETXCVR		0x22
 
@@ -39,6 +40,35 @@
 #define	BLAST_COMMS_PIC_MODE_RECEIVE	0x03
 #define	BLAST_COMMS_PIC_MODE_SHUTDOWN	0x0F
 
+/*
+ * Command/response framing: | CMD/RESP | TAG | LENGTH (LE16) | DATA ... |
+ * The PIC echoes the tag of the command in its response, and may answer
+ * commands out of order (e.g. a GET RAM is held until data arrives).
+ */
+#define	BLAST_COMMS_PIC_HDRLEN		4
+
+#define	BLAST_COMMS_PIC_TAGS		32	/* completion table entries */
+#define	BLAST_COMMS_PIC_TAG_MASK	0x1F	/* table index bits */
+#define	BLAST_COMMS_PIC_TAG_GEN		0x20	/* generation increment */
+#define	BLAST_COMMS_PIC_CMDMAXLEN	(4096 - BLAST_COMMS_PIC_HDRLEN)
+
+/*
+ * PUT RAM data is a single frame, its length that of the command.
+ * Batched PUT RAM data:
+ *	| COUNT | LEN 0 | ... | LEN COUNT-1 | FRAME 0 | ... | FRAME COUNT-1 |
+ * Frames vary in length.  The PIC keeps each one's length with it in the
+ * FIFO and programs the RFM23's transmit packet length as it starts it.
+ */
+#define	BLAST_COMMS_PIC_BATCH_HDRLEN	1	/* plus one byte per frame */
+#define	BLAST_COMMS_PIC_FRAME_MAX	255	/* RFM_REG_TX_PKT_LEN */
+
+/*
+ * Most frames that fit in one batched PUT RAM, each with its length byte
+ */
+#define	BLAST_COMMS_PIC_BATCH_MAX	((BLAST_COMMS_PIC_CMDMAXLEN -	\
+					BLAST_COMMS_PIC_BATCH_HDRLEN) /	\
+					(BLAST_COMMS_WIRE_MAX + 1))
+
 #endif /* _BLAST_COMMS_PIC_H_ */
 
 /* EOF */
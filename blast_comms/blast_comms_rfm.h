@@ -146,6 +146,15 @@
 #define	RFM_TX_POWER_10_DBM	0x6 		/* 10 dBm */
 #define	RFM_TX_POWER_13_DBM	0x7 		/* 13 dBm */
 
+/* Operating Mode (RFM_REG_OPERATING_MODE) */
+#define	RFM_MODE_STANDBY	0x00
+#define	RFM_MODE_READY		0x01	/* crystal on */
+#define	RFM_MODE_RX		0x05
+#define	RFM_MODE_TX		0x09
+
+/* Modulation Mode Control 2 (RFM_REG_MOD_MODE_2) */
+#define	RFM_MODE_FIFO		0x22	/* FIFO data source, FSK */
+
 /* Data Rate Constants */
 #define	RFM_TX_DR_2_21		2097152			/* 2^21 */
 #define	RFM_TX_DR_2_16		65536			/* 2^16 */
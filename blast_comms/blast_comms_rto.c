@@ -0,0 +1,254 @@
+/**
+ * blast_comms_rto.c
+ *
+ * Retransmission Deadlines
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Each sent frame has its own deadline, to the millisecond, and the
+ * watchdog only wakes when one of them passes; what it does then costs in
+ * the number of frames expired, not the size of the stack.
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * blast_comms_rto_alloc - allocate a link's deadlines
+ * @dev: the link
+ * Returns NULL on failure.
+ */
+static struct blast_comms_rto *blast_comms_rto_alloc(
+					struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_rto *rto;
+	int i;
+
+	rto = kzalloc(sizeof(struct blast_comms_rto), GFP_KERNEL);
+	if (!rto)
+		return NULL;
+
+	rto->dev = dev;
+	for (i = 0; i < BLAST_COMMS_RTO_SLOTS; i++)
+		rto->pos[i] = -1;
+
+	hrtimer_init(&rto->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	rto->timer.function = blast_comms_rto_expire;
+
+	return rto;
+}
+
+/**
+ * blast_comms_rto_release - free a link's deadlines
+ * @rto: the deadlines, or NULL
+ */
+static void blast_comms_rto_release(struct blast_comms_rto *rto)
+{
+	if (!rto)
+		return;
+
+	hrtimer_cancel(&rto->timer);
+	kfree(rto);
+}
+
+/**
+ * blast_comms_rto_expire - the earliest deadline has passed
+ * @timer: the link's timer
+ * Runs in interrupt context, so leaves the work to the watchdog.
+ */
+static enum hrtimer_restart blast_comms_rto_expire(struct hrtimer *timer)
+{
+	struct blast_comms_rto *rto = container_of(timer,
+					struct blast_comms_rto, timer);
+
+	wake_up(&rto->dev->watchdog_q);
+
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * blast_comms_rto_swap - swap two heap entries
+ */
+static void blast_comms_rto_swap(struct blast_comms_rto *rto, int i, int j)
+{
+	u8 seq = rto->heap[i];
+
+	rto->heap[i] = rto->heap[j];
+	rto->heap[j] = seq;
+	rto->pos[rto->heap[i]] = i;
+	rto->pos[rto->heap[j]] = j;
+}
+
+/**
+ * blast_comms_rto_up - move an entry up to where it belongs
+ */
+static void blast_comms_rto_up(struct blast_comms_rto *rto, int i)
+{
+	int p;
+
+	while (i > 0) {
+		p = (i - 1) / 2;
+		if (rto->sent[rto->heap[p]] <= rto->sent[rto->heap[i]])
+			break;
+
+		blast_comms_rto_swap(rto, i, p);
+		i = p;
+	}
+}
+
+/**
+ * blast_comms_rto_down - move an entry down to where it belongs
+ */
+static void blast_comms_rto_down(struct blast_comms_rto *rto, int i)
+{
+	int c;
+
+	while ((c = 2 * i + 1) < rto->count) {
+		if (c + 1 < rto->count &&
+			rto->sent[rto->heap[c + 1]] < rto->sent[rto->heap[c]])
+			c++;
+
+		if (rto->sent[rto->heap[i]] <= rto->sent[rto->heap[c]])
+			break;
+
+		blast_comms_rto_swap(rto, i, c);
+		i = c;
+	}
+}
+
+/**
+ * blast_comms_rto_restart - set the timer for the earliest deadline
+ * @dev: the link (tx_data_stack lock held)
+ * An empty heap leaves the timer as it is; waking the watchdog early only
+ * costs it a look.
+ */
+static void blast_comms_rto_restart(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_rto *rto = dev->rto;
+
+	if (!rto->count)
+		return;
+
+	hrtimer_start(&rto->timer, ns_to_ktime(rto->sent[rto->heap[0]] +
+				(s64)dev->rto_ms * NSEC_PER_MSEC),
+				HRTIMER_MODE_ABS);
+}
+
+/**
+ * blast_comms_rto_arm - a frame has (just) been sent
+ * @dev: the link (tx_data_stack lock held)
+ * @seq: its sequence number
+ */
+static void blast_comms_rto_arm(struct blast_comms_link_dev *dev, u8 seq)
+{
+	struct blast_comms_rto *rto = dev->rto;
+	int top = rto->count ? rto->heap[0] : -1;
+
+	rto->sent[seq] = ktime_to_ns(ktime_get());
+
+	/* Now is the latest, so it goes to the bottom */
+	if (rto->pos[seq] < 0) {
+		rto->pos[seq] = rto->count;
+		rto->heap[rto->count++] = seq;
+	} else {
+		blast_comms_rto_down(rto, rto->pos[seq]);
+	}
+
+	if (rto->heap[0] != top || seq == top)
+		blast_comms_rto_restart(dev);
+}
+
+/**
+ * blast_comms_rto_cancel - a frame no longer needs its deadline
+ * @dev: the link (tx_data_stack lock held)
+ * @seq: its sequence number
+ */
+static void blast_comms_rto_cancel(struct blast_comms_link_dev *dev, u8 seq)
+{
+	struct blast_comms_rto *rto = dev->rto;
+	int i = rto->pos[seq];
+
+	if (i < 0)
+		return;
+
+	rto->pos[seq] = -1;
+	rto->count--;
+
+	/* The last entry fills the hole, and goes whichever way it must */
+	if (i != rto->count) {
+		seq = rto->heap[rto->count];
+		rto->heap[i] = seq;
+		rto->pos[seq] = i;
+		blast_comms_rto_up(rto, i);
+		blast_comms_rto_down(rto, rto->pos[seq]);
+	}
+
+	if (i == 0)
+		blast_comms_rto_restart(dev);
+}
+
+/**
+ * blast_comms_rto_due - has the earliest deadline passed
+ * @dev: the link
+ * For the watchdog's wait, without the lock; blast_comms_rto_pop decides.
+ */
+static int blast_comms_rto_due(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_rto *rto = dev->rto;
+
+	return rto->count && ktime_to_ns(ktime_get()) >=
+			rto->sent[rto->heap[0]] +
+			(s64)dev->rto_ms * NSEC_PER_MSEC;
+}
+
+/**
+ * blast_comms_rto_pop - take off a frame whose deadline has passed
+ * @dev: the link (tx_data_stack lock held)
+ * Returns its sequence number, or -1 if there are none.
+ */
+static int blast_comms_rto_pop(struct blast_comms_link_dev *dev)
+{
+	struct blast_comms_rto *rto = dev->rto;
+	u8 seq;
+
+	if (!blast_comms_rto_due(dev))
+		return -1;
+
+	seq = rto->heap[0];
+	blast_comms_rto_cancel(dev, seq);
+
+	return seq;
+}
+
+/**
+ * blast_comms_rto_older - was a frame sent at least this long ago
+ * @dev: the link (tx_data_stack lock held)
+ * @seq: its sequence number
+ * @ms: how long
+ */
+static int blast_comms_rto_older(struct blast_comms_link_dev *dev, u8 seq,
+								int ms)
+{
+	return ktime_to_ns(ktime_get()) - dev->rto->sent[seq] >=
+						(s64)ms * NSEC_PER_MSEC;
+}
+
+/* EOF */
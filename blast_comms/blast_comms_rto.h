@@ -0,0 +1,73 @@
+/**
+ * blast_comms_rto.h
+ *
+ * Retransmission Deadlines
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_RTO_H_
+#define _BLAST_COMMS_RTO_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/hrtimer.h>
+
+/*
+ * Constants
+ * A sent frame is sent again if it hasn't been ACKed the link's RTO after
+ * it went (BLAST_COMMS_IOCTRTO).
+ */
+#define	BLAST_COMMS_RTO_DEFAULT		1000	/* ms */
+#define	BLAST_COMMS_RTO_MIN		10	/* ms */
+#define	BLAST_COMMS_RTO_MAX		60000	/* ms */
+#define	BLAST_COMMS_RTO_SLOTS		(BLAST_COMMS_FRAME_SEQNUM_LIM + 1)
+
+/*
+ * Per link deadlines
+ * A min-heap of the sent, unACKed frames by the time they went, so the
+ * first to expire is at the top and the others expire in the same order
+ * whatever the RTO.  One hrtimer is set for the top, and wakes the
+ * watchdog.  All under the tx_data_stack lock.
+ */
+struct blast_comms_link_dev;
+
+struct blast_comms_rto {
+	struct blast_comms_link_dev	*dev;
+	struct hrtimer			timer;
+	int				count;
+	u8				heap[BLAST_COMMS_RTO_SLOTS];	/** seq */
+	s16				pos[BLAST_COMMS_RTO_SLOTS];	/** by seq */
+	s64				sent[BLAST_COMMS_RTO_SLOTS];	/** ns */
+};
+
+/*
+ * Function Prototypes
+ */
+static struct blast_comms_rto *blast_comms_rto_alloc(
+					struct blast_comms_link_dev *dev);
+static void blast_comms_rto_release(struct blast_comms_rto *rto);
+static enum hrtimer_restart blast_comms_rto_expire(struct hrtimer *timer);
+static void blast_comms_rto_swap(struct blast_comms_rto *rto, int i, int j);
+static void blast_comms_rto_up(struct blast_comms_rto *rto, int i);
+static void blast_comms_rto_down(struct blast_comms_rto *rto, int i);
+static void blast_comms_rto_restart(struct blast_comms_link_dev *dev);
+static void blast_comms_rto_arm(struct blast_comms_link_dev *dev, u8 seq);
+static void blast_comms_rto_cancel(struct blast_comms_link_dev *dev, u8 seq);
+static int blast_comms_rto_due(struct blast_comms_link_dev *dev);
+static int blast_comms_rto_pop(struct blast_comms_link_dev *dev);
+static int blast_comms_rto_older(struct blast_comms_link_dev *dev, u8 seq,
+								int ms);
+
+#endif /* _BLAST_COMMS_RTO_H_ */
+
+/* EOF */
@@ -0,0 +1,273 @@
+/**
+ * blast_comms_stats.c
+ *
+ * USB Round-trip Statistics (debugfs)
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Each device gets a directory, named after its USB device, under
+ * <debugfs>/blast-comms/ containing:
+ *	latency		per command histograms; write anything to clear
+ *	counters	transmit ring and receive ring counters
+ */
+
+/*
+ * Linux inclusions
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+
+/*
+ * Local inclusions
+ */
+#include "blast_comms.h"
+
+/**
+ * debugfs root
+ */
+static struct dentry *blast_comms_stats_root;
+
+/**
+ * Names of the things timed, indexed by BLAST_COMMS_STATS_*
+ */
+static const char *blast_comms_stats_names[BLAST_COMMS_STATS_TYPES] = {
+	"RESET", "SETMODE", "SHUTDOWN", "CLEARRAM", "PUTRAM", "GETRAM",
+	"PUTRAMN", "PUTXCVR", "GETXCVR", "other", "usb-out", "usb-bulk"
+};
+
+/**
+ * blast_comms_stats_type - which histogram a PIC command is timed in
+ * @cmd: PIC command byte
+ */
+static int blast_comms_stats_type(unsigned int cmd)
+{
+	switch (cmd) {
+	case BLAST_COMMS_PIC_RESET:	return BLAST_COMMS_STATS_RESET;
+	case BLAST_COMMS_PIC_SETMODE:	return BLAST_COMMS_STATS_SETMODE;
+	case BLAST_COMMS_PIC_SHUTDOWN:	return BLAST_COMMS_STATS_SHUTDOWN;
+	case BLAST_COMMS_PIC_CLEARRAM:	return BLAST_COMMS_STATS_CLEARRAM;
+	case BLAST_COMMS_PIC_PUTRAM:	return BLAST_COMMS_STATS_PUTRAM;
+	case BLAST_COMMS_PIC_GETRAM:	return BLAST_COMMS_STATS_GETRAM;
+	case BLAST_COMMS_PIC_PUTRAMN:	return BLAST_COMMS_STATS_PUTRAMN;
+	case BLAST_COMMS_PIC_PUTXCVR:	return BLAST_COMMS_STATS_PUTXCVR;
+	case BLAST_COMMS_PIC_GETXCVR:	return BLAST_COMMS_STATS_GETXCVR;
+	default:			return BLAST_COMMS_STATS_OTHER;
+	}
+}
+
+/**
+ * blast_comms_stats_record - account for one completed round trip
+ * @stats: the device's statistics
+ * @type: BLAST_COMMS_STATS_*
+ * @start: when the command was sent
+ * @status: PIC response code, or -ve error
+ * Safe from interrupt context.  Only successful round trips go in the
+ * histogram; timeouts and errors would just measure the timeout.
+ */
+static void blast_comms_stats_record(struct blast_comms_stats *stats,
+					int type, ktime_t start, int status)
+{
+	struct blast_comms_stats_hist *hist = &stats->hist[type];
+	unsigned long flags;
+	s64 us;
+
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	if (us < 0)
+		us = 0;
+
+	spin_lock_irqsave(&stats->lock, flags);
+
+	if (status == -ETIMEDOUT) {
+		hist->timeouts++;
+	} else if (status < 0) {
+		hist->errors++;
+	} else {
+		if (status == BLAST_COMMS_PIC_NACK ||
+					status == BLAST_COMMS_PIC_EXNACK)
+			hist->nacks++;
+
+		hist->bucket[min_t(int, fls64(us),
+					BLAST_COMMS_STATS_BUCKETS - 1)]++;
+		hist->count++;
+		hist->total_us += us;
+		if (us > hist->max_us)
+			hist->max_us = us;
+	}
+
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+
+/**
+ * blast_comms_stats_latency_show - print the histograms
+ * @s: the seq_file
+ * @v: unused
+ * One line per command that has been seen: name, samples, mean and max
+ * (us), timeouts, NACKs, errors, then the bucket counts.
+ */
+static int blast_comms_stats_latency_show(struct seq_file *s, void *v)
+{
+	struct blast_comms_stats *stats = s->private;
+	struct blast_comms_stats_hist hist;
+	unsigned long flags;
+	int type, i;
+
+	seq_puts(s, "# type count mean_us max_us timeouts nacks errors |");
+	for (i = 0; i < BLAST_COMMS_STATS_BUCKETS; i++)
+		seq_printf(s, " <%lu", 1UL << i);
+	seq_puts(s, "\n");
+
+	for (type = 0; type < BLAST_COMMS_STATS_TYPES; type++) {
+		spin_lock_irqsave(&stats->lock, flags);
+		hist = stats->hist[type];
+		spin_unlock_irqrestore(&stats->lock, flags);
+
+		if (!hist.count && !hist.timeouts && !hist.errors)
+			continue;
+
+		seq_printf(s, "%s %llu %llu %u %u %u %u |",
+				blast_comms_stats_names[type], hist.count,
+				hist.count ? div64_u64(hist.total_us,
+							hist.count) : 0,
+				hist.max_us, hist.timeouts, hist.nacks,
+				hist.errors);
+		for (i = 0; i < BLAST_COMMS_STATS_BUCKETS; i++)
+			seq_printf(s, " %u", hist.bucket[i]);
+		seq_puts(s, "\n");
+	}
+
+	return 0;
+}
+
+static int blast_comms_stats_latency_open(struct inode *inode,
+							struct file *filp)
+{
+	return single_open(filp, blast_comms_stats_latency_show,
+							inode->i_private);
+}
+
+/**
+ * blast_comms_stats_latency_write - clear the histograms
+ */
+static ssize_t blast_comms_stats_latency_write(struct file *filp,
+				const char __user *buf, size_t count,
+				loff_t *f_pos)
+{
+	struct blast_comms_stats *stats =
+		((struct seq_file *)filp->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats->lock, flags);
+	memset(stats->hist, 0, sizeof(stats->hist));
+	spin_unlock_irqrestore(&stats->lock, flags);
+
+	return count;
+}
+
+static const struct file_operations blast_comms_stats_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = blast_comms_stats_latency_open,
+	.read = seq_read,
+	.write = blast_comms_stats_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/**
+ * blast_comms_stats_counters_show - print the ring counters
+ * @s: the seq_file
+ * @v: unused
+ */
+static int blast_comms_stats_counters_show(struct seq_file *s, void *v)
+{
+	struct blast_comms_dev *dev = s->private;
+
+	seq_printf(s, "tx_inflight %d\n", atomic_read(&dev->tx_inflight));
+	seq_printf(s, "tx_nacks %d\n", atomic_read(&dev->tx_nacks));
+	seq_printf(s, "rx_streaming %d\n", dev->rx_streaming);
+	seq_printf(s, "rx_overruns %d\n", atomic_read(&dev->rx_overruns));
+
+	return 0;
+}
+
+static int blast_comms_stats_counters_open(struct inode *inode,
+							struct file *filp)
+{
+	return single_open(filp, blast_comms_stats_counters_show,
+							inode->i_private);
+}
+
+static const struct file_operations blast_comms_stats_counters_fops = {
+	.owner = THIS_MODULE,
+	.open = blast_comms_stats_counters_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/**
+ * blast_comms_stats_module_init - create the debugfs root
+ * Failure is not fatal; the statistics are still gathered.
+ */
+static void blast_comms_stats_module_init(void)
+{
+	blast_comms_stats_root = debugfs_create_dir(DRIVER_NAME, NULL);
+}
+
+/**
+ * blast_comms_stats_module_exit - remove the debugfs root
+ */
+static void blast_comms_stats_module_exit(void)
+{
+	debugfs_remove_recursive(blast_comms_stats_root);
+	blast_comms_stats_root = NULL;
+}
+
+/**
+ * blast_comms_stats_init - set up a device's statistics
+ * @dev: the device (usb_dev must be set)
+ */
+static void blast_comms_stats_init(struct blast_comms_dev *dev)
+{
+	struct blast_comms_stats *stats = &dev->stats;
+
+	spin_lock_init(&stats->lock);
+	memset(stats->hist, 0, sizeof(stats->hist));
+
+	if (IS_ERR_OR_NULL(blast_comms_stats_root))
+		return;
+
+	stats->dir = debugfs_create_dir(dev_name(&dev->usb_dev->dev),
+						blast_comms_stats_root);
+	if (IS_ERR_OR_NULL(stats->dir))
+		return;
+
+	debugfs_create_file("latency", S_IRUGO | S_IWUSR, stats->dir, stats,
+					&blast_comms_stats_latency_fops);
+	debugfs_create_file("counters", S_IRUGO, stats->dir, dev,
+					&blast_comms_stats_counters_fops);
+}
+
+/**
+ * blast_comms_stats_release - remove a device's debugfs directory
+ * @dev: the device
+ */
+static void blast_comms_stats_release(struct blast_comms_dev *dev)
+{
+	debugfs_remove_recursive(dev->stats.dir);
+	dev->stats.dir = NULL;
+}
+
+/* EOF */
@@ -0,0 +1,89 @@
+/**
+ * blast_comms_stats.h
+ *
+ * USB Round-trip Statistics (debugfs)
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_COMMS_STATS_H_
+#define _BLAST_COMMS_STATS_H_
+
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+
+/*
+ * Constants
+ */
+#define	BLAST_COMMS_STATS_BUCKETS	24	/* log2(us), up to ~8s */
+
+/*
+ * What is being timed: one entry per PIC command (command to tagged
+ * response), plus the raw USB transfers underneath them.
+ */
+#define	BLAST_COMMS_STATS_RESET		0
+#define	BLAST_COMMS_STATS_SETMODE	1
+#define	BLAST_COMMS_STATS_SHUTDOWN	2
+#define	BLAST_COMMS_STATS_CLEARRAM	3
+#define	BLAST_COMMS_STATS_PUTRAM	4
+#define	BLAST_COMMS_STATS_GETRAM	5
+#define	BLAST_COMMS_STATS_PUTRAMN	6
+#define	BLAST_COMMS_STATS_PUTXCVR	7
+#define	BLAST_COMMS_STATS_GETXCVR	8
+#define	BLAST_COMMS_STATS_OTHER		9
+#define	BLAST_COMMS_STATS_USB_OUT	10	/* command buffer transfer */
+#define	BLAST_COMMS_STATS_USB_BULK	11	/* usb_bulk_msg() */
+#define	BLAST_COMMS_STATS_TYPES		12
+
+/*
+ * Latency histogram
+ * bucket[0] counts sub-microsecond samples, bucket[i] counts samples of
+ * 2^(i-1) to 2^i - 1 us; the last bucket also takes anything longer.
+ */
+struct blast_comms_stats_hist {
+	u32	bucket[BLAST_COMMS_STATS_BUCKETS];
+	u64	count;				/** samples */
+	u64	total_us;			/** for the mean */
+	u32	max_us;				/** worst seen */
+	u32	timeouts;			/** gave up waiting */
+	u32	nacks;				/** PIC said no */
+	u32	errors;				/** USB errors */
+};
+
+/*
+ * Per device statistics
+ */
+struct blast_comms_stats {
+	struct dentry			*dir;	/** debugfs directory */
+	spinlock_t			lock;
+	struct blast_comms_stats_hist	hist[BLAST_COMMS_STATS_TYPES];
+};
+
+/*
+ * Function Prototypes
+ */
+struct blast_comms_dev;
+
+static void blast_comms_stats_module_init(void);
+static void blast_comms_stats_module_exit(void);
+static void blast_comms_stats_init(struct blast_comms_dev *dev);
+static void blast_comms_stats_release(struct blast_comms_dev *dev);
+static int blast_comms_stats_type(unsigned int cmd);
+static void blast_comms_stats_record(struct blast_comms_stats *stats,
+					int type, ktime_t start, int status);
+
+#endif /* _BLAST_COMMS_STATS_H_ */
+
+/* EOF */
@@ -26,7 +26,9 @@
 #include <linux/kfifo.h>
 #include <linux/wait.h>
 #include <linux/atomic.h>
+#include <linux/workqueue.h>
 #include <linux/rslib.h>
+#include <asm/unaligned.h>
 
 /*
  * Local inclusions
@@ -35,14 +37,27 @@
 
 /**
  * blast_comms_transmit_thread
- * @dev: the device structure
+ * @data: the link
  * This routine is initailised as work in a workqueue kernel thread by open().
- * It scans the transmit queue for unsent frames and sends them.
+ * It scans the transmit queue for unsent frames and sends them.  On a bonded
+ * link each frame goes to radio (sequence number % radios), so the frames are
+ * striped across the radios and the receiver reorders them by sequence.
+ * With interleaving on, each radio's batch goes as interleaved groups.
  */
-static void blast_comms_transmit_thread(struct blast_comms_link_dev *dev)
+static int blast_comms_transmit_thread(void *data)
 {
+	struct blast_comms_link_dev *dev = data;
 	long this_frame = 0;			/* stack frame counter */
 	struct blast_comms_frame frame;		/* meta frame storage */
+	struct blast_comms_frame *batch_frames[BLAST_COMMS_PIC_BATCH_MAX];
+	u16 batch_idx[BLAST_COMMS_BOND_MAX][BLAST_COMMS_PIC_BATCH_MAX];
+	int batch[BLAST_COMMS_BOND_MAX];	/* frames per radio */
+	int gathered;				/* frames in all batches */
+	int marked;				/* of them, still to be sent */
+	int depth;				/* interleaving */
+	int radio;
+	u16 seq;
+	int i;
 
 	while (!kthread_should_stop()) {
 		/* Check meta frame stack first (for NACK/ACKs) */
@@ -50,51 +65,107 @@ static void blast_comms_transmit_thread(struct blast_comms_link_dev *dev)
 			/* Get the meta frame */
 			kfifo_get(dev->tx_meta_stack, &frame);
 
-			/* Copy it to the device for transmission */
-			blast_comms_pic_tx_write(dev, &frame);
+			/* Copy it to a radio for transmission */
+			blast_comms_pic_tx_write(dev->txs[frame.seq_num % \
+						dev->radios], &frame);
 		}
 
-		if (atomic_read(&dev->unsent) < 1)
+		/* Fountain coding: a symbol between looks at the stack */
+		if (blast_comms_lt_transmit(dev, &frame))
+			blast_comms_pic_tx_write(dev->txs[frame.seq_num % \
+						dev->radios], &frame);
+
+		if ((atomic_read(&dev->unsent) < 1) && !dev->lt->tx_active)
 			wait_event_interruptible(dev->transmit_q,
 				(!kfifo_is_empty(dev->tx_meta_stack) || \
-				(atomic_read(&dev->unsent) > 0)));
-
-		/* Now scan the data frame stack for unsent, ready frames */
-		while ((this_frame < dev->tx_data_stack.size) && \
-					(atomic_read(&dev->unsent) > 0)) {
+				(atomic_read(&dev->unsent) > 0) || \
+				dev->lt->tx_active));
+
+		/* Now scan the data frame stack for unsent, ready frames,
+		 * gathering as many as fit in one batched PUT RAM per radio
+		 */
+		memset(batch, 0, sizeof(batch));
+		gathered = 0;
+		while ((this_frame < dev->tx_data_stack->size) && \
+				(atomic_read(&dev->unsent) > gathered)) {
 			/* Is it unsent and ready? */
-			if (dev->tx_data_stack.map[this_frame] & \
-						BLAST_COMMS_STACK_MAP_READY) {
-				/* Then copy it to the device, marking it in the
-				 * stack as sent and updating counters
-				 */
-				blast_comms_pic_tx_write(dev,
-					&dev->tx_data_stack.frame[this_frame]);
-
-				spin_lock(&dev->tx_data_stack.lock);
+			if ((dev->tx_data_stack->map[this_frame] & \
+					(BLAST_COMMS_STACK_MAP_READY | \
+					BLAST_COMMS_STACK_MAP_SENT)) == \
+					BLAST_COMMS_STACK_MAP_READY) {
+				radio = this_frame % dev->radios;
+
+				/* That radio's batch is full, send first */
+				if (batch[radio] == BLAST_COMMS_PIC_BATCH_MAX)
+					break;
+
+				batch_idx[radio][batch[radio]++] = this_frame;
+				gathered++;
+
+				if (dev->mode == BLAST_COMMS_RTX)
+					blast_comms_ack_attach(dev,
+						&dev->tx_data_stack->frame[
+								this_frame]);
+			}
 
-				dev->tx_data_stack.map[this_frame] =  	     \
-					dev->tx_data_stack.map[this_frame] | \
-					BLAST_COMMS_STACK_MAP_SENT;
+			/* Increment counter, next frame */
+			this_frame++;
+		}
 
-				spin_unlock(&dev->tx_data_stack.lock);
+		depth = dev->ilv_depth;
+		marked = 0;
 
-				atomic_dec(&dev->unsent);
-				atomic_inc(&dev->unack);
+		for (radio = 0; radio < dev->radios; radio++) {
+			if (batch[radio] == 0)
+				continue;
 
-				/* Increment counter, and break out of scanning
-				 * to check again for meta frames
-				 */
-				this_frame++;
-				break;
-			} else {
-				/* Increment counter, next frame */
-				this_frame++;
+			/* Copy the batch to the radio, then mark each frame
+			 * in the stack as sent
+			 */
+			for (i = 0; i < batch[radio]; i++)
+				batch_frames[i] = &dev->tx_data_stack->frame[
+							batch_idx[radio][i]];
+
+			if (depth > 1)
+				for (i = 0; i < batch[radio]; i += depth)
+					blast_comms_pic_tx_write_ilv(
+						dev->txs[radio],
+						&batch_frames[i],
+						min(depth, batch[radio] - i),
+						dev->ilv_group++);
+			else
+				blast_comms_pic_tx_write_batch(dev->txs[radio],
+						batch_frames, batch[radio]);
+
+			/* Only those still ready: an ACK may have cleared
+			 * some since they were gathered, and
+			 * blast_comms_arq_clear has counted them already
+			 */
+			spin_lock(&dev->tx_data_stack->lock);
+			for (i = 0; i < batch[radio]; i++) {
+				seq = batch_idx[radio][i];
+				if ((dev->tx_data_stack->map[seq] & \
+					(BLAST_COMMS_STACK_MAP_READY | \
+					BLAST_COMMS_STACK_MAP_SENT)) != \
+					BLAST_COMMS_STACK_MAP_READY)
+					continue;
+
+				dev->tx_data_stack->map[seq] |= \
+						BLAST_COMMS_STACK_MAP_SENT;
+				blast_comms_rto_arm(dev, seq);
+				marked++;
 			}
+			spin_unlock(&dev->tx_data_stack->lock);
+		}
+
+		/* Update counters */
+		if (marked > 0) {
+			atomic_sub(marked, &dev->unsent);
+			atomic_add(marked, &dev->unack);
 		}
 
 		/* Have we scanned the whole stack? */
-		if (this_frame >= dev->tx_data_stack.size) {
+		if (this_frame >= dev->tx_data_stack->size) {
 			/* Reset the counter and empty the meta stack
 			 * into the device
 			 */
@@ -103,244 +174,539 @@ static void blast_comms_transmit_thread(struct blast_comms_link_dev *dev)
 			while (!kfifo_is_empty(dev->tx_meta_stack)) {
 				kfifo_get(dev->tx_meta_stack, &frame);
 
-				blast_comms_pic_tx_write(dev, &frame);
+				blast_comms_pic_tx_write(dev->txs[frame.seq_num % \
+							dev->radios], &frame);
 			}
 
 			/* Sleep */
 			wait_event_interruptible_timeout(dev->transmit_q,
 				(!kfifo_is_empty(dev->tx_meta_stack) || \
-				(atomic_read(&dev->unsent) > 0)),
+				(atomic_read(&dev->unsent) > 0) || \
+				dev->lt->tx_active),
 				BLAST_COMMS_TRANSMIT_THREAD_TIMEOUT);
 		}
 	}
+
+	return 0;
 }
 
 /**
  * blast_comms_watchdog
- * @dev: the device structure
+ * @data: the link
  * This routine is initailised as work in a workqueue kernel thread by
- * open().  It scans the transmit queue periodically to check for sent, but
- * unacknowledged frames.
+ * open().  It sleeps until the earliest retransmission deadline passes
+ * (see blast_comms_rto.h), then flags every frame whose deadline has
+ * passed for retransmission.
  */
-static void blast_comms_watchdog(struct blast_comms_link_dev *dev)
+static int blast_comms_watchdog(void *data)
 {
-	long this_frame = 0;
+	struct blast_comms_link_dev *dev = data;
+	int expired;
+	int seq;
 
 	while (!kthread_should_stop()) {
-	while ((this_frame < dev->tx_data_stack.size) && \
-					(atomic_read(&dev->unack) > 0)) {
-		/* Is it sent and unacknowledged? */
-		if (dev->tx_data_stack.map[this_frame] & \
-		(BLAST_COMMS_STACK_MAP_SENT | BLAST_COMMS_STACK_MAP_READY)) {
-			/* No? Increment unacknowledgement counter and
-			 * test for expired counter
-			 */
-			dev->tx_data_stack.map[this_frame]++;
-
-			if (dev->tx_data_stack.map[this_frame] ==   \
-						BLAST_COMMS_STACK_MAP_EXPIRED) {
-				/* Counter has expired, so flag frame
-				 * for retransmission and update stack counters
-				 */
-				spin_lock(&dev->tx_data_stack.lock);
-				dev->tx_data_stack.map[this_frame] =  \
-						BLAST_COMMS_STACK_MAP_READY;
-				spin_unlock(&dev->tx_data_stack.lock);
-
-				atomic_inc(&dev->unsent);
-				atomic_dec(&dev->unack);
-
-				/* Wake up transmit thread */
-				wake_up(dev->transmit_q);
-			}
+		wait_event_interruptible(dev->watchdog_q,
+					kthread_should_stop() ||
+					blast_comms_rto_due(dev));
 
-			/* Increment counter, and break out of scanning to
-			 * check again for meta frames
-			 */
-			this_frame++;
-			break;
-		} else {
-			/* Increment counter, next frame */
-			this_frame++;
-		}
-	}
+		expired = 0;
 
-	/* Have we scanned the whole stack? */
-	if (this_frame >= dev->tx_data_stack.size) {
-		/* Reset counter and sleep */
-		this_frame = 0;
+		spin_lock(&dev->tx_data_stack->lock);
+		while ((seq = blast_comms_rto_pop(dev)) >= 0) {
+			dev->tx_data_stack->map[seq] = \
+					BLAST_COMMS_STACK_MAP_READY;
 
-		wait_event_interruptible(dev->watchdog_q, (this_frame < \
-					dev->tx_data_stack.size) && 	\
-					(atomic_read(&dev->unack) > 0));
+			atomic_inc(&dev->unsent);
+			atomic_dec(&dev->unack);
+			expired++;
+		}
+		spin_unlock(&dev->tx_data_stack->lock);
+
+		/* Wake up transmit thread */
+		if (expired)
+			wake_up(&dev->transmit_q);
 	}
-	} /* while(!kthread_should_stop()) */
+
+	return 0;
 }
 
 /**
- * blast_comms_softirq
- * @dev: the device structure
- * This function is run at regular intervals to wake any recurring threads.
+ * blast_comms_raw_receive
+ * @data: the receiving radio
+ * This function polls a radio without a streaming endpoint for received
+ * bytes and feeds them to the radio's frame finder.
  */
-static void blast_comms_softirq(struct blast_comms_link_dev *dev)
+static int blast_comms_raw_receive(void *data)
 {
-	/* Wakeup watchdog thread */
-	wake_up(dev->watchdog_q);
+	struct blast_comms_dev *radio = data;
+	char buf[sizeof(struct blast_comms_frame)];
+	int len = 0;
+
+	while (!kthread_should_stop()) {
+		/* Wait for room to put a frame's worth */
+		if (kfifo_avail(&radio->rx_raw_stack) < sizeof(buf))
+			wait_event_interruptible(radio->receive_q,
+				kfifo_avail(&radio->rx_raw_stack) >= sizeof(buf) ||
+				kthread_should_stop());
+
+		/* The PIC holds GET RAM until there is something to read */
+		len = blast_comms_pic_rx_read(radio, buf, sizeof(buf));
+		if (len <= 0)
+			continue;
+
+		kfifo_in(&radio->rx_raw_stack, buf, len);
+		wake_up(&radio->framefinder_q);
+	}
 
-	/* Reschedule soft irq */
-	add_timer(&dev->softirq);
+	return 0;
 }
 
 /**
- * blast_comms_receive
- * @dev: the device structure
- * This function is run when there is data on the device.
+ * blast_comms_frame_finder
+ * @data: the receiving radio
+ * This function is run when there is data to pull frames from.  Each radio
+ * of a link has its own; they all deliver into the link's rx_data_stack.
+ * Interleaved packets are gathered by group, and the group's frames
+ * delivered once its last packet arrives, or a packet of another group.
+ * Tags are found despite a few bit errors, at any bit offset (see
+ * blast_comms_frame_sync), and replaced with the real thing before the
+ * frame is passed on.
  */
-static void blast_comms_raw_receive(struct blast_comms_link_dev *dev)
+static int blast_comms_frame_finder(void *data)
 {
-	char buf = 0;
+	struct blast_comms_dev *radio = data;
+	struct blast_comms_link_dev *dev = radio->link_dev;
+	struct kfifo *raw = &radio->rx_raw_stack;
+	struct blast_comms_sync sync = { 0, 0 };
+	int	tag;
+	struct blast_comms_frame frame;
+	struct blast_comms_ilv_rx *ilv;
+	struct blast_comms_ilv_head ilv_head;
+	size_t	head_len = dev->fec->head_len - (2 * sizeof(u32));
+	size_t	air_len;
+
+	ilv = kzalloc(sizeof(struct blast_comms_ilv_rx), GFP_KERNEL);
+	if (!ilv)
+		return -ENOMEM;
 
 	while (!kthread_should_stop()) {
-		while (blast_comms_pic_rx_read(dev, &buf, 1)) {
-			if (kfifo_len(dev->rx_raw_stack) < 1) {
-				wake_up(dev->framefinder_q);
+		tag = blast_comms_frame_sync(radio, &sync, dev->sync_dist);
+		if (!tag) {
+			/* Everything so far searched, wait for more */
+			wake_up(&radio->receive_q);
+			wait_event_interruptible(radio->framefinder_q,
+					kfifo_len(raw) >= sizeof(u64) ||
+					kthread_should_stop());
+			continue;
+		}
 
-				wait_event_interruptible(dev->receive_q,
-					kfifo_len(dev->rx_raw_stack) > 0);
-			}
+		if (tag == BLAST_COMMS_SYNC_ILV) {
+			if (kfifo_len(raw) < BLAST_COMMS_ILV_HDRLEN)
+				wait_event_interruptible(radio->framefinder_q,
+					kfifo_len(raw) >= BLAST_COMMS_ILV_HDRLEN ||
+					kthread_should_stop());
+			if (kthread_should_stop())
+				break;
+
+			blast_comms_frame_read(radio, &sync,
+					&frame.wire[BLAST_COMMS_WIRE_SYNC],
+					BLAST_COMMS_ILV_HDRLEN);
+			if (blast_comms_ilv_head(frame.wire, &ilv_head))
+				continue;
+
+			/* A packet of another group ends the last one */
+			if (ilv->have && !blast_comms_ilv_rx_same(ilv, &ilv_head))
+				blast_comms_ilv_deliver(dev, ilv, &frame);
+
+			ilv->head = ilv_head;
+			air_len = blast_comms_ilv_packet_len(&ilv_head) -
+						BLAST_COMMS_ILV_HEAD_LEN;
+
+			if (kfifo_len(raw) < air_len)
+				wait_event_interruptible(radio->framefinder_q,
+					kfifo_len(raw) >= air_len ||
+					kthread_should_stop());
+			if (kthread_should_stop())
+				break;
+
+			blast_comms_frame_read(radio, &sync,
+					&ilv->stream[ilv_head.index *
+					BLAST_COMMS_ILV_PKT_DATA], air_len);
+			ilv->have |= 1 << ilv_head.index;
+			wake_up(&radio->receive_q);
 
-			kfifo_put(dev->rx_raw_stack, &buf);
+			if (ilv_head.index == BLAST_COMMS_ILV_PACKETS(
+					ilv_head.depth, ilv_head.row_len) - 1)
+				blast_comms_ilv_deliver(dev, ilv, &frame);
+			continue;
+		}
+
+		/* The head says how much data follows it */
+		if (kfifo_len(raw) < head_len)
+			wait_event_interruptible(radio->framefinder_q,
+					kfifo_len(raw) >= head_len ||
+					kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		put_unaligned_le32(BLAST_COMMS_FRAME_CORREL_TAG_1,
+							&frame.wire[0]);
+		put_unaligned_le32(BLAST_COMMS_FRAME_CORREL_TAG_2,
+							&frame.wire[sizeof(u32)]);
+
+		blast_comms_frame_read(radio, &sync,
+				&frame.wire[2 * sizeof(u32)], head_len);
+
+		air_len = dev->fec->air_len(dev, frame.wire);
+		if (!air_len) {
+			/* Length damaged, look for the next tag */
+			wake_up(&radio->receive_q);
+			continue;
 		}
 
-		wait_event_interruptible(dev->receive_q,
-			blast_comms_dev_status(BLAST_COMMS_DEV_DATA_TO_SEND));
+		if (kfifo_len(raw) < air_len - dev->fec->head_len)
+			wait_event_interruptible(radio->framefinder_q,
+					kfifo_len(raw) >= air_len -
+					dev->fec->head_len ||
+					kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		blast_comms_frame_read(radio, &sync,
+				&frame.wire[dev->fec->head_len],
+				air_len - dev->fec->head_len);
+		frame.wire_len = air_len;
+		wake_up(&radio->receive_q);
+
+		blast_comms_frame_receive(dev, &frame);
+
+		memset(&frame, 0, sizeof(struct blast_comms_frame));
 	}
+
+	kfree(ilv);
+
+	return 0;
 }
 
 /**
- * blast_comms_frame_finder
- * @dev: the device structure
- * This function is run when there is data to pull frames from.
+ * blast_comms_frame_receive - validate a found frame and act on it
+ * @dev: the link
+ * @frame: frame buffer, wire_len bytes of wire as on air
+ * The frame buffer is reused for any ACK or NACK.
  */
-static void blast_comms_frame_finder(struct blast_comms_link_dev *dev)
+static void blast_comms_frame_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
 {
-	u32	chunk = 0;
-	struct blast_comms_frame frame;
+	u64	sack;
 
-	while (!kthread_should_stop()) {
-	if (kfifo_len(dev->rx_raw_stack) < 1)
-		wait_event_interruptible(dev->framefinder_q,
-					kfifo_avail(dev->rx_raw_stack) > 0);
-
-		while (chunk != BLAST_COMMS_FRAME_CORREL_TAG_2)
-			kfifo_out(dev->rx_raw_stack, &chunk, sizeof(u32));
-
-		if (kfifo_len(dev->rx_raw_stack) <   			  \
-					(sizeof(struct blast_comms_frame) \
-					- (2 * sizeof(u32))))
-			wait_event_interruptible(dev->framefinder_q,
-					kfifo_len(dev->rx_raw_stack) >=      \
-					(sizeof(struct blast_comms_frame) -  \
-					sizeof(u16) - 			     \
-					BLAST_COMMS_FRAME_CHKSYM_LEN - 1));
-
-		frame.correlation_tag[1] = chunk;
-
-		kfifo_out(dev->rx_raw_stack, &frame.head_sync_word,
-			sizeof(struct blast_comms_frame) - (2 * sizeof(u32)));
-
-		switch (blast_comms_validate_frame(dev, &frame)) {
-		case BLAST_COMMS_DATA_FRAME:
-			if (dev->status == BLAST_COMMS_FLUSHING)
-			/* Flushing buffers, ignore incoming data frames */
+	switch (blast_comms_validate_frame(dev, frame)) {
+	case BLAST_COMMS_DATA_FRAME:
+		/* The other end's ACK state, riding along */
+		if (frame->ctl & BLAST_COMMS_FRAME_CTL_ACK) {
+			if (frame->data_len < BLAST_COMMS_ARQ_ACK_LEN)
 				break;
 
-			/* Put validated frame on received stack */
-			spin_lock(&dev->tx_data_stack.lock);
-			memcpy(&dev->rx_data_stack.frame[frame.seq_num], &frame,
-					sizeof(struct blast_comms_frame));
-			dev->rx_data_stack.map[frame.seq_num] =   \
-						BLAST_COMMS_STACK_MAP_UNREAD;
-			spin_unlock(&dev->tx_data_stack.lock);
-
-			/* Send ACK */
-			blast_comms_build_ack_frame(dev, &frame, frame.seq_num);
+			frame->data_len -= BLAST_COMMS_ARQ_ACK_LEN;
+			frame->ctl &= ~BLAST_COMMS_FRAME_CTL_ACK;
+			blast_comms_arq_ack(dev, frame->data[frame->data_len],
+				get_unaligned_le64(
+					&frame->data[frame->data_len + 1]));
+		}
 
-			kfifo_put(dev->tx_meta_stack, &frame);
+		if (dev->status == BLAST_COMMS_FLUSHING)
+		/* Flushing buffers, ignore incoming data frames */
+			break;
 
-			wake_up(dev->transmit_q);
-			wake_up(dev->decoder_q);
+		/* Fountain symbols are neither sequenced nor acknowledged */
+		if (frame->ctl & BLAST_COMMS_FRAME_CTL_LT) {
+			blast_comms_lt_receive(dev, frame);
 			break;
-		case BLAST_COMMS_ACK_FRAME:
-			spin_lock(&dev->tx_data_stack.lock);
-			dev->tx_data_stack.map[frame.seq_num] =   \
-						BLAST_COMMS_STACK_MAP_CLEAR;
-			spin_unlock(&dev->tx_data_stack.lock);
+		}
 
-			atomic_dec(&dev->unack);
+		/* Put validated frame on received stack; frames from
+		 * bonded radios land in sequence order here.  Repeats of
+		 * frames already ACKed are only ACKed again, and a frame
+		 * whose slot hasn't been read yet is left to be sent again.
+		 */
+		spin_lock(&dev->rx_data_stack->lock);
+		if (blast_comms_arq_mark(dev, frame->seq_num)) {
+			memcpy(&dev->rx_data_stack->frame[frame->seq_num],
+				frame, sizeof(struct blast_comms_frame));
+			dev->rx_data_stack->map[frame->seq_num] =   \
+					BLAST_COMMS_STACK_MAP_UNREAD;
+		}
+		dev->ack_pending = 1;
+		spin_unlock(&dev->rx_data_stack->lock);
+
+		wake_up(&dev->decoder_q);
+
+		/* Send ACK, now or with the next data frame (or later) */
+		if (dev->mode == BLAST_COMMS_RTX)
+			schedule_delayed_work(&dev->ack_work,
+					msecs_to_jiffies(dev->ack_delay_ms));
+		else
+			blast_comms_ack_send(dev, frame);
+		break;
+	case BLAST_COMMS_ACK_FRAME:
+		sack = 0;
+		if (frame->data_len >= BLAST_COMMS_ARQ_SACK_LEN)
+			sack = get_unaligned_le64(frame->data);
+
+		blast_comms_arq_ack(dev, frame->seq_num, sack);
+		break;
+	case BLAST_COMMS_NACK_FRAME:
+		/* Only a frame still out goes again, as for an ACK's holes */
+		spin_lock(&dev->tx_data_stack->lock);
+		if (!(dev->tx_data_stack->map[frame->seq_num] & \
+					BLAST_COMMS_STACK_MAP_SENT)) {
+			spin_unlock(&dev->tx_data_stack->lock);
 			break;
-		case BLAST_COMMS_NACK_FRAME:
-			spin_lock(&dev->tx_data_stack.lock);
-			dev->tx_data_stack.map[frame.seq_num] =   \
-						BLAST_COMMS_STACK_MAP_READY;
-			spin_unlock(&dev->tx_data_stack.lock);
+		}
+		blast_comms_rto_cancel(dev, frame->seq_num);
+		dev->tx_data_stack->map[frame->seq_num] =   \
+					BLAST_COMMS_STACK_MAP_READY;
+		atomic_dec(&dev->unack);
+		atomic_inc(&dev->unsent);
+		spin_unlock(&dev->tx_data_stack->lock);
+
+		wake_up(&dev->transmit_q);
+		break;
+	case BLAST_COMMS_E_BADFRAME_SEQ:
+		/* Send NACK on sequence number */
+		blast_comms_build_nack_frame(dev, frame, frame->seq_num);
+
+		kfifo_in_spinlocked(dev->tx_meta_stack, frame, sizeof(*frame),
+							&dev->tx_meta_lock);
+
+		wake_up(&dev->transmit_q);
+		break;
+	default:
+		/* Drop frame */
+		break;
+	}
+}
 
-			atomic_inc(&dev->unsent);
+/**
+ * blast_comms_lt_transmit - make the next fountain symbol
+ * @dev: the link
+ * @frame: frame buffer
+ * Returns 1 with the frame finalised, ready to send, or 0 if there is no
+ * block to send.
+ */
+static int blast_comms_lt_transmit(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_lt *lt = dev->lt;
 
-			wake_up(dev->q_transmit);
-			break;
-		case BLAST_COMMS_E_BADFRAME_SEQ:
-			/* Send NACK on sequence number */
-			blast_comms_build_nack_frame(dev, &frame,
-								frame.seq_num);
+	mutex_lock(&lt->tx_lock);
 
-			kfifo_put(dev->tx_meta_stack, &frame);
+	if (!lt->tx_active) {
+		mutex_unlock(&lt->tx_lock);
+		return 0;
+	}
 
-			wake_up(dev->q_transmit);
-			break;
-		default:
-			/* Drop frame */
-		}
+	blast_comms_build_frame(dev, frame);
+	frame->ctl |= BLAST_COMMS_FRAME_CTL_LT;
+	frame->data_len = blast_comms_lt_encode(lt, frame->data);
 
-		memset(&frame, 0, sizeof(struct blast_comms_frame));
-		chunk = 0;
+	/* Not a sequence number, but stripes the symbols across radios */
+	blast_comms_finalise_frame(dev, frame, lt->tx_esi % \
+					(BLAST_COMMS_FRAME_SEQNUM_LIM + 1));
+
+	/* The next block may go now */
+	if (lt->tx_sent == lt->tx_min)
+		wake_up_interruptible(&dev->writers_q);
+
+	mutex_unlock(&lt->tx_lock);
+
+	return 1;
+}
+
+/**
+ * blast_comms_lt_receive - take in a fountain symbol
+ * @dev: the link
+ * @frame: validated frame marked BLAST_COMMS_FRAME_CTL_LT
+ */
+static void blast_comms_lt_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	struct blast_comms_lt *lt = dev->lt;
+
+	mutex_lock(&lt->rx_lock);
+
+	if (blast_comms_lt_decode(lt, frame->data, frame->data_len) == 1)
+		blast_comms_lt_deliver(dev, lt);
+
+	mutex_unlock(&lt->rx_lock);
+}
+
+/**
+ * blast_comms_lt_deliver - put a decoded block in read_stack
+ * @dev: the link
+ * @lt: the fountain state (rx_lock held), with a decoded block
+ * As one message in message mode.  If there isn't room the block waits,
+ * and the next symbol of it to arrive tries again.  Fountain coded data
+ * frames are all there is on such a link, so the receive thread isn't
+ * filling read_stack at the same time.
+ */
+static void blast_comms_lt_deliver(struct blast_comms_link_dev *dev,
+					struct blast_comms_lt *lt)
+{
+	size_t	left, len;
+	u16	msg_len = lt->rx_len;
+	int	i;
+
+	if (kfifo_avail(dev->read_stack) < lt->rx_len +
+					(dev->msg ? sizeof(msg_len) : 0))
+		return;
+
+	if (dev->msg)
+		kfifo_in(dev->read_stack, &msg_len, sizeof(msg_len));
+
+	for (i = 0, left = lt->rx_len; left > 0; i++, left -= len) {
+		len = min_t(size_t, left, lt->rx_sym);
+		kfifo_in(dev->read_stack, lt->rx_row[i], len);
+	}
+
+	lt->rx_state = BLAST_COMMS_LT_DELIVERED;
+
+	wake_up_interruptible(&dev->readers_q);
+}
+
+/**
+ * blast_comms_ilv_deliver - hand on the frames of an interleaved group
+ * @dev: the link
+ * @ilv: the de-interleaver, with what arrived of the group
+ * @frame: frame buffer to use
+ * Rows whose length was lost are dropped; the watchdog resends them.
+ */
+static void blast_comms_ilv_deliver(struct blast_comms_link_dev *dev,
+					struct blast_comms_ilv_rx *ilv,
+					struct blast_comms_frame *frame)
+{
+	size_t	air_len;
+	int	row;
+
+	for (row = 0; row < ilv->head.depth; row++) {
+		blast_comms_ilv_rx_row(ilv, row, frame);
+
+		/* Trim the padding */
+		air_len = dev->fec->air_len(dev, frame->wire);
+		if (!air_len || air_len > frame->wire_len)
+			continue;
+		frame->wire_len = air_len;
+
+		blast_comms_frame_receive(dev, frame);
 	}
+
+	blast_comms_ilv_rx_reset(ilv);
+}
+
+/**
+ * blast_comms_msg_receive - add a frame to the message being put together
+ * @dev: the link (message mode)
+ * @frame: the next frame, in sequence order
+ * A whole message goes into read_stack as a u16 length and then its data.
+ * A message cut short, by the sender being interrupted or by growing past
+ * BLAST_COMMS_MSG_MAX, is dropped; so are frames until the next one starts.
+ */
+static void blast_comms_msg_receive(struct blast_comms_link_dev *dev,
+					struct blast_comms_frame *frame)
+{
+	u16	len;
+
+	if (frame->ctl & BLAST_COMMS_FRAME_CTL_FIRST) {
+		dev->msg_len = 0;
+		dev->msg_open = 1;
+	}
+
+	if (!dev->msg_open)
+		return;
+
+	if (dev->msg_len + frame->data_len > BLAST_COMMS_MSG_MAX) {
+		dev->msg_open = 0;
+		return;
+	}
+
+	memcpy(&dev->msg_buf[dev->msg_len], frame->data, frame->data_len);
+	dev->msg_len += frame->data_len;
+
+	if (!(frame->ctl & BLAST_COMMS_FRAME_CTL_LAST))
+		return;
+
+	len = dev->msg_len;
+	kfifo_in(dev->read_stack, &len, sizeof(len));
+	kfifo_in(dev->read_stack, dev->msg_buf, len);
+	dev->msg_open = 0;
+
+	wake_up_interruptible(&dev->readers_q);
 }
 
 /**
  * blast_comms_receive_thread
- * @dev: the device structure
+ * @data: the link
  */
-static void blast_comms_receive_thread(struct blast_comms_dev *dev) {
+static int blast_comms_receive_thread(void *data)
+{
+	struct blast_comms_link_dev *dev = data;
+	struct blast_comms_frame *frame;
 	size_t	rx_ptr = 0;
+	size_t	need;
+	int	raw;
 
 	while (!kthread_should_stop()) {
-		if (dev->rx_data_stack.map[rx_ptr] != \
-					BLAST_COMMS_STACK_MAP_UNREAD)
+		if (dev->rx_data_stack->map[rx_ptr] != \
+					BLAST_COMMS_STACK_MAP_UNREAD) {
 			wait_event_interruptible(dev->decoder_q,
-					dev->rx_data_stack.map[rx_ptr] == \
-					BLAST_COMMS_STACK_MAP_UNREAD);
+					dev->rx_data_stack->map[rx_ptr] == \
+					BLAST_COMMS_STACK_MAP_UNREAD ||
+					kthread_should_stop());
+			continue;
+		}
+
+		frame = &dev->rx_data_stack->frame[rx_ptr];
 
-		if (kfifo_avail(dev->read_stack) < \
-				dev->rx_data_stack.frame[rx_ptr].data_len) {
+		/* A compressed frame may complete a whole block, and a frame
+		 * in message mode a whole message
+		 */
+		need = frame->data_len;
+		if (frame->ctl & BLAST_COMMS_FRAME_CTL_LZ4)
+			need = BLAST_COMMS_LZ4_BLOCK;
+		if (dev->msg)
+			need = sizeof(u16) + BLAST_COMMS_MSG_MAX;
+
+		/* Wait for readers to make room */
+		if (kfifo_avail(dev->read_stack) < need) {
 			wait_event_interruptible(dev->decoder_q,
-				kfifo_avail(dev->read_stack) < \
-				dev->rx_data_stack.frame[rx_ptr].data_len);
+				kfifo_avail(dev->read_stack) >= need ||
+				kthread_should_stop());
 			continue;
 		}
 
-		kfifo_in(dev->read_stack,
-				&dev->rx_data_stack.frame[rx_ptr].data,
-				dev->rx_data_stack.frame[rx_ptr].data_len);
+		if (dev->msg) {
+			blast_comms_msg_receive(dev, frame);
+		} else if (frame->ctl & BLAST_COMMS_FRAME_CTL_LZ4) {
+			raw = blast_comms_lz4_feed(dev->lz4, frame->data,
+				frame->data_len,
+				frame->ctl & BLAST_COMMS_FRAME_CTL_LZ4_START);
+			if (raw > 0)
+				kfifo_in(dev->read_stack, dev->lz4->rx_raw, raw);
+		} else {
+			kfifo_in(dev->read_stack, frame->data,
+							frame->data_len);
+		}
 
-		spin_lock(&dev->tx_data_stack.lock);
-		dev->rx_data_stack.map[rx_ptr] = BLAST_COMMS_STACK_MAP_CLEAR;
-		spin_unlock(&dev->tx_data_stack.lock);
+		/* The frame finders write the map under this lock */
+		spin_lock(&dev->rx_data_stack->lock);
+		dev->rx_data_stack->map[rx_ptr] = BLAST_COMMS_STACK_MAP_CLEAR;
+		spin_unlock(&dev->rx_data_stack->lock);
 
 		rx_ptr++;
 		if (rx_ptr > BLAST_COMMS_FRAME_SEQNUM_LIM)
 			rx_ptr = 0;
 	}
+
+	return 0;
 }
 
 /* EOF */
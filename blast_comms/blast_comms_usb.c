@@ -22,11 +22,20 @@
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/usb.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
 
 /*
  * Local inclusions
  */
 #include "blast_comms_usb.h"
+#include "blast_comms_pic.h"
 
 /**
  * USB Device Table
@@ -35,11 +44,19 @@ static const struct usb_device_id blast_comms_id_table[] = {
 	{ USB_DEVICE(USB_VENDOR_ID_BLASTCOMMS, USB_DEVICE_ID_BLASTCOMMS) },
 	{ }	/* null terminator */
 };
+MODULE_DEVICE_TABLE(usb, blast_comms_id_table);
+
+/*
+ * The usb_class_driver Structure, for the command interface's node
+ */
+static struct usb_class_driver blast_comms_class = {
+	.name		= "bcomms%d",
+};
 
 /*
  * The usb_device Structure (Declared Later)
  */
-static struct usb_driver blast_comms_usb_dev;
+struct usb_driver blast_comms_usb_drv;
 
 /**
  * blast_comms_usb_probe - add USB device to the system
@@ -58,7 +75,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 	/* Allocate and zero the device structure, fail gracefully. */
 	dev = kzalloc(sizeof(struct blast_comms_dev), GFP_KERNEL);
 	if (!dev) {
-		kprint(KERN_WARNING "%s: out of memory.\n", DRIVER_NAME);
+		printk(KERN_WARNING "%s: out of memory.\n", DRIVER_NAME);
 		return -ENOMEM;
 	}
 
@@ -71,7 +88,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 
 	if (usb_if != interface) {
 		result = -ENODEV;
-		kprint(KERN_WARNING "%s: USB control interface not found.\n",
+		printk(KERN_WARNING "%s: USB control interface not found.\n",
 								DRIVER_NAME);
 		goto probe_failure_free;
 	}
@@ -81,7 +98,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 
 	if (!usb_if) {
 		result = -ENODEV;
-		kprint(KERN_WARNING "%s: USB data interface not found.\n",
+		printk(KERN_WARNING "%s: USB data interface not found.\n",
 								DRIVER_NAME);
 		goto probe_failure_free;
 	}
@@ -89,7 +106,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 	/* Check if interface is already claimed. */
 	if (usb_interface_claimed(usb_if)) {
 		result = -EBUSY;
-		kprint(KERN_WARNING "%s: USB data interface busy.\n",
+		printk(KERN_WARNING "%s: USB data interface busy.\n",
 								DRIVER_NAME);
 		goto probe_failure_free;
 	}
@@ -97,7 +114,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 	/* Setup endpoints. */
 	if (usb_if->cur_altsetting->desc.bNumEndpoints < 2) {
 		result = -EINVAL;
-		kprint(KERN_WARNING "%s: insufficient USB endpoints found.\n",
+		printk(KERN_WARNING "%s: insufficient USB endpoints found.\n",
 								DRIVER_NAME);
 		goto probe_failure_free;
 	}
@@ -108,8 +125,8 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 
 	/* Check them... */
 	if (!ep_out || !ep_in) {
-		result -EINVAL;
-		kprint(KERN_WARNING "%s: invalid USB endpoints.\n",
+		result = -EINVAL;
+		printk(KERN_WARNING "%s: invalid USB endpoints.\n",
 								DRIVER_NAME);
 		goto probe_failure_free;
 	}
@@ -119,19 +136,56 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 	dev->usb_ep_in = ep_in->desc.bEndpointAddress;
 	dev->usb_if = usb_get_intf(usb_if);
 
+	/* Newer firmware streams received bytes on a third endpoint */
+	if (usb_if->cur_altsetting->desc.bNumEndpoints > 2)
+		dev->usb_ep_stream =
+			usb_if->cur_altsetting->endpoint[2].desc.bEndpointAddress;
+
+	/* Set up the tagged command table and the transmit pipeline */
+	sema_init(&dev->usb_lock, 1);
+	blast_comms_stats_init(dev);
+
+	result = blast_comms_usb_cmd_init(dev);
+	if (result < 0) {
+		printk(KERN_WARNING "%s: unable to arm response ring.\n",
+								DRIVER_NAME);
+		goto probe_failure_put;
+	}
+
+	result = blast_comms_usb_tx_init(dev);
+	if (result < 0) {
+		printk(KERN_WARNING "%s: unable to allocate transmit ring.\n",
+								DRIVER_NAME);
+		goto probe_failure_cmd;
+	}
+
+	result = blast_comms_usb_pool_init(dev);
+	if (result < 0) {
+		printk(KERN_WARNING "%s: unable to allocate buffer pool.\n",
+								DRIVER_NAME);
+		goto probe_failure_ring;
+	}
+
+	result = blast_comms_usb_rx_init(dev);
+	if (result < 0) {
+		printk(KERN_WARNING "%s: unable to allocate receive ring.\n",
+								DRIVER_NAME);
+		goto probe_failure_ring;
+	}
+
 	/* Claim the interface to stop other drivers doing so. */
-	result = usb_driver_claim_interface(&blast_comms_usb_dev, dev->usb_if,
+	result = usb_driver_claim_interface(&blast_comms_usb_drv, dev->usb_if,
 									dev);
 
 	if (result < 0) {
-		kprint(KERN_WARNING "%s: unable to claim USB data interface.\n",
+		printk(KERN_WARNING "%s: unable to claim USB data interface.\n",
 								DRIVER_NAME);
-		goto probe_failure_put;
+		goto probe_failure_ring;
 	}
 
 	result = usb_register_dev(interface, &blast_comms_class);
 	if (result) {
-		kprint(KERN_WARNING "%s: unable to claim USB data interface.\n",
+		printk(KERN_WARNING "%s: unable to claim USB data interface.\n",
 								DRIVER_NAME);
 		goto probe_failure_release;
 	}
@@ -143,7 +197,7 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 	result = blast_comms_dev_init(dev);
 	if (result < 0) {
 		result = -ENODEV;
-		kprint(KERN_WARNING "%s: unable to initialise device.\n",
+		printk(KERN_WARNING "%s: unable to initialise device.\n",
 								DRIVER_NAME);
 		goto probe_failure_release;
 	}
@@ -156,8 +210,15 @@ static int blast_comms_usb_probe(struct usb_interface *interface,
 probe_failure_release:
 	usb_set_intfdata(interface, NULL);
 	usb_set_intfdata(dev->usb_if, NULL);
-	usb_driver_release_interface(&blast_comms_usb_dev, dev->usb_if);
+	usb_driver_release_interface(&blast_comms_usb_drv, dev->usb_if);
+probe_failure_ring:
+	blast_comms_usb_rx_release(dev);
+	blast_comms_usb_pool_release(dev);
+	blast_comms_usb_tx_release(dev);
+probe_failure_cmd:
+	blast_comms_usb_cmd_release(dev);
 probe_failure_put:
+	blast_comms_stats_release(dev);
 	usb_put_intf(dev->usb_if);
 probe_failure_free:
 	usb_put_dev(dev->usb_dev);
@@ -182,9 +243,16 @@ static void blast_comms_usb_disconnect(struct usb_interface *interface)
 	if (alt->desc.bInterfaceNumber)
 		return;
 
+	/* Cancel anything still in flight before the buffers go */
+	blast_comms_usb_rx_release(dev);
+	blast_comms_usb_pool_release(dev);
+	blast_comms_usb_tx_release(dev);
+	blast_comms_usb_cmd_release(dev);
+	blast_comms_stats_release(dev);
+
 	usb_set_intfdata(interface, NULL);
 	usb_set_intfdata(dev->usb_if, NULL);
-	usb_driver_release_interface(&blast_comms_usb_dev, dev->usb_if);
+	usb_driver_release_interface(&blast_comms_usb_drv, dev->usb_if);
 	usb_put_intf(dev->usb_if);
 	usb_put_dev(dev->usb_dev);
 
@@ -200,12 +268,19 @@ static void blast_comms_usb_disconnect(struct usb_interface *interface)
 static inline int blast_comms_usb_read(struct blast_comms_dev *dev, char *buf,
 									int len)
 {
+	ktime_t start = ktime_get();
+	int result = 0;
+
 	if (len <= 0 || len > BLAST_COMMS_USB_MAX_TRANSFER)
 		return -EINVAL;
 
-	return usb_bulk_msg(dev->usb_dev,
+	result = usb_bulk_msg(dev->usb_dev,
 				usb_rcvbulkpipe(dev->usb_dev, dev->usb_ep_in),
 				buf, len, &len, BLAST_COMMS_USB_TIMEOUT);
+	blast_comms_stats_record(&dev->stats, BLAST_COMMS_STATS_USB_BULK,
+							start, result);
+
+	return result;
 }
 
 /**
@@ -220,43 +295,1056 @@ static u32 blast_comms_usb_write(struct blast_comms_dev *dev, char *buf,
 	int result = 0;
 	int actual = 0;
 	char response[5];
+	ktime_t start;
 
 	/* Check for valid len */
 	if (len <= 0 || len > BLAST_COMMS_USB_MAXLEN) {
-		kprint(KERN_WARNING "%s: blast_comms_usb_write: data too long",
+		printk(KERN_WARNING "%s: blast_comms_usb_write: data too long",
 			DRIVER_NAME);
 		return -EINVAL;
 	}
 
 	/* Send buffer to device */
+	start = ktime_get();
 	result = usb_bulk_msg(dev->usb_dev,
 				usb_sndbulkpipe(dev->usb_dev, dev->usb_ep_out),
 				buf, len, &actual, BLAST_COMMS_USB_TIMEOUT);
+	blast_comms_stats_record(&dev->stats, BLAST_COMMS_STATS_USB_BULK,
+							start, result);
 	if (!result) {
-		kprint(KERN_WARNING "%s: blast_comms_usb_write: send failed",
+		printk(KERN_WARNING "%s: blast_comms_usb_write: send failed",
 			DRIVER_NAME);
 		return -EFAULT;
 	}
 
+	start = ktime_get();
 	result = usb_bulk_msg(dev->usb_dev,
 				usb_rcvbulkpipe(dev->usb_dev, dev->usb_ep_in),
 				response, 5, &actual, BLAST_COMMS_USB_TIMEOUT);
+	blast_comms_stats_record(&dev->stats, BLAST_COMMS_STATS_USB_BULK,
+							start, result);
 	if (!result) {
-		kprint(KERN_WARNING "%s: blast_comms_usb_write: receive failed",
+		printk(KERN_WARNING "%s: blast_comms_usb_write: receive failed",
 			DRIVER_NAME);
 		return -EFAULT;
 	}
 
 	if (response[0] != BLAST_COMMS_PIC_ACK)
-		return *(u32 *)response[1];
+		return *(u32 *)&response[1];
+
+	return 0;
+}
+
+/**
+ * blast_comms_usb_transient - is a URB error worth resubmitting for
+ * @status: the URB's status
+ * Completions resubmit straight away, so an error that will only happen
+ * again (a stall, a protocol error, the device going) would spin.
+ */
+static int blast_comms_usb_transient(int status)
+{
+	switch (status) {
+	case -EOVERFLOW:	/* babble, more than we asked for */
+	case -EREMOTEIO:	/* short transfer */
+	case -ETIMEDOUT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * blast_comms_usb_req_finish - complete a tagged command
+ * @dev: the device
+ * @req: the command
+ * @status: PIC response code or -ve error
+ * Called at most once per submission, with req_lock held.
+ */
+static void blast_comms_usb_req_finish(struct blast_comms_dev *dev,
+				struct blast_comms_pic_req *req, int status)
+{
+	req->pending = 0;
+	req->status = status;
+
+	blast_comms_stats_record(&dev->stats,
+			blast_comms_stats_type(req->cmd), req->start, status);
+
+	if (req->complete)
+		req->complete(req);
+	else
+		complete(&req->done);
+}
+
+/**
+ * blast_comms_usb_resp_complete - a PIC response has arrived
+ * @urb: the response URB
+ * Runs in interrupt context.  The tag in the response header selects the
+ * outstanding command it belongs to, so responses may arrive in any order.
+ * Responses for commands that have already timed out are dropped.
+ */
+static void blast_comms_usb_resp_complete(struct urb *urb)
+{
+	struct blast_comms_dev *dev = urb->context;
+	struct blast_comms_pic_req *req;
+	unsigned char *resp = urb->transfer_buffer;
+	unsigned long flags;
+	size_t len;
+
+	switch (urb->status) {
+	case 0:
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		/* killed by cmd_release or disconnect */
+		return;
+	default:
+		if (blast_comms_usb_transient(urb->status))
+			goto resp_resubmit;
+
+		/* it would only fail again; the commands time out */
+		printk(KERN_WARNING "%s: response endpoint: error %d",
+						DRIVER_NAME, urb->status);
+		return;
+	}
+
+	if (urb->actual_length < BLAST_COMMS_PIC_HDRLEN)
+		goto resp_resubmit;
+
+	len = le16_to_cpu(*((__le16 *)&resp[2]));
+	if (len > urb->actual_length - BLAST_COMMS_PIC_HDRLEN)
+		len = urb->actual_length - BLAST_COMMS_PIC_HDRLEN;
+
+	req = &dev->req[resp[1] & BLAST_COMMS_PIC_TAG_MASK];
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	if (req->pending && req->tag == resp[1]) {
+		/* copy out any extended response data */
+		if (req->buf) {
+			req->actual = min(len, req->len);
+			memcpy(req->buf, &resp[BLAST_COMMS_PIC_HDRLEN],
+								req->actual);
+		}
+
+		blast_comms_usb_req_finish(dev, req, resp[0]);
+	}
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+resp_resubmit:
+	usb_anchor_urb(urb, &dev->resp_anchor);
+	if (usb_submit_urb(urb, GFP_ATOMIC))
+		usb_unanchor_urb(urb);
+}
+
+/**
+ * blast_comms_usb_cmd_init - set up the tag table and arm the response ring
+ * @dev: the device
+ * Tags 0 to BLAST_COMMS_USB_TX_RING - 1 belong to the transmit ring slots;
+ * the rest are handed out to synchronous commands by blast_comms_usb_req_get.
+ */
+static int blast_comms_usb_cmd_init(struct blast_comms_dev *dev)
+{
+	struct urb *urb;
+	char *buf;
+	int result = 0;
+	int i;
+
+	spin_lock_init(&dev->req_lock);
+	init_waitqueue_head(&dev->req_q);
+	init_usb_anchor(&dev->resp_anchor);
+
+	for (i = 0; i < BLAST_COMMS_PIC_TAGS; i++) {
+		dev->req[i].tag = i;
+		dev->req[i].busy = (i < BLAST_COMMS_USB_TX_RING);
+		dev->req[i].pending = 0;
+		init_completion(&dev->req[i].done);
+	}
+
+	for (i = 0; i < BLAST_COMMS_USB_RESP_RING; i++) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			goto cmd_init_fail;
+
+		dev->resp_ring[i] = urb;
+
+		buf = usb_alloc_coherent(dev->usb_dev, BLAST_COMMS_USB_MAXLEN,
+						GFP_KERNEL, &urb->transfer_dma);
+		if (!buf)
+			goto cmd_init_fail;
+
+		usb_fill_bulk_urb(urb, dev->usb_dev,
+				usb_rcvbulkpipe(dev->usb_dev, dev->usb_ep_in),
+				buf, BLAST_COMMS_USB_MAXLEN,
+				blast_comms_usb_resp_complete, dev);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+		usb_anchor_urb(urb, &dev->resp_anchor);
+		result = usb_submit_urb(urb, GFP_KERNEL);
+		if (result) {
+			usb_unanchor_urb(urb);
+			blast_comms_usb_cmd_release(dev);
+			return result;
+		}
+	}
+
+	return 0;
+
+cmd_init_fail:
+	blast_comms_usb_cmd_release(dev);
+	return -ENOMEM;
+}
+
+/**
+ * blast_comms_usb_cmd_release - disarm and free the response ring
+ * @dev: the device
+ * Any command still waiting is failed with -ESHUTDOWN.
+ */
+static void blast_comms_usb_cmd_release(struct blast_comms_dev *dev)
+{
+	struct urb *urb;
+	unsigned long flags;
+	int i;
+
+	usb_kill_anchored_urbs(&dev->resp_anchor);
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	for (i = 0; i < BLAST_COMMS_PIC_TAGS; i++)
+		if (dev->req[i].pending)
+			blast_comms_usb_req_finish(dev, &dev->req[i],
+								-ESHUTDOWN);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+	for (i = 0; i < BLAST_COMMS_USB_RESP_RING; i++) {
+		urb = dev->resp_ring[i];
+		if (!urb)
+			continue;
+
+		if (urb->transfer_buffer)
+			usb_free_coherent(dev->usb_dev, BLAST_COMMS_USB_MAXLEN,
+						urb->transfer_buffer,
+						urb->transfer_dma);
+		usb_free_urb(urb);
+		dev->resp_ring[i] = NULL;
+	}
+}
+
+/**
+ * blast_comms_usb_req_get - allocate a tag for a synchronous command
+ * @dev: the device
+ * Sleeps until a tag is free.  Returns NULL if interrupted.
+ */
+static struct blast_comms_pic_req *blast_comms_usb_req_get(
+						struct blast_comms_dev *dev)
+{
+	struct blast_comms_pic_req *req = NULL;
+	unsigned long flags;
+	int i;
+
+	while (!req) {
+		spin_lock_irqsave(&dev->req_lock, flags);
+		for (i = BLAST_COMMS_USB_TX_RING; i < BLAST_COMMS_PIC_TAGS; i++) {
+			if (!dev->req[i].busy) {
+				req = &dev->req[i];
+				req->busy = 1;
+				break;
+			}
+		}
+		spin_unlock_irqrestore(&dev->req_lock, flags);
+
+		if (req)
+			break;
+
+		if (wait_event_interruptible(dev->req_q,
+				blast_comms_usb_req_avail(dev)))
+			return NULL;
+	}
+
+	req->buf = NULL;
+	req->len = 0;
+	req->actual = 0;
+	req->complete = NULL;
+	req->context = NULL;
+
+	return req;
+}
+
+/**
+ * blast_comms_usb_req_avail - is there a free tag?
+ * @dev: the device
+ */
+static int blast_comms_usb_req_avail(struct blast_comms_dev *dev)
+{
+	int i;
+
+	for (i = BLAST_COMMS_USB_TX_RING; i < BLAST_COMMS_PIC_TAGS; i++)
+		if (!dev->req[i].busy)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * blast_comms_usb_req_put - release a tag
+ * @dev: the device
+ * @req: the command
+ */
+static void blast_comms_usb_req_put(struct blast_comms_dev *dev,
+					struct blast_comms_pic_req *req)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	req->pending = 0;
+	req->busy = 0;
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+	wake_up(&dev->req_q);
+}
+
+/**
+ * blast_comms_usb_req_arm - get a tag ready for the command about to be sent
+ * @dev: the device
+ * @req: the command
+ * @cmd: the PIC command byte, for the latency statistics
+ * Moves the tag on a generation so a late response to an earlier command
+ * that used the same table entry can't be mistaken for this one.  Returns
+ * the tag to put in the command header.
+ */
+static u8 blast_comms_usb_req_arm(struct blast_comms_dev *dev,
+				struct blast_comms_pic_req *req, unsigned int cmd)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	req->tag += BLAST_COMMS_PIC_TAG_GEN;
+	req->cmd = cmd;
+	req->start = ktime_get();
+	req->status = 0;
+	req->actual = 0;
+	req->pending = 1;
+	reinit_completion(&req->done);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+	return req->tag;
+}
+
+/**
+ * blast_comms_usb_req_abort - give up on a command
+ * @dev: the device
+ * @req: the command
+ * @status: -ve error to complete it with, if it is still outstanding
+ */
+static void blast_comms_usb_req_abort(struct blast_comms_dev *dev,
+				struct blast_comms_pic_req *req, int status)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	if (req->pending)
+		blast_comms_usb_req_finish(dev, req, status);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+}
+
+/**
+ * blast_comms_usb_req_wait - wait for a synchronous command's response
+ * @dev: the device
+ * @req: the command
+ * Returns the PIC response code or -ETIMEDOUT.
+ */
+static int blast_comms_usb_req_wait(struct blast_comms_dev *dev,
+					struct blast_comms_pic_req *req)
+{
+	if (!wait_for_completion_timeout(&req->done,
+			msecs_to_jiffies(BLAST_COMMS_USB_CMD_TIMEOUT))) {
+		blast_comms_usb_req_abort(dev, req, -ETIMEDOUT);
+		wait_for_completion(&req->done);
+	}
+
+	return req->status;
+}
+
+/**
+ * blast_comms_usb_tx_ack_complete - PIC response to a queued command arrived
+ * @req: the ring slot's command
+ * Runs in interrupt context with req_lock held.  Frees the ring slot.
+ */
+static void blast_comms_usb_tx_ack_complete(struct blast_comms_pic_req *req)
+{
+	struct blast_comms_tx_slot *slot = req->context;
+	struct blast_comms_dev *dev = slot->dev;
+
+	if (req->status != BLAST_COMMS_PIC_ACK)
+		atomic_inc(&dev->tx_nacks);
+
+	slot->busy = 0;
+
+	atomic_dec(&dev->tx_inflight);
+	wake_up(&dev->tx_idle_q);
+}
+
+/**
+ * blast_comms_usb_tx_cmd_complete - command URB has left the host
+ * @urb: the command URB
+ * Runs in interrupt context.  If the command never reached the PIC there will
+ * be no response, so the slot's tag is completed with the error here.
+ */
+static void blast_comms_usb_tx_cmd_complete(struct urb *urb)
+{
+	struct blast_comms_tx_slot *slot = urb->context;
+
+	if (unlikely(urb->status))
+		blast_comms_usb_req_abort(slot->dev, slot->req, urb->status);
+}
+
+/**
+ * blast_comms_usb_tx_init - allocate the asynchronous transmit ring
+ * @dev: the device
+ * Must be called after blast_comms_usb_cmd_init.
+ */
+static int blast_comms_usb_tx_init(struct blast_comms_dev *dev)
+{
+	struct blast_comms_tx_slot *slot;
+	int i;
+
+	init_usb_anchor(&dev->tx_anchor);
+	init_waitqueue_head(&dev->tx_idle_q);
+	atomic_set(&dev->tx_inflight, 0);
+	atomic_set(&dev->tx_nacks, 0);
+	dev->tx_head = 0;
+
+	/* Frames can only be gathered from the stack if the controller takes
+	 * sg entries that aren't multiples of the packet size (i.e. xHCI)
+	 */
+	dev->tx_sg = dev->usb_dev->bus->sg_tablesize > 0 &&
+					dev->usb_dev->bus->no_sg_constraint;
+
+	for (i = 0; i < BLAST_COMMS_USB_TX_RING; i++) {
+		slot = &dev->tx_ring[i];
+		slot->dev = dev;
+		slot->busy = 0;
+
+		/* each slot owns the tag of the same number */
+		slot->req = &dev->req[i];
+		slot->req->complete = blast_comms_usb_tx_ack_complete;
+		slot->req->context = slot;
+		slot->req->buf = NULL;
+
+		slot->cmd_urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!slot->cmd_urb)
+			goto tx_init_fail;
+
+		slot->cmd_buf = usb_alloc_coherent(dev->usb_dev,
+					BLAST_COMMS_USB_MAX_TRANSFER, GFP_KERNEL,
+					&slot->cmd_urb->transfer_dma);
+		if (!slot->cmd_buf)
+			goto tx_init_fail;
+
+		usb_fill_bulk_urb(slot->cmd_urb, dev->usb_dev,
+				usb_sndbulkpipe(dev->usb_dev, dev->usb_ep_out),
+				slot->cmd_buf, 0,
+				blast_comms_usb_tx_cmd_complete, slot);
+		slot->cmd_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+		if (!dev->tx_sg)
+			continue;
+
+		slot->sg_urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!slot->sg_urb)
+			goto tx_init_fail;
+
+		slot->sg_hdr = kmalloc(BLAST_COMMS_PIC_HDRLEN +
+					BLAST_COMMS_PIC_BATCH_HDRLEN +
+					BLAST_COMMS_PIC_BATCH_MAX, GFP_KERNEL);
+		if (!slot->sg_hdr)
+			goto tx_init_fail;
+
+		usb_fill_bulk_urb(slot->sg_urb, dev->usb_dev,
+				usb_sndbulkpipe(dev->usb_dev, dev->usb_ep_out),
+				NULL, 0, blast_comms_usb_tx_cmd_complete, slot);
+		slot->sg_urb->sg = slot->sg;
+	}
+
+	return 0;
+
+tx_init_fail:
+	blast_comms_usb_tx_release(dev);
+	return -ENOMEM;
+}
+
+/**
+ * blast_comms_usb_tx_release - cancel and free the asynchronous transmit ring
+ * @dev: the device
+ */
+static void blast_comms_usb_tx_release(struct blast_comms_dev *dev)
+{
+	struct blast_comms_tx_slot *slot;
+	int i;
+
+	usb_kill_anchored_urbs(&dev->tx_anchor);
+
+	for (i = 0; i < BLAST_COMMS_USB_TX_RING; i++) {
+		slot = &dev->tx_ring[i];
+
+		if (slot->cmd_buf)
+			usb_free_coherent(dev->usb_dev,
+					BLAST_COMMS_USB_MAX_TRANSFER,
+					slot->cmd_buf,
+					slot->cmd_urb->transfer_dma);
+
+		usb_free_urb(slot->cmd_urb);
+		usb_free_urb(slot->sg_urb);
+		kfree(slot->sg_hdr);
+
+		slot->cmd_urb = NULL;
+		slot->cmd_buf = NULL;
+		slot->sg_urb = NULL;
+		slot->sg_hdr = NULL;
+	}
+}
+
+/**
+ * blast_comms_usb_tx_abort - give up on a ring slot's command
+ * @dev: the device
+ * @slot: the slot
+ * For a response that never came.  The command URB is cancelled if it is
+ * somehow still going, and the slot's tag completed with -ETIMEDOUT, which
+ * frees the slot; a late response is then dropped by its tag generation.
+ */
+static void blast_comms_usb_tx_abort(struct blast_comms_dev *dev,
+					struct blast_comms_tx_slot *slot)
+{
+	usb_kill_urb(slot->cmd_urb);
+	if (slot->sg_urb)
+		usb_kill_urb(slot->sg_urb);
+
+	blast_comms_usb_req_abort(dev, slot->req, -ETIMEDOUT);
+
+	printk(KERN_WARNING "%s: blast_comms_usb_tx_abort: no response to "
+		"tag %d", DRIVER_NAME, slot->req->tag);
+}
+
+/**
+ * blast_comms_usb_tx_quiesce - let the transmit ring empty, then cancel it
+ * @dev: the device
+ * Called before the frames a gathered command points at are freed.  Waits up
+ * to BLAST_COMMS_USB_CMD_TIMEOUT for outstanding ACKs.
+ */
+static void blast_comms_usb_tx_quiesce(struct blast_comms_dev *dev)
+{
+	wait_event_timeout(dev->tx_idle_q,
+			atomic_read(&dev->tx_inflight) == 0,
+			msecs_to_jiffies(BLAST_COMMS_USB_CMD_TIMEOUT));
+
+	usb_kill_anchored_urbs(&dev->tx_anchor);
+}
+
+/**
+ * blast_comms_usb_tx_begin - reserve the next transmit ring slot
+ * @dev: the device
+ * On success usb_lock is held and the slot's cmd_buf may be filled from
+ * offset BLAST_COMMS_PIC_HDRLEN onwards; finish with blast_comms_usb_tx_commit.
+ * Blocks only while every ring slot is in flight, and for no more than
+ * BLAST_COMMS_USB_CMD_TIMEOUT: a slot whose response hasn't come by then is
+ * aborted.  Called from the transmit thread; returns NULL if interrupted or
+ * told to stop.
+ */
+static struct blast_comms_tx_slot *blast_comms_usb_tx_begin(
+						struct blast_comms_dev *dev)
+{
+	struct blast_comms_tx_slot *slot;
+	long left;
+
+	/* Keep ring slots in submission order */
+	if (down_interruptible(&dev->usb_lock))
+		return NULL;
+
+	/* Wait for the next slot in ring order to come free */
+	slot = &dev->tx_ring[dev->tx_head];
+	left = wait_event_interruptible_timeout(dev->tx_idle_q,
+			!slot->busy || kthread_should_stop(),
+			msecs_to_jiffies(BLAST_COMMS_USB_CMD_TIMEOUT));
+
+	if (left < 0 || kthread_should_stop()) {
+		up(&dev->usb_lock);
+		return NULL;
+	}
+
+	/* The response was lost */
+	if (slot->busy)
+		blast_comms_usb_tx_abort(dev, slot);
+
+	/* entry 0 is kept for the header */
+	if (dev->tx_sg) {
+		sg_init_table(slot->sg, BLAST_COMMS_USB_TX_SGS);
+		slot->sg_count = 1;
+	}
+
+	return slot;
+}
+
+/**
+ * blast_comms_usb_tx_send - fill in the header and submit a slot's URB
+ * @dev: the device
+ * @slot: slot from blast_comms_usb_tx_begin
+ * @urb: the slot's cmd_urb or sg_urb
+ * @hdr: where the command header goes
+ * @cmd: PIC command byte
+ * @len: length of command data
+ * Releases usb_lock.
+ */
+static int blast_comms_usb_tx_send(struct blast_comms_dev *dev,
+				struct blast_comms_tx_slot *slot,
+				struct urb *urb, char *hdr,
+				unsigned int cmd, size_t len)
+{
+	int result = 0;
+
+	/* Fill in the command header */
+	hdr[0] = (unsigned char)cmd;
+	hdr[1] = blast_comms_usb_req_arm(dev, slot->req, cmd);
+	*((__le16 *)&hdr[2]) = cpu_to_le16(len);
+	urb->transfer_buffer_length = len + BLAST_COMMS_PIC_HDRLEN;
+
+	slot->busy = 1;
+	atomic_inc(&dev->tx_inflight);
+
+	usb_anchor_urb(urb, &dev->tx_anchor);
+	result = usb_submit_urb(urb, GFP_KERNEL);
+	if (result) {
+		usb_unanchor_urb(urb);
+		blast_comms_usb_req_abort(dev, slot->req, result);
+		up(&dev->usb_lock);
+
+		printk(KERN_WARNING "%s: blast_comms_usb_tx_send: submit "
+			"failed", DRIVER_NAME);
+		return result;
+	}
+
+	dev->tx_head = (dev->tx_head + 1) % BLAST_COMMS_USB_TX_RING;
+	up(&dev->usb_lock);
+
+	return 0;
+}
+
+/**
+ * blast_comms_usb_tx_commit - queue a filled slot without waiting for its ACK
+ * @dev: the device
+ * @slot: slot from blast_comms_usb_tx_begin
+ * @cmd: PIC command byte
+ * @len: length of command data already in the slot
+ * Releases usb_lock.  NACKs are counted in dev->tx_nacks; the ARQ layer
+ * recovers the lost frames.
+ */
+static int blast_comms_usb_tx_commit(struct blast_comms_dev *dev,
+				struct blast_comms_tx_slot *slot,
+				unsigned int cmd, size_t len)
+{
+	return blast_comms_usb_tx_send(dev, slot, slot->cmd_urb,
+						slot->cmd_buf, cmd, len);
+}
+
+/**
+ * blast_comms_usb_tx_sg_add - append a buffer to a slot's gathered command
+ * @slot: slot from blast_comms_usb_tx_begin (dev->tx_sg only)
+ * @data: kmalloc'd (not stack or vmalloc) memory, untouched until the ACK
+ * @len: length of data
+ * Buffers that follow on from the previous one in memory share its entry.
+ */
+static int blast_comms_usb_tx_sg_add(struct blast_comms_tx_slot *slot,
+						void *data, size_t len)
+{
+	struct scatterlist *last = &slot->sg[slot->sg_count - 1];
+
+	if (slot->sg_count > 1 && sg_virt(last) + last->length == data) {
+		last->length += len;
+		return 0;
+	}
+
+	if (slot->sg_count >= BLAST_COMMS_USB_TX_SGS)
+		return -ENOSPC;
+
+	sg_set_buf(&slot->sg[slot->sg_count++], data, len);
+
+	return 0;
+}
+
+/**
+ * blast_comms_usb_tx_commit_sg - queue a gathered command
+ * @dev: the device
+ * @slot: slot from blast_comms_usb_tx_begin, with buffers added
+ * @hdr_len: command data already placed after the header in slot->sg_hdr
+ * Releases usb_lock.  As blast_comms_usb_tx_commit, but the command data is
+ * sent straight from the buffers given to blast_comms_usb_tx_sg_add.
+ */
+static int blast_comms_usb_tx_commit_sg(struct blast_comms_dev *dev,
+				struct blast_comms_tx_slot *slot,
+				unsigned int cmd, size_t hdr_len)
+{
+	size_t len = hdr_len;
+	int i;
+
+	sg_set_buf(&slot->sg[0], slot->sg_hdr,
+				BLAST_COMMS_PIC_HDRLEN + hdr_len);
+	sg_mark_end(&slot->sg[slot->sg_count - 1]);
+
+	for (i = 1; i < slot->sg_count; i++)
+		len += slot->sg[i].length;
+
+	slot->sg_urb->num_sgs = slot->sg_count;
+
+	return blast_comms_usb_tx_send(dev, slot, slot->sg_urb,
+						slot->sg_hdr, cmd, len);
+}
+
+/**
+ * blast_comms_usb_tx_submit - queue a command without waiting for its ACK
+ * @dev: the device
+ * @cmd: PIC command byte
+ * @data: command data
+ * @len: length of command data
+ */
+static int blast_comms_usb_tx_submit(struct blast_comms_dev *dev,
+				unsigned int cmd, char *data, size_t len)
+{
+	struct blast_comms_tx_slot *slot;
+
+	if (len > BLAST_COMMS_USB_MAX_TRANSFER - BLAST_COMMS_PIC_HDRLEN)
+		return -EINVAL;
+
+	slot = blast_comms_usb_tx_begin(dev);
+	if (!slot)
+		return -ERESTARTSYS;
+
+	memcpy(&slot->cmd_buf[BLAST_COMMS_PIC_HDRLEN], data, len);
+
+	return blast_comms_usb_tx_commit(dev, slot, cmd, len);
+}
+
+/**
+ * blast_comms_usb_buf_complete - a pooled transfer has finished
+ * @urb: the URB
+ */
+static void blast_comms_usb_buf_complete(struct urb *urb)
+{
+	struct blast_comms_usb_buf *buf = urb->context;
+
+	complete(&buf->done);
+}
+
+/**
+ * blast_comms_usb_pool_init - allocate the command buffer pool
+ * @dev: the device
+ */
+static int blast_comms_usb_pool_init(struct blast_comms_dev *dev)
+{
+	struct blast_comms_usb_buf *buf;
+	int i;
+
+	INIT_LIST_HEAD(&dev->buf_free);
+	spin_lock_init(&dev->buf_lock);
+	init_waitqueue_head(&dev->buf_q);
+
+	for (i = 0; i < BLAST_COMMS_USB_POOL_SIZE; i++) {
+		buf = &dev->buf_pool[i];
+
+		buf->urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!buf->urb)
+			goto pool_init_fail;
+
+		buf->data = usb_alloc_coherent(dev->usb_dev,
+					BLAST_COMMS_USB_MAXLEN, GFP_KERNEL,
+					&buf->urb->transfer_dma);
+		if (!buf->data)
+			goto pool_init_fail;
+
+		init_completion(&buf->done);
+		list_add_tail(&buf->list, &dev->buf_free);
+	}
+
+	return 0;
+
+pool_init_fail:
+	blast_comms_usb_pool_release(dev);
+	return -ENOMEM;
+}
+
+/**
+ * blast_comms_usb_pool_release - free the command buffer pool
+ * @dev: the device
+ */
+static void blast_comms_usb_pool_release(struct blast_comms_dev *dev)
+{
+	struct blast_comms_usb_buf *buf;
+	int i;
+
+	for (i = 0; i < BLAST_COMMS_USB_POOL_SIZE; i++) {
+		buf = &dev->buf_pool[i];
+
+		if (buf->urb)
+			usb_kill_urb(buf->urb);
+
+		if (buf->data)
+			usb_free_coherent(dev->usb_dev, BLAST_COMMS_USB_MAXLEN,
+					buf->data, buf->urb->transfer_dma);
+
+		usb_free_urb(buf->urb);
+		buf->urb = NULL;
+		buf->data = NULL;
+	}
+
+	INIT_LIST_HEAD(&dev->buf_free);
+}
+
+/**
+ * blast_comms_usb_buf_get - take a buffer from the pool
+ * @dev: the device
+ * Sleeps until a buffer is free.  Returns NULL if interrupted.
+ */
+static struct blast_comms_usb_buf *blast_comms_usb_buf_get(
+						struct blast_comms_dev *dev)
+{
+	struct blast_comms_usb_buf *buf = NULL;
+
+	while (!buf) {
+		spin_lock_bh(&dev->buf_lock);
+		if (!list_empty(&dev->buf_free)) {
+			buf = list_first_entry(&dev->buf_free,
+					struct blast_comms_usb_buf, list);
+			list_del(&buf->list);
+		}
+		spin_unlock_bh(&dev->buf_lock);
+
+		if (buf)
+			break;
+
+		if (wait_event_interruptible(dev->buf_q,
+						!list_empty(&dev->buf_free)))
+			return NULL;
+	}
+
+	buf->len = 0;
+	return buf;
+}
+
+/**
+ * blast_comms_usb_buf_put - return a buffer to the pool
+ * @dev: the device
+ * @buf: the buffer
+ */
+static void blast_comms_usb_buf_put(struct blast_comms_dev *dev,
+					struct blast_comms_usb_buf *buf)
+{
+	spin_lock_bh(&dev->buf_lock);
+	list_add(&buf->list, &dev->buf_free);
+	spin_unlock_bh(&dev->buf_lock);
+
+	wake_up(&dev->buf_q);
+}
+
+/**
+ * blast_comms_usb_xfer - synchronous bulk transfer from a pool buffer
+ * @dev: the device
+ * @buf: the pool buffer (already DMA mapped)
+ * @pipe: bulk pipe
+ * @len: bytes to send, or the most to receive
+ * @actual: bytes actually transferred
+ * Equivalent to usb_bulk_msg() but without mapping or bouncing the buffer.
+ */
+static int blast_comms_usb_xfer(struct blast_comms_dev *dev,
+				struct blast_comms_usb_buf *buf,
+				unsigned int pipe, size_t len, size_t *actual)
+{
+	ktime_t start;
+	int result = 0;
+
+	if (len <= 0 || len > BLAST_COMMS_USB_MAXLEN)
+		return -EINVAL;
+
+	usb_fill_bulk_urb(buf->urb, dev->usb_dev, pipe, buf->data, len,
+					blast_comms_usb_buf_complete, buf);
+	buf->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	reinit_completion(&buf->done);
+
+	start = ktime_get();
+	result = usb_submit_urb(buf->urb, GFP_KERNEL);
+	if (result)
+		return result;
+
+	if (!wait_for_completion_timeout(&buf->done,
+				msecs_to_jiffies(BLAST_COMMS_USB_TIMEOUT))) {
+		usb_kill_urb(buf->urb);
+		*actual = buf->urb->actual_length;
+		blast_comms_stats_record(&dev->stats,
+				BLAST_COMMS_STATS_USB_OUT, start, -ETIMEDOUT);
+		return -ETIMEDOUT;
+	}
+
+	*actual = buf->urb->actual_length;
+	blast_comms_stats_record(&dev->stats, BLAST_COMMS_STATS_USB_OUT,
+						start, buf->urb->status);
+	return buf->urb->status;
+}
+
+/**
+ * blast_comms_usb_rx_complete - a block of received bytes has arrived
+ * @urb: the receive URB
+ * Runs in interrupt context.  The block is pushed onto the radio's raw receive
+ * stack for its frame finder and the URB is immediately rearmed.  The USB core
+ * completes URBs on one endpoint in order, so this is the only producer.
+ */
+static void blast_comms_usb_rx_complete(struct urb *urb)
+{
+	struct blast_comms_dev *dev = urb->context;
+	unsigned int copied;
+
+	switch (urb->status) {
+	case 0:
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		/* killed by rx_stop or disconnect */
+		return;
+	default:
+		/* transient bus error, drop the block and keep listening */
+		if (blast_comms_usb_transient(urb->status))
+			goto rx_resubmit;
+
+		printk(KERN_WARNING "%s: stream endpoint: error %d",
+						DRIVER_NAME, urb->status);
+		return;
+	}
+
+	if (dev->link_dev && urb->actual_length) {
+		copied = kfifo_in(&dev->rx_raw_stack, urb->transfer_buffer,
+							urb->actual_length);
+		if (copied < urb->actual_length)
+			atomic_inc(&dev->rx_overruns);
+
+		wake_up(&dev->framefinder_q);
+	}
+
+rx_resubmit:
+	if (!dev->rx_streaming)
+		return;
+
+	usb_anchor_urb(urb, &dev->rx_anchor);
+	if (usb_submit_urb(urb, GFP_ATOMIC))
+		usb_unanchor_urb(urb);
+}
+
+/**
+ * blast_comms_usb_rx_init - allocate the streaming receive ring
+ * @dev: the device
+ * Does nothing if the PIC firmware has no streaming endpoint.
+ */
+static int blast_comms_usb_rx_init(struct blast_comms_dev *dev)
+{
+	struct urb *urb;
+	char *buf;
+	int i;
+
+	init_usb_anchor(&dev->rx_anchor);
+	atomic_set(&dev->rx_overruns, 0);
+	dev->rx_streaming = 0;
+
+	if (!dev->usb_ep_stream)
+		return 0;
+
+	for (i = 0; i < BLAST_COMMS_USB_RX_RING; i++) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			goto rx_init_fail;
+
+		dev->rx_ring[i] = urb;
+
+		buf = usb_alloc_coherent(dev->usb_dev, BLAST_COMMS_USB_RX_LEN,
+						GFP_KERNEL, &urb->transfer_dma);
+		if (!buf)
+			goto rx_init_fail;
+
+		usb_fill_bulk_urb(urb, dev->usb_dev,
+			usb_rcvbulkpipe(dev->usb_dev, dev->usb_ep_stream),
+			buf, BLAST_COMMS_USB_RX_LEN,
+			blast_comms_usb_rx_complete, dev);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	return 0;
+
+rx_init_fail:
+	blast_comms_usb_rx_release(dev);
+	return -ENOMEM;
+}
+
+/**
+ * blast_comms_usb_rx_release - cancel and free the streaming receive ring
+ * @dev: the device
+ */
+static void blast_comms_usb_rx_release(struct blast_comms_dev *dev)
+{
+	struct urb *urb;
+	int i;
+
+	blast_comms_usb_rx_stop(dev);
+
+	for (i = 0; i < BLAST_COMMS_USB_RX_RING; i++) {
+		urb = dev->rx_ring[i];
+		if (!urb)
+			continue;
+
+		if (urb->transfer_buffer)
+			usb_free_coherent(dev->usb_dev, BLAST_COMMS_USB_RX_LEN,
+						urb->transfer_buffer,
+						urb->transfer_dma);
+		usb_free_urb(urb);
+		dev->rx_ring[i] = NULL;
+	}
+}
+
+/**
+ * blast_comms_usb_rx_start - arm every receive URB
+ * @dev: the device
+ * The device's rx_raw_stack must exist before this is called.
+ */
+static int blast_comms_usb_rx_start(struct blast_comms_dev *dev)
+{
+	int result = 0;
+	int i;
+
+	if (!dev->usb_ep_stream)
+		return -ENODEV;
+
+	dev->rx_streaming = 1;
+
+	for (i = 0; i < BLAST_COMMS_USB_RX_RING; i++) {
+		usb_anchor_urb(dev->rx_ring[i], &dev->rx_anchor);
+		result = usb_submit_urb(dev->rx_ring[i], GFP_KERNEL);
+		if (result) {
+			usb_unanchor_urb(dev->rx_ring[i]);
+			blast_comms_usb_rx_stop(dev);
+			return result;
+		}
+	}
 
 	return 0;
 }
 
+/**
+ * blast_comms_usb_rx_stop - disarm the receive ring
+ * @dev: the device
+ */
+static void blast_comms_usb_rx_stop(struct blast_comms_dev *dev)
+{
+	dev->rx_streaming = 0;
+	usb_kill_anchored_urbs(&dev->rx_anchor);
+}
+
 /**
  * THE usb_driver Structure
  */
-static struct usb_driver blast_comms_usb_dev = {
+struct usb_driver blast_comms_usb_drv = {
 	.name 		= DRIVER_NAME,
 	.probe 		= blast_comms_usb_probe,
 	.disconnect	= blast_comms_usb_disconnect,
@@ -19,6 +19,16 @@
 #ifndef _BLAST_COMMS_USB_H_
 #define _BLAST_COMMS_USB_H_
 
+/*
+ * Linux inclusions
+ */
+#include <linux/types.h>
+#include <linux/usb.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/scatterlist.h>
+
 /*
  * Local inclusions
  */
@@ -31,9 +41,74 @@
 #define USB_DEVICE_ID_BLASTCOMMS 			0x00
 
 #define BLAST_COMMS_USB_MAX_TRANSFER		4096
+#define	BLAST_COMMS_USB_MAXLEN			BLAST_COMMS_USB_MAX_TRANSFER
 #define BLAST_COMMS_USB_TIMEOUT				4
 #define	BLAST_COMMS_USB_MINOR_BASE			0
 
+#define	BLAST_COMMS_USB_TX_RING			8	/* PUTRAMs in flight */
+/* header + one batch */
+#define	BLAST_COMMS_USB_TX_SGS			(BLAST_COMMS_PIC_BATCH_MAX + 1)
+#define	BLAST_COMMS_USB_RESP_RING		4	/* response URBs armed */
+#define	BLAST_COMMS_USB_CMD_TIMEOUT		1000	/* ms */
+
+#define	BLAST_COMMS_USB_RX_RING			4	/* IN URBs armed */
+#define	BLAST_COMMS_USB_RX_LEN			512	/* bytes per URB */
+
+#define	BLAST_COMMS_USB_POOL_SIZE		4	/* command buffers */
+
+/*
+ * Command buffer pool entry
+ * A DMA-coherent buffer of BLAST_COMMS_USB_MAXLEN bytes together with the URB
+ * used to move it, so synchronous PIC commands allocate nothing.
+ */
+struct blast_comms_usb_buf {
+	struct list_head	list;		/** free list linkage */
+	struct urb		*urb;		/** carries the DMA handle */
+	char			*data;		/** coherent buffer */
+	size_t			len;		/** bytes in use */
+	struct completion	done;		/** transfer complete */
+};
+
+/*
+ * Tagged PIC command
+ * One entry per tag in the device's completion table.  Synchronous callers
+ * sleep on done; asynchronous users (the transmit ring) set complete, which
+ * is called from the response URB's completion handler.
+ */
+struct blast_comms_pic_req {
+	u8			tag;		/** tag in the command header */
+	int			busy;		/** tag allocated */
+	int			pending;	/** awaiting a response */
+	int			status;		/** response code or -ve error */
+	unsigned int		cmd;		/** command byte, for stats */
+	ktime_t			start;		/** when it was sent */
+	char			*buf;		/** EX(N)ACK data destination */
+	size_t			len;		/** room in buf */
+	size_t			actual;		/** bytes copied to buf */
+	struct completion	done;		/** response received */
+	void			(*complete)(struct blast_comms_pic_req *req);
+	void			*context;	/** for complete() */
+};
+
+/*
+ * Asynchronous transmit ring slot
+ * Each slot owns a PUTRAM command URB and a fixed tag; the ACK is matched to
+ * the slot by the response dispatcher.  Where the host controller can gather
+ * arbitrary scatterlists the slot also has an sg URB, which sends the command
+ * header from sg_hdr and the frames straight out of the transmit stack.
+ */
+struct blast_comms_tx_slot {
+	struct blast_comms_dev	*dev;		/** owning device */
+	struct urb		*cmd_urb;	/** command (OUT) */
+	char			*cmd_buf;	/** coherent command buffer */
+	struct urb		*sg_urb;	/** gathered command (OUT) */
+	char			*sg_hdr;	/** header for sg_urb */
+	struct scatterlist	sg[BLAST_COMMS_USB_TX_SGS];
+	int			sg_count;	/** entries in use */
+	struct blast_comms_pic_req *req;	/** the slot's tag */
+	int			busy;		/** slot in flight */
+};
+
 /*
  * Function prototypes
  */
@@ -44,6 +119,50 @@ static inline int blast_comms_usb_read(struct blast_comms_dev *dev, char *buf,
 								int len);
 static u32 blast_comms_usb_write(struct blast_comms_dev *dev, char *buf,
 								int len);
+static int blast_comms_usb_cmd_init(struct blast_comms_dev *dev);
+static void blast_comms_usb_cmd_release(struct blast_comms_dev *dev);
+static int blast_comms_usb_transient(int status);
+static struct blast_comms_pic_req *blast_comms_usb_req_get(
+						struct blast_comms_dev *dev);
+static int blast_comms_usb_req_avail(struct blast_comms_dev *dev);
+static void blast_comms_usb_req_put(struct blast_comms_dev *dev,
+					struct blast_comms_pic_req *req);
+static u8 blast_comms_usb_req_arm(struct blast_comms_dev *dev,
+				struct blast_comms_pic_req *req, unsigned int cmd);
+static void blast_comms_usb_req_abort(struct blast_comms_dev *dev,
+				struct blast_comms_pic_req *req, int status);
+static int blast_comms_usb_req_wait(struct blast_comms_dev *dev,
+					struct blast_comms_pic_req *req);
+static int blast_comms_usb_tx_init(struct blast_comms_dev *dev);
+static void blast_comms_usb_tx_release(struct blast_comms_dev *dev);
+static void blast_comms_usb_tx_abort(struct blast_comms_dev *dev,
+					struct blast_comms_tx_slot *slot);
+static struct blast_comms_tx_slot *blast_comms_usb_tx_begin(
+						struct blast_comms_dev *dev);
+static int blast_comms_usb_tx_commit(struct blast_comms_dev *dev,
+				struct blast_comms_tx_slot *slot,
+				unsigned int cmd, size_t len);
+static int blast_comms_usb_tx_submit(struct blast_comms_dev *dev,
+				unsigned int cmd, char *data, size_t len);
+static int blast_comms_usb_tx_sg_add(struct blast_comms_tx_slot *slot,
+						void *data, size_t len);
+static int blast_comms_usb_tx_commit_sg(struct blast_comms_dev *dev,
+				struct blast_comms_tx_slot *slot,
+				unsigned int cmd, size_t hdr_len);
+static void blast_comms_usb_tx_quiesce(struct blast_comms_dev *dev);
+static int blast_comms_usb_pool_init(struct blast_comms_dev *dev);
+static void blast_comms_usb_pool_release(struct blast_comms_dev *dev);
+static struct blast_comms_usb_buf *blast_comms_usb_buf_get(
+						struct blast_comms_dev *dev);
+static void blast_comms_usb_buf_put(struct blast_comms_dev *dev,
+					struct blast_comms_usb_buf *buf);
+static int blast_comms_usb_xfer(struct blast_comms_dev *dev,
+				struct blast_comms_usb_buf *buf,
+				unsigned int pipe, size_t len, size_t *actual);
+static int blast_comms_usb_rx_init(struct blast_comms_dev *dev);
+static void blast_comms_usb_rx_release(struct blast_comms_dev *dev);
+static int blast_comms_usb_rx_start(struct blast_comms_dev *dev);
+static void blast_comms_usb_rx_stop(struct blast_comms_dev *dev);
 
 #endif /* _BLAST_COMMS_USB_H_ */
 
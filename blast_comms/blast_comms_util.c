@@ -20,8 +20,9 @@
  * Linux inclusions
  */
 #include <linux/kernel.h>
-#include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/bitrev.h>
+#include <asm/unaligned.h>
 
 /*
  * Local inclusions
@@ -29,55 +30,35 @@
 #include "blast_comms.h"
 
 /**
- * Bit reversal lookup table (used by __u8_bitflip)
- */
-static u8 bitreversal_lookup[16] = {
-   0x0, 0x8, 0x4, 0xC,
-   0x2, 0xA, 0x6, 0xE,
-   0x1, 0x9, 0x5, 0xD,
-   0x3, 0xB, 0x7, 0xF
-};
-
-/**
- * __u8_bitflip - reverses the bits in a single byte
- * @n: byte to flip
- */
-static u8 __u8_bitflip(u8 n)
-{
-   return (bitreversal_lookup[n & 0x0F] << 4) | bitreversal_lookup[n >> 4];
-}
-
-/**
- * bitflip - reverses the bits and endian of the data
+ * bitrev8_words - reverse the bits of every byte in a buffer, in place
  * @buf: buffer to flip
  * @len: length of buffer
+ * Works a machine word at a time, swapping bit pairs, then pairs of pairs,
+ * then nibbles across every byte of the word at once.  Byte order is left
+ * alone, so the result is the same whatever the CPU's endianness.
  */
-static void bitflip(u8 *buf, size_t len)
+static void bitrev8_words(void *buf, size_t len)
 {
-	u8 *tmp = (u8 *)kmalloc(len, GFP_ATOMIC);	/* Temporary buffer */
-	u8 *buf_head = buf;			/* Hold the buffer head */
-	size_t l = len;				/* Hold the buffer length */
+	u8 *p = buf;
+	unsigned long v;
 
-	/* Check allocation, fail gracefully (ish) */
-	if (tmp) {
-		printk(KERN_NOTICE "%s: bitflip() unable to allocate memory "
-					"for tmp. Aborting.\n", DRIVER_NAME);
-		return;
+	while (len >= sizeof(unsigned long)) {
+		v = get_unaligned((unsigned long *)p);
+		v = ((v >> 1) & REPEAT_BYTE(0x55)) |
+					((v & REPEAT_BYTE(0x55)) << 1);
+		v = ((v >> 2) & REPEAT_BYTE(0x33)) |
+					((v & REPEAT_BYTE(0x33)) << 2);
+		v = ((v >> 4) & REPEAT_BYTE(0x0F)) |
+					((v & REPEAT_BYTE(0x0F)) << 4);
+		put_unaligned(v, (unsigned long *)p);
+		p += sizeof(unsigned long);
+		len -= sizeof(unsigned long);
 	}
 
-	/* Flip and reverse. */
-	/* TODO: change to take into account cpu endianness */
-	while (len > 0) {
-		tmp[len - 1] = __u8_bitflip(*buf);
-		buf++;
-		len--;
+	while (len--) {
+		*p = bitrev8(*p);
+		p++;
 	}
-
-	/* Copy back to buffer */
-	memcpy(buf_head, tmp, l);
-
-	/* Clean up */
-	kfree(tmp);
 }
 
 /* EOF */
@@ -0,0 +1,72 @@
+/**
+ * gen_crctable.c
+ *
+ * CRC Table Generator (host program)
+ *
+ * Cubesat Communications Uplink/Downlink Driver
+ * Use with Linux Kernel >=3.0 [http://www.kernel.org/]
+ * Designed for Google Android [http://android.google.com/]
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Writes blast_comms_crctable.h: slice-by-4 tables for the reflected
+ * CRC-CCITT (x^16 + x^12 + x^5 + 1) used by blast_comms_crc.c.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define	CRC_POLY_REFLECTED	0x8408
+#define	CRC_SLICES		4
+
+static uint16_t table[CRC_SLICES][256];
+
+/**
+ * crc_init - fill the tables
+ * table[0] is the usual byte at a time table; table[k][b] is the CRC of
+ * byte b followed by k zero bytes, so four bytes can be folded in at once.
+ */
+static void crc_init(void)
+{
+	uint16_t crc;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC_POLY_REFLECTED : 0);
+		table[0][i] = crc;
+	}
+
+	for (k = 1; k < CRC_SLICES; k++)
+		for (i = 0; i < 256; i++)
+			table[k][i] = (table[k - 1][i] >> 8) ^
+					table[0][table[k - 1][i] & 0xFF];
+}
+
+int main(void)
+{
+	int i, k;
+
+	crc_init();
+
+	printf("/* this file is generated by gen_crctable - do not edit */\n\n");
+	printf("#define\tBLAST_COMMS_CRC_SLICES\t%d\n\n", CRC_SLICES);
+	printf("static const u16 blast_comms_crc_table[%d][256] = {\n",
+								CRC_SLICES);
+	for (k = 0; k < CRC_SLICES; k++) {
+		printf("\t{");
+		for (i = 0; i < 256; i++)
+			printf("%s0x%04x,", (i % 8) ? " " : "\n\t\t",
+								table[k][i]);
+		printf("\n\t},\n");
+	}
+	printf("};\n");
+
+	return 0;
+}
+
+/* EOF */
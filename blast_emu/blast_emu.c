@@ -0,0 +1,177 @@
+/**
+ * blast_emu.c
+ *
+ * Application Entry Point
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Emulates the blast_pic firmware (and the RFM23 behind it) as a USB device
+ * using the raw-gadget interface, so blast_comms can be exercised without
+ * hardware.  With dummy_hcd loaded the module binds to it like a real radio:
+ *
+ *	modprobe dummy_hcd; modprobe raw_gadget
+ *	blast_emu --stream --sink /tmp/air &
+ *	insmod blast_comms.ko
+ *
+ * Two emulators can be joined through a named pipe, one transmitting into it
+ * (--sink) and one receiving from it (--source).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blast_emu.h"
+
+/*
+ * Global variables
+ */
+static struct emu emu;
+
+/* 'long' options - flags preceeded by '--': e.g. '--help' */
+static struct option long_options[] = {
+	{ "version",	no_argument,		0,	'V'	},
+	{ "help",	no_argument,		0,	'h'	},
+	{ "driver",	required_argument,	0,	'd'	},
+	{ "device",	required_argument,	0,	'D'	},
+	{ "bitrate",	required_argument,	0,	'r'	},
+	{ "latency",	required_argument,	0,	'l'	},
+	{ "stream",	no_argument,		0,	's'	},
+	{ "sink",	required_argument,	0,	'o'	},
+	{ "source",	required_argument,	0,	'i'	},
+	{ 0,		0,			0,	0	}
+};
+
+/* 'short' options - single-character flags: e.g. '-d' */
+static char *short_options = "Vhd:D:r:l:so:i:";
+
+/**
+ * Usage text
+ */
+static char *usage_str =
+"Usage: %s [options]\n"
+"options include:\n"
+" --driver <udc>     UDC driver name (default dummy_udc).\n"
+" --device <udc>     UDC device name (default dummy_udc.0).\n"
+" --bitrate <bps>    Fix the air bitrate (default: as programmed).\n"
+" --latency <us>     Delay every command response.\n"
+" --stream           Offer the streaming receive endpoint.\n"
+" --sink <file>      Write transmitted bytes to file.\n"
+" --source <file>    Receive bytes from file.\n"
+" --version          Display version information and exit.\n"
+" --help             Display this message and exit.\n";
+
+/**
+ * emu_signal - note a signal for the main loop
+ * @sig: the signal
+ * Only async-signal-safe work here; emu_gadget_run returns to main().
+ */
+static void emu_signal(int sig)
+{
+	emu.signal = sig;
+}
+
+/**
+ * emu_stats - print counters
+ */
+static void emu_stats(void)
+{
+	fprintf(stderr, "%s: %lu commands, %lu NACKs, %lu frames "
+			"(%lu bytes) sent, %lu received (%lu streamed, "
+			"%lu dropped), air %ld bps\n", EMU_NAME, emu.commands,
+			emu.nacks, emu.frames_tx, emu.bytes_tx, emu.bytes_rx,
+			emu.bytes_streamed, emu.overruns, emu_air_bitrate(&emu));
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa;
+	int opt;
+
+	memset(&emu, 0, sizeof(emu));
+	emu.udc_driver = "dummy_udc";
+	emu.udc_device = "dummy_udc.0";
+	emu.sink_fd = -1;
+	emu.source_fd = -1;
+
+	while ((opt = getopt_long(argc, argv, short_options, long_options,
+							NULL)) != -1) {
+		switch (opt) {
+		case 'V':
+			printf("%s %s\n", EMU_NAME, EMU_VERSION);
+			printf("Project BLAST PIC/USB Device Emulator\n");
+			return 0;
+		case 'h':
+			printf(usage_str, EMU_NAME);
+			return 0;
+		case 'd':
+			emu.udc_driver = optarg;
+			break;
+		case 'D':
+			emu.udc_device = optarg;
+			break;
+		case 'r':
+			emu.bitrate = strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			emu.latency = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			emu.stream = 1;
+			break;
+		case 'o':
+			emu.sink_fd = open(optarg, O_WRONLY | O_CREAT | O_APPEND,
+									0644);
+			if (emu.sink_fd < 0) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			emu.source_fd = open(optarg, O_RDONLY | O_NONBLOCK);
+			if (emu.source_fd < 0) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, usage_str, EMU_NAME);
+			return 1;
+		}
+	}
+
+	/* No SA_RESTART: the signal has to break ep0's wait for an event */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = emu_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	emu_pic_init(&emu);
+
+	if (emu_gadget_init(&emu) < 0)
+		return 1;
+
+	while (emu_gadget_run(&emu) == -EINTR) {
+		emu_stats();
+		if (emu.signal != SIGUSR1)
+			return 0;
+		emu.signal = 0;
+	}
+
+	return 1;
+}
+
+/* EOF */
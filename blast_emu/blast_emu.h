@@ -0,0 +1,136 @@
+/**
+ * blast_emu.h
+ *
+ * BLAST PIC/USB Device Emulator
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#ifndef _BLAST_EMU_H_
+#define _BLAST_EMU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * The command set is shared with the driver
+ */
+#include "../blast_comms/blast_comms_pic.h"
+
+#define	EMU_NAME		"blast_emu"
+#define	EMU_VERSION		"0.1"
+
+/*
+ * USB identity (must match the driver's device table)
+ */
+#define	EMU_USB_VENDOR		0x0000
+#define	EMU_USB_PRODUCT		0x0000
+#define	EMU_USB_MAXPACKET	512		/* high speed bulk */
+#define	EMU_USB_BUFFER_LEN	4096		/* as the PIC's BUFFER_LEN */
+
+/*
+ * PIC constants (see blast_pic.h)
+ */
+#define	EMU_RAM_LEN		0x10000		/* external FIFO RAM */
+#define	EMU_XCVR_MAX		256		/* largest held RAM GET */
+#define	EMU_XCVR_BUFFER_LEN	40		/* RFM23 FIFO threshold */
+#define	EMU_RESP_NONE		0x00		/* held, answered later */
+#define	EMU_FRAME_MAX		255		/* as RFM_REG_TX_PKT_LEN */
+
+/*
+ * RFM23 registers the emulator interprets
+ */
+#define	EMU_RFM_WRITE		0x80
+#define	EMU_RFM_REG_TX_PKT_LEN	0x3E
+#define	EMU_RFM_REG_TX_DR_1	0x6E
+#define	EMU_RFM_REG_TX_DR_0	0x6F
+#define	EMU_RFM_REG_MOD_MODE_1	0x70
+#define	EMU_RFM_TX_DR_SCALE	0x20
+#define	EMU_RFM_REGS		0x80
+
+#define	EMU_DEFAULT_BITRATE	10000		/* bps, the driver default */
+
+/*
+ * Emulator state
+ */
+struct emu {
+	/* Options */
+	const char	*udc_driver;
+	const char	*udc_device;
+	long		bitrate;		/* bps; 0 = from RFM registers */
+	long		latency;		/* us added to every response */
+	int		stream;			/* offer the streaming endpoint */
+	int		sink_fd;		/* transmitted bytes, or -1 */
+	int		source_fd;		/* bytes to receive, or -1 */
+	volatile sig_atomic_t signal;		/* caught, not yet handled */
+
+	/* USB */
+	int		fd;			/* /dev/raw-gadget */
+	int		ep_cmd;			/* raw gadget endpoint handles */
+	int		ep_resp;
+	int		ep_stream;
+	uint8_t		addr_cmd;		/* endpoint addresses */
+	uint8_t		addr_resp;
+	uint8_t		addr_stream;
+	int		configured;
+	pthread_mutex_t	resp_lock;		/* one response at a time */
+
+	/* PIC */
+	pthread_mutex_t	lock;			/* everything below */
+	int		mode;
+	uint8_t		ram[EMU_RAM_LEN];
+	size_t		fifo_head;
+	size_t		fifo_tail;
+	size_t		fifo_count;
+	size_t		tx_frame_left;		/* of the frame on air */
+	uint8_t		rfm[EMU_RFM_REGS];	/* RFM23 register file */
+	uint8_t		xcvr_user_buffer[EMU_XCVR_MAX];
+	int		pending_get;		/* a RAM GET is being held */
+	uint8_t		pending_get_tag;
+	size_t		pending_get_len;
+
+	/* Statistics */
+	unsigned long	commands;
+	unsigned long	nacks;
+	unsigned long	frames_tx;		/* sent over the air */
+	unsigned long	bytes_tx;
+	unsigned long	bytes_rx;		/* received over the air */
+	unsigned long	bytes_streamed;
+	unsigned long	overruns;		/* received bytes dropped */
+};
+
+/*
+ * Function Prototypes
+ */
+
+/* Gadget */
+int emu_gadget_init(struct emu *emu);
+int emu_gadget_run(struct emu *emu);
+int emu_gadget_read(struct emu *emu, int ep, uint8_t *buf, size_t len);
+int emu_gadget_write(struct emu *emu, int ep, uint8_t *buf, size_t len);
+
+/* PIC */
+void emu_pic_init(struct emu *emu);
+void *emu_pic_thread(void *arg);
+int emu_pic_respond(struct emu *emu, uint8_t resp, uint8_t tag,
+						uint8_t *data, size_t len);
+int emu_fifo_put(struct emu *emu, const uint8_t *buf, size_t len);
+size_t emu_fifo_get(struct emu *emu, uint8_t *buf, size_t len);
+void emu_fifo_clear(struct emu *emu);
+int emu_fifo_put_frame(struct emu *emu, const uint8_t *buf, size_t len);
+int emu_fifo_put_batch(struct emu *emu, const uint8_t *buf, size_t len);
+
+/* Air */
+long emu_air_bitrate(struct emu *emu);
+void *emu_air_thread(void *arg);
+
+#endif /* _BLAST_EMU_H_ */
+
+/* EOF */
@@ -0,0 +1,193 @@
+/**
+ * blast_emu_air.c
+ *
+ * RFM23 Air Interface Emulation
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blast_emu.h"
+
+#define	EMU_AIR_TICK		1000000L	/* ns */
+#define	EMU_AIR_BYTE		(8 * 1000000000LL)	/* credit per byte */
+
+/**
+ * emu_air_bitrate - current air bitrate in bps
+ * @emu: the emulator (lock held)
+ * Follows the RFM23 data rate registers as the driver programs them unless
+ * a fixed bitrate was given on the command line.
+ */
+long emu_air_bitrate(struct emu *emu)
+{
+	long dr;
+
+	if (emu->bitrate > 0)
+		return emu->bitrate;
+
+	dr = (emu->rfm[EMU_RFM_REG_TX_DR_1] << 8) |
+					emu->rfm[EMU_RFM_REG_TX_DR_0];
+	if (dr == 0)
+		return EMU_DEFAULT_BITRATE;
+
+	/* DR = bps * 2^16 / 10^6, or * 2^21 with txdtrtscale set */
+	if (emu->rfm[EMU_RFM_REG_MOD_MODE_1] & EMU_RFM_TX_DR_SCALE)
+		return (dr * 1000000L) >> 21;
+
+	return (dr * 1000000L) >> 16;
+}
+
+/**
+ * emu_air_transmit - send the next tick's worth of the FIFO
+ * @emu: the emulator (lock held)
+ * @budget: bytes the air can carry this tick
+ * Frames are sent one packet at a time: each one's length byte is taken
+ * off the FIFO into the RFM23's packet length register, as irq() does.
+ */
+static void emu_air_transmit(struct emu *emu, size_t budget)
+{
+	uint8_t buf[EMU_FRAME_MAX];
+	size_t sent = 0;
+	size_t len;
+
+	while (sent < budget) {
+		if (emu->tx_frame_left == 0) {
+			if (emu_fifo_get(emu, buf, 1) == 0)
+				break;
+
+			emu->rfm[EMU_RFM_REG_TX_PKT_LEN] = buf[0];
+			emu->tx_frame_left = buf[0];
+			emu->frames_tx++;
+		}
+
+		len = budget - sent;
+		if (len > emu->tx_frame_left)
+			len = emu->tx_frame_left;
+
+		len = emu_fifo_get(emu, buf, len);
+		if (len == 0)
+			break;
+
+		emu->tx_frame_left -= len;
+		emu->bytes_tx += len;
+		sent += len;
+
+		if (emu->sink_fd >= 0 && write(emu->sink_fd, buf, len) < 0 &&
+							errno != EAGAIN)
+			emu->sink_fd = -1;
+	}
+}
+
+/**
+ * emu_air_receive - take the next tick's worth from the source (as irq())
+ * @emu: the emulator (lock held; dropped around USB writes)
+ * @budget: bytes the air has carried since the last call
+ * Like the RFM23, bytes are only handed over a FIFO threshold at a time.
+ * They are streamed straight to the host when nothing is queued ahead of
+ * them, otherwise kept in the FIFO; a held RAM GET is then answered.
+ * Returns the number of bytes taken off the air.
+ */
+static size_t emu_air_receive(struct emu *emu, size_t budget)
+{
+	uint8_t buf[EMU_USB_BUFFER_LEN];
+	uint8_t tag;
+	ssize_t got;
+	size_t len;
+
+	if (budget < EMU_XCVR_BUFFER_LEN)
+		return 0;
+
+	if (budget > sizeof(buf))
+		budget = sizeof(buf);
+
+	got = read(emu->source_fd, buf, budget);
+	if (got <= 0)
+		return 0;
+
+	emu->bytes_rx += got;
+
+	if (emu->stream && !emu->pending_get && emu->fifo_count == 0) {
+		emu->bytes_streamed += got;
+		pthread_mutex_unlock(&emu->lock);
+		emu_gadget_write(emu, emu->ep_stream, buf, got);
+		pthread_mutex_lock(&emu->lock);
+		return got;
+	}
+
+	if (emu_fifo_put(emu, buf, got))
+		emu->overruns += got;
+
+	if (!emu->pending_get || emu->fifo_count == 0)
+		return got;
+
+	len = emu_fifo_get(emu, buf, emu->pending_get_len);
+	tag = emu->pending_get_tag;
+	emu->pending_get = 0;
+
+	pthread_mutex_unlock(&emu->lock);
+	emu_pic_respond(emu, BLAST_COMMS_PIC_EXACK, tag, buf, len);
+	pthread_mutex_lock(&emu->lock);
+
+	return got;
+}
+
+/**
+ * emu_air_thread - move bytes over the air at the configured bitrate
+ * @arg: the emulator
+ * Each tick earns a tick's worth of bits; what isn't used is carried over
+ * so low bitrates aren't rounded down to nothing, but idle air isn't saved
+ * up beyond one RFM23 FIFO threshold.
+ */
+void *emu_air_thread(void *arg)
+{
+	struct emu *emu = arg;
+	struct timespec next;
+	long long credit = 0;		/* bits, scaled by 10^9 */
+	size_t budget;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (;;) {
+		next.tv_nsec += EMU_AIR_TICK;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		pthread_mutex_lock(&emu->lock);
+
+		credit += (long long)emu_air_bitrate(emu) * EMU_AIR_TICK;
+		budget = credit / EMU_AIR_BYTE;
+
+		if (emu->mode == BLAST_COMMS_PIC_MODE_TRANSMIT) {
+			emu_air_transmit(emu, budget);
+			credit -= (long long)budget * EMU_AIR_BYTE;
+		} else if (emu->mode == BLAST_COMMS_PIC_MODE_RECEIVE &&
+							emu->source_fd >= 0) {
+			credit -= (long long)emu_air_receive(emu, budget) *
+								EMU_AIR_BYTE;
+			if (credit > EMU_XCVR_BUFFER_LEN * EMU_AIR_BYTE)
+				credit = EMU_XCVR_BUFFER_LEN * EMU_AIR_BYTE;
+		} else {
+			credit = 0;
+		}
+
+		pthread_mutex_unlock(&emu->lock);
+	}
+
+	return NULL;
+}
+
+/* EOF */
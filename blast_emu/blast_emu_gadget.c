@@ -0,0 +1,506 @@
+/**
+ * blast_emu_gadget.c
+ *
+ * USB Gadget (Raw Gadget Interface)
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "blast_emu.h"
+
+/*
+ * Raw gadget transfer buffers
+ */
+struct emu_ctrl_event {
+	struct usb_raw_event	inner;
+	struct usb_ctrlrequest	ctrl;
+};
+
+struct emu_io {
+	struct usb_raw_ep_io	inner;
+	uint8_t			data[EMU_USB_BUFFER_LEN];
+};
+
+/*
+ * Descriptors
+ * Interface 0 is the (empty) control interface the driver probes on;
+ * interface 1 carries the command, response and optional stream endpoints,
+ * in the order the driver expects them.
+ */
+struct emu_config_desc {
+	struct usb_config_descriptor	config;
+	struct usb_interface_descriptor	ctl_if;
+	struct usb_interface_descriptor	data_if;
+	struct usb_endpoint_descriptor	ep[3];
+} __attribute__((packed));
+
+#define	EMU_STRING_MANUFACTURER		1
+#define	EMU_STRING_PRODUCT		2
+
+static struct usb_device_descriptor emu_device_desc = {
+	.bLength		= USB_DT_DEVICE_SIZE,
+	.bDescriptorType	= USB_DT_DEVICE,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= USB_CLASS_VENDOR_SPEC,
+	.bMaxPacketSize0	= 64,
+	.idVendor		= EMU_USB_VENDOR,
+	.idProduct		= EMU_USB_PRODUCT,
+	.bcdDevice		= 0x0001,
+	.iManufacturer		= EMU_STRING_MANUFACTURER,
+	.iProduct		= EMU_STRING_PRODUCT,
+	.bNumConfigurations	= 1,
+};
+
+static struct usb_qualifier_descriptor emu_qualifier_desc = {
+	.bLength		= sizeof(struct usb_qualifier_descriptor),
+	.bDescriptorType	= USB_DT_DEVICE_QUALIFIER,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= USB_CLASS_VENDOR_SPEC,
+	.bMaxPacketSize0	= 64,
+	.bNumConfigurations	= 1,
+};
+
+static const char *emu_strings[] = {
+	[EMU_STRING_MANUFACTURER]	= "Project BLAST",
+	[EMU_STRING_PRODUCT]		= "BLAST PIC Emulator",
+};
+
+/**
+ * emu_bulk_desc - fill in a bulk endpoint descriptor
+ * @desc: descriptor to fill
+ * @addr: endpoint address (including direction)
+ */
+static void emu_bulk_desc(struct usb_endpoint_descriptor *desc, uint8_t addr)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->bLength = USB_DT_ENDPOINT_SIZE;
+	desc->bDescriptorType = USB_DT_ENDPOINT;
+	desc->bEndpointAddress = addr;
+	desc->bmAttributes = USB_ENDPOINT_XFER_BULK;
+	desc->wMaxPacketSize = EMU_USB_MAXPACKET;
+}
+
+/**
+ * emu_config_build - build the configuration descriptor
+ * @emu: the emulator
+ * @desc: where to build it
+ * Returns the total length.
+ */
+static size_t emu_config_build(struct emu *emu, struct emu_config_desc *desc)
+{
+	int eps = emu->stream ? 3 : 2;
+	size_t len = sizeof(*desc) -
+			(3 - eps) * sizeof(struct usb_endpoint_descriptor);
+
+	memset(desc, 0, sizeof(*desc));
+
+	desc->config.bLength = USB_DT_CONFIG_SIZE;
+	desc->config.bDescriptorType = USB_DT_CONFIG;
+	desc->config.wTotalLength = len;
+	desc->config.bNumInterfaces = 2;
+	desc->config.bConfigurationValue = 1;
+	desc->config.bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_SELFPOWER;
+	desc->config.bMaxPower = 0x32;
+
+	desc->ctl_if.bLength = USB_DT_INTERFACE_SIZE;
+	desc->ctl_if.bDescriptorType = USB_DT_INTERFACE;
+	desc->ctl_if.bInterfaceNumber = 0;
+	desc->ctl_if.bInterfaceClass = USB_CLASS_VENDOR_SPEC;
+
+	desc->data_if.bLength = USB_DT_INTERFACE_SIZE;
+	desc->data_if.bDescriptorType = USB_DT_INTERFACE;
+	desc->data_if.bInterfaceNumber = 1;
+	desc->data_if.bNumEndpoints = eps;
+	desc->data_if.bInterfaceClass = USB_CLASS_VENDOR_SPEC;
+
+	emu_bulk_desc(&desc->ep[0], emu->addr_cmd);
+	emu_bulk_desc(&desc->ep[1], emu->addr_resp);
+	if (emu->stream)
+		emu_bulk_desc(&desc->ep[2], emu->addr_stream);
+
+	return len;
+}
+
+/**
+ * emu_string_build - build a string descriptor
+ * @index: string index (0 is the language table)
+ * @buf: where to build it
+ * @len: room in buf
+ * Returns the descriptor length, or -1 for an unknown string.
+ */
+static int emu_string_build(int index, uint8_t *buf, size_t len)
+{
+	const char *str;
+	size_t i, n;
+
+	if (index == 0) {
+		buf[0] = 4;
+		buf[1] = USB_DT_STRING;
+		buf[2] = 0x09;			/* en-US */
+		buf[3] = 0x04;
+		return 4;
+	}
+
+	if (index >= (int)(sizeof(emu_strings) / sizeof(emu_strings[0])) ||
+							!emu_strings[index])
+		return -1;
+
+	str = emu_strings[index];
+	n = strlen(str);
+	if (2 + 2 * n > len)
+		n = (len - 2) / 2;
+
+	buf[0] = 2 + 2 * n;
+	buf[1] = USB_DT_STRING;
+	for (i = 0; i < n; i++) {
+		buf[2 + 2 * i] = str[i];	/* ASCII to UTF-16LE */
+		buf[3 + 2 * i] = 0;
+	}
+
+	return buf[0];
+}
+
+/**
+ * emu_ep_assign - pick UDC endpoints for the data interface
+ * @emu: the emulator
+ * Called once the gadget is bound, when the UDC's endpoints are known.
+ */
+static int emu_ep_assign(struct emu *emu)
+{
+	struct usb_raw_eps_info info;
+	uint8_t *want[3] = { &emu->addr_cmd, &emu->addr_resp,
+							&emu->addr_stream };
+	int dir_in[3] = { 0, 1, 1 };
+	int used[USB_RAW_EPS_NUM_MAX] = { 0 };
+	int next_num = 1;
+	int num, i, j;
+
+	memset(&info, 0, sizeof(info));
+	num = ioctl(emu->fd, USB_RAW_IOCTL_EPS_INFO, &info);
+	if (num < 0)
+		return -errno;
+
+	for (i = 0; i < (emu->stream ? 3 : 2); i++) {
+		for (j = 0; j < num; j++) {
+			if (used[j] || !info.eps[j].caps.type_bulk)
+				continue;
+			if (dir_in[i] ? !info.eps[j].caps.dir_in :
+						!info.eps[j].caps.dir_out)
+				continue;
+			break;
+		}
+
+		if (j == num) {
+			fprintf(stderr, "%s: UDC has too few bulk endpoints.\n",
+								EMU_NAME);
+			return -ENODEV;
+		}
+
+		used[j] = 1;
+
+		if (info.eps[j].addr == USB_RAW_EP_ADDR_ANY)
+			*want[i] = next_num++;
+		else
+			*want[i] = info.eps[j].addr;
+
+		if (dir_in[i])
+			*want[i] |= USB_DIR_IN;
+	}
+
+	return 0;
+}
+
+/**
+ * emu_ep_enable - enable the data interface endpoints
+ * @emu: the emulator
+ */
+static int emu_ep_enable(struct emu *emu)
+{
+	struct usb_endpoint_descriptor desc;
+
+	emu_bulk_desc(&desc, emu->addr_cmd);
+	emu->ep_cmd = ioctl(emu->fd, USB_RAW_IOCTL_EP_ENABLE, &desc);
+	if (emu->ep_cmd < 0)
+		return -errno;
+
+	emu_bulk_desc(&desc, emu->addr_resp);
+	emu->ep_resp = ioctl(emu->fd, USB_RAW_IOCTL_EP_ENABLE, &desc);
+	if (emu->ep_resp < 0)
+		return -errno;
+
+	if (!emu->stream)
+		return 0;
+
+	emu_bulk_desc(&desc, emu->addr_stream);
+	emu->ep_stream = ioctl(emu->fd, USB_RAW_IOCTL_EP_ENABLE, &desc);
+	if (emu->ep_stream < 0)
+		return -errno;
+
+	return 0;
+}
+
+/**
+ * emu_configure - handle SET_CONFIGURATION
+ * @emu: the emulator
+ * Starts the PIC and air threads the first time the host configures us.
+ */
+static int emu_configure(struct emu *emu)
+{
+	pthread_t thread;
+	sigset_t all, old;
+	int result = 0;
+
+	if (emu->configured)
+		return 0;
+
+	result = emu_ep_enable(emu);
+	if (result < 0)
+		return result;
+
+	ioctl(emu->fd, USB_RAW_IOCTL_VBUS_DRAW, 0x32);
+	if (ioctl(emu->fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+		return -errno;
+
+	emu->configured = 1;
+
+	/* Signals are for ep0's loop, so the threads never take them */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if (pthread_create(&thread, NULL, emu_pic_thread, emu) ||
+			pthread_create(&thread, NULL, emu_air_thread, emu))
+		result = -EAGAIN;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return result;
+}
+
+/**
+ * emu_control - handle a control request on ep0
+ * @emu: the emulator
+ * @ctrl: the setup packet
+ * @io: buffer for the data stage
+ * Returns the length of an IN data stage, 0 for a status-only OUT request,
+ * or -1 to stall.
+ */
+static int emu_control(struct emu *emu, struct usb_ctrlrequest *ctrl,
+							struct emu_io *io)
+{
+	struct emu_config_desc config;
+	int len = 0;
+
+	if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD)
+		return -1;
+
+	switch (ctrl->bRequest) {
+
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (ctrl->wValue >> 8) {
+		case USB_DT_DEVICE:
+			len = sizeof(emu_device_desc);
+			memcpy(io->data, &emu_device_desc, len);
+			break;
+		case USB_DT_DEVICE_QUALIFIER:
+			len = sizeof(emu_qualifier_desc);
+			memcpy(io->data, &emu_qualifier_desc, len);
+			break;
+		case USB_DT_CONFIG:
+			len = emu_config_build(emu, &config);
+			memcpy(io->data, &config, len);
+			break;
+		case USB_DT_STRING:
+			len = emu_string_build(ctrl->wValue & 0xFF, io->data,
+							sizeof(io->data));
+			break;
+		default:
+			return -1;
+		}
+
+		if (len > ctrl->wLength)
+			len = ctrl->wLength;
+		return len;
+
+	case USB_REQ_SET_CONFIGURATION:
+		if (emu_configure(emu) < 0) {
+			fprintf(stderr, "%s: unable to configure endpoints.\n",
+								EMU_NAME);
+			return -1;
+		}
+		return 0;
+
+	case USB_REQ_SET_INTERFACE:
+		return 0;
+
+	case USB_REQ_GET_INTERFACE:
+		io->data[0] = 0;
+		return 1;
+
+	case USB_REQ_GET_STATUS:
+		io->data[0] = 1;		/* self powered */
+		io->data[1] = 0;
+		return ctrl->wLength < 2 ? ctrl->wLength : 2;
+
+	default:
+		return -1;
+	}
+}
+
+/**
+ * emu_gadget_init - open raw gadget and bind to the UDC
+ * @emu: the emulator
+ */
+int emu_gadget_init(struct emu *emu)
+{
+	struct usb_raw_init init;
+
+	emu->fd = open("/dev/raw-gadget", O_RDWR);
+	if (emu->fd < 0) {
+		perror("/dev/raw-gadget");
+		return -errno;
+	}
+
+	memset(&init, 0, sizeof(init));
+	strncpy((char *)init.driver_name, emu->udc_driver,
+						UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, emu->udc_device,
+						UDC_NAME_LENGTH_MAX - 1);
+	init.speed = USB_SPEED_HIGH;
+
+	if (ioctl(emu->fd, USB_RAW_IOCTL_INIT, &init) < 0) {
+		perror("USB_RAW_IOCTL_INIT");
+		return -errno;
+	}
+
+	if (ioctl(emu->fd, USB_RAW_IOCTL_RUN, 0) < 0) {
+		perror("USB_RAW_IOCTL_RUN");
+		return -errno;
+	}
+
+	return 0;
+}
+
+/**
+ * emu_gadget_run - service ep0 until the gadget goes away
+ * @emu: the emulator
+ * Returns -EINTR when a signal has been caught (emu->signal), for the
+ * caller to deal with outside the handler; it may call again.
+ */
+int emu_gadget_run(struct emu *emu)
+{
+	struct emu_ctrl_event event;
+	struct emu_io io;
+	int len = 0;
+
+	for (;;) {
+		if (emu->signal)
+			return -EINTR;
+
+		memset(&event, 0, sizeof(event));
+		event.inner.length = sizeof(event.ctrl);
+
+		if (ioctl(emu->fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0) {
+			if (errno == EINTR)
+				return -EINTR;
+			perror("USB_RAW_IOCTL_EVENT_FETCH");
+			return -errno;
+		}
+
+		if (event.inner.type == USB_RAW_EVENT_CONNECT) {
+			if (emu_ep_assign(emu) < 0)
+				return -ENODEV;
+			continue;
+		}
+
+		if (event.inner.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		io.inner.ep = 0;
+		io.inner.flags = 0;
+
+		len = emu_control(emu, &event.ctrl, &io);
+		if (len < 0) {
+			ioctl(emu->fd, USB_RAW_IOCTL_EP0_STALL, 0);
+			continue;
+		}
+
+		io.inner.length = len;
+
+		/* A signal mustn't cost the host its data stage */
+		if (event.ctrl.bRequestType & USB_DIR_IN)
+			while (ioctl(emu->fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0 &&
+							errno == EINTR)
+				;
+		else
+			while (ioctl(emu->fd, USB_RAW_IOCTL_EP0_READ, &io) < 0 &&
+							errno == EINTR)
+				;
+	}
+}
+
+/**
+ * emu_gadget_read - read one transfer from an OUT endpoint
+ * @emu: the emulator
+ * @ep: endpoint handle
+ * @buf: where to put the data
+ * @len: room in buf (at most EMU_USB_BUFFER_LEN)
+ * Returns bytes read or -ve error.
+ */
+int emu_gadget_read(struct emu *emu, int ep, uint8_t *buf, size_t len)
+{
+	struct emu_io io;
+	int result = 0;
+
+	io.inner.ep = ep;
+	io.inner.flags = 0;
+	io.inner.length = len;
+
+	result = ioctl(emu->fd, USB_RAW_IOCTL_EP_READ, &io);
+	if (result < 0)
+		return -errno;
+
+	memcpy(buf, io.data, result);
+	return result;
+}
+
+/**
+ * emu_gadget_write - write one transfer to an IN endpoint
+ * @emu: the emulator
+ * @ep: endpoint handle
+ * @buf: data to send
+ * @len: length of data (at most EMU_USB_BUFFER_LEN)
+ * A zero length packet follows if needed so the host's URB completes.
+ */
+int emu_gadget_write(struct emu *emu, int ep, uint8_t *buf, size_t len)
+{
+	struct emu_io io;
+	int result = 0;
+
+	io.inner.ep = ep;
+	io.inner.flags = USB_RAW_IO_FLAGS_ZERO;
+	io.inner.length = len;
+	memcpy(io.data, buf, len);
+
+	result = ioctl(emu->fd, USB_RAW_IOCTL_EP_WRITE, &io);
+	if (result < 0)
+		return -errno;
+
+	return result;
+}
+
+/* EOF */
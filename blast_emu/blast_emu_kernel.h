@@ -0,0 +1,978 @@
+/**
+ * blast_emu_kernel.h
+ *
+ * Kernel Stand-ins for the Codec Tests
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Just enough of the kernel API for blast_emu_test to build the driver's
+ * codecs (blast_comms_*.c) as they are, in one userspace program.  Every
+ * <linux/...> and <asm/...> header they include is made to include this
+ * (see the Makefile).  The tests are single threaded, so locks and wait
+ * queues do nothing; the kfifo, the hrtimer and Reed-Solomon are real
+ * enough for the code under test.
+ */
+
+#ifndef _BLAST_EMU_KERNEL_H_
+#define _BLAST_EMU_KERNEL_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+/*
+ * Types
+ */
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int8_t		s8;
+typedef int16_t		s16;
+typedef int32_t		s32;
+typedef int64_t		s64;
+typedef uint8_t		__u8;
+typedef uint16_t	__u16;
+typedef uint32_t	__u32;
+typedef uint64_t	__u64;
+typedef int64_t		ktime_t;
+typedef unsigned int	gfp_t;
+
+#define	__user
+#define	__init
+#define	__exit
+#define	GFP_KERNEL	0
+#define	NSEC_PER_MSEC	1000000L
+
+/*
+ * Helpers
+ */
+#define	min(a, b)		((a) < (b) ? (a) : (b))
+#define	max(a, b)		((a) > (b) ? (a) : (b))
+#define	min_t(t, a, b)		((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define	max_t(t, a, b)		((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define	DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define	ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define	REPEAT_BYTE(x)		((~0UL / 0xFF) * (x))
+#define	BUILD_BUG_ON(c)		((void)sizeof(char[1 - 2 * !!(c)]))
+#define	container_of(p, t, m)	((t *)((char *)(p) - offsetof(t, m)))
+#define	printk			printf
+#define	KERN_INFO		""
+#define	KERN_ERR		""
+
+#define	kzalloc(n, f)		calloc(1, n)
+#define	kcalloc(n, s, f)	calloc(n, s)
+#define	kmalloc(n, f)		malloc(n)
+#define	kfree(p)		free(p)
+
+#define	hweight8(x)		__builtin_popcount((u8)(x))
+#define	hweight64(x)		__builtin_popcountll((u64)(x))
+#define	__ffs(x)		((unsigned long)__builtin_ctzl(x))
+#define	fls64(x)		((x) ? 64 - __builtin_clzll(x) : 0)
+#define	swab64(x)		__builtin_bswap64(x)
+
+static inline u8 bitrev8(u8 b)
+{
+	b = (b >> 4) | (b << 4);
+	b = ((b >> 2) & 0x33) | ((b & 0x33) << 2);
+	return ((b >> 1) & 0x55) | ((b & 0x55) << 1);
+}
+
+static inline u16 bitrev16(u16 x)
+{
+	return (bitrev8(x & 0xFF) << 8) | bitrev8(x >> 8);
+}
+
+/* Little endian, as the tests are run */
+#define	cpu_to_le16s(p)		((void)(p))
+#define	le16_to_cpus(p)		((void)(p))
+
+/*
+ * Unaligned access (asm/unaligned.h)
+ */
+#define	get_unaligned(p)	({ __typeof__(*(p)) _v;			\
+				memcpy(&_v, (p), sizeof(_v)); _v; })
+#define	put_unaligned(v, p)	do { __typeof__(*(p)) _v = (v);		\
+				memcpy((p), &_v, sizeof(_v)); } while (0)
+
+static inline u16 get_unaligned_le16(const void *p)
+{
+	const u8 *b = p;
+
+	return b[0] | b[1] << 8;
+}
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+	const u8 *b = p;
+
+	return b[0] | b[1] << 8 | b[2] << 16 | (u32)b[3] << 24;
+}
+
+static inline u64 get_unaligned_le64(const void *p)
+{
+	return get_unaligned_le32(p) |
+		(u64)get_unaligned_le32((const u8 *)p + 4) << 32;
+}
+
+static inline u64 get_unaligned_be64(const void *p)
+{
+	return swab64(get_unaligned_le64(p));
+}
+
+static inline void put_unaligned_le16(u16 v, void *p)
+{
+	u8 *b = p;
+
+	b[0] = v;
+	b[1] = v >> 8;
+}
+
+static inline void put_unaligned_le32(u32 v, void *p)
+{
+	put_unaligned_le16(v, p);
+	put_unaligned_le16(v >> 16, (u8 *)p + 2);
+}
+
+static inline void put_unaligned_le64(u64 v, void *p)
+{
+	put_unaligned_le32(v, p);
+	put_unaligned_le32(v >> 32, (u8 *)p + 4);
+}
+
+/*
+ * Locks, atomics, wait queues and work, none of which the tests need
+ */
+typedef struct { int held; } spinlock_t;
+struct mutex { int held; };
+struct semaphore { int count; };
+struct completion { int done; };
+typedef struct { int counter; } atomic_t;
+typedef struct { int unused; } wait_queue_head_t;
+struct work_struct { int unused; };
+struct delayed_work { struct work_struct work; };
+struct list_head { struct list_head *next, *prev; };
+struct cdev { int unused; };
+struct usb_anchor { int unused; };
+
+/* Typed, so that the driver passes them what the kernel's would take */
+static inline void spin_lock_init(spinlock_t *l) { l->held = 0; }
+static inline void spin_lock(spinlock_t *l) { l->held++; }
+static inline void spin_unlock(spinlock_t *l) { l->held--; }
+static inline void spin_lock_bh(spinlock_t *l) { l->held++; }
+static inline void spin_unlock_bh(spinlock_t *l) { l->held--; }
+#define	spin_lock_irqsave(l, f)		do { (f) = 0; spin_lock(l); } while (0)
+#define	spin_unlock_irqrestore(l, f)	do { (void)(f); spin_unlock(l); } while (0)
+#define	DEFINE_SPINLOCK(l)	spinlock_t l
+
+static inline void mutex_init(struct mutex *m) { m->held = 0; }
+static inline void mutex_lock(struct mutex *m) { m->held++; }
+static inline void mutex_unlock(struct mutex *m) { m->held--; }
+
+static inline void sema_init(struct semaphore *s, int n) { s->count = n; }
+static inline void down(struct semaphore *s) { s->count--; }
+static inline int down_interruptible(struct semaphore *s)
+{
+	s->count--;
+	return 0;
+}
+static inline int down_trylock(struct semaphore *s)
+{
+	s->count--;
+	return 0;
+}
+static inline void up(struct semaphore *s) { s->count++; }
+
+static inline int atomic_read(const atomic_t *a) { return a->counter; }
+static inline void atomic_set(atomic_t *a, int v) { a->counter = v; }
+static inline void atomic_inc(atomic_t *a) { a->counter++; }
+static inline void atomic_dec(atomic_t *a) { a->counter--; }
+static inline void atomic_add(int n, atomic_t *a) { a->counter += n; }
+static inline void atomic_sub(int n, atomic_t *a) { a->counter -= n; }
+static inline int atomic_inc_return(atomic_t *a) { return ++a->counter; }
+static inline int atomic_dec_return(atomic_t *a) { return --a->counter; }
+static inline int atomic_dec_and_test(atomic_t *a) { return !--a->counter; }
+static inline void init_waitqueue_head(wait_queue_head_t *q) { }
+static inline void wake_up(wait_queue_head_t *q) { }
+static inline void wake_up_interruptible(wait_queue_head_t *q) { }
+static inline void wake_up_all(wait_queue_head_t *q) { }
+#define	emu_wait(q, c)		({ wait_queue_head_t *_q = &(q);	\
+				(void)_q; (void)(c); })
+#define	wait_event(q, c)	emu_wait(q, c)
+#define	wait_event_interruptible(q, c)	({ emu_wait(q, c); 0; })
+#define	wait_event_timeout(q, c, t)	({ emu_wait(q, c); (long)(t); })
+#define	wait_event_interruptible_timeout(q, c, t)	\
+				({ emu_wait(q, c); (long)(t); })
+
+static inline void init_completion(struct completion *c) { c->done = 0; }
+static inline void reinit_completion(struct completion *c) { c->done = 0; }
+static inline void complete(struct completion *c) { c->done = 1; }
+static inline void complete_all(struct completion *c) { c->done = 1; }
+static inline void wait_for_completion(struct completion *c) { }
+static inline unsigned long wait_for_completion_timeout(struct completion *c,
+							unsigned long t)
+{
+	return t;
+}
+
+static inline int kthread_should_stop(void) { return 0; }
+
+typedef void (*work_func_t)(struct work_struct *work);
+
+#define	INIT_WORK(w, f)		do { work_func_t _f = (f);		\
+				(void)(w)->unused; (void)_f; } while (0)
+#define	INIT_DELAYED_WORK(w, f)	INIT_WORK(&(w)->work, f)
+#define	to_delayed_work(w)	container_of(w, struct delayed_work, work)
+static inline int schedule_work(struct work_struct *w) { return 1; }
+static inline int schedule_delayed_work(struct delayed_work *w,
+						unsigned long delay)
+{
+	return 1;
+}
+static inline int cancel_delayed_work(struct delayed_work *w) { return 0; }
+static inline int cancel_delayed_work_sync(struct delayed_work *w)
+{
+	return 0;
+}
+
+#define	jiffies			0UL
+#define	HZ			100
+#define	msecs_to_jiffies(ms)	((unsigned long)(ms) / 10)
+#define	jiffies_to_msecs(j)	((unsigned int)(j) * 10)
+
+/*
+ * Byte FIFO (linux/kfifo.h), the old struct kfifo interface
+ */
+struct kfifo {
+	u8		*buffer;
+	unsigned int	size;			/* a power of 2 */
+	unsigned int	in;
+	unsigned int	out;
+};
+
+static inline int kfifo_alloc(struct kfifo *fifo, unsigned int size,
+								gfp_t gfp)
+{
+	fifo->buffer = malloc(size);
+	fifo->size = size;
+	fifo->in = fifo->out = 0;
+
+	return fifo->buffer ? 0 : -ENOMEM;
+}
+
+static inline void kfifo_free(struct kfifo *fifo)
+{
+	free(fifo->buffer);
+}
+
+#define	kfifo_len(f)		((f)->in - (f)->out)
+#define	kfifo_avail(f)		((f)->size - kfifo_len(f))
+#define	kfifo_is_empty(f)	(kfifo_len(f) == 0)
+
+static inline unsigned int kfifo_in(struct kfifo *fifo, const void *from,
+							unsigned int len)
+{
+	const u8 *p = from;
+	unsigned int i;
+
+	len = min(len, kfifo_avail(fifo));
+	for (i = 0; i < len; i++)
+		fifo->buffer[(fifo->in + i) & (fifo->size - 1)] = p[i];
+	fifo->in += len;
+
+	return len;
+}
+
+static inline unsigned int kfifo_out_peek(struct kfifo *fifo, void *to,
+							unsigned int len)
+{
+	u8 *p = to;
+	unsigned int i;
+
+	len = min(len, kfifo_len(fifo));
+	for (i = 0; i < len; i++)
+		p[i] = fifo->buffer[(fifo->out + i) & (fifo->size - 1)];
+
+	return len;
+}
+
+static inline unsigned int kfifo_out(struct kfifo *fifo, void *to,
+							unsigned int len)
+{
+	len = kfifo_out_peek(fifo, to, len);
+	fifo->out += len;
+
+	return len;
+}
+
+#define	kfifo_in_spinlocked(f, p, n, l)	kfifo_in(f, p, n)
+
+/*
+ * Time (linux/ktime.h, linux/hrtimer.h)
+ * The tests set the clock, so deadlines can be checked to the nanosecond.
+ */
+static s64 emu_test_now;
+
+#define	ktime_get()		((ktime_t)emu_test_now)
+#define	ktime_to_ns(t)		((s64)(t))
+#define	ns_to_ktime(ns)		((ktime_t)(ns))
+
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_ABS };
+
+struct hrtimer {
+	enum hrtimer_restart	(*function)(struct hrtimer *timer);
+	ktime_t			expires;
+	int			active;
+};
+
+static inline void hrtimer_init(struct hrtimer *timer, clockid_t clock,
+						enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t expires,
+						enum hrtimer_mode mode)
+{
+	timer->expires = expires;
+	timer->active = 1;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	int active = timer->active;
+
+	timer->active = 0;
+
+	return active;
+}
+
+/*
+ * Reed-Solomon (linux/rslib.h)
+ * Karn's codec, which the kernel's is, for 8 bit symbols and no erasures.
+ */
+#define	EMU_RS_NN		255
+#define	EMU_RS_ROOTS_MAX	32
+
+struct rs_control {
+	int	nroots;
+	int	fcr;
+	int	prim;
+	int	iprim;
+	u8	alpha_to[EMU_RS_NN + 1];
+	u8	index_of[EMU_RS_NN + 1];
+	u8	genpoly[EMU_RS_ROOTS_MAX + 1];	/* index form */
+};
+
+static inline int emu_rs_modnn(int x)
+{
+	while (x >= EMU_RS_NN)
+		x -= EMU_RS_NN;
+
+	return x;
+}
+
+static inline struct rs_control *init_rs(int symsize, int gfpoly, int fcr,
+						int prim, int nroots)
+{
+	struct rs_control *rs;
+	int i, j, sr, root;
+
+	if (symsize != 8 || nroots > EMU_RS_ROOTS_MAX)
+		return NULL;
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		return NULL;
+
+	rs->nroots = nroots;
+	rs->fcr = fcr;
+	rs->prim = prim;
+
+	rs->index_of[0] = EMU_RS_NN;
+	rs->alpha_to[EMU_RS_NN] = 0;
+	for (i = 0, sr = 1; i < EMU_RS_NN; i++) {
+		rs->index_of[sr] = i;
+		rs->alpha_to[i] = sr;
+		sr <<= 1;
+		if (sr & 0x100)
+			sr ^= gfpoly;
+	}
+
+	for (rs->iprim = 1; rs->iprim % prim; rs->iprim += EMU_RS_NN)
+		;
+	rs->iprim /= prim;
+
+	/* Generator polynomial, from its roots */
+	rs->genpoly[0] = 1;
+	for (i = 0, root = fcr * prim; i < nroots; i++, root += prim) {
+		rs->genpoly[i + 1] = 1;
+		for (j = i; j > 0; j--)
+			rs->genpoly[j] = rs->genpoly[j - 1] ^ (rs->genpoly[j] ?
+				rs->alpha_to[emu_rs_modnn(
+				rs->index_of[rs->genpoly[j]] + root)] : 0);
+		rs->genpoly[0] = rs->alpha_to[emu_rs_modnn(
+				rs->index_of[rs->genpoly[0]] + root)];
+	}
+	for (i = 0; i <= nroots; i++)
+		rs->genpoly[i] = rs->index_of[rs->genpoly[i]];
+
+	return rs;
+}
+
+static inline void free_rs(struct rs_control *rs)
+{
+	free(rs);
+}
+
+static inline int encode_rs8(struct rs_control *rs, u8 *data, int len,
+						u16 *par, u16 invmsk)
+{
+	int i, j, fb;
+
+	for (i = 0; i < len; i++) {
+		fb = rs->index_of[(data[i] ^ invmsk ^ par[0]) & 0xFF];
+		if (fb != EMU_RS_NN)
+			for (j = 1; j < rs->nroots; j++)
+				par[j] ^= rs->alpha_to[emu_rs_modnn(fb +
+					rs->genpoly[rs->nroots - j])];
+
+		memmove(&par[0], &par[1], sizeof(u16) * (rs->nroots - 1));
+		par[rs->nroots - 1] = fb != EMU_RS_NN ?
+			rs->alpha_to[emu_rs_modnn(fb + rs->genpoly[0])] : 0;
+	}
+
+	return 0;
+}
+
+static inline int decode_rs8(struct rs_control *rs, u8 *data, u16 *par,
+				int len, u16 *s_in, int no_eras, int *eras_pos,
+				u16 invmsk, u16 *corr)
+{
+	const int nn = EMU_RS_NN, nroots = rs->nroots;
+	const u8 *alpha_to = rs->alpha_to, *index_of = rs->index_of;
+	int pad = nn - nroots - len;
+	int s[EMU_RS_ROOTS_MAX], lambda[EMU_RS_ROOTS_MAX + 1];
+	int b[EMU_RS_ROOTS_MAX + 1], t[EMU_RS_ROOTS_MAX + 1];
+	int omega[EMU_RS_ROOTS_MAX + 1], reg[EMU_RS_ROOTS_MAX + 1];
+	int root[EMU_RS_ROOTS_MAX], loc[EMU_RS_ROOTS_MAX];
+	int i, j, k, r, el, q, count, deg_lambda, deg_omega;
+	int discr_r, num1, num2, den, tmp, pos, syn_error = 0;
+	u8 c;
+
+	if (pad < 0)
+		return -EINVAL;
+
+	/* Syndromes, by Horner's rule over data then parity */
+	for (i = 0; i < nroots; i++)
+		s[i] = 0;
+	for (j = 0; j < len + nroots; j++) {
+		c = j < len ? data[j] ^ invmsk : par[j - len];
+		for (i = 0; i < nroots; i++)
+			s[i] = c ^ (s[i] ? alpha_to[emu_rs_modnn(index_of[s[i]] +
+					(rs->fcr + i) * rs->prim)] : 0);
+	}
+	for (i = 0; i < nroots; i++) {
+		syn_error |= s[i];
+		s[i] = index_of[s[i]];
+	}
+	if (!syn_error)
+		return 0;
+
+	/* Berlekamp-Massey */
+	memset(lambda, 0, sizeof(lambda));
+	lambda[0] = 1;
+	for (i = 0; i <= nroots; i++)
+		b[i] = index_of[lambda[i]];
+
+	for (r = 1, el = 0; r <= nroots; r++) {
+		discr_r = 0;
+		for (i = 0; i < r; i++)
+			if (lambda[i] && s[r - i - 1] != nn)
+				discr_r ^= alpha_to[emu_rs_modnn(
+					index_of[lambda[i]] + s[r - i - 1])];
+		discr_r = index_of[discr_r];
+
+		if (discr_r == nn) {
+			memmove(&b[1], b, nroots * sizeof(b[0]));
+			b[0] = nn;
+			continue;
+		}
+
+		t[0] = lambda[0];
+		for (i = 0; i < nroots; i++)
+			t[i + 1] = lambda[i + 1] ^ (b[i] != nn ?
+				alpha_to[emu_rs_modnn(discr_r + b[i])] : 0);
+
+		if (2 * el <= r - 1) {
+			el = r - el;
+			for (i = 0; i <= nroots; i++)
+				b[i] = lambda[i] ? emu_rs_modnn(
+					index_of[lambda[i]] - discr_r + nn) : nn;
+		} else {
+			memmove(&b[1], b, nroots * sizeof(b[0]));
+			b[0] = nn;
+		}
+		memcpy(lambda, t, (nroots + 1) * sizeof(t[0]));
+	}
+
+	deg_lambda = 0;
+	for (i = 0; i <= nroots; i++) {
+		lambda[i] = index_of[lambda[i]];
+		if (lambda[i] != nn)
+			deg_lambda = i;
+	}
+
+	/* Chien search for the roots of lambda */
+	memcpy(&reg[1], &lambda[1], nroots * sizeof(reg[0]));
+	count = 0;
+	for (i = 1, k = rs->iprim - 1; i <= nn;
+				i++, k = emu_rs_modnn(k + rs->iprim)) {
+		q = 1;
+		for (j = deg_lambda; j > 0; j--) {
+			if (reg[j] != nn) {
+				reg[j] = emu_rs_modnn(reg[j] + j);
+				q ^= alpha_to[reg[j]];
+			}
+		}
+		if (q)
+			continue;
+
+		root[count] = i;
+		loc[count] = k;
+		if (++count == deg_lambda)
+			break;
+	}
+	if (deg_lambda != count)
+		return -EBADMSG;
+
+	/* Forney: omega = s * lambda mod x^nroots, then the values */
+	deg_omega = deg_lambda - 1;
+	for (i = 0; i <= deg_omega; i++) {
+		tmp = 0;
+		for (j = i; j >= 0; j--)
+			if (s[i - j] != nn && lambda[j] != nn)
+				tmp ^= alpha_to[emu_rs_modnn(s[i - j] +
+								lambda[j])];
+		omega[i] = index_of[tmp];
+	}
+
+	for (j = count - 1; j >= 0; j--) {
+		if (loc[j] < pad)
+			return -EBADMSG;
+
+		num1 = 0;
+		for (i = deg_omega; i >= 0; i--)
+			if (omega[i] != nn)
+				num1 ^= alpha_to[emu_rs_modnn(omega[i] +
+								i * root[j])];
+		num2 = alpha_to[emu_rs_modnn(root[j] * (rs->fcr - 1) + nn)];
+		den = 0;
+		for (i = min(deg_lambda, nroots - 1) & ~1; i >= 0; i -= 2)
+			if (lambda[i + 1] != nn)
+				den ^= alpha_to[emu_rs_modnn(lambda[i + 1] +
+								i * root[j])];
+		if (!num1)
+			continue;
+
+		tmp = alpha_to[emu_rs_modnn(index_of[num1] + index_of[num2] +
+						nn - index_of[den])];
+		pos = loc[j] - pad;
+		if (pos < len)
+			data[pos] ^= tmp;
+		else
+			par[pos - len] ^= tmp;
+	}
+
+	return count;
+}
+
+/*
+ * LZ4 (linux/lz4.h), declared only
+ */
+#define	LZ4_COMPRESSBOUND(n)	((n) + (n) / 255 + 16)
+#define	LZ4_MEM_COMPRESS	16384
+#define	LZ4_ACCELERATION_DEFAULT	1
+
+typedef struct { u64 table[LZ4_MEM_COMPRESS / sizeof(u64)]; } LZ4_stream_t;
+typedef struct { u64 table[4]; } LZ4_streamDecode_t;
+
+void LZ4_resetStream(LZ4_stream_t *stream);
+int LZ4_compress_fast_continue(LZ4_stream_t *stream, const char *src,
+			char *dst, int srcSize, int maxDstSize, int acceleration);
+int LZ4_setStreamDecode(LZ4_streamDecode_t *stream, const char *dictionary,
+							int dictSize);
+int LZ4_decompress_safe_continue(LZ4_streamDecode_t *stream,
+			const char *source, char *dest, int compressedSize,
+						int maxDecompressedSize);
+
+/*
+ * Everything else the driver uses
+ * The driver is built as well as the tests, so that it is type checked, but
+ * never linked: what the tests do not call is only declared here.
+ */
+#define	likely(x)		__builtin_expect(!!(x), 1)
+#define	unlikely(x)		__builtin_expect(!!(x), 0)
+#define	KERN_CRIT		""
+#define	KERN_WARNING		""
+#define	KERN_NOTICE		""
+#define	KERN_DEBUG		""
+#define	ERESTARTSYS		512
+#define	GFP_ATOMIC		1
+
+#define	THIS_MODULE		((struct module *)0)
+#define	MODULE_LICENSE(s)
+#define	MODULE_AUTHOR(s)
+#define	MODULE_DESCRIPTION(s)
+#define	MODULE_VERSION(s)
+#define	MODULE_DEVICE_TABLE(t, n)
+#define	module_init(f)		int (*emu_module_init)(void) = f
+#define	module_exit(f)		void (*emu_module_exit)(void) = f
+
+typedef u16			__le16;
+typedef u64			dma_addr_t;
+typedef unsigned int		fmode_t;
+typedef unsigned short		umode_t;
+
+#define	cpu_to_le16(x)		((__le16)(x))
+#define	le16_to_cpu(x)		((u16)(x))
+#define	le32_to_cpu(x)		((u32)(x))
+#define	div64_u64(a, b)		((u64)(a) / (u64)(b))
+
+#define	MAX_ERRNO		4095
+#define	IS_ERR_VALUE(x)		((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+#define	IS_ERR(p)		IS_ERR_VALUE(p)
+#define	IS_ERR_OR_NULL(p)	(!(p) || IS_ERR_VALUE(p))
+#define	PTR_ERR(p)		((long)(p))
+#define	ERR_PTR(e)		((void *)(long)(e))
+
+#define	set_bit(n, a)		(*(a) |= 1UL << (n))
+#define	clear_bit(n, a)		(*(a) &= ~(1UL << (n)))
+#define	test_bit(n, a)		(!!(*(a) & (1UL << (n))))
+
+
+#define	ATOMIC_INIT(i)		{ (i) }
+
+#define	ktime_sub(a, b)		((a) - (b))
+#define	ktime_to_us(t)		((s64)(t) / 1000)
+#define	ktime_us_delta(a, b)	ktime_to_us(ktime_sub(a, b))
+
+#define	kfifo_reset(f)		((f)->in = (f)->out = 0)
+#define	kfifo_put(f, v)		kfifo_in(f, v, sizeof(*(v)))
+#define	kfifo_get(f, v)		kfifo_out(f, v, sizeof(*(v)))
+#define	kfifo_out_spinlocked(f, p, n, l)	kfifo_out(f, p, n)
+
+void *vzalloc(unsigned long size);
+void vfree(const void *addr);
+
+/* Lists (linux/list.h) */
+#define	LIST_HEAD_INIT(n)	{ &(n), &(n) }
+#define	LIST_HEAD(n)		struct list_head n = LIST_HEAD_INIT(n)
+#define	list_entry(p, t, m)	container_of(p, t, m)
+#define	list_first_entry(h, t, m)	list_entry((h)->next, t, m)
+#define	list_for_each(p, h)	for (p = (h)->next; p != (h); p = p->next)
+#define	list_for_each_safe(p, n, h)	\
+		for (p = (h)->next, n = p->next; p != (h); p = n, n = p->next)
+#define	list_for_each_entry(p, h, m)					\
+		for (p = list_entry((h)->next, __typeof__(*p), m);	\
+			&p->m != (h);					\
+			p = list_entry(p->m.next, __typeof__(*p), m))
+
+static inline void INIT_LIST_HEAD(struct list_head *h)
+{
+	h->next = h->prev = h;
+}
+
+static inline void list_add(struct list_head *n, struct list_head *h)
+{
+	n->next = h->next;
+	n->prev = h;
+	h->next->prev = n;
+	h->next = n;
+}
+
+static inline void list_add_tail(struct list_head *n, struct list_head *h)
+{
+	list_add(n, h->prev);
+}
+
+static inline void list_del(struct list_head *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+}
+
+static inline void list_move_tail(struct list_head *e, struct list_head *h)
+{
+	list_del(e);
+	list_add_tail(e, h);
+}
+
+static inline int list_empty(const struct list_head *h)
+{
+	return h->next == h;
+}
+
+/* Threads (linux/kthread.h) */
+struct task_struct;
+
+struct task_struct *kthread_run(int (*fn)(void *data), void *data,
+						const char *fmt, ...);
+int kthread_stop(struct task_struct *task);
+
+/* Files (linux/fs.h, linux/cdev.h, linux/uaccess.h) */
+struct module;
+struct poll_table_struct;
+
+#define	FMODE_READ		((fmode_t)1)
+#define	FMODE_WRITE		((fmode_t)2)
+#define	S_IRUGO			0444
+#define	S_IWUSR			0200
+#define	CAP_SYS_ADMIN		21
+#define	MINORBITS		20
+#define	MAJOR(d)		((unsigned int)((d) >> MINORBITS))
+#define	MINOR(d)		((unsigned int)((d) & ((1U << MINORBITS) - 1)))
+#define	MKDEV(ma, mi)		(((dev_t)(ma) << MINORBITS) | (mi))
+
+struct inode {
+	struct cdev	*i_cdev;
+	void		*i_private;
+};
+
+struct file {
+	fmode_t		f_mode;
+	void		*private_data;
+};
+
+typedef void *fl_owner_t;
+
+struct file_operations {
+	struct module	*owner;
+	loff_t		(*llseek)(struct file *, loff_t, int);
+	ssize_t		(*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t		(*write)(struct file *, const char __user *, size_t,
+								loff_t *);
+	unsigned int	(*poll)(struct file *, struct poll_table_struct *);
+	long		(*unlocked_ioctl)(struct file *, unsigned int,
+							unsigned long);
+	int		(*open)(struct inode *, struct file *);
+	int		(*flush)(struct file *, fl_owner_t id);
+	int		(*release)(struct inode *, struct file *);
+	int		(*fsync)(struct file *, loff_t, loff_t, int);
+};
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+void cdev_del(struct cdev *cdev);
+int alloc_chrdev_region(dev_t *dev, unsigned int first, unsigned int count,
+							const char *name);
+int register_chrdev_region(dev_t dev, unsigned int count, const char *name);
+void unregister_chrdev_region(dev_t dev, unsigned int count);
+int capable(int cap);
+
+unsigned long copy_to_user(void __user *to, const void *from,
+							unsigned long n);
+unsigned long copy_from_user(void *to, const void __user *from,
+							unsigned long n);
+#define	get_user(x, p)		({ memcpy(&(x), (p), sizeof(*(p))); 0; })
+#define	put_user(x, p)		({ *(p) = (x); 0; })
+#define	__get_user(x, p)	get_user(x, p)
+#define	__put_user(x, p)	put_user(x, p)
+
+/* debugfs and seq_file (linux/debugfs.h, linux/seq_file.h) */
+struct dentry;
+
+struct seq_file {
+	void	*private;
+};
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				struct dentry *parent, void *data,
+				const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+int seq_printf(struct seq_file *m, const char *fmt, ...);
+int seq_puts(struct seq_file *m, const char *s);
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+								void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+								loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+
+/* Scatter-gather (linux/scatterlist.h) */
+struct scatterlist {
+	void		*buf;
+	unsigned int	length;
+	int		end;
+};
+
+static inline void sg_init_table(struct scatterlist *sg, unsigned int n)
+{
+	memset(sg, 0, n * sizeof(*sg));
+	sg[n - 1].end = 1;
+}
+
+static inline void sg_set_buf(struct scatterlist *sg, const void *buf,
+							unsigned int len)
+{
+	sg->buf = (void *)buf;
+	sg->length = len;
+}
+
+#define	sg_mark_end(sg)		((sg)->end = 1)
+#define	sg_virt(sg)		((sg)->buf)
+
+/* USB (linux/usb.h) */
+struct device {
+	const char	*init_name;
+};
+
+#define	dev_name(d)		((d)->init_name)
+
+struct usb_bus {
+	unsigned int	sg_tablesize;
+	unsigned int	no_sg_constraint;
+};
+
+struct usb_device {
+	struct device	dev;
+	struct usb_bus	*bus;
+};
+
+struct usb_endpoint_descriptor {
+	u8		bEndpointAddress;
+	u8		bmAttributes;
+	u16		wMaxPacketSize;
+};
+
+struct usb_host_endpoint {
+	struct usb_endpoint_descriptor	desc;
+};
+
+struct usb_interface_descriptor {
+	u8		bInterfaceNumber;
+	u8		bNumEndpoints;
+};
+
+struct usb_host_interface {
+	struct usb_interface_descriptor	desc;
+	struct usb_host_endpoint	*endpoint;
+};
+
+struct usb_interface {
+	struct usb_host_interface	*cur_altsetting;
+	int				minor;
+};
+
+struct usb_device_id {
+	u16		match_flags;
+	u16		idVendor;
+	u16		idProduct;
+};
+
+#define	USB_DEVICE_ID_MATCH_DEVICE	0x0003
+#define	USB_DEVICE(v, p)	.match_flags = USB_DEVICE_ID_MATCH_DEVICE, \
+				.idVendor = (v), .idProduct = (p)
+
+struct usb_driver {
+	const char	*name;
+	int		(*probe)(struct usb_interface *intf,
+					const struct usb_device_id *id);
+	void		(*disconnect)(struct usb_interface *intf);
+	const struct usb_device_id	*id_table;
+};
+
+struct usb_class_driver {
+	char		*name;
+	const struct file_operations	*fops;
+	int		minor_base;
+};
+
+struct urb;
+typedef void (*usb_complete_t)(struct urb *urb);
+
+struct urb {
+	struct usb_device	*dev;
+	unsigned int		pipe;
+	int			status;
+	unsigned int		transfer_flags;
+	void			*transfer_buffer;
+	dma_addr_t		transfer_dma;
+	struct scatterlist	*sg;
+	int			num_sgs;
+	u32			transfer_buffer_length;
+	u32			actual_length;
+	void			*context;
+	usb_complete_t		complete;
+};
+
+#define	URB_NO_TRANSFER_DMA_MAP	0x0004
+#define	USB_DIR_IN		0x80
+
+int usb_register(struct usb_driver *drv);
+void usb_deregister(struct usb_driver *drv);
+int usb_register_dev(struct usb_interface *intf,
+				struct usb_class_driver *class_driver);
+void usb_deregister_dev(struct usb_interface *intf,
+				struct usb_class_driver *class_driver);
+struct usb_device *usb_get_dev(struct usb_device *dev);
+void usb_put_dev(struct usb_device *dev);
+struct usb_interface *usb_get_intf(struct usb_interface *intf);
+void usb_put_intf(struct usb_interface *intf);
+void *usb_get_intfdata(struct usb_interface *intf);
+void usb_set_intfdata(struct usb_interface *intf, void *data);
+struct usb_device *interface_to_usbdev(struct usb_interface *intf);
+struct usb_interface *usb_ifnum_to_if(const struct usb_device *dev,
+							unsigned ifnum);
+int usb_interface_claimed(struct usb_interface *iface);
+int usb_driver_claim_interface(struct usb_driver *driver,
+				struct usb_interface *iface, void *priv);
+void usb_driver_release_interface(struct usb_driver *driver,
+				struct usb_interface *iface);
+unsigned int usb_sndbulkpipe(struct usb_device *dev, unsigned int ep);
+unsigned int usb_rcvbulkpipe(struct usb_device *dev, unsigned int ep);
+struct urb *usb_alloc_urb(int iso_packets, gfp_t mem_flags);
+void usb_free_urb(struct urb *urb);
+int usb_submit_urb(struct urb *urb, gfp_t mem_flags);
+void usb_kill_urb(struct urb *urb);
+void *usb_alloc_coherent(struct usb_device *dev, size_t size,
+				gfp_t mem_flags, dma_addr_t *dma);
+void usb_free_coherent(struct usb_device *dev, size_t size, void *addr,
+							dma_addr_t dma);
+int usb_bulk_msg(struct usb_device *usb_dev, unsigned int pipe, void *data,
+				int len, int *actual_length, int timeout);
+void init_usb_anchor(struct usb_anchor *anchor);
+void usb_anchor_urb(struct urb *urb, struct usb_anchor *anchor);
+void usb_unanchor_urb(struct urb *urb);
+void usb_kill_anchored_urbs(struct usb_anchor *anchor);
+int usb_wait_anchor_empty_timeout(struct usb_anchor *anchor,
+						unsigned int timeout);
+
+static inline void usb_fill_bulk_urb(struct urb *urb, struct usb_device *dev,
+				unsigned int pipe, void *buf, int len,
+				usb_complete_t complete, void *context)
+{
+	urb->dev = dev;
+	urb->pipe = pipe;
+	urb->transfer_buffer = buf;
+	urb->transfer_buffer_length = len;
+	urb->complete = complete;
+	urb->context = context;
+}
+
+#endif /* _BLAST_EMU_KERNEL_H_ */
+
+/* EOF */
@@ -0,0 +1,438 @@
+/**
+ * blast_emu_pic.c
+ *
+ * PIC Firmware Emulation
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blast_emu.h"
+
+/**
+ * emu_pic_init - power on state
+ * @emu: the emulator
+ */
+void emu_pic_init(struct emu *emu)
+{
+	pthread_mutex_init(&emu->lock, NULL);
+	pthread_mutex_init(&emu->resp_lock, NULL);
+
+	emu->mode = BLAST_COMMS_PIC_MODE_STANDBY;
+	emu->pending_get = 0;
+	memset(emu->rfm, 0, sizeof(emu->rfm));
+	emu_fifo_clear(emu);
+}
+
+/**
+ * emu_fifo_clear - empty the FIFO
+ * @emu: the emulator (lock held)
+ */
+void emu_fifo_clear(struct emu *emu)
+{
+	emu->fifo_head = 0;
+	emu->fifo_tail = 0;
+	emu->fifo_count = 0;
+	emu->tx_frame_left = 0;
+}
+
+/**
+ * emu_fifo_put - add to the FIFO, all or nothing (as fifo_put)
+ * @emu: the emulator (lock held)
+ * @buf: data
+ * @len: length of data
+ */
+int emu_fifo_put(struct emu *emu, const uint8_t *buf, size_t len)
+{
+	size_t first;
+
+	if (len > EMU_RAM_LEN - emu->fifo_count)
+		return -ENOSPC;
+
+	first = EMU_RAM_LEN - emu->fifo_head;
+	if (first > len)
+		first = len;
+
+	memcpy(&emu->ram[emu->fifo_head], buf, first);
+	memcpy(emu->ram, buf + first, len - first);
+
+	emu->fifo_head = (emu->fifo_head + len) % EMU_RAM_LEN;
+	emu->fifo_count += len;
+
+	return 0;
+}
+
+/**
+ * emu_fifo_get - take up to len bytes from the FIFO (as fifo_get)
+ * @emu: the emulator (lock held)
+ * @buf: where to put the data, or NULL to discard
+ * @len: most to take
+ * Returns the number of bytes taken.
+ */
+size_t emu_fifo_get(struct emu *emu, uint8_t *buf, size_t len)
+{
+	size_t first;
+
+	if (len > emu->fifo_count)
+		len = emu->fifo_count;
+
+	first = EMU_RAM_LEN - emu->fifo_tail;
+	if (first > len)
+		first = len;
+
+	if (buf) {
+		memcpy(buf, &emu->ram[emu->fifo_tail], first);
+		memcpy(buf + first, emu->ram, len - first);
+	}
+
+	emu->fifo_tail = (emu->fifo_tail + len) % EMU_RAM_LEN;
+	emu->fifo_count -= len;
+
+	return len;
+}
+
+/**
+ * emu_fifo_put_frame - add a frame, led by its length (as fifo_put_frame)
+ * @emu: the emulator (lock held)
+ * @buf: the frame
+ * @len: length of the frame
+ */
+int emu_fifo_put_frame(struct emu *emu, const uint8_t *buf, size_t len)
+{
+	uint8_t len_byte = len;
+
+	if (len == 0 || len > EMU_FRAME_MAX)
+		return -EINVAL;
+
+	if (len + 1 > EMU_RAM_LEN - emu->fifo_count)
+		return -ENOSPC;
+
+	emu_fifo_put(emu, &len_byte, 1);
+	return emu_fifo_put(emu, buf, len);
+}
+
+/**
+ * emu_fifo_put_batch - add a batch of frames, all or nothing
+ * @emu: the emulator (lock held)
+ * @buf: | COUNT | LEN 0 | ... | LEN COUNT-1 | FRAME 0 | ... |
+ * @len: length of the batch
+ */
+int emu_fifo_put_batch(struct emu *emu, const uint8_t *buf, size_t len)
+{
+	const uint8_t *frame;
+	size_t total;
+	int count, i;
+
+	if (len < 1 || buf[0] == 0)
+		return -EINVAL;
+
+	count = buf[0];
+	total = 1 + count;
+	if (len < total)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (buf[1 + i] == 0)
+			return -EINVAL;
+		total += buf[1 + i];
+	}
+
+	if (total != len)
+		return -EINVAL;
+
+	if (len - 1 > EMU_RAM_LEN - emu->fifo_count)
+		return -ENOSPC;
+
+	frame = &buf[1 + count];
+	for (i = 0; i < count; i++) {
+		emu_fifo_put_frame(emu, frame, buf[1 + i]);
+		frame += buf[1 + i];
+	}
+
+	return 0;
+}
+
+/**
+ * emu_pic_respond - send a response to the host
+ * @emu: the emulator
+ * @resp: response code
+ * @tag: tag of the command being answered
+ * @data: extended response data, or NULL
+ * @len: length of data
+ * May be called from any thread; waits out the configured latency first.
+ */
+int emu_pic_respond(struct emu *emu, uint8_t resp, uint8_t tag,
+						uint8_t *data, size_t len)
+{
+	uint8_t buf[EMU_USB_BUFFER_LEN];
+	int result = 0;
+
+	if (len > EMU_USB_BUFFER_LEN - BLAST_COMMS_PIC_HDRLEN)
+		len = EMU_USB_BUFFER_LEN - BLAST_COMMS_PIC_HDRLEN;
+
+	buf[0] = resp;
+	buf[1] = tag;
+	buf[2] = len & 0xFF;
+	buf[3] = len >> 8;
+	if (len)
+		memcpy(&buf[BLAST_COMMS_PIC_HDRLEN], data, len);
+
+	if (emu->latency > 0)
+		usleep(emu->latency);
+
+	pthread_mutex_lock(&emu->resp_lock);
+	result = emu_gadget_write(emu, emu->ep_resp, buf,
+						BLAST_COMMS_PIC_HDRLEN + len);
+	pthread_mutex_unlock(&emu->resp_lock);
+
+	return result;
+}
+
+/**
+ * emu_pic_mode - change operating mode (as mode())
+ * @emu: the emulator (lock held)
+ * @mode: the new mode
+ */
+static int emu_pic_mode(struct emu *emu, int mode)
+{
+	switch (mode) {
+	case BLAST_COMMS_PIC_MODE_STANDBY:
+	case BLAST_COMMS_PIC_MODE_TRANSMIT:
+	case BLAST_COMMS_PIC_MODE_RECEIVE:
+	case BLAST_COMMS_PIC_MODE_SHUTDOWN:
+		break;
+	default:
+		return BLAST_COMMS_PIC_NACK;
+	}
+
+	/* a held RAM GET can't be answered outside receive mode */
+	if (mode != BLAST_COMMS_PIC_MODE_RECEIVE && emu->pending_get) {
+		emu->pending_get = 0;
+		emu->nacks++;
+		pthread_mutex_unlock(&emu->lock);
+		emu_pic_respond(emu, BLAST_COMMS_PIC_NACK,
+					emu->pending_get_tag, NULL, 0);
+		pthread_mutex_lock(&emu->lock);
+	}
+
+	emu->mode = mode;
+
+	return BLAST_COMMS_PIC_ACK;
+}
+
+/**
+ * emu_xcvr_put - emulate an SPI transaction with the RFM23
+ * @emu: the emulator (lock held)
+ * @buf: bytes clocked out (address, then data)
+ * @len: length of the transaction
+ * The bytes clocked back in are left in xcvr_user_buffer for XCVR GET.
+ */
+static void emu_xcvr_put(struct emu *emu, uint8_t *buf, size_t len)
+{
+	uint8_t addr;
+	size_t i;
+
+	if (len > EMU_XCVR_MAX)
+		len = EMU_XCVR_MAX;
+
+	memset(emu->xcvr_user_buffer, 0, sizeof(emu->xcvr_user_buffer));
+	if (len == 0)
+		return;
+
+	addr = buf[0] & ~EMU_RFM_WRITE;
+
+	/* burst access, the address increments after each byte */
+	for (i = 1; i < len; i++, addr = (addr + 1) % EMU_RFM_REGS) {
+		if (buf[0] & EMU_RFM_WRITE)
+			emu->rfm[addr] = buf[i];
+		else
+			emu->xcvr_user_buffer[i] = emu->rfm[addr];
+	}
+}
+
+/**
+ * emu_pic_cmd - decode and execute a command (as cmd())
+ * @emu: the emulator
+ * @buf: the command, with room for a response of EMU_USB_BUFFER_LEN
+ * @avail: command data actually received
+ * @len: on entry the header's length field; on exit the response data length
+ * Returns the response code, or EMU_RESP_NONE if the command is held.
+ */
+static int emu_pic_cmd(struct emu *emu, uint8_t *buf, size_t avail,
+								size_t *len)
+{
+	uint8_t *data = &buf[BLAST_COMMS_PIC_HDRLEN];
+	size_t want = *len;
+	int result = 0;
+
+	*len = 0;
+
+	/* a truncated command is NACKed without being looked at */
+	switch (buf[0]) {
+	case BLAST_COMMS_PIC_SETMODE:
+	case BLAST_COMMS_PIC_PUTRAM:
+	case BLAST_COMMS_PIC_PUTRAMN:
+	case BLAST_COMMS_PIC_PUTXCVR:
+		if (want > avail)
+			buf[0] = 0;
+		break;
+	}
+
+	pthread_mutex_lock(&emu->lock);
+
+	switch (buf[0]) {
+
+	case BLAST_COMMS_PIC_RESET:
+		result = emu_pic_mode(emu, BLAST_COMMS_PIC_MODE_STANDBY);
+		emu_fifo_clear(emu);
+		break;
+
+	case BLAST_COMMS_PIC_SETMODE:
+		result = want ? emu_pic_mode(emu, data[0]) :
+							BLAST_COMMS_PIC_NACK;
+		break;
+
+	case BLAST_COMMS_PIC_SHUTDOWN:
+		result = emu_pic_mode(emu, BLAST_COMMS_PIC_MODE_SHUTDOWN);
+		break;
+
+	case BLAST_COMMS_PIC_CLEARRAM:
+		emu_fifo_clear(emu);
+		result = BLAST_COMMS_PIC_ACK;
+		break;
+
+	case BLAST_COMMS_PIC_PUTRAM:
+		if (emu->mode != BLAST_COMMS_PIC_MODE_TRANSMIT ||
+					emu_fifo_put_frame(emu, data, want))
+			result = BLAST_COMMS_PIC_NACK;
+		else
+			result = BLAST_COMMS_PIC_ACK;
+		break;
+
+	case BLAST_COMMS_PIC_PUTRAMN:
+		if (emu->mode != BLAST_COMMS_PIC_MODE_TRANSMIT ||
+					emu_fifo_put_batch(emu, data, want))
+			result = BLAST_COMMS_PIC_NACK;
+		else
+			result = BLAST_COMMS_PIC_ACK;
+		break;
+
+	case BLAST_COMMS_PIC_GETRAM:
+		if (emu->mode != BLAST_COMMS_PIC_MODE_RECEIVE) {
+			result = BLAST_COMMS_PIC_NACK;
+			break;
+		}
+
+		if (emu->fifo_count == 0) {
+			if (emu->pending_get || want > EMU_XCVR_MAX) {
+				result = BLAST_COMMS_PIC_NACK;
+				break;
+			}
+
+			/* answered by the air thread when data arrives */
+			emu->pending_get = 1;
+			emu->pending_get_tag = buf[1];
+			emu->pending_get_len = want;
+			result = EMU_RESP_NONE;
+			break;
+		}
+
+		if (want > EMU_USB_BUFFER_LEN - BLAST_COMMS_PIC_HDRLEN)
+			want = EMU_USB_BUFFER_LEN - BLAST_COMMS_PIC_HDRLEN;
+
+		*len = emu_fifo_get(emu, data, want);
+		result = BLAST_COMMS_PIC_EXACK;
+		break;
+
+	case BLAST_COMMS_PIC_PUTXCVR:
+		emu_xcvr_put(emu, data, want);
+		result = BLAST_COMMS_PIC_ACK;
+		break;
+
+	case BLAST_COMMS_PIC_GETXCVR:
+		if (want > EMU_XCVR_MAX)
+			want = EMU_XCVR_MAX;
+
+		memcpy(data, emu->xcvr_user_buffer, want);
+		*len = want;
+		result = BLAST_COMMS_PIC_EXACK;
+		break;
+
+	default:
+		result = BLAST_COMMS_PIC_NACK;
+		break;
+	}
+
+	emu->commands++;
+	if (result == BLAST_COMMS_PIC_NACK)
+		emu->nacks++;
+
+	pthread_mutex_unlock(&emu->lock);
+
+	return result;
+}
+
+/**
+ * emu_pic_thread - receive, execute and answer host commands
+ * @arg: the emulator
+ * Commands are reassembled packet by packet using the length in the header,
+ * since the driver doesn't end transfers with a zero length packet.
+ */
+void *emu_pic_thread(void *arg)
+{
+	struct emu *emu = arg;
+	uint8_t buf[EMU_USB_BUFFER_LEN];
+	size_t have, want, len;
+	int result = 0;
+
+	for (;;) {
+		have = 0;
+		want = BLAST_COMMS_PIC_HDRLEN;
+
+		while (have < want) {
+			result = emu_gadget_read(emu, emu->ep_cmd, &buf[have],
+							EMU_USB_MAXPACKET);
+			if (result < 0) {
+				fprintf(stderr, "%s: command endpoint: %s.\n",
+						EMU_NAME, strerror(-result));
+				return NULL;
+			}
+
+			have += result;
+
+			if (want == BLAST_COMMS_PIC_HDRLEN &&
+					have >= BLAST_COMMS_PIC_HDRLEN) {
+				want += buf[2] | (buf[3] << 8);
+				if (want > EMU_USB_BUFFER_LEN)
+					want = EMU_USB_BUFFER_LEN;
+			}
+
+			/* short packet: the transfer is over */
+			if (result < EMU_USB_MAXPACKET)
+				break;
+		}
+
+		if (have < BLAST_COMMS_PIC_HDRLEN)
+			continue;			/* stray ZLP */
+
+		len = buf[2] | (buf[3] << 8);
+		result = emu_pic_cmd(emu, buf, have - BLAST_COMMS_PIC_HDRLEN,
+									&len);
+
+		if (result != EMU_RESP_NONE)
+			emu_pic_respond(emu, result, buf[1],
+					&buf[BLAST_COMMS_PIC_HDRLEN], len);
+	}
+}
+
+/* EOF */
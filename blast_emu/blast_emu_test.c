@@ -0,0 +1,990 @@
+/**
+ * blast_emu_test.c
+ *
+ * Codec Tests
+ *
+ * Cubesat Communications Uplink/Downlink Test Software
+ *
+ * Project BLAST [http://www.projectblast.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012,2013
+ * Licensed under GPLv2
+ *
+ * Known-answer and round-trip tests of the driver's codecs, which have to
+ * agree bit for bit with the other end of the link.  The driver's own
+ * source is built in, against blast_emu_kernel.h:
+ *
+ *	make test
+ *
+ * Each test prints what failed and the program exits non-zero if anything
+ * did.  Random data comes from a fixed seed, so a failure repeats.
+ */
+
+#include "blast_emu_kernel.h"
+
+#include "../blast_comms/blast_comms.h"
+#include "../blast_comms/blast_comms_util.c"
+#include "../blast_comms/blast_comms_crc.c"
+#include "../blast_comms/blast_comms_frame.c"
+#include "../blast_comms/blast_comms_fec.c"
+#include "../blast_comms/blast_comms_ilv.c"
+#include "../blast_comms/blast_comms_lt.c"
+#include "../blast_comms/blast_comms_arq.c"
+#include "../blast_comms/blast_comms_rto.c"
+
+/*
+ * Global variables
+ */
+static int failures;
+static u32 test_seed = 0x2545F491;
+
+#define	CHECK(cond)	do {						\
+		if (!(cond)) {						\
+			failures++;					\
+			fprintf(stderr, "%s:%d: %s: failed: %s\n",	\
+				__FILE__, __LINE__, __func__, #cond);	\
+		}							\
+	} while (0)
+
+#define	TEST_MS(ms)	((s64)(ms) * NSEC_PER_MSEC)
+
+/**
+ * test_rand - next pseudo-random number (xorshift32)
+ */
+static u32 test_rand(void)
+{
+	test_seed ^= test_seed << 13;
+	test_seed ^= test_seed >> 17;
+	test_seed ^= test_seed << 5;
+
+	return test_seed;
+}
+
+/**
+ * test_fill - fill a buffer with pseudo-random bytes
+ */
+static void test_fill(void *buf, size_t len)
+{
+	u8 *p = buf;
+
+	while (len--)
+		*p++ = test_rand();
+}
+
+/**
+ * test_link - make a link as open() would, as far as the codecs need
+ * @fec: BLAST_COMMS_FEC_*
+ */
+static struct blast_comms_link_dev *test_link(int fec)
+{
+	struct blast_comms_link_dev *dev;
+
+	dev = calloc(1, sizeof(struct blast_comms_link_dev));
+	if (!dev)
+		abort();
+
+	dev->radios = 1;
+	dev->sync_dist = BLAST_COMMS_SYNC_DIST_DEFAULT;
+	dev->arq_window = BLAST_COMMS_ARQ_WINDOW(1);
+	dev->rto_ms = BLAST_COMMS_RTO_DEFAULT;
+	dev->fec = blast_comms_fec_get(fec);
+	dev->tx_data_stack = blast_comms_frame_stack_alloc();
+	dev->rx_data_stack = blast_comms_frame_stack_alloc();
+	dev->rto = blast_comms_rto_alloc(dev);
+
+	if (!dev->fec || dev->fec->init(dev) || !dev->tx_data_stack ||
+			!dev->rx_data_stack || !dev->rto)
+		abort();
+
+	return dev;
+}
+
+/**
+ * test_link_release - undo test_link()
+ */
+static void test_link_release(struct blast_comms_link_dev *dev)
+{
+	dev->fec->release(dev);
+	blast_comms_frame_stack_release(dev->tx_data_stack);
+	blast_comms_frame_stack_release(dev->rx_data_stack);
+	blast_comms_rto_release(dev->rto);
+	free(dev);
+}
+
+/**
+ * test_frame - build a finalised data frame of random data
+ * @dev: the link
+ * @frame: frame buffer
+ * @len: data length
+ * @seq: sequence number
+ */
+static void test_frame(struct blast_comms_link_dev *dev,
+			struct blast_comms_frame *frame, size_t len, u8 seq)
+{
+	blast_comms_build_frame(dev, frame);
+	frame->data_len = len;
+	test_fill(frame->data, len);
+	blast_comms_finalise_frame(dev, frame, seq);
+}
+
+/**
+ * test_crc_bitwise - CRC-CCITT a bit at a time, to check the tables by
+ */
+static u16 test_crc_bitwise(u16 crc, const u8 *buf, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x8408 : 0);
+	}
+
+	return crc;
+}
+
+/**
+ * test_crc - slice-by-4 frame check sequence
+ * Against the check value of CRC-16/MCRF4XX (reflected 0x1021, initial
+ * 0xFFFF, no final XOR) and a bitwise CRC, at every length and alignment
+ * and fed in two pieces.  The FCS is the running CRC as it stands.
+ */
+static void test_crc(void)
+{
+	u8 buf[300 + 4];
+	size_t len, off, cut;
+	u16 crc;
+
+	CHECK(blast_comms_crc_update(blast_comms_crc_init(), "123456789", 9)
+								== 0x6F91);
+	CHECK(blast_comms_crc("123456789", 9) == 0x6F91);
+	CHECK(blast_comms_crc(NULL, 0) == BLAST_COMMS_CRC_INIT);
+
+	test_fill(buf, sizeof(buf));
+	for (len = 0; len <= 300; len++) {
+		for (off = 0; off < 4; off++) {
+			crc = blast_comms_crc(&buf[off], len);
+			CHECK(crc == test_crc_bitwise(BLAST_COMMS_CRC_INIT,
+							&buf[off], len));
+
+			cut = len ? test_rand() % len : 0;
+			CHECK(crc == blast_comms_crc_final(
+				blast_comms_crc_update(blast_comms_crc_update(
+					blast_comms_crc_init(), &buf[off], cut),
+					&buf[off + cut], len - cut)));
+		}
+	}
+}
+
+/**
+ * test_bitrev - on-air bit order, a word at a time
+ */
+static void test_bitrev(void)
+{
+	u8 buf[40 + 8], ref[sizeof(buf)];
+	size_t len, off, i;
+
+	for (len = 0; len <= 40; len++) {
+		for (off = 0; off < 8; off++) {
+			test_fill(buf, sizeof(buf));
+			memcpy(ref, buf, sizeof(buf));
+			for (i = 0; i < len; i++)
+				ref[off + i] = bitrev8(ref[off + i]);
+
+			bitrev8_words(&buf[off], len);
+			CHECK(!memcmp(buf, ref, sizeof(buf)));
+		}
+	}
+
+	CHECK(bitrev8(0x01) == 0x80 && bitrev8(0x7E) == 0x7E &&
+						bitrev8(0x12) == 0x48);
+}
+
+/**
+ * test_frame_wire - frame serialisation
+ * The layout of blast_comms_frame.h, byte for byte, and back.
+ */
+static void test_frame_wire(void)
+{
+	static const u8 tag[BLAST_COMMS_WIRE_SYNC] = {
+		0xA6, 0x60, 0xFF, 0x26, 0xDE, 0x8F, 0xCC, 0x00
+	};
+	struct blast_comms_frame frame, back;
+	size_t len;
+
+	for (len = 0; len <= BLAST_COMMS_FRAME_DATA_LEN; len++) {
+		blast_comms_build_frame(NULL, &frame);
+		frame.ctl = BLAST_COMMS_FRAME_CTL_FIRST;
+		frame.seq_num = len % BLAST_COMMS_FRAME_SEQNUM_MOD;
+		frame.data_len = len;
+		test_fill(frame.data, len);
+		frame.fcs = blast_comms_frame_fcs(&frame);
+
+		CHECK(blast_comms_frame_encode(&frame) ==
+					BLAST_COMMS_WIRE_LEN(len));
+		CHECK(!memcmp(frame.wire, tag, sizeof(tag)));
+		CHECK(frame.wire[BLAST_COMMS_WIRE_SYNC] == 0x7E);
+		CHECK(frame.wire[BLAST_COMMS_WIRE_CTL] ==
+					BLAST_COMMS_FRAME_CTL_FIRST);
+		CHECK(frame.wire[BLAST_COMMS_WIRE_PID] ==
+					BLAST_COMMS_FRAME_PID);
+		CHECK(frame.wire[BLAST_COMMS_WIRE_SEQ] == frame.seq_num);
+		CHECK(frame.wire[BLAST_COMMS_WIRE_DLEN] == len);
+		CHECK(get_unaligned_le16(&frame.wire[BLAST_COMMS_WIRE_DATA +
+							len]) == frame.fcs);
+		CHECK(frame.wire[BLAST_COMMS_WIRE_DATA + len + 2] == 0x7E);
+
+		memset(&back, 0, sizeof(back));
+		memcpy(back.wire, frame.wire, frame.wire_len);
+		back.wire_len = frame.wire_len;
+		CHECK(!blast_comms_frame_decode(&back));
+		CHECK(back.ctl == frame.ctl && back.pid == frame.pid &&
+				back.seq_num == frame.seq_num &&
+				back.data_len == len && back.fcs == frame.fcs &&
+				!memcmp(back.data, frame.data, len));
+
+		/* The length byte and the wire length must agree */
+		back.wire_len++;
+		CHECK(blast_comms_frame_decode(&back) == -EINVAL);
+	}
+
+	CHECK(blast_comms_seq_diff(5, 5) == 0);
+	CHECK(blast_comms_seq_diff(0, BLAST_COMMS_FRAME_SEQNUM_LIM) == 1);
+	CHECK(blast_comms_seq_diff(BLAST_COMMS_FRAME_SEQNUM_LIM, 0) ==
+					BLAST_COMMS_FRAME_SEQNUM_LIM);
+}
+
+/**
+ * test_fec_round_trip - every scheme, every data length, no errors
+ * Also that the frame finder would size each frame from its head.
+ */
+static void test_fec_round_trip(void)
+{
+	struct blast_comms_link_dev *dev;
+	struct blast_comms_frame frame;
+	u8 data[BLAST_COMMS_FRAME_DATA_LEN];
+	size_t len;
+	int fec;
+
+	for (fec = 0; fec < BLAST_COMMS_FEC_SCHEMES; fec++) {
+		dev = test_link(fec);
+
+		for (len = 0; len <= dev->fec->data_max; len++) {
+			test_frame(dev, &frame, len, len);
+			memcpy(data, frame.data, len);
+
+			CHECK(frame.wire_len <= BLAST_COMMS_WIRE_MAX);
+			CHECK(dev->fec->air_len(dev, frame.wire) ==
+							frame.wire_len);
+
+			memset(frame.data, 0, sizeof(frame.data));
+			CHECK(blast_comms_validate_frame(dev, &frame) ==
+						BLAST_COMMS_DATA_FRAME);
+			CHECK(frame.data_len == len &&
+					!memcmp(frame.data, data, len));
+		}
+
+		test_link_release(dev);
+	}
+}
+
+/**
+ * test_fec_none - without FEC a bit error is caught by the CRC
+ */
+static void test_fec_none(void)
+{
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_NONE);
+	struct blast_comms_frame frame;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		test_frame(dev, &frame, 1 + test_rand() % 128, 0);
+		frame.wire[BLAST_COMMS_WIRE_DATA + test_rand() %
+				(frame.wire_len - BLAST_COMMS_WIRE_DATA)] ^=
+						1 << (test_rand() % 8);
+		CHECK(blast_comms_validate_frame(dev, &frame) ==
+					BLAST_COMMS_E_BADFRAME_NOSEQ);
+	}
+
+	test_link_release(dev);
+}
+
+/**
+ * test_rs - Reed-Solomon corrects up to 16 bad bytes, anywhere after the
+ * tag, check symbols included
+ */
+static void test_rs(void)
+{
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_fec_rs *rs = dev->fec_priv;
+	struct blast_comms_frame frame;
+	u8 data[BLAST_COMMS_FRAME_DATA_LEN];
+	u8 hit[BLAST_COMMS_WIRE_MAX];
+	size_t len, pos;
+	int i, n, result;
+
+	for (i = 0; i < 200; i++) {
+		len = test_rand() % (BLAST_COMMS_FRAME_DATA_LEN + 1);
+		test_frame(dev, &frame, len, i % BLAST_COMMS_FRAME_SEQNUM_MOD);
+		memcpy(data, frame.data, len);
+
+		/* Up to 16 bytes, or one too many */
+		n = i < 150 ? 1 + i % (BLAST_COMMS_RS_NROOTS / 2) :
+						BLAST_COMMS_RS_NROOTS / 2 + 1;
+		memset(hit, 0, sizeof(hit));
+		while (n) {
+			pos = BLAST_COMMS_WIRE_SYNC + test_rand() %
+				(frame.wire_len - BLAST_COMMS_WIRE_SYNC);
+			if (hit[pos])
+				continue;
+			hit[pos] = 1;
+			frame.wire[pos] ^= 1 + test_rand() % 255;
+			n--;
+		}
+
+		result = blast_comms_validate_frame(dev, &frame);
+		if (i < 150)
+			CHECK(result == BLAST_COMMS_DATA_FRAME &&
+					frame.data_len == len &&
+					!memcmp(frame.data, data, len));
+		else
+			CHECK(result == BLAST_COMMS_E_BADFRAME_NOSEQ ||
+					(frame.data_len == len &&
+					!memcmp(frame.data, data, len)));
+
+		/* The codec is let go on every path */
+		CHECK(rs->lock.held == 0);
+	}
+
+	test_link_release(dev);
+}
+
+/**
+ * test_conv - convolutional code and Viterbi decoder
+ * The impulse response is the two generators, a code bit pair per input
+ * bit, G1 first; scattered bit errors are corrected.
+ */
+static void test_conv(void)
+{
+	static const u8 impulse[] = { 0xCB, 0x37, 0x00, 0x00 };
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_CONV);
+	struct blast_comms_frame frame;
+	u8 data[BLAST_COMMS_FRAME_DATA_LEN];
+	size_t len, bit, gap;
+	int i;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.wire[BLAST_COMMS_WIRE_SYNC] = 0x01;
+	frame.wire_len = BLAST_COMMS_WIRE_SYNC + 1;
+	blast_comms_fec_conv_encode(dev, &frame);
+	CHECK(frame.wire_len == BLAST_COMMS_WIRE_SYNC + sizeof(impulse));
+	CHECK(!memcmp(&frame.wire[BLAST_COMMS_WIRE_SYNC], impulse,
+							sizeof(impulse)));
+
+	for (i = 0; i < 100; i++) {
+		len = test_rand() % (BLAST_COMMS_CONV_DATA_MAX + 1);
+		test_frame(dev, &frame, len, 0);
+		memcpy(data, frame.data, len);
+
+		/* A bit error every so often, never closer than 24 */
+		gap = 24 + test_rand() % 40;
+		for (bit = test_rand() % gap;
+				bit < 8 * (frame.wire_len - BLAST_COMMS_WIRE_SYNC);
+				bit += gap)
+			frame.wire[BLAST_COMMS_WIRE_SYNC + bit / 8] ^=
+							1 << (bit % 8);
+
+		CHECK(blast_comms_validate_frame(dev, &frame) ==
+						BLAST_COMMS_DATA_FRAME);
+		CHECK(frame.data_len == len && !memcmp(frame.data, data, len));
+	}
+
+	test_link_release(dev);
+}
+
+/**
+ * test_ilv_group - interleave a group and take it apart as the frame
+ * finder would
+ * @dev: the link (Reed-Solomon)
+ * @depth: frames in the group
+ * @burst: bytes of the column stream to wipe out, 0 for none
+ */
+static void test_ilv_group(struct blast_comms_link_dev *dev, int depth,
+								size_t burst)
+{
+	static struct blast_comms_frame frames[BLAST_COMMS_ILV_MAX];
+	static struct blast_comms_ilv_rx rx;
+	struct blast_comms_frame *group[BLAST_COMMS_ILV_MAX];
+	struct blast_comms_frame frame;
+	struct blast_comms_ilv_head head;
+	u8 buf[BLAST_COMMS_ILV_MAX * BLAST_COMMS_WIRE_MAX * 2];
+	u8 lens[BLAST_COMMS_ILV_MAX * 2];
+	u8 group_id = test_rand();
+	size_t row_len, total, off, start;
+	int packets, i;
+
+	for (i = 0; i < depth; i++) {
+		test_frame(dev, &frames[i], 40 + test_rand() % 89, i);
+		group[i] = &frames[i];
+	}
+
+	row_len = blast_comms_ilv_row_len(group, depth);
+	packets = BLAST_COMMS_ILV_PACKETS(depth, row_len);
+	total = blast_comms_ilv_encode(group, depth, group_id, buf, lens);
+
+	blast_comms_ilv_rx_reset(&rx);
+	for (i = 0, off = 0; i < packets; off += lens[i], i++) {
+		CHECK(get_unaligned_le32(&buf[off]) ==
+					BLAST_COMMS_FRAME_CORREL_TAG_1);
+		CHECK(get_unaligned_le32(&buf[off + 4]) ==
+					BLAST_COMMS_ILV_CORREL_TAG_2);
+
+		/* One copy of the header may be damaged */
+		buf[off + BLAST_COMMS_WIRE_SYNC + BLAST_COMMS_ILV_FIELDS *
+				(i % BLAST_COMMS_ILV_COPIES) +
+				i % BLAST_COMMS_ILV_FIELDS] ^= 0xFF;
+
+		CHECK(!blast_comms_ilv_head(&buf[off], &head));
+		CHECK(head.depth == depth && head.index == i &&
+				head.group == group_id &&
+				head.row_len == row_len);
+		CHECK(blast_comms_ilv_packet_len(&head) == lens[i]);
+		CHECK(i == 0 || blast_comms_ilv_rx_same(&rx, &head));
+
+		rx.head = head;
+		memcpy(&rx.stream[i * BLAST_COMMS_ILV_PKT_DATA],
+				&buf[off + BLAST_COMMS_ILV_HEAD_LEN],
+				lens[i] - BLAST_COMMS_ILV_HEAD_LEN);
+		rx.have |= 1 << i;
+	}
+	CHECK(off == total);
+
+	/* After the data lengths, which the frames are sized by */
+	if (burst) {
+		start = depth * (BLAST_COMMS_WIRE_DATA -
+					BLAST_COMMS_WIRE_SYNC + 1);
+		memset(&rx.stream[start], 0x55, burst);
+	}
+
+	for (i = 0; i < depth; i++) {
+		memset(&frame, 0, sizeof(frame));
+		blast_comms_ilv_rx_row(&rx, i, &frame);
+		CHECK(frame.wire_len == BLAST_COMMS_WIRE_SYNC + row_len);
+
+		frame.wire_len = dev->fec->air_len(dev, frame.wire);
+		CHECK(frame.wire_len == frames[i].wire_len);
+		if (!burst)
+			CHECK(!memcmp(frame.wire, frames[i].wire,
+							frame.wire_len));
+
+		CHECK(blast_comms_validate_frame(dev, &frame) ==
+						BLAST_COMMS_DATA_FRAME);
+		CHECK(frame.seq_num == i);
+	}
+
+	for (i = 0; i < depth; i++)
+		blast_comms_validate_frame(dev, &frames[i]);
+}
+
+/**
+ * test_ilv - the interleaver, and what it is for: a burst of up to 16
+ * bytes per frame of the group is corrected
+ */
+static void test_ilv(void)
+{
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_RS);
+	u8 air[BLAST_COMMS_ILV_HEAD_LEN];
+	struct blast_comms_ilv_head head;
+	int depth;
+
+	for (depth = 1; depth <= BLAST_COMMS_ILV_MAX; depth++) {
+		test_ilv_group(dev, depth, 0);
+		test_ilv_group(dev, depth,
+				depth * BLAST_COMMS_RS_NROOTS / 2);
+	}
+
+	/* Nonsense headers are refused */
+	memset(air, 0, sizeof(air));
+	CHECK(blast_comms_ilv_head(air, &head) == -EINVAL);
+	memset(air, 0xFF, sizeof(air));
+	CHECK(blast_comms_ilv_head(air, &head) == -EINVAL);
+
+	test_link_release(dev);
+}
+
+/**
+ * test_shift_in - put bytes on a radio's raw stack after some stray bits
+ * @radio: the radio
+ * @src: the bytes
+ * @len: how many
+ * @shift: stray bits first, which the rest then straddle
+ */
+static void test_shift_in(struct blast_comms_dev *radio, const u8 *src,
+						size_t len, int shift)
+{
+	u8 buf[1024];
+	size_t out = len + DIV_ROUND_UP(shift, 8);
+	size_t k, b;
+
+	test_fill(buf, out);
+	for (k = shift; k < 8 * out; k++) {
+		b = k - shift;
+		if (b >= 8 * len)
+			break;
+		buf[k / 8] &= ~(0x80 >> (k % 8));
+		buf[k / 8] |= ((src[b / 8] << (b % 8)) & 0x80) >> (k % 8);
+	}
+
+	kfifo_in(&radio->rx_raw_stack, buf, out);
+}
+
+/**
+ * test_sync - the correlator
+ * Tags are found at any bit offset, with up to the sync distance in bit
+ * errors, and what follows them is read back byte aligned; a tag with one
+ * error too many is not found.
+ */
+static void test_sync(void)
+{
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_dev *radio;
+	struct blast_comms_frame *group[1];
+	struct blast_comms_frame frame;
+	struct blast_comms_sync sync;
+	u8 stream[2 * BLAST_COMMS_WIRE_MAX + 64];
+	u8 buf[BLAST_COMMS_WIRE_MAX];
+	u8 lens[2];
+	size_t len, noise;
+	int shift, errors, i, bit;
+	u64 hit;
+
+	radio = calloc(1, sizeof(struct blast_comms_dev));
+	if (!radio || kfifo_alloc(&radio->rx_raw_stack, 4096, GFP_KERNEL))
+		abort();
+
+	for (shift = 0; shift < 24; shift++) {
+		for (errors = 0; errors <= dev->sync_dist + 1; errors++) {
+			test_frame(dev, &frame, test_rand() % 129, shift);
+
+			noise = test_rand() % 16;
+			test_fill(stream, noise);
+			memcpy(&stream[noise], frame.wire, frame.wire_len);
+			len = noise + frame.wire_len;
+			test_fill(&stream[len], 8);
+			len += 8;
+
+			for (hit = 0, i = 0; i < errors; ) {
+				bit = test_rand() % 64;
+				if (hit & (1ULL << bit))
+					continue;
+				hit |= 1ULL << bit;
+				stream[noise + bit / 8] ^= 1 << (bit % 8);
+				i++;
+			}
+
+			memset(&sync, 0, sizeof(sync));
+			radio->rx_raw_stack.in = radio->rx_raw_stack.out = 0;
+			test_shift_in(radio, stream, len, shift);
+
+			if (errors > dev->sync_dist) {
+				CHECK(blast_comms_frame_sync(radio, &sync,
+						dev->sync_dist) == 0);
+				continue;
+			}
+
+			CHECK(blast_comms_frame_sync(radio, &sync,
+				dev->sync_dist) == BLAST_COMMS_SYNC_FRAME);
+			blast_comms_frame_read(radio, &sync, buf,
+				frame.wire_len - BLAST_COMMS_WIRE_SYNC);
+			CHECK(!memcmp(buf, &frame.wire[BLAST_COMMS_WIRE_SYNC],
+				frame.wire_len - BLAST_COMMS_WIRE_SYNC));
+		}
+	}
+
+	/* Two back to back, the second an interleaved packet */
+	test_frame(dev, &frame, 64, 0);
+	group[0] = &frame;
+	memcpy(stream, frame.wire, frame.wire_len);
+	len = frame.wire_len;
+	len += blast_comms_ilv_encode(group, 1, 7, &stream[len], lens);
+	test_fill(&stream[len], 8);
+	len += 8;
+
+	memset(&sync, 0, sizeof(sync));
+	radio->rx_raw_stack.in = radio->rx_raw_stack.out = 0;
+	test_shift_in(radio, stream, len, 5);
+
+	CHECK(blast_comms_frame_sync(radio, &sync, dev->sync_dist) ==
+						BLAST_COMMS_SYNC_FRAME);
+	blast_comms_frame_read(radio, &sync, buf,
+				frame.wire_len - BLAST_COMMS_WIRE_SYNC);
+	CHECK(!memcmp(buf, &frame.wire[BLAST_COMMS_WIRE_SYNC],
+				frame.wire_len - BLAST_COMMS_WIRE_SYNC));
+	CHECK(blast_comms_frame_sync(radio, &sync, dev->sync_dist) ==
+						BLAST_COMMS_SYNC_ILV);
+	blast_comms_frame_read(radio, &sync, buf, BLAST_COMMS_ILV_HDRLEN);
+	CHECK(!memcmp(buf, &stream[frame.wire_len + BLAST_COMMS_WIRE_SYNC],
+						BLAST_COMMS_ILV_HDRLEN));
+
+	kfifo_free(&radio->rx_raw_stack);
+	free(radio);
+	test_link_release(dev);
+}
+
+/**
+ * test_lt_block - send a block through the fountain, losing symbols
+ * @len: block length
+ * @loss: percent of symbols lost
+ */
+static void test_lt_block(size_t len, int loss)
+{
+	struct blast_comms_lt *tx = blast_comms_lt_alloc();
+	struct blast_comms_lt *rx = blast_comms_lt_alloc();
+	u8 sym[BLAST_COMMS_FRAME_DATA_LEN];
+	size_t sym_len = BLAST_COMMS_LT_SYM_MAX;
+	int sent = 0, result = 0, i;
+
+	if (!tx || !rx)
+		abort();
+
+	test_fill(tx->tx_block, len);
+	blast_comms_lt_load(tx, sym_len, len, 0);
+	CHECK(tx->tx_k == max_t(int, DIV_ROUND_UP(len, sym_len), 1));
+
+	while (result != 1 && sent < 10 * BLAST_COMMS_LT_K_MAX) {
+		CHECK(blast_comms_lt_encode(tx, sym) ==
+					BLAST_COMMS_LT_HDRLEN + sym_len);
+		sent++;
+		if (test_rand() % 100 < loss)
+			continue;
+
+		result = blast_comms_lt_decode(rx, sym,
+					BLAST_COMMS_LT_HDRLEN + sym_len);
+		CHECK(result >= 0);
+	}
+
+	CHECK(result == 1 && rx->rx_state == BLAST_COMMS_LT_DECODED);
+	CHECK(rx->rx_len == len && rx->rx_k == tx->tx_k);
+	for (i = 0; i < rx->rx_k; i++)
+		CHECK(!memcmp(rx->rx_row[i], &tx->tx_block[i * sym_len],
+								sym_len));
+
+	/* Once decoded, more of the same block change nothing */
+	blast_comms_lt_encode(tx, sym);
+	CHECK(blast_comms_lt_decode(rx, sym,
+				BLAST_COMMS_LT_HDRLEN + sym_len) == 1);
+
+	blast_comms_lt_release(tx);
+	blast_comms_lt_release(rx);
+}
+
+/**
+ * test_lt - the fountain code
+ * Source symbols are themselves, the rest a fixed mix of them; a block
+ * comes back from any symbols that span it, whichever are lost.
+ */
+static void test_lt(void)
+{
+	struct blast_comms_lt *rx = blast_comms_lt_alloc();
+	u8 sym[BLAST_COMMS_FRAME_DATA_LEN];
+	int k, esi, loss;
+	u32 mask, seen;
+
+	if (!rx)
+		abort();
+
+	for (k = 1; k <= BLAST_COMMS_LT_K_MAX; k++) {
+		seen = 0;
+		for (esi = 0; esi < 4 * k + 64; esi++) {
+			mask = blast_comms_lt_mask(3, esi, k);
+			CHECK(mask == blast_comms_lt_mask(3, esi, k));
+			CHECK(mask && (k == BLAST_COMMS_LT_K_MAX ||
+						!(mask >> k)));
+			if (esi < k)
+				CHECK(mask == 1U << esi);
+			else
+				seen |= mask;
+		}
+		CHECK(seen == (k < BLAST_COMMS_LT_K_MAX ?
+						(1U << k) - 1 : ~0U));
+	}
+
+	for (loss = 0; loss <= 50; loss += 25) {
+		test_lt_block(1, loss);
+		test_lt_block(BLAST_COMMS_LT_SYM_MAX, loss);
+		test_lt_block(BLAST_COMMS_LT_SYM_MAX + 1, loss);
+		test_lt_block(1000, loss);
+		test_lt_block(BLAST_COMMS_LT_BLOCK_MAX, loss);
+	}
+
+	/* Symbols that make no sense */
+	memset(sym, 0, sizeof(sym));
+	CHECK(blast_comms_lt_decode(rx, sym, BLAST_COMMS_LT_HDRLEN) ==
+								-EINVAL);
+	sym[1] = 0;
+	CHECK(blast_comms_lt_decode(rx, sym, sizeof(sym)) == -EINVAL);
+	sym[1] = BLAST_COMMS_LT_K_MAX + 1;
+	CHECK(blast_comms_lt_decode(rx, sym, sizeof(sym)) == -EINVAL);
+	sym[1] = 2;
+	put_unaligned_le16(1, &sym[4]);
+	CHECK(blast_comms_lt_decode(rx, sym, 10) == -EINVAL);
+
+	blast_comms_lt_release(rx);
+}
+
+/**
+ * test_rto - retransmission deadlines
+ * They expire oldest first, the timer always set for the first of them,
+ * whatever order they are armed, re-armed and cancelled in.
+ */
+static void test_rto(void)
+{
+	struct blast_comms_link_dev *dev = test_link(BLAST_COMMS_FEC_NONE);
+	struct blast_comms_rto *rto = dev->rto;
+	s64 sent[BLAST_COMMS_RTO_SLOTS];
+	int seq, i, n, oldest;
+
+	emu_test_now = TEST_MS(10);
+	blast_comms_rto_arm(dev, 5);
+	emu_test_now = TEST_MS(20);
+	blast_comms_rto_arm(dev, 7);
+	emu_test_now = TEST_MS(30);
+	blast_comms_rto_arm(dev, 3);
+
+	CHECK(rto->count == 3 && rto->timer.active);
+	CHECK(rto->timer.expires == TEST_MS(10 + BLAST_COMMS_RTO_DEFAULT));
+
+	emu_test_now = TEST_MS(10 + BLAST_COMMS_RTO_DEFAULT) - 1;
+	CHECK(!blast_comms_rto_due(dev) && blast_comms_rto_pop(dev) == -1);
+	emu_test_now++;
+	CHECK(blast_comms_rto_pop(dev) == 5 && blast_comms_rto_pop(dev) == -1);
+	CHECK(rto->timer.expires == TEST_MS(20 + BLAST_COMMS_RTO_DEFAULT));
+
+	/* Sent again, so last to expire; cancelling the top moves the timer */
+	emu_test_now = TEST_MS(1015);
+	blast_comms_rto_arm(dev, 7);
+	CHECK(rto->timer.expires == TEST_MS(30 + BLAST_COMMS_RTO_DEFAULT));
+	blast_comms_rto_cancel(dev, 3);
+	CHECK(rto->timer.expires == TEST_MS(1015 + BLAST_COMMS_RTO_DEFAULT));
+	blast_comms_rto_cancel(dev, 3);
+	CHECK(rto->count == 1);
+
+	CHECK(blast_comms_rto_older(dev, 7, 0));
+	CHECK(!blast_comms_rto_older(dev, 7, 1));
+	emu_test_now += TEST_MS(BLAST_COMMS_ARQ_HOLDOFF);
+	CHECK(blast_comms_rto_older(dev, 7, BLAST_COMMS_ARQ_HOLDOFF));
+	blast_comms_rto_cancel(dev, 7);
+	CHECK(rto->count == 0);
+
+	/* Against a plain table, the clock never going back */
+	for (seq = 0; seq < BLAST_COMMS_RTO_SLOTS; seq++)
+		sent[seq] = -1;
+
+	for (i = 0; i < 20000; i++) {
+		emu_test_now += TEST_MS(1);
+		seq = test_rand() % BLAST_COMMS_RTO_SLOTS;
+
+		switch (test_rand() % 3) {
+		case 0:
+			blast_comms_rto_arm(dev, seq);
+			sent[seq] = emu_test_now;
+			break;
+		case 1:
+			blast_comms_rto_cancel(dev, seq);
+			sent[seq] = -1;
+			break;
+		default:
+			/* Let the oldest expire */
+			oldest = -1;
+			for (n = 0; n < BLAST_COMMS_RTO_SLOTS; n++)
+				if (sent[n] >= 0 && (oldest < 0 ||
+						sent[n] < sent[oldest]))
+					oldest = n;
+			if (oldest < 0) {
+				CHECK(blast_comms_rto_pop(dev) == -1);
+				break;
+			}
+
+			CHECK(rto->timer.expires == sent[oldest] +
+				TEST_MS(BLAST_COMMS_RTO_DEFAULT));
+			emu_test_now = max(emu_test_now, sent[oldest] +
+				TEST_MS(BLAST_COMMS_RTO_DEFAULT));
+			CHECK(blast_comms_rto_pop(dev) == oldest);
+			sent[oldest] = -1;
+		}
+
+		for (n = 0, seq = 0; seq < BLAST_COMMS_RTO_SLOTS; seq++)
+			n += sent[seq] >= 0;
+		CHECK(rto->count == n);
+	}
+
+	test_link_release(dev);
+}
+
+/**
+ * test_arq_send - a transmit stack with frames 0 to count - 1 sent
+ * @dev: the link
+ * @count: how many
+ */
+static void test_arq_send(struct blast_comms_link_dev *dev, int count)
+{
+	int seq;
+
+	memset(dev->tx_data_stack->map, 0, BLAST_COMMS_STACK_SIZE);
+	dev->tx_base = 0;
+	atomic_set(&dev->unack, count);
+	atomic_set(&dev->unsent, 0);
+
+	for (seq = 0; seq < count; seq++) {
+		dev->tx_data_stack->map[seq] = BLAST_COMMS_STACK_MAP_READY |
+						BLAST_COMMS_STACK_MAP_SENT;
+		blast_comms_rto_arm(dev, seq);
+	}
+}
+
+/**
+ * test_arq - selective repeat, both ends
+ * The receiver's ACK state, carried in an ACK frame, frees at the
+ * transmitter what was received and sends again what is missing.
+ */
+static void test_arq(void)
+{
+	static const u8 order[] = { 0, 1, 3, 4, 6, 3, 0 };
+	struct blast_comms_link_dev *rx = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_link_dev *tx = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_frame frame;
+	u8 *map = (u8 *)tx->tx_data_stack->map;
+	u64 sack;
+	int i, seq, kept = 0;
+
+	/* Receiver: 2 and 5 are lost, and 3 and 0 come again */
+	for (i = 0; i < ARRAY_SIZE(order); i++)
+		kept += blast_comms_arq_mark(rx, order[i]);
+	CHECK(kept == 5);
+	CHECK(rx->rx_cum == 2 && rx->rx_sack >> 1 == 0x0B);
+
+	/* Outside the window, or the slot not yet read */
+	CHECK(!blast_comms_arq_mark(rx, (2 + rx->arq_window) %
+					BLAST_COMMS_FRAME_SEQNUM_MOD));
+	rx->rx_data_stack->map[5] = BLAST_COMMS_STACK_MAP_UNREAD;
+	CHECK(!blast_comms_arq_mark(rx, 5));
+	rx->rx_data_stack->map[5] = BLAST_COMMS_STACK_MAP_CLEAR;
+
+	/* Transmitter: the ACK goes as a frame of its own */
+	emu_test_now = 0;
+	test_arq_send(tx, 8);
+	emu_test_now = TEST_MS(BLAST_COMMS_ARQ_HOLDOFF);
+
+	blast_comms_build_ack_frame(rx, &frame, rx->rx_cum, rx->rx_sack >> 1);
+	CHECK(blast_comms_validate_frame(tx, &frame) ==
+						BLAST_COMMS_ACK_FRAME);
+	sack = get_unaligned_le64(frame.data);
+	blast_comms_arq_ack(tx, frame.seq_num, sack);
+
+	CHECK(tx->tx_base == 2);
+	for (seq = 0; seq < 8; seq++) {
+		if (seq == 2 || seq == 5)
+			CHECK(map[seq] == BLAST_COMMS_STACK_MAP_READY);
+		else if (seq == 7)
+			CHECK(map[seq] & BLAST_COMMS_STACK_MAP_SENT);
+		else
+			CHECK(map[seq] == BLAST_COMMS_STACK_MAP_CLEAR);
+	}
+	CHECK(atomic_read(&tx->unsent) == 2 && atomic_read(&tx->unack) == 1);
+	CHECK(tx->rto->count == 1 && tx->rto->heap[0] == 7);
+
+	/* An older ACK changes nothing */
+	blast_comms_arq_ack(tx, 0, 0);
+	CHECK(tx->tx_base == 2 && map[0] == BLAST_COMMS_STACK_MAP_CLEAR &&
+				map[2] == BLAST_COMMS_STACK_MAP_READY);
+
+	/* Holes sent too recently wait for the next ACK, or the watchdog */
+	blast_comms_rto_cancel(tx, 7);
+	emu_test_now = 0;
+	test_arq_send(tx, 8);
+	emu_test_now = TEST_MS(BLAST_COMMS_ARQ_HOLDOFF) - 1;
+	blast_comms_arq_ack(tx, 2, 0x0B);
+	CHECK(map[2] & BLAST_COMMS_STACK_MAP_SENT &&
+				map[5] & BLAST_COMMS_STACK_MAP_SENT);
+	CHECK(atomic_read(&tx->unsent) == 0 && atomic_read(&tx->unack) == 3);
+
+	/* Round the end of the sequence numbers */
+	rx->rx_cum = BLAST_COMMS_FRAME_SEQNUM_LIM - 2;
+	rx->rx_sack = 0;
+	for (i = 0; i < 6; i++)
+		CHECK(blast_comms_arq_mark(rx, (BLAST_COMMS_FRAME_SEQNUM_LIM -
+			2 + i) % BLAST_COMMS_FRAME_SEQNUM_MOD));
+	CHECK(rx->rx_cum == 3 && rx->rx_sack == 0);
+
+	test_link_release(rx);
+	test_link_release(tx);
+}
+
+/**
+ * test_ack_attach - a data frame carries the ACK state on an RTX link
+ * Only the frame as sent has it; the stack's copy is sent again as it was.
+ */
+static void test_ack_attach(void)
+{
+	struct blast_comms_link_dev *tx = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_link_dev *rx = test_link(BLAST_COMMS_FEC_RS);
+	struct blast_comms_frame frame, sent;
+	size_t len;
+
+	tx->mode = BLAST_COMMS_RTX;
+	len = blast_comms_data_max(tx);
+	CHECK(len == tx->fec->data_max - BLAST_COMMS_ARQ_ACK_LEN);
+	test_frame(tx, &frame, len, 9);
+
+	/* Nothing pending, nothing added */
+	sent = frame;
+	blast_comms_ack_attach(tx, &sent);
+	CHECK(!memcmp(&sent, &frame, sizeof(frame)));
+
+	tx->rx_cum = 5;
+	tx->rx_sack = 0x0B << 1;
+	tx->ack_pending = 1;
+	blast_comms_ack_attach(tx, &sent);
+	CHECK(!tx->ack_pending);
+	CHECK(sent.ctl == frame.ctl && sent.data_len == frame.data_len);
+	CHECK(sent.wire_len > frame.wire_len);
+
+	CHECK(blast_comms_validate_frame(rx, &sent) == BLAST_COMMS_DATA_FRAME);
+	CHECK(sent.ctl & BLAST_COMMS_FRAME_CTL_ACK);
+	CHECK(sent.data_len == len + BLAST_COMMS_ARQ_ACK_LEN);
+	CHECK(sent.data[len] == 5 &&
+			get_unaligned_le64(&sent.data[len + 1]) == 0x0B);
+	CHECK(!memcmp(sent.data, frame.data, len));
+
+	test_link_release(tx);
+	test_link_release(rx);
+}
+
+int main(void)
+{
+	test_crc();
+	test_bitrev();
+	test_frame_wire();
+	test_fec_round_trip();
+	test_fec_none();
+	test_rs();
+	test_conv();
+	test_ilv();
+	test_sync();
+	test_lt();
+	test_rto();
+	test_arq();
+	test_ack_attach();
+
+	if (failures) {
+		fprintf(stderr, "%s: %d checks failed\n", "blast_emu_test",
+								failures);
+		return 1;
+	}
+
+	printf("%s: all passed\n", "blast_emu_test");
+
+	return 0;
+}
+
+/* EOF */
@@ -22,6 +22,11 @@
  */
 int 		device_mode;
 char		xcvr_user_buffer[XCVR_MAX];
+char		get_buffer[XCVR_MAX];		/* held RAM GET response */
+char		pending_get;				/* a RAM GET is being held */
+char		pending_get_tag;
+size_t		pending_get_len;
+size_t		tx_frame_left;				/* of the frame being sent */
 
 /**
  * irq - the interrupt function
@@ -30,23 +35,51 @@ char		xcvr_user_buffer[XCVR_MAX];
 static int irq(void)
 {
 	char buffer[XCVR_BUFFER_LEN];
+	size_t len = 0;
 	int result = 0;
 
 	switch (device_mode) {
 
 		case MODE_TRANSMIT:
-			result = fifo_get(buffer, XCVR_BUFFER_LEN);
+			/* starting a frame: program its length first */
+			if (tx_frame_left == 0) {
+				result = fifo_get(buffer, 1);
+				if (result != 0)
+					return result;
 
-			if (result == 0)
-				return xcvr_put(buffer, XCVR_BUFFER_LEN);
+				tx_frame_left = (unsigned char)buffer[0];
+				result = xcvr_packet_len(tx_frame_left);
+				if (result != 0)
+					return result;
+			}
+
+			len = tx_frame_left;
+			if (len > XCVR_BUFFER_LEN)
+				len = XCVR_BUFFER_LEN;
+
+			result = fifo_get(buffer, len);
+
+			if (result == 0) {
+				tx_frame_left -= len;
+				return xcvr_put(buffer, len);
+			}
 			
 			return result;
 
 		case MODE_RECEIVE:
 			result = xvcr_get(buffer, XCVR_BUFFER_LEN);
 
-			if (result == 0)
-				return fifo_put(buffer, XCVR_BUFFER_LEN);
+			if (result != 0)
+				return result;
+
+			/* stream straight to the host if nothing is queued
+			 * ahead of us, otherwise keep the bytes in order */
+			if (!pending_get && fifo_is_empty() &&
+					usb_stream(buffer, XCVR_BUFFER_LEN) == 0)
+				return 0;
+
+			result = fifo_put(buffer, XCVR_BUFFER_LEN);
+			get_pending();				/* a held RAM GET? */
 
 			return result;
 			
@@ -72,6 +105,7 @@ static int mode(int mode_number)
 
 	case MODE_SHUTDOWN:
 		fifo_clear();
+		tx_frame_left = 0;
 		xcvr_shutdown();
 		device_mode = MODE_SHUTDOWN;
 		return RESP_ACK;
@@ -93,6 +127,30 @@ static int mode(int mode_number)
 	}
 }
 
+/**
+ * get_pending - answer a held RAM GET if there is now data for it
+ * Called from irq() whenever received data lands in the FIFO, and when a
+ * response has gone.
+ */
+static void get_pending(void)
+{
+	int result = 0;
+	size_t len = pending_get_len;
+
+	/* the answer needs somewhere to go before it leaves the FIFO */
+	if (!pending_get || fifo_is_empty() || resp_queued)
+		return;
+
+	result = fifo_get(get_buffer, len);
+	if (result > 0)
+		len = result;				/* partial: what was there */
+	else if (result < 0)
+		return;
+
+	pending_get = 0;
+	usb_respond(RESP_EXACK, pending_get_tag, get_buffer, len);
+}
+
 /**
  * cmd - decodes and executes commands from the USB host
  * @buffer: a pointer to the raw data contained in the URB.
@@ -102,6 +160,9 @@ static int mode(int mode_number)
  * that should be sent to the host (i.e. either ACK, NACK, EXACK or EXNACK).  If 
  * the response code is extended (i.e. EXACK or EXNACK) then the extra data and its
  * length has been placed in buffer.  The maximum length of the buffer is 4096 bytes.
+ * The tag in buffer[1] is left alone and must be echoed in the response header.
+ * RESP_NONE means the command has been held and will be answered later (with
+ * its tag) by usb_respond(), so commands behind it are not stalled.
  */
 static int cmd(char *buffer)
 {
@@ -111,47 +172,81 @@ static int cmd(char *buffer)
 
 	case CMD_RESET:						/* RESET */
 		result = mode(MODE_STANDBY);	/* set device mode */
-		if (result == RESP_ACK)			/* if successful, reset the fifo */
+		if (result == RESP_ACK) {		/* if successful, reset the fifo */
 			fifo_clear();
+			tx_frame_left = 0;
+		}
 		return result;
 
 	case CMD_SET_MODE:					/* SET MODE */
-		return mode(buffer[1]);			/* set device mode */
+		return mode(buffer[CMD_HDR_LEN]);	/* set device mode */
 
 	case CMD_SHUTDOWN:					/* SHUTDOWN */
 		return mode(MODE_SHUTDOWN);		/* set device mode */
 
 	case CMD_RAM_CLEAR:					/* RAM CLEAR */
 		fifo_clear();					/* reset the fifo */
+		tx_frame_left = 0;
 		return RESP_ACK;				/* response: ACK */
 
 	case CMD_RAM_PUT:					/* RAM PUT */
 		if (device_mode != MODE_TRANSMIT)
 			return RESP_NACK;			/* not in transmit mode! */
 
-		if (fifo_put(&buffer[3], *((size_t)&buffer[1])) == 0)
+		/* one frame, as long as the command */
+		if (fifo_put_frame(&buffer[CMD_HDR_LEN], cmd_len(buffer)) == 0)
 			return RESP_ACK;			/* put data successfully */
 		else
 			return RESP_NACK;			/* something went wrong */
 
+	case CMD_RAM_PUT_BATCH:				/* RAM PUT (BATCHED) */
+		if (device_mode != MODE_TRANSMIT)
+			return RESP_NACK;			/* not in transmit mode! */
+
+		if (cmd_len(buffer) > BUFFER_LEN - CMD_HDR_LEN)
+			return RESP_NACK;			/* longer than the buffer */
+
+		/* count, a length per frame, then the frames back to back;
+		 * the whole batch goes in (or doesn't) */
+		if (fifo_put_batch(&buffer[CMD_HDR_LEN], cmd_len(buffer)) == 0)
+			return RESP_ACK;			/* put batch successfully */
+		else
+			return RESP_NACK;			/* no room for the batch */
+
 	case CMD_RAM_GET:					/* RAM GET */
 		if (device_mode != MODE_RECEIVE)
 			return RESP_NACK;			/* not in receive mode! */
 
-		if (fifo_get(&buffer[3], *((size_t)&buffer[1])) == 0)
-			return RESP_EXACK;			/* got data ok */
-		else
+		if (fifo_is_empty()) {
+			if (pending_get || cmd_len(buffer) > XCVR_MAX)
+				return RESP_NACK;		/* can only hold one */
+
+			pending_get = 1;			/* answer from irq() */
+			pending_get_tag = buffer[1];
+			pending_get_len = cmd_len(buffer);
+			return RESP_NONE;
+		}
+
+		result = fifo_get(&buffer[CMD_HDR_LEN], cmd_len(buffer));
+		if (result > 0)
+			cmd_len(buffer) = result;	/* partial: what was there */
+		else if (result < 0)
 			return RESP_NACK;			/* oops */
 
+		return RESP_EXACK;				/* got data ok */
+
 	case CMD_XCVR_PUT:					/* XCVR PUT */
-		xcvr_write(&buffer[3], xcvr_user_buffer, *((size_t)&buffer[1]));
+		xcvr_write(&buffer[CMD_HDR_LEN], xcvr_user_buffer, cmd_len(buffer));
 		return RESP_ACK;				/* always ACK, host should check
 										 * actual response with XCVR GET
 										 */
 
 	case CMD_XCVR_GET:					/* XCVR GET */
-		xcvr_read(&buffer[3], xcvr_user_buffer, *((size_t)&buffer[1]));
+		xcvr_read(&buffer[CMD_HDR_LEN], xcvr_user_buffer, cmd_len(buffer));
 		return RESP_EXACK;
+
+	default:
+		return RESP_NACK;				/* unknown command */
 	}
 }
 
@@ -19,8 +19,11 @@
  * Errors
  */
 #define		EBADCMD				0x01
+#define		EBADLENGTH			0x02
 #define		EFIFOFULL			0x04
 #define		EFIFOEMPTY			0x05
+#define		ESTREAMBUSY			0x06
+#define		EUSBBUSY			0x07
 #define		EWTF				0x0F
 
 /*
@@ -40,6 +43,7 @@
 #define		CMD_RAM_CLEAR		0x10
 #define		CMD_RAM_PUT			0x11
 #define		CMD_RAM_GET			0x12
+#define		CMD_RAM_PUT_BATCH	0x13
 #define		CMD_XCVR_PUT		0x21
 #define		CMD_XCVR_GET		0x22
 
@@ -50,6 +54,18 @@
 #define		RESP_EXACK			0xFE
 #define		RESP_NACK			0x0F
 #define		RESP_EXNACK			0x0E
+#define		RESP_NONE			0x00	/* held, answered later */
+
+/*
+ * Command/response header: | CMD/RESP | TAG | LENGTH (LE16) | DATA ... |
+ */
+#define		CMD_HDR_LEN			4
+#define		cmd_len(buffer)		(*((unsigned short *)&(buffer)[2]))
+
+/*
+ * RAM PUT (BATCHED) data: | COUNT | LEN 0 | ... | LEN COUNT-1 | FRAME 0 | ... |
+ */
+#define		BATCH_HDR_LEN		1	/* plus one byte per frame */
 
 /*
  * Transceiver constants
@@ -58,6 +74,13 @@
 #define		XCVR_BUFFER_LEN		40 /* bytes */
 #define		XCVR_PUT_CMD		
 #define		XCVR_GET_CMD
+#define		XCVR_FRAME_MAX		255 /* bytes, RFM_REG_TX_PKT_LEN */
+
+/*
+ * RFM23 registers
+ */
+#define		RFM_WRITE			0x80
+#define		RFM_REG_TX_PKT_LEN	0x3E	/* transmit packet length */
 
 /*
  * RAM constants
@@ -65,6 +88,27 @@
 #define		RAM_BASE			0x0000
 #define		RAM_LIMIT			0xFFFF
 
+/*
+ * USB constants
+ */
+#define		USB_EP_CMD_OUT		0x01	/* commands from host */
+#define		USB_EP_RESP_IN		0x81	/* responses to host */
+#define		USB_EP_STREAM_IN	0x82	/* unsolicited receive data */
+#define		USB_EP_IN			0x80	/* direction bit */
+#define		USB_EP_NUM			0x0F
+#define		USB_EP_MAX			3
+#define		USB_PACKET_LEN		64		/* full speed bulk */
+
+/*
+ * USB buffer descriptors (SIE, ping-pong off): EVEN OUT, ODD IN per endpoint
+ */
+#define		USB_BDT_BASE		0x400
+#define		BD_UOWN				0x80	/* SIE owns the buffer */
+#define		BD_DTS				0x40	/* DATA1 */
+#define		BD_DTSEN			0x08	/* check data toggle */
+#define		usb_bd_in(ep)		(&((struct usb_bd *)USB_BDT_BASE) \
+										[((ep) & USB_EP_NUM) * 2 + 1])
+
 /*
  * Other constants
  */
@@ -76,6 +120,27 @@
 typedef 	unsigned int 		size_t;		/* buffer length */
 typedef		unsigned int 		ptr_t;		/* RAM address */
 
+/*
+ * USB buffer descriptor, as the SIE sees it
+ */
+struct usb_bd {
+	volatile unsigned char	stat;
+	volatile unsigned char	cnt;
+	volatile unsigned short	adr;
+};
+
+/*
+ * An IN transfer in progress, sent a packet at a time
+ */
+struct usb_xfer {
+	char		*buffer;
+	size_t		len;
+	size_t		done;				/* handed to the SIE */
+	size_t		last;				/* length of the last packet */
+	char		busy;
+	char		dts;				/* next data toggle */
+};
+
 /*
  * Function Prototypes
  */
@@ -85,15 +150,28 @@ static void *memset(void *dest, int val, size_t len);
 static void fifo_clear(void);
 static int fifo_put(char *buffer, size_t len);
 static int fifo_get(char *buffer, size_t len);
+static int fifo_is_empty(void);
+static size_t fifo_space(void);
+static int fifo_put_frame(char *buffer, size_t len);
+static int fifo_put_batch(char *buffer, size_t len);
 
 static int ram_write(ptr_t addr, char *buffer, size_t len);
 static int ram_read(ptr_t addr, char *buffer, size_t len);
 static int ram_init(void);
 
+static int usb_send(unsigned char ep, char *buffer, size_t len);
+static void usb_packet(unsigned char ep);
+static void usb_in_done(unsigned char ep);
+static int usb_respond(char resp, char tag, char *buffer, size_t len);
+static void usb_respond_done(void);
+static int usb_stream(char *buffer, size_t len);
+static void usb_stream_done(void);
+
 static int xvcr_get(char *buffer, size_t len);
 static int xcvr_put(char *buffer, size_t len);
 static int xcvr_write(char *buffer, char *user_buffer, size_t len);
 static int xcvr_read(char *buffer, char *user_buffer, size_t len);
+static int xcvr_packet_len(size_t len);
 static int xcvr_shutdown(void);
 static int xcvr_standby(void);
 static int xcvr_receive(void);
@@ -25,7 +25,7 @@ ptr_t		fifo_tail = RAM_BASE;
 ptr_t		fifo_count = 0;
 
 #define		fifo_limit 			RAM_LIMIT
-#define		fifo_avail			((fifo_limit - fifo_count)
+#define		fifo_avail			(fifo_limit - fifo_count)
 #define		fifo_empty			(fifo_count == 0)
 #define		fifo_full			(fifo_count == fifo_limit)
 #define		fifo_used			fifo_count
@@ -44,25 +44,38 @@ static void fifo_clear(void)
  * fifo_put - puts data into the RAM FIFO
  * @buffer: pointer to the data to put
  * @len: length of the data
+ * The data is stored in full or not at all, so a batch of frames from one
+ * PUT RAM never half-lands in the FIFO.
  */
 static int fifo_put(char *buffer, size_t len)
 {
 	ptr_t top_avail = fifo_limit - fifo_head;
 	int result = 0;
 
-	if (fifo_full)
+	if (fifo_full || len > fifo_avail)
 		return -EFIFOFULL;
 
-	result = ram_write(fifo_head, buffer, len);
-	if (result != 0)
-		return result;
-
 	if (len > top_avail) {
-		fifo_head = len - top_avail;
+		/* wrap: fill to the top of RAM, then carry on from the base */
+		result = ram_write(fifo_head, buffer, top_avail);
+		if (result != 0)
+			return result;
+
+		result = ram_write(RAM_BASE, &buffer[top_avail], len - top_avail);
+		if (result != 0)
+			return result;
+
+		fifo_head = RAM_BASE + len - top_avail;
 	} else {
+		result = ram_write(fifo_head, buffer, len);
+		if (result != 0)
+			return result;
+
 		fifo_head += len;
 	}
 
+	fifo_count += len;
+
 	return 0;
 }
 
@@ -70,36 +83,127 @@ static int fifo_put(char *buffer, size_t len)
  * fifo_get - gets data from the RAM FIFO
  * @buffer: pointer to a buffer
  * @len: length of the buffer
+ * Returns 0 if @len bytes were got, or the number got if the FIFO held
+ * fewer (it is then empty).
  */
 static int fifo_get(char *buffer, size_t len)
 {
 	int result = 0;
-	ptr_t used = fifo_used;
+	int partial = 0;
 	ptr_t top_used = fifo_limit - fifo_tail;
 
 	if (fifo_empty)
 		return -EFIFOEMPTY;
 
 	if (fifo_used < len) {
-		result = ram_read(fifo_tail, buffer, fifo_used);
+		len = fifo_used;			/* all there is */
+		partial = 1;
+	}
+
+	if (len > top_used) {
+		/* wrap: read to the top of RAM, then carry on from the base */
+		result = ram_read(fifo_tail, buffer, top_used);
 		if (result != 0)
 			return result;
 
-		fifo_tail = fifo_head;
-		fifo_count = 0;
-		return used;
+		result = ram_read(RAM_BASE, &buffer[top_used], len - top_used);
+		if (result != 0)
+			return result;
+
+		fifo_tail = RAM_BASE + len - top_used;
 	} else {
 		result = ram_read(fifo_tail, buffer, len);
 		if (result != 0)
 			return result;
 
-		if (top_used < len)
-			fifo_tail = len - top_used;
-		else
-			fifo_tail += len;
+		fifo_tail += len;
+	}
+
+	fifo_count -= len;
+
+	return partial ? len : 0;
+}
+
+/**
+ * fifo_space - how many more bytes the RAM FIFO can take
+ */
+static size_t fifo_space(void)
+{
+	return fifo_avail;
+}
+
+/**
+ * fifo_put_frame - puts a frame into the RAM FIFO, led by its length
+ * @buffer: pointer to the frame
+ * @len: length of the frame
+ * Frames vary in length, so irq() needs each one's length to program the
+ * RFM23's packet length before sending it.
+ */
+static int fifo_put_frame(char *buffer, size_t len)
+{
+	char len_byte = (char)len;
+	int result = 0;
+
+	if (len == 0 || len > XCVR_FRAME_MAX)
+		return -EBADLENGTH;
+
+	if (len + 1 > fifo_avail)
+		return -EFIFOFULL;
+
+	result = fifo_put(&len_byte, 1);
+	if (result != 0)
+		return result;
+
+	return fifo_put(buffer, len);
+}
+
+/**
+ * fifo_put_batch - puts a batch of frames into the RAM FIFO
+ * @buffer: | COUNT | LEN 0 | ... | LEN COUNT-1 | FRAME 0 | ... |
+ * @len: length of the batch
+ * The whole batch goes in or none of it does.
+ */
+static int fifo_put_batch(char *buffer, size_t len)
+{
+	unsigned char count = buffer[0];
+	unsigned char *lens = (unsigned char *)&buffer[BATCH_HDR_LEN];
+	char *frame = &buffer[BATCH_HDR_LEN + count];
+	size_t total = BATCH_HDR_LEN + count;
+	int result = 0;
+	int i;
+
+	if (count == 0 || len < total)
+		return -EBADLENGTH;
+
+	for (i = 0; i < count; i++) {
+		if (lens[i] == 0)
+			return -EBADLENGTH;
+		total += lens[i];
+	}
+
+	if (total != len)
+		return -EBADLENGTH;		/* lengths don't add up */
 
-		return 0;
+	/* in the FIFO each frame keeps its length byte; the count goes */
+	if (len - BATCH_HDR_LEN > fifo_avail)
+		return -EFIFOFULL;
+
+	for (i = 0; i < count; i++) {
+		result = fifo_put_frame(frame, lens[i]);
+		if (result != 0)
+			return result;
+		frame += lens[i];
 	}
+
+	return 0;
+}
+
+/**
+ * fifo_is_empty - checks whether the RAM FIFO holds any data
+ */
+static int fifo_is_empty(void)
+{
+	return fifo_empty;
 }
 
 /* EOF */
@@ -0,0 +1,211 @@
+/**
+ * blast_pic_usb.c
+ *
+ * USB Endpoint Functions
+ *
+ * Transceiver Assembly
+ * Programmable Integrated Circuit (PIC18) Software
+ *
+ * Project BLAST [http://www.projectsharp.co.uk]
+ * University of Southampton
+ * Copyright (c) 2012
+ * Licensed under GPLv2
+ */
+
+#include "blast_pic.h"
+
+/*
+ * Globals
+ * Endpoint buffers are handed to the SIE as they are, so these must be
+ * placed in USB RAM.
+ */
+struct usb_xfer	usb_xfers[USB_EP_MAX];
+char		resp_buffer[CMD_HDR_LEN + XCVR_MAX];
+char		resp_queued;				/* waiting for USB_EP_RESP_IN */
+size_t		resp_len;
+char		stream_busy;
+char		stream_buffer[XCVR_BUFFER_LEN];
+
+/**
+ * usb_send - start an IN transfer
+ * @ep: endpoint address
+ * @buffer: the data, left alone until the transfer is done
+ * @len: length of the data
+ * The transfer goes a packet at a time from the transaction complete
+ * interrupt (see usb_in_done), and ends with a short or zero length packet
+ * so the host knows where it stops.  Returns 0 on success or -EUSBBUSY if
+ * the endpoint is still sending the last one.
+ */
+static int usb_send(unsigned char ep, char *buffer, size_t len)
+{
+	struct usb_xfer *xfer = &usb_xfers[ep & USB_EP_NUM];
+
+	if (xfer->busy)
+		return -EUSBBUSY;
+
+	xfer->busy = 1;
+	xfer->buffer = buffer;
+	xfer->len = len;
+	xfer->done = 0;
+
+	usb_packet(ep);
+
+	return 0;
+}
+
+/**
+ * usb_packet - hand the next packet of an IN transfer to the SIE
+ * @ep: endpoint address
+ */
+static void usb_packet(unsigned char ep)
+{
+	struct usb_xfer *xfer = &usb_xfers[ep & USB_EP_NUM];
+	struct usb_bd *bd = usb_bd_in(ep);
+	size_t len = xfer->len - xfer->done;
+
+	if (len > USB_PACKET_LEN)
+		len = USB_PACKET_LEN;
+
+	bd->adr = (unsigned short)&xfer->buffer[xfer->done];
+	bd->cnt = (unsigned char)len;
+	bd->stat = (xfer->dts ? BD_DTS : 0) | BD_DTSEN;
+	bd->stat |= BD_UOWN;				/* last: the SIE takes it */
+
+	xfer->dts = !xfer->dts;
+	xfer->done += len;
+	xfer->last = len;
+}
+
+/**
+ * usb_in_done - the host has collected a packet from an IN endpoint
+ * @ep: endpoint address
+ * This function should be called from the USB transaction complete
+ * interrupt for IN endpoints.  Sends the next packet, or if that was the
+ * last, lets whoever started the transfer know.
+ */
+static void usb_in_done(unsigned char ep)
+{
+	struct usb_xfer *xfer = &usb_xfers[ep & USB_EP_NUM];
+
+	if (!xfer->busy)
+		return;
+
+	/* more to go, or a full last packet needs a zero length one */
+	if (xfer->done < xfer->len || xfer->last == USB_PACKET_LEN) {
+		usb_packet(ep);
+		return;
+	}
+
+	xfer->busy = 0;
+
+	switch (ep) {
+	case USB_EP_RESP_IN:
+		usb_respond_done();
+		break;
+	case USB_EP_STREAM_IN:
+		usb_stream_done();
+		break;
+	}
+}
+
+/**
+ * usb_respond - send a response to the host outside of cmd()
+ * @resp: response code
+ * @tag: tag of the command being answered
+ * @buffer: extended response data, or NULL
+ * @len: length of the data (at most XCVR_MAX)
+ * Used to answer commands that cmd() held with RESP_NONE.  The host matches
+ * the response to its command by @tag, so it may overtake later commands.
+ * If USB_EP_RESP_IN is busy with another response this one waits for it.
+ * Returns 0 on success, or -EUSBBUSY if a response is already waiting.
+ */
+static int usb_respond(char resp, char tag, char *buffer, size_t len)
+{
+	if (len > XCVR_MAX)
+		return -EBADLENGTH;
+
+	if (resp_queued)
+		return -EUSBBUSY;
+
+	resp_buffer[0] = resp;
+	resp_buffer[1] = tag;
+	cmd_len(resp_buffer) = len;
+	if (len)
+		memcpy(&resp_buffer[CMD_HDR_LEN], buffer, len);
+
+	resp_len = CMD_HDR_LEN + len;
+	resp_queued = 1;
+
+	if (usb_send(USB_EP_RESP_IN, resp_buffer, resp_len) == 0)
+		resp_queued = 0;
+
+	return 0;
+}
+
+/**
+ * usb_respond_done - USB_EP_RESP_IN has finished sending a response
+ * Sends the held response if it was waiting, then looks for another held
+ * RAM GET that can be answered now.
+ */
+static void usb_respond_done(void)
+{
+	if (resp_queued &&
+			usb_send(USB_EP_RESP_IN, resp_buffer, resp_len) == 0)
+		resp_queued = 0;
+
+	get_pending();
+}
+
+/**
+ * usb_stream - send received bytes to the host without being asked
+ * @buffer: the data
+ * @len: length of the data (at most XCVR_BUFFER_LEN)
+ * Arms USB_EP_STREAM_IN with a copy of @buffer.  The host keeps several
+ * bulk IN transfers outstanding on this endpoint while in MODE_RECEIVE, so
+ * there is normally somewhere for the data to go.  Returns 0 on success or
+ * -ESTREAMBUSY if the previous block has not been collected yet.
+ */
+static int usb_stream(char *buffer, size_t len)
+{
+	if (stream_busy)
+		return -ESTREAMBUSY;
+
+	if (len > XCVR_BUFFER_LEN)
+		return -EBADLENGTH;
+
+	stream_busy = 1;
+	memcpy(stream_buffer, buffer, len);
+
+	if (usb_send(USB_EP_STREAM_IN, stream_buffer, len) != 0) {
+		stream_busy = 0;
+		return -ESTREAMBUSY;
+	}
+
+	return 0;
+}
+
+/**
+ * usb_stream_done - the host has collected the last streamed block
+ * Called by usb_in_done() when the transfer on USB_EP_STREAM_IN is over.
+ * Anything that backed up in the RAM FIFO while the endpoint was busy is
+ * sent next, unless a held RAM GET is waiting for it.
+ */
+static void usb_stream_done(void)
+{
+	char buffer[XCVR_BUFFER_LEN];
+	int result = 0;
+
+	stream_busy = 0;
+
+	if (device_mode != MODE_RECEIVE || pending_get)
+		return;
+
+	result = fifo_get(buffer, XCVR_BUFFER_LEN);
+
+	if (result == 0)
+		usb_stream(buffer, XCVR_BUFFER_LEN);	/* full block */
+	else if (result > 0)
+		usb_stream(buffer, result);		/* what was left */
+}
+
+/* EOF */
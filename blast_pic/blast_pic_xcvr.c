@@ -84,6 +84,23 @@ static int xcvr_read(char *buffer, char *user_buffer, size_t len)
 	return 0;
 }
 
+/**
+ * xcvr_packet_len - set the length of the next packet the RFM23 sends
+ * @len: length in bytes
+ */
+static int xcvr_packet_len(size_t len)
+{
+	char put[2];
+
+	if (len > XCVR_FRAME_MAX)
+		return -EBADLENGTH;
+
+	put[0] = RFM_WRITE | RFM_REG_TX_PKT_LEN;
+	put[1] = (char)len;
+
+	return xcvr_write(put, xcvr_buffer, 2);
+}
+
 /**
  * xcvr_shutdown - shutdown the RFM23
  */